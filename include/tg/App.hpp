@@ -4,6 +4,8 @@
 #include "tg/Renderer.hpp"
 #include "tg/generator.hpp"
 
+#include <string>
+
 #include <SDL3/SDL.h>
 
 namespace tg {
@@ -21,6 +23,15 @@ public:
     void run();
 
 private:
+    /** @brief Writes a PNG preview of every job in jobFile to directory, without a window; see Renderer::renderThumbnails() */
+    void runHeadless(const std::string& jobFile, const std::string& directory, uint32_t size);
+
+    /** @brief Compares the compute backend with the CPU generators without a window; see Renderer::checkComputeParity() */
+    void runComputeCheck();
+
+    /** @brief Throws if --validate is set and the validation layer reported errors */
+    void checkValidation() const;
+
     int argc;
     char** argv;
 
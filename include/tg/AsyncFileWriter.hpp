@@ -0,0 +1,115 @@
+#ifndef TG_ASYNC_FILE_WRITER_HPP
+#define TG_ASYNC_FILE_WRITER_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tg {
+
+/**
+ * @class AsyncFileWriter
+ * @brief Asynchronous write backend shared by all exporters.
+ *
+ * Appended data is copied into a fixed pool of page-aligned buffers and written in the background,
+ * through io_uring on Linux or a small pwrite thread pool everywhere else. The buffer pool bounds the
+ * number of writes in flight (the queue depth); append() only blocks when every buffer is in flight.
+ */
+class AsyncFileWriter {
+public:
+    struct Options {
+        unsigned queueDepth = 32;           // buffers, and therefore writes, in flight
+        size_t bufferSize = 1 << 20;        // bytes per write; rounded up to the page size
+        bool registerBuffers = true;        // io_uring fixed buffers, avoids per-write page pinning
+        bool directIO = false;              // O_DIRECT / F_NOCACHE, falls back to buffered I/O if unsupported
+        bool forceFallback = false;         // skip io_uring even when available
+        unsigned fallbackThreads = 2;
+    };
+
+    struct FileState;
+
+    /**
+     * @brief A file being written sequentially. append() must only be called from one thread at a time.
+     */
+    class File {
+    public:
+        ~File();
+
+        File(const File&) = delete;
+        File& operator=(const File&) = delete;
+
+        void append(const void* data, size_t size);
+
+        /** @brief Flushes and blocks until all writes have landed; throws if any write failed */
+        void close();
+
+        /** @brief Flushes and returns immediately; the future is ready once all writes have landed */
+        std::future<void> closeAsync();
+
+        const std::string& path() const;
+
+    private:
+        friend class AsyncFileWriter;
+        File(AsyncFileWriter& writer, std::shared_ptr<FileState> state);
+
+        void submitCurrentBuffer();
+
+        AsyncFileWriter& _writer;
+        std::shared_ptr<FileState> _state;
+        int _currentBuffer = -1;
+        size_t _currentFill = 0;
+        bool _closed = false;
+    };
+
+    AsyncFileWriter();
+    explicit AsyncFileWriter(const Options& options);
+    ~AsyncFileWriter();
+
+    AsyncFileWriter(const AsyncFileWriter&) = delete;
+    AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+
+    /** @brief Process-wide writer used by the exporters */
+    static AsyncFileWriter& shared();
+
+    /** @brief Sets the options of the shared writer; only has an effect before its first use */
+    static void configureShared(const Options& options);
+
+    /** @brief Options the shared writer uses or will use, without creating it */
+    static const Options& sharedOptions();
+
+    std::unique_ptr<File> open(const std::string& path);
+
+    const char* backendName() const;
+    const Options& options() const { return _options; }
+
+    struct WriteOp;
+    class Backend;
+
+private:
+    Options _options;
+    size_t _alignment;
+
+    std::vector<void*> _buffers;
+    std::vector<int> _freeBuffers;
+    std::mutex _bufferMutex;
+    std::condition_variable _bufferAvailable;
+
+    std::unique_ptr<Backend> _backend;
+
+    int acquireBuffer();
+    void releaseBuffer(int index);
+    void* bufferData(int index) const { return _buffers[index]; }
+
+    void submit(WriteOp* op);
+    void onComplete(WriteOp* op, int64_t result);
+    void finishFile(const std::shared_ptr<FileState>& state);
+};
+
+} // namespace tg
+
+#endif // TG_ASYNC_FILE_WRITER_HPP
@@ -0,0 +1,115 @@
+#ifndef TG_COMPUTE_TERRAIN_HPP
+#define TG_COMPUTE_TERRAIN_HPP
+
+#include <cstdint>
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+namespace tg {
+
+/** @brief One ComputeTerrain run; the CPU equivalent is generatePerlinNoiseHeightmap() followed by applyThermalWeathering() */
+struct ComputeRequest {
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    // Perlin noise into the image; otherwise the run starts from what the image holds
+    bool perlin = false;
+    uint32_t perlinGridSize = 4;
+    uint32_t seed = 0;
+
+    bool thermal = false;
+    float thermalThreshold = 0.01f;
+    float thermalConstant = 0.25f;
+    int thermalIterations = 10;
+};
+
+/**
+ * @class ComputeTerrain
+ * @brief Generates and weathers terrain with compute shaders, straight into the R16 heightmap texture the renderer samples.
+ *
+ * A run is one command buffer on the graphics queue: Perlin noise, or a copy of the texture, into a packed 16-bit buffer,
+ * thermal weathering in a pair of float buffers, then a copy into the texture. Nothing passes through the host on the way.
+ * The result is also copied into a readback buffer, so the host copy of the heightmap, which the exporters, the quadtree
+ * bounds and the mesh mode use, can be brought up to date with readResult() once finished() says so.
+ *
+ * The texture is back in SHADER_READ_ONLY_OPTIMAL at the end of the run, and the final barrier makes the new contents
+ * visible to the vertex shaders of everything submitted to the queue afterwards.
+ *
+ * One run at a time; submit() waits for the previous one. Use from one thread only.
+ */
+class ComputeTerrain {
+public:
+    ComputeTerrain() = default;
+    ComputeTerrain(const ComputeTerrain&) = delete;
+    ComputeTerrain& operator=(const ComputeTerrain&) = delete;
+
+    /** @param queue a queue of queueFamily, which must support compute */
+    void init(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamily, VkPipelineCache pipelineCache);
+    void destroy();
+
+    /**
+     * @brief Records and submits a run writing request's terrain into image, a width x height R16_UNORM image with
+     * TRANSFER_SRC and TRANSFER_DST usage. The image must be in SHADER_READ_ONLY_OPTIMAL unless request.perlin is set;
+     * then its contents are discarded.
+     * @param waitSemaphore timeline semaphore the run waits for at waitValue before it starts, e.g. the staging uploader's
+     */
+    void submit(const ComputeRequest& request, VkImage image, VkSemaphore waitSemaphore, uint64_t waitValue);
+
+    /** @brief Whether the last run has finished; true when nothing was submitted */
+    bool finished() const;
+    void wait();
+
+    /** @brief Copies the last run's width * height samples into data; call once it has finished */
+    void readResult(uint16_t* data) const;
+
+private:
+    struct Buffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VmaAllocation allocation = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        void* mapped = nullptr;     // host-visible buffers only
+    };
+
+    enum Pass : uint32_t {
+        Perlin,
+        ThermalLoad,
+        ThermalStep,
+        HeightRange,
+        StoreHeights,
+        PassCount
+    };
+
+    VkDevice _device = VK_NULL_HANDLE;
+    VmaAllocator _allocator = VK_NULL_HANDLE;
+    VkQueue _queue = VK_NULL_HANDLE;
+
+    VkCommandPool _commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer _commandBuffer = VK_NULL_HANDLE;
+    VkFence _fence = VK_NULL_HANDLE;
+    bool _submitted = false;
+
+    VkDescriptorSetLayout _descriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool _descriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet _descriptorSets[2] = {};    // the second has the two thermal buffers swapped
+    VkPipelineLayout _pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline _pipelines[PassCount] = {};
+
+    // Grown as larger maps come in, never shrunk
+    Buffer _packed;
+    Buffer _heights[2];
+    Buffer _range;
+    Buffer _gradients;
+    Buffer _readback;
+    uint32_t _width = 0;
+    uint32_t _height = 0;
+
+    void ensureBuffer(Buffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags);
+    void destroyBuffer(Buffer& buffer);
+    void updateDescriptorSets();
+    void dispatch(Pass pass, uint32_t set);
+};
+
+} // namespace tg
+
+#endif // TG_COMPUTE_TERRAIN_HPP
@@ -0,0 +1,55 @@
+#ifndef TG_EXECUTION_CONTEXT_HPP
+#define TG_EXECUTION_CONTEXT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+
+#include "tg/Scheduler.hpp"
+
+namespace tg {
+
+/**
+ * @brief How a generator or filter runs: optional progress reporting, cooperative cancellation and a cap on
+ * the threads it occupies. The default context runs to completion on all threads of the shared scheduler.
+ */
+struct ExecutionContext {
+    CancellationToken cancel;   // checked between bands of rows and between iterations; throws OperationCancelled
+    std::function<void(const char* stage, float fraction)> onProgress; // may come from any thread; calls for one stage never overlap
+    unsigned threads = 0;       // most scheduler threads working on it at once; 0 = all of them
+
+    /** @brief Chunk size for a parallel loop over count items; with a thread hint, at most that many chunks */
+    size_t grain(size_t count, size_t minGrain = 1) const {
+        if(threads == 0) return automaticGrain(count, minGrain);
+        return std::max(minGrain, (count + threads - 1) / threads);
+    }
+};
+
+/**
+ * @class ProgressReporter
+ * @brief Counts finished units of one stage and passes the fraction done to ExecutionContext::onProgress.
+ * Calls are throttled to steps of 0.1% and always increase; safe to advance from several threads.
+ */
+class ProgressReporter {
+public:
+    ProgressReporter(const ExecutionContext& context, const char* stage, size_t total);
+
+    ProgressReporter(const ProgressReporter&) = delete;
+    ProgressReporter& operator=(const ProgressReporter&) = delete;
+
+    void advance(size_t units = 1);
+
+private:
+    const ExecutionContext& _context;
+    const char* _stage;
+    size_t _total;
+    std::atomic<size_t> _done{0};
+    std::atomic<int> _reported{-1}; // per mille
+    std::mutex _mutex;
+};
+
+} // namespace tg
+
+#endif // TG_EXECUTION_CONTEXT_HPP
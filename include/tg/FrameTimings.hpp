@@ -0,0 +1,59 @@
+#ifndef TG_FRAME_TIMINGS_HPP
+#define TG_FRAME_TIMINGS_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace tg {
+
+/** @brief What the editor times per frame: CPU stages of Renderer::update() and render(), then GPU passes */
+enum class FrameStage : uint32_t {
+    Frame,          // CPU time from one render() to the next
+    Update,         // building the GUI, polling jobs, uploading edits
+    FenceWait,      // waiting for the frame NUM_FRAME_OVERLAP back to finish on the GPU
+    Record,
+    Submit,
+    Present,
+    GpuTerrain,     // viewport pass
+    GpuGui,         // ImGui pass onto the swapchain image
+    GpuTotal,
+    Count
+};
+
+/**
+ * @class FrameTimings
+ * @brief Rolling history of the last HISTORY frames per stage, in milliseconds, for the frame timing overlay.
+ */
+class FrameTimings {
+public:
+    static constexpr size_t HISTORY = 240;
+
+    void record(FrameStage stage, float milliseconds);
+
+    /** @brief Ring of samples; plot count() of them starting at offset() to get them oldest first */
+    const float* samples(FrameStage stage) const { return history(stage).samples.data(); }
+    size_t count(FrameStage stage) const { return history(stage).count; }
+    size_t offset(FrameStage stage) const;
+
+    /** @brief Sample below which the given fraction of the history lies; 0 before anything was recorded */
+    float percentile(FrameStage stage, float fraction) const;
+    float latest(FrameStage stage) const;
+
+    static const char* name(FrameStage stage);
+
+private:
+    struct History {
+        std::array<float, HISTORY> samples{};
+        size_t next = 0;
+        size_t count = 0;
+    };
+
+    std::array<History, static_cast<size_t>(FrameStage::Count)> _histories;
+
+    const History& history(FrameStage stage) const { return _histories[static_cast<size_t>(stage)]; }
+};
+
+} // namespace tg
+
+#endif // TG_FRAME_TIMINGS_HPP
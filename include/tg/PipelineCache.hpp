@@ -0,0 +1,48 @@
+#ifndef TG_PIPELINE_CACHE_HPP
+#define TG_PIPELINE_CACHE_HPP
+
+#include <string>
+
+#include <vulkan/vulkan.h>
+
+namespace tg {
+
+/**
+ * @class PipelineCache
+ * @brief A VkPipelineCache kept in a file between runs, so pipelines compiled once are not compiled again at startup.
+ *
+ * The file starts with the vendor, device, driver version and pipelineCacheUUID it was written on plus a hash of the
+ * data; a file from another GPU or driver, or a damaged one, is ignored and the cache starts empty. It is written
+ * through a temporary file and renamed into place, so an interrupted save leaves the previous file intact.
+ *
+ * The handle may be used from several threads at once; VkPipelineCache is internally synchronized.
+ */
+class PipelineCache {
+public:
+    PipelineCache() = default;
+    PipelineCache(const PipelineCache&) = delete;
+    PipelineCache& operator=(const PipelineCache&) = delete;
+
+    /** @param path cache file; empty keeps the cache in memory only */
+    void init(VkDevice device, const VkPhysicalDeviceProperties& properties, const std::string& path);
+
+    /** @brief Writes the cache back to its file; failures are reported on stderr, never thrown */
+    void save();
+    void destroy();
+
+    VkPipelineCache handle() const { return _cache; }
+
+    /** @brief Whether init() found a matching file, i.e. pipelines should come out of the cache */
+    bool loaded() const { return _loaded; }
+
+private:
+    VkDevice _device = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties _properties{};
+    VkPipelineCache _cache = VK_NULL_HANDLE;
+    std::string _path;
+    bool _loaded = false;
+};
+
+} // namespace tg
+
+#endif // TG_PIPELINE_CACHE_HPP
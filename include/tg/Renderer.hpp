@@ -1,6 +1,11 @@
 #ifndef TG_RENDERER_HPP
 #define TG_RENDERER_HPP
 
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
 #include <vector>
 
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -10,11 +15,29 @@
 #include <vk_mem_alloc.h>
 #include <vulkan/vulkan.h>
 
+#include "tg/ComputeTerrain.hpp"
+#include "tg/ExecutionContext.hpp"
+#include "tg/FrameTimings.hpp"
+#include "tg/PipelineCache.hpp"
+#include "tg/StagingUploader.hpp"
+#include "tg/TerrainQuadtree.hpp"
+#include "tg/cache.hpp"
 #include "tg/generator.hpp"
+#include "tg/job.hpp"
 
 namespace tg {
 
 constexpr unsigned int NUM_FRAME_OVERLAP = 2;
+constexpr uint64_t HEIGHTMAP_CACHE_BYTES = uint64_t(2) << 30;
+constexpr uint32_t PATCH_QUADS = 64; // quads along one edge of the grid patch drawn per terrain quadtree node
+constexpr float LOD_PIXELS_PER_QUAD = 4.0f; // screen size a grid quad may grow to before a finer level is used
+constexpr float LOD_MORPH_START = 0.7f; // fraction of a level's range after which it morphs towards the next level
+constexpr uint32_t VIEWPORT_SLACK_DIVISOR = 4; // viewport images are allocated a quarter larger than needed, so resizing rarely reallocates
+constexpr uint32_t VIEWPORT_SHRINK_FACTOR = 2; // and reallocated smaller once the viewport is less than half of them
+constexpr uint32_t IDLE_AFTER_FRAMES = 3; // frames drawn after the last event before the main loop waits; ImGui needs a few to settle
+constexpr int32_t IDLE_WAIT_MILLISECONDS = 250; // idle wake-up, for tooltips, the text cursor and other ImGui timers
+constexpr int32_t JOB_WAIT_MILLISECONDS = 33; // while a generation job runs, so its progress bar keeps moving
+constexpr uint16_t COMPUTE_PARITY_TOLERANCE = 4; // largest difference between compute and CPU samples checkComputeParity() accepts
 
 /**
  * @class Renderer
@@ -23,7 +46,36 @@ constexpr unsigned int NUM_FRAME_OVERLAP = 2;
 class Renderer {
 public:
     void init(SDL_Window* window, char* argv0);
+
+    /** @brief Sets up Vulkan without a window, surface or GUI, for renderThumbnails(); works on CPU implementations such as lavapipe */
+    void initHeadless(uint32_t width, uint32_t height);
+
+    /**
+     * @brief Headless mode: draws each job's terrain from the default view and writes it to directory as <job name>.png
+     * @return the number of jobs that failed; each is reported on stderr
+     */
+    size_t renderThumbnails(std::vector<JobSpec> jobs, const std::string& directory);
+
+    /**
+     * @brief Headless mode: runs a few generations and edits on the compute backend and on the CPU and compares the results
+     * @return the number of cases that differ by more than COMPUTE_PARITY_TOLERANCE; each is reported on stderr
+     */
+    size_t checkComputeParity();
+
+    /**
+     * @brief Call before init() or initHeadless(): requires the Khronos validation layer in any build, with synchronization
+     * validation, and counts the errors it reports
+     */
+    void enableValidation() { _validation = true; }
+
+    /** @brief Errors the validation layer has reported; always 0 without enableValidation() */
+    uint32_t validationErrors() const { return _validationErrors.load(); }
+
     bool isRunning() const { return _isRunning; }
+
+    /** @brief How long the main loop may block waiting for an event before the next frame; 0 to draw it right away */
+    int32_t idleWaitMilliseconds() const;
+
     void handleEvent(const SDL_Event& event);
     void update();
     void render();
@@ -35,6 +87,84 @@ private:
         VmaAllocation allocation;
     };
 
+    struct Texture {
+        VkImage image;
+        VmaAllocation allocation;
+        VkImageView view;
+    };
+
+    // Buffers and textures no longer drawn, destroyed once the frames that may still use them have finished
+    struct RetiredBuffer {
+        Buffer buffer;
+        uint32_t frame;
+    };
+
+    struct RetiredTexture {
+        Texture texture;
+        uint32_t frame;
+    };
+
+    struct RetiredGUITexture {
+        VkDescriptorSet descriptorSet;  // from ImGui_ImplVulkan_AddTexture
+        uint32_t frame;
+    };
+
+    // Replaced on resize; may still be presenting images queued by earlier frames
+    struct RetiredSwapchain {
+        VkSwapchainKHR swapchain;
+        std::vector<VkImageView> imageViews;
+        uint32_t frame;
+    };
+
+    // Mesh: the CPU-built vertex and index buffers; Displaced: quadtree patches displaced by the heightmap texture
+    enum class RenderMode {
+        Mesh,
+        Displaced
+    };
+
+    // Where the panel's Generate and Apply buttons run; the compute backend covers Perlin noise and thermal weathering
+    enum class Backend {
+        CPU,
+        Compute
+    };
+
+    // Result of a background generation job, swapped in as a whole
+    struct GeneratedTerrain {
+        Heightmap heightmap;
+        bool computed = false;  // generated by the compute backend, whose texture (_computeRun.texture) already holds it
+        Mesh mesh;      // empty when generated for the displaced mode
+        TerrainQuadtree quadtree; // empty when the heightmap does not fit in a texture
+
+        // An edit of the current terrain instead: only heightmap.dirty is uploaded, into the existing texture and buffers
+        bool edited = false;
+        Vector<Attributes> editedVertexRows; // the mesh rows affectedMeshRows() gives for the dirty region, if the mesh was current
+    };
+
+    // Push constants of the displaced pipeline, see shaders/displaced.slang
+    struct PatchData {
+        float cameraPosition[3];
+        float range0;
+        uint32_t heightmapSize[2];
+        uint32_t patchQuads;
+        float morphStart;
+    };
+
+    struct GenerationJob {
+        std::future<GeneratedTerrain> result;
+        ExecutionContext context;
+        std::atomic<const char*> stage{"starting"}; // written by the job's progress callback, read by the panel
+        std::atomic<float> progress{0.0f};
+    };
+
+    // The compute backend's run in flight, if any; see pollCompute()
+    struct ComputeRun {
+        bool pending = false;   // submitted, the host copy not read back yet
+        bool edit = false;      // weathering _heightmapTexture in place; otherwise generating into texture
+        Texture texture = {VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE}; // owned until swapped in or replaced
+        uint32_t width = 0;
+        uint32_t height = 0;
+    };
+
     struct DataPerFrame {
         VkCommandPool _commandPool;
         VkCommandBuffer _mainCommandBuffer;
@@ -42,45 +172,104 @@ private:
         VkFence renderFence;
         VkSemaphore imageAcquireToRenderSemaphore;
 
-        VkImage mainViewportImage;
-        VkImageView mainViewportImageView;
-        VkDeviceMemory mainViewportImageMemory;
-
-        VkImage mainViewportDepthImage;
-        VkImageView mainViewportDepthImageView;
-        VkDeviceMemory mainViewportDepthImageMemory;
+        // The viewport is drawn into the top-left _mainViewportExtent of these, see ensureViewportImages()
+        Texture viewportColor = {VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE};
+        Texture viewportDepth = {VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE};
+        VkExtent2D viewportCapacity = {0, 0};
 
         void* uboData;
         Buffer _uboBuffer;
         VkDescriptorSet _descriptorSet;
+        VkImageView boundHeightmapView = VK_NULL_HANDLE; // heightmap texture _descriptorSet points at
+
+        // Patches picked for this frame and one indirect draw per LOD level, written once the frame's fence is signalled
+        Buffer patchInstanceBuffer;
+        void* patchInstanceData;
+        uint32_t patchInstanceCapacity = 0;
+        Buffer indirectBuffer;
+        void* indirectData;
+        uint32_t indirectDrawCount = 0;
+        PatchData patchData;
+
+        // Timestamps around the GPU passes, read back once the frame's fence is signalled
+        VkQueryPool timestampPool = VK_NULL_HANDLE;
+        bool timestampsWritten = false;
+        uint64_t submitTime = 0;    // steady_clock nanoseconds; places the GPU passes in the trace
 
         VkDescriptorSet _GUIdescriptorSet;
+        VkImageView GUITextureView = VK_NULL_HANDLE; // viewport image _GUIdescriptorSet samples, its own or the last one drawn
+
+        // Headless mode: the viewport image is copied here, and written to thumbnailPath once the frame's fence is signalled
+        Buffer thumbnailReadback = {VK_NULL_HANDLE, VK_NULL_HANDLE};
+        void* thumbnailReadbackData = nullptr;
+        std::string thumbnailPath;  // empty while nothing is waiting to be written
     };
 
-    SDL_Window* _window;
+    SDL_Window* _window = nullptr;
+    bool _headless = false;                     // no window, swapchain or GUI; see initHeadless()
     bool _isRunning = true;
     char* executablePath = nullptr;
 
     VkInstance _instance;
     VkDebugUtilsMessengerEXT _debugMessenger;
+    bool _validation = false;                   // see enableValidation()
+    std::atomic<uint32_t> _validationErrors = 0;
     VkSurfaceKHR _surface;
     VkPhysicalDevice _physicalDevice;
     VkDevice _device;
     uint32_t _graphicsQueueFamily;
     VkQueue _graphicsQueue;
     VkQueue _presentQueue;
+    uint32_t _transferQueueFamily;  // a transfer-only family when the device has one, else the graphics family
+    VkQueue _transferQueue;
+    StagingUploader _uploader;
+    ComputeTerrain _compute;
+    bool _computeAvailable = false;             // the graphics queue can run compute and heightmaps can be textures
+    ComputeRun _computeRun;
 
     VkCommandPool _commandPool;
     VkDescriptorSetLayout _descriptorSetLayout;
     VkDescriptorPool _descriptorPool;
 
+    PipelineCache _pipelineCache;
     VkPipelineLayout _pipelineLayout;
     VkPipeline _graphicsPipeline;
+    VkPipeline _displacedPipeline;
     VkSampler _sampler;
 
     VmaAllocator _allocator;
     Buffer _vertexBuffer;
     Buffer _indexBuffer;
+    bool _meshMatchesHeightmap = false;         // the mesh buffers are built lazily in the displaced mode
+
+    Texture _heightmapTexture;
+    Buffer _patchVertexBuffer;
+    Buffer _patchIndexBuffer;
+    uint32_t _maxHeightmapTextureSize = 0;      // 0 when the device cannot sample R16_UNORM from the vertex shader
+    RenderMode _renderMode = RenderMode::Displaced;
+    TerrainQuadtree _quadtree;
+    bool _multiDrawIndirect = false;            // several indirect draws per call, with firstInstance
+    std::vector<PatchInstance> _selectedPatches;
+    std::vector<uint32_t> _patchesPerLevel;
+
+    FrameTimings _frameTimings;
+    bool _showFrameTimings = false;
+    float _timestampPeriod = 0.0f;              // nanoseconds per timestamp tick; 0 when the graphics queue cannot write timestamps
+    uint64_t _timestampMask = 0;                // the valid bits of a timestamp
+    std::chrono::steady_clock::time_point _lastRenderStart;
+
+    // Idle rendering: the terrain pass only runs when what it draws changed; otherwise the GUI shows the last image again
+    uint32_t _framesSinceEvent = 0;
+    bool _viewportStale = true;                 // terrain or viewport images replaced since the last terrain pass
+    uint32_t _viewportFrame = 0;                // frame slot whose viewport image holds the last terrain pass
+    glm::mat4 _viewportMVP = glm::mat4(0.0f);   // and what it was drawn with
+    VkExtent2D _viewportExtentDrawn = {0, 0};
+    RenderMode _viewportMode = RenderMode::Displaced;
+
+    // Startup cost, reported once the first frame is presented
+    std::chrono::steady_clock::time_point _initStart;
+    float _pipelineMilliseconds = 0.0f;         // creating both pipelines, overlapped with the rest of init()
+    float _timeToFirstFrame = 0.0f;             // 0 until the first present
 
     VkSwapchainKHR _swapchain;
     VkFormat _swapchainImageFormat;
@@ -88,39 +277,84 @@ private:
 
     std::vector<VkImage> _swapchainImages;
     std::vector<VkImageView> _swapchainImageViews;
+    bool _swapchainOutdated = false;            // resized; replaced at the start of the next update()
+    uint32_t _maxViewportSize = 0;              // maxImageDimension2D
 
     uint32_t _mainViewportWidth;
     VkExtent2D _mainViewportExtent;
     Heightmap _currentHeightmap;
+    std::unique_ptr<HeightmapCache> _heightmapCache;
+
+    std::unique_ptr<GenerationJob> _generation;                 // the newest request, still running
+    std::vector<std::unique_ptr<GenerationJob>> _cancelledGenerations; // replaced, winding down
+    std::string _generationError;
+    std::vector<RetiredBuffer> _retiredBuffers;
+    std::vector<RetiredTexture> _retiredTextures;
+    std::vector<RetiredGUITexture> _retiredGUITextures;
+    std::vector<RetiredSwapchain> _retiredSwapchains;
 
     uint32_t _frameCount = 0;
     DataPerFrame _frames[NUM_FRAME_OVERLAP];
     std::vector<VkSemaphore> _renderToPresentSemaphores;
 
     void initVulkan();
-    void createSwapchain();
+    void createSwapchain(VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE);
     void destroySwapchain();
+    bool recreateSwapchain();
     void createViewportResources();
+    void ensureViewportImages(DataPerFrame& frame);
+    Texture createViewportImage(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect, VkExtent2D extent);
     void destroyViewportResources();
     void initGUI();
     void initDefaultGeometry();
     void generateUserGeometry();
-    void recordMainCommands(VkCommandBuffer& commandBuffer, int imageIndex);
+    std::unique_ptr<GenerationJob> newGenerationJob();
+    void startGeneration(JobSpec spec);
+    void startThermalEdit();
+    bool usesCompute(const JobSpec& spec) const;
+    void startComputeGeneration(JobSpec spec);
+    void startComputeThermalEdit();
+    void abandonComputeRun();
+    void pollCompute();
+    void cancelGeneration();
+    void pollGeneration();
+    void swapInTerrain(GeneratedTerrain& terrain);
+    void updateTerrainRegion(const HeightmapRegion& region, Vector<Attributes> vertexRows);
+    void uploadMesh(const Mesh& mesh);
+    void bindHeightmapTexture(DataPerFrame& frame);
+    void selectPatches(DataPerFrame& frame);
+    void destroyRetiredResources(bool all);
+    void readFrameTimestamps(DataPerFrame& frame);
+    void drawFrameTimings();
+    bool needsTerrainPass(const DataPerFrame& frame) const;
+    void setGUITexture(DataPerFrame& frame, VkImageView view);
+    void recordMainCommands(VkCommandBuffer& commandBuffer, int imageIndex, bool drawTerrain);
+    void recordViewportCommands(VkCommandBuffer commandBuffer);
+    void updateCamera();
+    void renderThumbnail(const std::string& path, std::vector<std::future<void>>& writes);
+    std::future<void> writeThumbnail(DataPerFrame& frame);
 
-    VkShaderModule createShaderModule(const char* filename);
+    VkShaderModule createShaderModule(const uint32_t* code, size_t codeSize);
     void createGraphicsPipeline();
-    Buffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags);
-    Buffer uploadToNewDeviceLocalBuffer(VkDeviceSize size, void* data, VkBufferUsageFlags usage);
+    void initCompute();
+    Buffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags, bool sharedWithTransfer = false);
+    Buffer uploadToNewDeviceLocalBuffer(VkDeviceSize size, const void* data, VkBufferUsageFlags usage);
+    Texture createHeightmapTexture(uint32_t width, uint32_t height);
+    Texture uploadToNewHeightmapTexture(const Heightmap& heightmap);
+    bool fitsHeightmapTexture(size_t width, size_t height) const;
 
     DataPerFrame& getCurrentFrame() { return _frames[_frameCount % NUM_FRAME_OVERLAP]; }
 
     bool shouldOpenAboutPopup = false;
     int selectedSize = 512;
+    uint32_t seed = 0;
     int selectedMethod = 0;
+    Backend selectedBackend = Backend::CPU;
     int perlinGridSize = 4;
     float diamondSquareRoughness = 0.5f;
     int faultingIterations = 10;
-    const char* methodNames[3] = { "Perlin Noise", "Diamond-Square", "Fault Formation" };
+    const char* methodNames[4] = { "Perlin Noise", "Diamond-Square", "Fault Formation", "Simplex Noise" };
+    const char* backendNames[2] = { "CPU", "GPU Compute" };
     
     bool shouldThermalWeather = false;
     float thermalThreshold = 0.01;
@@ -131,6 +365,8 @@ private:
     glm::mat4 V_matrix;
     glm::mat4 P_matrix;
     glm::mat4 normal_matrix;
+    glm::mat4 MVP_matrix;
+    glm::vec3 cameraModelPosition;  // the camera in the model space of the terrain, for LOD selection
 
     glm::vec3 target = glm::vec3(0.0f);
     float distance = 4.0f;
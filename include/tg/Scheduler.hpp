@@ -0,0 +1,238 @@
+#ifndef TG_SCHEDULER_HPP
+#define TG_SCHEDULER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "tg/numa.hpp"
+
+namespace tg {
+
+/** @brief Thrown by TaskGroup::wait() and parallelFor when the work was cancelled */
+class OperationCancelled : public std::runtime_error {
+public:
+    OperationCancelled() : std::runtime_error("Operation cancelled") { }
+};
+
+/**
+ * @brief Shared flag for stopping work early; copies refer to the same flag, so one can be handed to
+ * the code doing the work and cancelled from anywhere else
+ */
+class CancellationToken {
+public:
+    CancellationToken() : _flag(std::make_shared<std::atomic<bool>>(false)) { }
+
+    void cancel() const { _flag->store(true, std::memory_order_relaxed); }
+    bool isCancelled() const { return _flag->load(std::memory_order_relaxed); }
+    void throwIfCancelled() const { if(isCancelled()) throw OperationCancelled(); }
+
+private:
+    std::shared_ptr<std::atomic<bool>> _flag;
+};
+
+struct SchedulerOptions {
+    unsigned threads = 0;        // threads working on parallel loops, the waiting caller included; 0 = one per hardware thread
+    bool pinThreads = false;     // pin worker i to the i-th CPU the process may run on (Linux only)
+    NumaPlacement numa = NumaPlacement::Default; // Local also pins the workers, spread over the nodes
+};
+
+/**
+ * @class Scheduler
+ * @brief Persistent work-stealing task scheduler used by every parallel algorithm in the library.
+ *
+ * Each worker owns a deque: it pushes and pops its own tasks at the back and steals from the front of the
+ * others' when it runs dry. Tasks spawned from outside the pool go to a shared queue. A thread waiting for
+ * a TaskGroup runs queued tasks meanwhile, so nested parallelism cannot deadlock, and concurrent jobs all
+ * share the same workers instead of each starting their own.
+ *
+ * With NumaPlacement::Local on a machine with several nodes, every node also has a queue that only its
+ * workers take from while they have other work, and parallelFor hands each node a fixed band of the range,
+ * so the rows a node works on are the ones placeRows() put in its memory.
+ */
+class Scheduler {
+public:
+    explicit Scheduler(const SchedulerOptions& options = {});
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    /** @brief The process-wide scheduler, created on first use with the options of configureScheduler() */
+    static Scheduler& shared();
+
+    /** @brief Threads that run tasks: the workers plus one waiting caller */
+    unsigned concurrency() const { return static_cast<unsigned>(_workers.size()) + 1; }
+
+    /** @brief Queues a task; node >= 0 queues it for the workers of that NUMA node */
+    void spawn(std::function<void()> task, int node = -1);
+
+    /** @brief Nodes parallel loops are banded over; 1 unless NUMA placement is Local on a multi-node machine */
+    size_t nodeCount() const { return _nodeQueues.empty() ? 1 : _nodeQueues.size(); }
+
+    /** @brief Part of [begin, end) handled by a node, in proportion to its number of workers */
+    std::pair<size_t, size_t> nodeBand(size_t node, size_t begin, size_t end) const;
+
+    const SchedulerOptions& options() const { return _options; }
+
+    /** @brief Runs queued tasks on the calling thread until done() returns true */
+    void helpUntil(const std::function<bool()>& done);
+
+    /** @brief Wakes threads in helpUntil() so they re-check their condition */
+    void notifyProgress();
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    SchedulerOptions _options;
+    std::vector<std::unique_ptr<WorkerQueue>> _queues; // one per worker
+    WorkerQueue _injected;                             // tasks spawned by threads outside the pool
+    std::vector<std::unique_ptr<WorkerQueue>> _nodeQueues; // one per NUMA node, only with Local placement
+    std::vector<int> _workerNodes;                     // node index of each worker
+    std::vector<size_t> _nodeWorkersBefore;            // workers on the nodes before each node, plus the total
+    std::vector<std::thread> _workers;
+
+    std::atomic<size_t> _queued{0};
+    std::atomic<bool> _stopping{false};
+    std::mutex _sleepMutex;
+    std::condition_variable _wake;
+
+    bool tryRunTask(int self);
+    bool tryTake(WorkerQueue& queue, bool newest, std::function<void()>& task);
+    void worker(int index);
+};
+
+/** @brief Replaces the shared scheduler; call while no parallel work is running, e.g. at startup */
+void configureScheduler(const SchedulerOptions& options);
+SchedulerOptions schedulerOptions();
+
+/**
+ * @class TaskGroup
+ * @brief Set of tasks that can be waited for and cancelled together. The first exception thrown by a task
+ * skips the tasks of the group that have not started yet and is rethrown by wait().
+ */
+class TaskGroup {
+public:
+    explicit TaskGroup(CancellationToken token = {}, Scheduler& scheduler = Scheduler::shared())
+        : _scheduler(scheduler), _token(std::move(token)) { }
+
+    /** @brief Waits for any tasks still running, without rethrowing */
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    /** @brief Queues a task; node >= 0 prefers the workers of that NUMA node, see Scheduler::spawn() */
+    template<typename F>
+    void run(F&& task, int node = -1) {
+        _pending.fetch_add(1, std::memory_order_relaxed);
+        // The group may be gone as soon as the last task has counted itself off, so only the scheduler is used after that
+        _scheduler.spawn([this, scheduler = &_scheduler, task = std::forward<F>(task)]() mutable {
+            if(!_failed.load(std::memory_order_relaxed) && !_token.isCancelled()) {
+                try {
+                    task();
+                } catch(...) {
+                    recordError(std::current_exception());
+                }
+            }
+            if(_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) scheduler->notifyProgress();
+        }, node);
+    }
+
+    /** @brief Runs queued work until every task has finished; rethrows, or throws OperationCancelled */
+    void wait();
+
+    /** @brief Cancels the token the group was created with; tasks not yet started are skipped */
+    void cancel() { _token.cancel(); }
+    bool isCancelled() const { return _token.isCancelled(); }
+
+private:
+    Scheduler& _scheduler;
+    CancellationToken _token;
+    std::atomic<size_t> _pending{0};
+    std::atomic<bool> _failed{false};
+    std::mutex _errorMutex;
+    std::exception_ptr _error;
+
+    void recordError(std::exception_ptr error);
+};
+
+/** @brief Chunk size giving every thread several chunks to balance uneven work; never below minGrain */
+inline size_t automaticGrain(size_t count, size_t minGrain = 1) {
+    size_t chunks = static_cast<size_t>(Scheduler::shared().concurrency()) * 4;
+    return std::max(minGrain, (count + chunks - 1) / chunks);
+}
+
+/**
+ * @brief Calls body(chunkBegin, chunkEnd) over [begin, end) split into chunks of grain (0 = automatic),
+ * in parallel on the shared scheduler. Returns once every chunk is done; rethrows the first exception.
+ */
+template<typename Body>
+void parallelFor(size_t begin, size_t end, Body&& body, size_t grain = 0, const CancellationToken& token = {}) {
+    if(end <= begin) return;
+    size_t count = end - begin;
+    if(grain == 0) grain = automaticGrain(count);
+
+    Scheduler& scheduler = Scheduler::shared();
+    if(count <= grain || scheduler.concurrency() == 1) {
+        token.throwIfCancelled();
+        body(begin, end);
+        return;
+    }
+
+    // Chunks never cross node bands, so each node keeps working on the same rows from loop to loop
+    TaskGroup group(token, scheduler);
+    size_t nodes = scheduler.nodeCount();
+    for(size_t node = 0; node < nodes; node++) {
+        auto [bandBegin, bandEnd] = nodes > 1 ? scheduler.nodeBand(node, begin, end) : std::pair<size_t, size_t>(begin, end);
+        for(size_t chunk = bandBegin; chunk < bandEnd; chunk += grain) {
+            size_t chunkEnd = std::min(bandEnd, chunk + grain);
+            group.run([&body, chunk, chunkEnd]() { body(chunk, chunkEnd); }, nodes > 1 ? static_cast<int>(node) : -1);
+        }
+    }
+    group.wait();
+}
+
+/**
+ * @brief Calls body(rowBegin, rowEnd, columnBegin, columnEnd) over a rows x columns range split into blocks.
+ * Blocks are whole rows when there are enough rows to keep every thread busy, otherwise rows are split too.
+ */
+template<typename Body>
+void parallelFor2D(size_t rows, size_t columns, Body&& body, size_t rowGrain = 0, size_t columnGrain = 0,
+                   const CancellationToken& token = {}) {
+    if(rows == 0 || columns == 0) return;
+
+    size_t chunks = static_cast<size_t>(Scheduler::shared().concurrency()) * 4;
+    if(rowGrain == 0) rowGrain = std::max<size_t>(1, (rows + chunks - 1) / chunks);
+    if(columnGrain == 0) {
+        size_t rowBlocks = (rows + rowGrain - 1) / rowGrain;
+        size_t columnBlocks = std::max<size_t>(1, chunks / rowBlocks);
+        columnGrain = std::max<size_t>(64, (columns + columnBlocks - 1) / columnBlocks);
+    }
+
+    size_t rowBlocks = (rows + rowGrain - 1) / rowGrain;
+    size_t columnBlocks = (columns + columnGrain - 1) / columnGrain;
+    parallelFor(0, rowBlocks * columnBlocks, [&](size_t blockBegin, size_t blockEnd) {
+        for(size_t block = blockBegin; block < blockEnd; block++) {
+            size_t row = block / columnBlocks * rowGrain;
+            size_t column = block % columnBlocks * columnGrain;
+            body(row, std::min(rows, row + rowGrain), column, std::min(columns, column + columnGrain));
+        }
+    }, 1, token);
+}
+
+} // namespace tg
+
+#endif // TG_SCHEDULER_HPP
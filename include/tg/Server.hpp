@@ -0,0 +1,125 @@
+#ifndef TG_SERVER_HPP
+#define TG_SERVER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "tg/ExecutionContext.hpp"
+#include "tg/ThreadPool.hpp"
+#include "tg/json.hpp"
+
+namespace tg {
+
+class HeightmapCache;
+
+struct ServerOptions {
+    std::string socketPath;
+    unsigned socketMode = 0600; // permissions of the socket file; anyone who can connect can write files as the server
+    std::string outputRoot;     // output and checkpoint paths of requests are relative to this directory; empty = working directory
+    unsigned workers = 0;       // jobs running at once; 0 = one per hardware thread
+    size_t maxQueued = 64;      // jobs waiting for a worker; further jobs are rejected until the queue drains
+    uint64_t memoryLimit = 0;   // reject jobs whose estimated peak exceeds this many bytes; 0 = no limit
+    HeightmapCache* cache = nullptr; // shared by all jobs if set
+};
+
+/**
+ * @class Server
+ * @brief Long-running generation daemon on a Unix domain socket (POSIX only).
+ *
+ * Requests and responses are single-line JSON objects; responses echo the request's "id" and may arrive
+ * out of order. Operations:
+ *   {"op": "generate", "job": {...}, "result": "file" | "shm"}  job keys are the CLI job options
+ *       optional "progress": true sends {"id", "status": "progress", "stage", "fraction"} lines before the response,
+ *       optional "threads": n caps the scheduler threads the job occupies
+ *   {"op": "cancel", "target": id}                               cancels a queued or running job of this connection
+ *   {"op": "stats"}       queue depth, counters and per-stage latency percentiles
+ *   {"op": "release", "shm": name}                               unlinks a shared-memory result
+ *   {"op": "ping"}, {"op": "shutdown"}
+ *
+ * Output and checkpoint paths must be relative and cannot contain "..", so requests only write below
+ * ServerOptions::outputRoot.
+ *
+ * "shm" results are raw .r16 samples in a POSIX shared-memory object; the client maps it and sends
+ * "release" (or calls shm_unlink itself) when done. Unreleased objects are unlinked when the server exits.
+ */
+class Server {
+public:
+    explicit Server(const ServerOptions& options);
+    ~Server();
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    /** @brief Accepts connections until stop() or a shutdown request, then drains queued and running jobs */
+    void run();
+
+    /** @brief Async-signal-safe; may be called from a signal handler */
+    void stop() { _stopping.store(true); }
+
+private:
+    struct Connection;
+
+    /** @brief Most recent latencies of one stage, for percentiles */
+    struct StageSamples {
+        std::vector<double> seconds;
+        size_t next = 0;
+        uint64_t count = 0;
+    };
+
+    ServerOptions _options;
+    int _listenFd = -1;
+    std::atomic<bool> _stopping{false};
+    std::chrono::steady_clock::time_point _startTime;
+
+    ThreadPool _pool;
+
+    // Jobs accepted but not yet finished, and live connection readers and writers; run() waits for all to reach zero
+    std::mutex _activityMutex;
+    std::condition_variable _activityDone;
+    size_t _queued = 0;
+    size_t _running = 0;
+    size_t _readers = 0;
+    size_t _writers = 0;
+
+    std::atomic<uint64_t> _completed{0};
+    std::atomic<uint64_t> _failed{0};
+    std::atomic<uint64_t> _rejected{0};
+    std::atomic<uint64_t> _cancelled{0};
+
+    // Tokens of accepted jobs with an id, by connection and id, so "cancel" can reach them
+    std::mutex _jobsMutex;
+    std::map<std::pair<const Connection*, std::string>, CancellationToken> _jobs;
+
+    std::mutex _statsMutex;
+    std::map<std::string, StageSamples> _stages;
+
+    std::mutex _connectionsMutex;
+    std::vector<std::weak_ptr<Connection>> _connections;
+
+    std::mutex _shmMutex;
+    std::set<std::string> _sharedMemory;
+    uint64_t _nextSharedMemory = 0;
+
+    void openSocket();
+    void serveConnection(std::shared_ptr<Connection> connection);
+    void handleRequest(const std::shared_ptr<Connection>& connection, const std::string& line);
+    void submitJob(const std::shared_ptr<Connection>& connection, const JsonValue& request, const std::string& id);
+    void cancelJob(const std::shared_ptr<Connection>& connection, const JsonValue& request);
+    std::string resolvePath(const std::string& path) const;
+    std::string exportSharedMemory(const void* data, size_t size);
+    void releaseSharedMemory(const std::string& name);
+    void recordLatency(const char* stage, double seconds);
+    std::string statsJson();
+};
+
+} // namespace tg
+
+#endif // TG_SERVER_HPP
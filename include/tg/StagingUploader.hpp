@@ -0,0 +1,96 @@
+#ifndef TG_STAGING_UPLOADER_HPP
+#define TG_STAGING_UPLOADER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan.h>
+
+namespace tg {
+
+/**
+ * @class StagingUploader
+ * @brief Copies host data into device-local buffers through one persistent, mapped staging ring.
+ *
+ * The ring is split into equal slots, each with its own command buffer. An upload is cut into slot-sized
+ * chunks; every chunk is one submission on the transfer queue that signals the next value of a timeline
+ * semaphore. The host only waits when it wraps around onto a slot whose copy has not finished yet, so small
+ * uploads return at once. Consumers wait for the value upload() returns on the GPU (see semaphore()) instead
+ * of the host waiting for the copy.
+ *
+ * Use from one thread only; it submits to its queue without further locking.
+ */
+class StagingUploader {
+public:
+    static constexpr uint32_t SLOT_COUNT = 4;
+    static constexpr VkDeviceSize SLOT_BYTES = VkDeviceSize(16) << 20;
+
+    StagingUploader() = default;
+    StagingUploader(const StagingUploader&) = delete;
+    StagingUploader& operator=(const StagingUploader&) = delete;
+
+    void init(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamily);
+    void destroy();
+
+    /**
+     * @brief Queues a copy of size bytes from data to dst at dstOffset; data may be freed as soon as this returns
+     * @return the timeline value signalled once the whole copy has finished
+     */
+    uint64_t upload(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+
+    /**
+     * @brief Queues a copy of a tightly packed width x height image, a band of rows per slot. The image is moved
+     * from any layout to TRANSFER_DST_OPTIMAL first and left in SHADER_READ_ONLY_OPTIMAL.
+     * @return the timeline value signalled once the whole image is in place
+     */
+    uint64_t uploadImage(VkImage image, uint32_t width, uint32_t height, uint32_t texelBytes, const void* data);
+
+    /**
+     * @brief Queues a copy of the width x height texels at (x, y) of an image already in SHADER_READ_ONLY_OPTIMAL,
+     * keeping the rest of it. Source rows start rowPitch bytes apart, so data can point into a larger image.
+     * The caller makes sure no earlier GPU work still reads the image.
+     * @return the timeline value signalled once the region is in place
+     */
+    uint64_t uploadImageRegion(VkImage image, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t texelBytes,
+                               const void* data, size_t rowPitch);
+
+    VkSemaphore semaphore() const { return _timeline; }
+
+    /** @brief Value of the last submitted copy; waiting for it waits for every upload so far */
+    uint64_t lastSubmitted() const { return _lastSubmitted; }
+
+    /** @brief Blocks until the copies up to value have finished */
+    void wait(uint64_t value);
+
+private:
+    struct Slot {
+        VkDeviceSize offset = 0;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        uint64_t value = 0;      // timeline value of the copy last submitted from this slot
+    };
+
+    VkDevice _device = VK_NULL_HANDLE;
+    VmaAllocator _allocator = VK_NULL_HANDLE;
+    VkQueue _queue = VK_NULL_HANDLE;
+
+    VkBuffer _ring = VK_NULL_HANDLE;
+    VmaAllocation _ringAllocation = VK_NULL_HANDLE;
+    char* _ringData = nullptr;
+
+    VkCommandPool _commandPool = VK_NULL_HANDLE;
+    VkSemaphore _timeline = VK_NULL_HANDLE;
+    uint64_t _lastSubmitted = 0;
+
+    std::vector<Slot> _slots;
+    uint32_t _nextSlot = 0;
+
+    // Lets fill write size bytes into the next free slot, records the copy out of it and submits it; returns its timeline value
+    uint64_t submitChunk(VkDeviceSize size, const std::function<void(char* staging)>& fill,
+                         const std::function<void(VkCommandBuffer, VkDeviceSize ringOffset)>& record);
+};
+
+} // namespace tg
+
+#endif // TG_STAGING_UPLOADER_HPP
@@ -0,0 +1,73 @@
+#ifndef TG_TERRAIN_QUADTREE_HPP
+#define TG_TERRAIN_QUADTREE_HPP
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "tg/ExecutionContext.hpp"
+#include "tg/generator.hpp"
+
+namespace tg {
+
+/** @brief One patch to draw: the grid patch placed at origin, one grid quad covering spacing x spacing samples */
+struct PatchInstance {
+    uint32_t originX, originY;  // first sample covered
+    uint32_t spacing;           // 1 << level
+    uint32_t level;             // LOD level; picks the range the patch morphs towards the next level in
+};
+
+/**
+ * @class TerrainQuadtree
+ * @brief Height bounds of a quadtree of square patches over a heightmap, for CDLOD patch selection.
+ *
+ * A node on level L covers patchQuads << L quads, so each node is drawn with the same grid patch at a
+ * spacing of 1 << L samples. The root level covers the whole map. select() walks the tree top down,
+ * skipping nodes outside the view frustum and descending into a node only while the camera is inside the
+ * LOD range of its children. Ranges double per level, so the number of patches per level, and with it the
+ * cost of a frame, depends on the viewport rather than on the size of the map.
+ */
+class TerrainQuadtree {
+public:
+    TerrainQuadtree() = default;
+    TerrainQuadtree(const Heightmap& heightmap, uint32_t patchQuads, const ExecutionContext& context = {});
+
+    uint32_t levelCount() const { return static_cast<uint32_t>(_levels.size()); }
+
+    /**
+     * @brief Recomputes the bounds of the nodes covering region after those samples changed in place
+     * @param heightmap the heightmap the tree was built from, same size
+     */
+    void update(const Heightmap& heightmap, const HeightmapRegion& region);
+
+    /**
+     * @brief Appends the patches to draw, grouped by level from finest to coarsest
+     * @param modelViewProjection maps the terrain's model space (x, y in [0, 1], z = height) to clip space
+     * @param cameraPosition the camera in the same model space
+     * @param range0 distance up to which level 0 is used; level L is used up to range0 * 2^L
+     * @param levelCounts receives the number of patches appended per level
+     */
+    void select(const glm::mat4& modelViewProjection, const glm::vec3& cameraPosition, float range0,
+                std::vector<PatchInstance>& instances, std::vector<uint32_t>& levelCounts) const;
+
+private:
+    struct Level {
+        uint32_t nodesX = 0, nodesY = 0;
+        std::vector<std::pair<uint16_t, uint16_t>> bounds;  // lowest and highest sample of each node, row-major
+    };
+
+    struct SelectState;
+
+    size_t _width = 0, _height = 0;
+    uint32_t _patchQuads = 0;
+    std::vector<Level> _levels;     // _levels[0] is the finest
+
+    bool selectNode(SelectState& state, uint32_t level, uint32_t x, uint32_t y) const;
+    void computeFinestBounds(const Heightmap& heightmap, uint32_t nodeX, uint32_t nodeY);
+};
+
+} // namespace tg
+
+#endif // TG_TERRAIN_QUADTREE_HPP
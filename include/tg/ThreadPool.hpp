@@ -0,0 +1,55 @@
+#ifndef TG_THREAD_POOL_HPP
+#define TG_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace tg {
+
+/**
+ * @class ThreadPool
+ * @brief Fixed set of worker threads running submitted tasks in FIFO order
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned numThreads = 0); // 0 = one per hardware thread
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /** @brief Pool shared by everything in the process that runs jobs */
+    static ThreadPool& shared();
+
+    template<typename F>
+    auto submit(F&& task) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+        using Result = std::invoke_result_t<std::decay_t<F>>;
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+        std::future<Result> future = packaged->get_future();
+        enqueue([packaged]() { (*packaged)(); });
+        return future;
+    }
+
+    unsigned size() const { return static_cast<unsigned>(_threads.size()); }
+
+private:
+    std::vector<std::thread> _threads;
+    std::deque<std::function<void()>> _queue;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stopping = false;
+
+    void enqueue(std::function<void()> task);
+    void worker();
+};
+
+} // namespace tg
+
+#endif // TG_THREAD_POOL_HPP
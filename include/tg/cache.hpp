@@ -0,0 +1,77 @@
+#ifndef TG_CACHE_HPP
+#define TG_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+
+#include "tg/generator.hpp"
+
+namespace tg {
+
+/**
+ * @brief Identifies the result of one pipeline stage. The hash covers the stage name, its parameters,
+ * the key of the stage it was computed from and tg::algorithmVersion, so results of older stage code are never reused.
+ */
+struct CacheKey {
+    std::string stage;
+    uint64_t hash = 0;
+};
+
+/**
+ * @brief parameters must describe everything the result depends on (algorithm, size, seed, settings);
+ * input is the key of the heightmap the stage was applied to, if any
+ */
+CacheKey makeCacheKey(const std::string& stage, const std::string& parameters, const CacheKey* input = nullptr);
+
+/**
+ * @class HeightmapCache
+ * @brief Content-addressed directory of heightmaps, one snapshot file per key, evicted least recently used
+ * first once the directory grows past its size limit.
+ *
+ * The directory itself is the index: entries are written through a temporary file and renamed into place, looked up
+ * by opening them and read by mapping them, and their modification time is the LRU order. Eviction rescans the
+ * directory under a lock file, so several processes may share a cache directory and its size limit. Thread-safe.
+ */
+class HeightmapCache {
+public:
+    HeightmapCache(const std::string& directory, uint64_t maxBytes);
+
+    HeightmapCache(const HeightmapCache&) = delete;
+    HeightmapCache& operator=(const HeightmapCache&) = delete;
+
+    std::optional<Heightmap> load(const CacheKey& key);
+
+    /** @brief Entries larger than the whole cache are not stored */
+    void store(const CacheKey& key, const Heightmap& heightmap);
+
+    void clear();
+
+    const std::string& directory() const { return _directory; }
+    uint64_t maxBytes() const { return _maxBytes; }
+
+    /** @brief Current size of the directory, entries of other processes included */
+    uint64_t sizeBytes() const;
+    uint64_t hits() const { return _hits.load(); }
+    uint64_t misses() const { return _misses.load(); }
+
+private:
+    std::string _directory;
+    uint64_t _maxBytes;
+
+    std::mutex _mutex;
+    std::set<std::string> _writing; // entries another thread of this process is storing right now
+
+    std::atomic<uint64_t> _hits{0};
+    std::atomic<uint64_t> _misses{0};
+
+    static std::string fileName(const CacheKey& key);
+    void evict();
+};
+
+} // namespace tg
+
+#endif // TG_CACHE_HPP
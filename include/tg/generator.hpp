@@ -1,15 +1,32 @@
 #ifndef GENERATOR_HPP
 #define GENERATOR_HPP
 
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <stdexcept>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include "tg/ExecutionContext.hpp"
+#include "tg/memory.hpp"
+
 namespace tg {
 
+/** @brief Samples [x0, x1) x [y0, y1) of a heightmap */
+struct HeightmapRegion {
+    size_t x0 = 0, y0 = 0;
+    size_t x1 = 0, y1 = 0;
+
+    bool empty() const { return x0 >= x1 || y0 >= y1; }
+};
+
 struct Heightmap {
-    std::vector<uint16_t> data; //row-major order
+    Vector<uint16_t> data; //row-major order
     size_t width;
     size_t height;
+    HeightmapRegion dirty; // samples changed in place since the last takeDirtyRegion(); filters and editing tools mark what they touch
 };
 
 struct Attributes {
@@ -19,28 +36,117 @@ struct Attributes {
 };
 
 struct Mesh {
-    std::vector<Attributes> interleavedAttributes;
-    std::vector<uint32_t> indices;
+    Vector<Attributes> interleavedAttributes;
+    Vector<uint32_t> indices;
+};
+
+struct ThermalCheckpointOptions {
+    std::string path;           // snapshot file; empty disables checkpointing
+    int everyIterations = 0;    // 0 disables the iteration trigger
+    double everySeconds = 0.0;  // 0 disables the wall-clock trigger
+    bool resume = false;        // continue from the snapshot at path if there is one; it must come from the same input and parameters
+
+    // Intermediate heightmaps, identical to a run stopped after that many iterations, are handed to onEmit
+    // between iterations; keep it short (e.g. copy and queue the work) since the next iteration waits for it
+    std::vector<int> emitIterations;
+    std::function<void(int iteration, const Heightmap& heightmap)> onEmit;
 };
 
-Heightmap generateFlatHeightmap(size_t width, size_t height, uint16_t value = 32768);
+struct HeightmapTile {
+    size_t tileX, tileY;     // position in the tile grid
+    size_t offsetX, offsetY; // top-left sample in the source heightmap
+    std::string filename;
+};
+
+/**
+ * @brief Tiles of tileSize x tileSize samples; neighbouring tiles share one edge row/column
+ * so each tile can be imported as its own landscape (e.g. UE5 World Partition, 1009 or 2017)
+ */
+struct TileGrid {
+    size_t sourceWidth, sourceHeight;
+    size_t tileSize;
+    size_t tilesX, tilesY;
+    std::vector<HeightmapTile> tiles;
+};
+
+// Fresh nondeterministic seed; the generators default to one per call
+uint32_t generateRandomSeed();
+
+// Threads of the shared Scheduler that runs the parallel algorithms; 0 (the default) means one per hardware thread
+void setThreadCount(unsigned count);
+unsigned threadCount();
+
+// Version of what the generators and filters below produce. Bump it in the change that alters their output for the same
+// parameters and seed (a new hash, another border rule, ...): cache entries and thermal checkpoints are keyed by it, so
+// those written by older code stop matching instead of being reused.
+inline constexpr uint32_t algorithmVersion = 1;
+
+// The generators, filters and mesh conversion take an optional ExecutionContext: they report progress through it,
+// stop with OperationCancelled soon after it is cancelled and keep to its thread hint. The output never depends on it.
+Heightmap generateFlatHeightmap(size_t width, size_t height, uint16_t value = 32768, const ExecutionContext& context = {});
 
-Heightmap generateRandomHeightmap(size_t width, size_t height);
+Heightmap generateRandomHeightmap(size_t width, size_t height, uint32_t seed = generateRandomSeed(), const ExecutionContext& context = {});
 
-Heightmap generatePerlinNoiseHeightmap(size_t width, size_t height, size_t gridResolution);
+/**
+ * @brief The unit gradients generatePerlinNoiseHeightmap() interpolates between: (gridResolution + 1)^2 corners,
+ * row by row, as x, y pairs. The compute backend takes the same ones, so both produce the same terrain from a seed.
+ */
+std::vector<float> perlinGradients(size_t gridResolution, uint32_t seed);
 
-Heightmap generateDiamondSquareHeightmap(size_t width, size_t height, float roughness);
+Heightmap generatePerlinNoiseHeightmap(size_t width, size_t height, size_t gridResolution, uint32_t seed = generateRandomSeed(),
+                                       const ExecutionContext& context = {});
 
-Heightmap generateFaultingHeightmap(size_t width, size_t height, int iterations);
+/**
+ * @brief SimplexNoise sampled over gridResolution lattice units along each axis, the same feature scale as Perlin noise
+ * with that grid, without its axis-aligned artifacts
+ */
+Heightmap generateSimplexNoiseHeightmap(size_t width, size_t height, size_t gridResolution, uint32_t seed = generateRandomSeed(),
+                                        const ExecutionContext& context = {});
 
-void applyThermalWeathering(Heightmap& heightmap, float threshold, float c, int iterations);
+Heightmap generateDiamondSquareHeightmap(size_t width, size_t height, float roughness, uint32_t seed = generateRandomSeed(),
+                                         const ExecutionContext& context = {});
 
-Mesh convertHeightmapToMesh(const Heightmap& heightmap);
+Heightmap generateFaultingHeightmap(size_t width, size_t height, int iterations, uint32_t seed = generateRandomSeed(),
+                                    const ExecutionContext& context = {});
+
+void applyThermalWeathering(Heightmap& heightmap, float threshold, float c, int iterations, const ExecutionContext& context = {});
+
+void applyThermalWeathering(Heightmap& heightmap, float threshold, float c, int iterations, const ThermalCheckpointOptions& checkpoint,
+                            const ExecutionContext& context = {});
+
+Mesh convertHeightmapToMesh(const Heightmap& heightmap, const ExecutionContext& context = {});
+
+// Grows the dirty region of the heightmap to cover region, clipped to the heightmap
+void markDirty(Heightmap& heightmap, const HeightmapRegion& region);
+
+// The dirty region, which is reset to empty
+HeightmapRegion takeDirtyRegion(Heightmap& heightmap);
+
+// Mesh vertex rows whose position or normal depends on a sample in region: its rows plus one on either side
+std::pair<size_t, size_t> affectedMeshRows(const Heightmap& heightmap, const HeightmapRegion& region);
+
+// Vertices of rows [rowBegin, rowEnd), identical to that part of convertHeightmapToMesh's interleavedAttributes
+Vector<Attributes> convertHeightmapRowsToVertices(const Heightmap& heightmap, size_t rowBegin, size_t rowEnd, const ExecutionContext& context = {});
 
 void exportHeightmapAsR16(Heightmap& heightmap, const std::string& filepath);
 
 void exportHeightmapAsObj(Heightmap& heightmap, const std::string& filepath);
 
+// Async variants return once the data has been handed to the shared AsyncFileWriter;
+// the heightmap may be modified or freed immediately, the future reports write completion
+std::future<void> exportHeightmapAsR16Async(const Heightmap& heightmap, const std::string& filepath);
+
+std::future<void> exportHeightmapAsObjAsync(const Heightmap& heightmap, const std::string& filepath);
+
+// 8-bit RGBA, rows tightly packed; used for rendered previews
+std::future<void> exportImageAsPngAsync(const uint8_t* rgba, uint32_t width, uint32_t height, const std::string& filepath);
+
+TileGrid computeTileGrid(size_t width, size_t height, size_t tileSize, const std::string& filepath);
+
+TileGrid exportHeightmapAsR16Tiles(const Heightmap& heightmap, const std::string& filepath, size_t tileSize);
+
+TileGrid exportR16FileAsR16Tiles(const std::string& sourcePath, size_t width, size_t height, const std::string& filepath, size_t tileSize);
+
 } // namespace tg
 
 #endif // GENERATOR_HPP
\ No newline at end of file
@@ -0,0 +1,104 @@
+#ifndef TG_JOB_HPP
+#define TG_JOB_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tg/generator.hpp"
+#include "tg/json.hpp"
+
+namespace tg {
+
+class HeightmapCache;
+struct CacheKey;
+
+enum class GenerationMethod { Flat, Random, Perlin, DiamondSquare, Faulting, Simplex };
+
+/**
+ * @brief One terrain to produce: generator, filters and outputs.
+ * Parsed from the same arguments on the command line and in batch job files.
+ */
+struct JobSpec {
+    std::string name;
+
+    GenerationMethod method = GenerationMethod::Perlin;
+    size_t width = 512;
+    size_t height = 512;
+    std::optional<uint32_t> seed; // random if not given
+
+    uint16_t flatValue = 32768;
+    size_t perlinGridSize = 4; // also the simplex noise scale
+    float diamondSquareRoughness = 0.5f;
+    int faultingIterations = 10;
+
+    bool thermal = false;
+    float thermalThreshold = 0.01f;
+    float thermalConstant = 0.25f;
+    int thermalIterations = 10;
+    ThermalCheckpointOptions thermalCheckpoint;
+
+    std::vector<std::string> outputs; // format picked by extension: .r16 or .obj
+    size_t tileSize = 0;              // if set, .r16 outputs are written as tiles of this size
+};
+
+/**
+ * @brief Memory a job is expected to need, computed from its parameters alone so a scheduler
+ * can admit or reject it before it runs. Mirrors the allocations the core library makes.
+ */
+struct MemoryEstimate {
+    uint64_t peakBytes = 0;                               // largest stage plus the file writer's buffers
+    const char* peakStage = nullptr;
+    std::vector<std::pair<const char*, uint64_t>> stages; // bytes alive while each stage runs, heightmap included
+    uint64_t writerBufferBytes = 0;                       // shared AsyncFileWriter buffer pool, allocated once per process
+};
+
+struct JobTimings {
+    double generateSeconds = 0.0;
+    double filterSeconds = 0.0;
+    double exportSeconds = 0.0;
+};
+
+const char* generationMethodName(GenerationMethod method);
+
+/** @brief Parses job arguments (see jobUsage()); throws std::invalid_argument on bad input */
+JobSpec parseJobArguments(const std::vector<std::string>& args);
+
+/**
+ * @brief Parses a job given as a JSON object whose keys are the job options without "--",
+ * e.g. {"mode": "perlin", "size": 1024, "thermal": true, "output": ["a.r16", "a.obj"]}
+ */
+JobSpec parseJobObject(const JsonValue& job);
+
+/** @brief Splits a job file into jobs; one job per line, '#' starts a comment */
+std::vector<JobSpec> loadJobFile(const std::string& path);
+
+std::vector<std::string> splitArguments(const std::string& line);
+
+std::string jobUsage();
+
+/**
+ * @brief Runs the generator and filters of a job; fills in spec.seed if it was not set.
+ * With a cache, each stage's result is looked up before it is computed and stored after.
+ * The context is handed to the generator and thermal weathering; cancelling it stops the job with OperationCancelled.
+ */
+Heightmap generateJobHeightmap(JobSpec& spec, JobTimings* timings = nullptr, HeightmapCache* cache = nullptr,
+                               const ExecutionContext& context = {});
+
+/** @brief Cache keys of the generator output and of the thermal result computed from input; spec.seed must be set */
+CacheKey generatorCacheKey(const JobSpec& spec);
+CacheKey thermalCacheKey(const JobSpec& spec, const CacheKey& input);
+
+/** @brief Writes every output of a job, all outputs concurrently */
+void writeJobOutputs(const JobSpec& spec, const Heightmap& heightmap, JobTimings* timings = nullptr);
+
+/** @brief Generates the terrain and writes every output */
+void runJob(JobSpec& spec, JobTimings* timings = nullptr, HeightmapCache* cache = nullptr, const ExecutionContext& context = {});
+
+MemoryEstimate estimateJobMemory(const JobSpec& spec);
+
+} // namespace tg
+
+#endif // TG_JOB_HPP
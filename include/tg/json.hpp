@@ -0,0 +1,49 @@
+#ifndef TG_JSON_HPP
+#define TG_JSON_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace tg {
+
+/**
+ * @class JsonValue
+ * @brief Minimal JSON document for requests and job descriptions; numbers keep their source text
+ * so they can be handed to the job argument parser unchanged
+ */
+class JsonValue {
+public:
+    enum class Type { Null, Bool, Number, String, Array, Object };
+
+    /** @brief Parses a complete document; throws std::invalid_argument with the offset of the error */
+    static JsonValue parse(const std::string& text);
+
+    Type type() const { return _type; }
+    bool isNull() const { return _type == Type::Null; }
+
+    bool asBool() const;
+    double asNumber() const;
+    const std::string& asString() const;      // the text of a string or number
+    const std::vector<JsonValue>& asArray() const;
+    const std::vector<std::pair<std::string, JsonValue>>& asObject() const;
+
+    /** @brief Member of an object, or nullptr if absent or this is not an object */
+    const JsonValue* find(const std::string& key) const;
+
+private:
+    Type _type = Type::Null;
+    bool _bool = false;
+    std::string _text;
+    std::vector<JsonValue> _array;
+    std::vector<std::pair<std::string, JsonValue>> _object;
+
+    friend class JsonParser;
+};
+
+/** @brief Quotes and escapes text as a JSON string */
+std::string jsonQuote(const std::string& text);
+
+} // namespace tg
+
+#endif // TG_JSON_HPP
@@ -0,0 +1,107 @@
+#ifndef TG_MEMORY_HPP
+#define TG_MEMORY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+/**
+ * Memory accounting for the core library. Heightmap, mesh and scratch buffers are tg::Vector, which
+ * with TG_MEMORY_TRACKING (CMake option TG_ENABLE_MEMORY_TRACKING) allocates through TrackingAllocator
+ * and charges every byte to the stage that allocated it. Without it tg::Vector is a plain std::vector
+ * and TG_MEMORY_STAGE compiles to nothing.
+ */
+namespace tg::memory {
+
+#ifdef TG_MEMORY_TRACKING
+inline constexpr bool compiledIn = true;
+#else
+inline constexpr bool compiledIn = false;
+#endif
+
+struct StageUsage {
+    const char* name;
+    uint64_t currentBytes;  // allocated in this stage and still alive
+    uint64_t peakBytes;     // highest currentBytes since the last resetPeaks()
+    uint64_t allocations;
+};
+
+/** @brief Every stage that has allocated so far, plus "other" for allocations outside any stage */
+std::vector<StageUsage> stageUsage();
+
+uint64_t currentBytes();
+uint64_t peakBytes();
+
+/** @brief Lowers every peak to its current value, e.g. before running the next job */
+void resetPeaks();
+
+#ifdef TG_MEMORY_TRACKING
+
+namespace detail {
+uint32_t registerStage(const char* name);
+uint32_t enterStage(uint32_t stage);
+void leaveStage(uint32_t previous);
+void* allocate(size_t bytes);
+void deallocate(void* ptr, size_t bytes) noexcept;
+} // namespace detail
+
+/**
+ * @brief Attributes allocations on this thread to a stage until the end of the scope; stages nest
+ */
+class StageScope {
+public:
+    explicit StageScope(uint32_t stage) : _previous(detail::enterStage(stage)) { }
+    ~StageScope() { detail::leaveStage(_previous); }
+
+    StageScope(const StageScope&) = delete;
+    StageScope& operator=(const StageScope&) = delete;
+
+private:
+    uint32_t _previous;
+};
+
+template<typename T>
+struct TrackingAllocator {
+    using value_type = T;
+
+    static_assert(alignof(T) <= alignof(std::max_align_t), "TrackingAllocator does not support over-aligned types");
+
+    TrackingAllocator() noexcept = default;
+    template<typename U>
+    TrackingAllocator(const TrackingAllocator<U>&) noexcept { }
+
+    T* allocate(size_t count) { return static_cast<T*>(detail::allocate(count * sizeof(T))); }
+    void deallocate(T* ptr, size_t count) noexcept { detail::deallocate(ptr, count * sizeof(T)); }
+
+    template<typename U>
+    bool operator==(const TrackingAllocator<U>&) const noexcept { return true; }
+};
+
+#endif
+
+} // namespace tg::memory
+
+namespace tg {
+
+#ifdef TG_MEMORY_TRACKING
+template<typename T>
+using Vector = std::vector<T, memory::TrackingAllocator<T>>;
+#else
+template<typename T>
+using Vector = std::vector<T>;
+#endif
+
+} // namespace tg
+
+#ifdef TG_MEMORY_TRACKING
+#define TG_MEMORY_CONCAT_INNER(a, b) a##b
+#define TG_MEMORY_CONCAT(a, b) TG_MEMORY_CONCAT_INNER(a, b)
+#define TG_MEMORY_STAGE(name) \
+    static const uint32_t TG_MEMORY_CONCAT(tgMemoryStageId, __LINE__) = ::tg::memory::detail::registerStage(name); \
+    ::tg::memory::StageScope TG_MEMORY_CONCAT(tgMemoryStage, __LINE__)(TG_MEMORY_CONCAT(tgMemoryStageId, __LINE__))
+#else
+#define TG_MEMORY_STAGE(name) ((void)0)
+#endif
+
+#endif // TG_MEMORY_HPP
@@ -0,0 +1,40 @@
+#ifndef TG_NOISE_HPP
+#define TG_NOISE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "tg/generator.hpp"
+
+namespace tg {
+
+/**
+ * @class SimplexNoise
+ * @brief 2D simplex noise in about [-1, 1], evaluated over arrays of points rather than one point per call.
+ *
+ * Samples lie on a triangular lattice, so there are three corners per sample instead of Perlin's four and no axis-aligned
+ * grid lines. Corner gradients come from an integer hash of the lattice point and a key drawn from the seed instead of a
+ * permutation table; with no table lookups and no branches the batch loops vectorize, so a row of samples is evaluated a
+ * SIMD register at a time on NEON, SSE and AVX alike. Generators, domain warps and fBm octaves should hand over whole rows.
+ *
+ * The same seed gives the same noise on every platform and thread count. Const and thread-safe.
+ */
+class SimplexNoise {
+public:
+    explicit SimplexNoise(uint32_t seed = generateRandomSeed());
+
+    /** @brief out[i] = noise at (x[i], y[i]) for i < count */
+    void evaluate(const float* x, const float* y, float* out, size_t count) const;
+
+    /** @brief out[i] = noise at (x0 + i * step, y) for i < count, i.e. one row of a grid */
+    void evaluateRow(float x0, float step, float y, float* out, size_t count) const;
+
+    float evaluate(float x, float y) const;
+
+private:
+    uint32_t _key; // mixed into every corner hash
+};
+
+} // namespace tg
+
+#endif // TG_NOISE_HPP
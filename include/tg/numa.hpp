@@ -0,0 +1,53 @@
+#ifndef TG_NUMA_HPP
+#define TG_NUMA_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "tg/memory.hpp"
+
+namespace tg {
+
+/** @brief Where the pages of large heightmap and scratch buffers are placed on machines with several NUMA nodes */
+enum class NumaPlacement {
+    Default,        // wherever the thread that first writes a page runs
+    Local,          // each band of rows on the node whose workers process it
+    Interleaved     // pages spread round-robin over all nodes
+};
+
+struct NumaNode {
+    int id;
+    std::vector<int> cpus;          // only CPUs this process may run on
+};
+
+/**
+ * @brief NUMA nodes with at least one CPU this process may run on, read from /sys/devices/system/node.
+ * A single node holding every allowed CPU where that is not available.
+ */
+const std::vector<NumaNode>& numaNodes();
+
+NumaPlacement parseNumaPlacement(const std::string& name);
+const char* numaPlacementName(NumaPlacement placement);
+
+/**
+ * @brief Applies the shared scheduler's placement to the pages of a buffer laid out as rows of equal size:
+ * Local binds the rows of each node band (see Scheduler::nodeBand) to that node, Interleaved spreads the pages
+ * over all nodes. Pages already present are migrated. Does nothing with Default placement or a single node.
+ */
+void placeRows(void* data, size_t bytes, size_t rows);
+
+/**
+ * @brief Resizes an empty buffer to rows * rowLength elements, placing its pages before they are first written
+ * by the zero fill. Equivalent to resize() when placement is off.
+ */
+template<typename T>
+void resizePlaced(Vector<T>& buffer, size_t rows, size_t rowLength) {
+    buffer.reserve(rows * rowLength);
+    placeRows(buffer.data(), rows * rowLength * sizeof(T), rows);
+    buffer.resize(rows * rowLength);
+}
+
+} // namespace tg
+
+#endif // TG_NUMA_HPP
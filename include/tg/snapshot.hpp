@@ -0,0 +1,64 @@
+#ifndef TG_SNAPSHOT_HPP
+#define TG_SNAPSHOT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tg {
+
+/**
+ * @brief Describes the working state of a simulation, e.g. thermal weathering after N iterations,
+ * or a cached heightmap.
+ *
+ * Snapshot files hold a 4 KiB header followed by bufferCount width x height buffers of sampleBytes-sized
+ * samples, each starting on a 4 KiB boundary, so a mapped snapshot can be used in place without any
+ * parsing or copying.
+ */
+struct SnapshotInfo {
+    std::string kind;           // simulation name, at most 15 characters
+    uint64_t parameterHash = 0; // identifies the parameters the state was produced with
+    size_t width = 0;
+    size_t height = 0;
+    uint64_t step = 0;          // iterations completed
+    uint32_t bufferCount = 0;
+    uint32_t sampleBytes = sizeof(float); // 4 for float state, 2 for uint16_t heightmaps
+};
+
+/**
+ * @brief Writes a snapshot through a temporary file, syncs it and renames it into place, then syncs the directory,
+ * so neither a crash nor a power loss mid-write destroys the previous snapshot
+ */
+void writeSnapshot(const std::string& path, const SnapshotInfo& info, const std::vector<const void*>& buffers);
+
+/**
+ * @brief Read-only view of a snapshot file, memory mapped where supported
+ */
+class MappedSnapshot {
+public:
+    explicit MappedSnapshot(const std::string& path);
+    ~MappedSnapshot();
+
+    MappedSnapshot(const MappedSnapshot&) = delete;
+    MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+    const SnapshotInfo& info() const { return _info; }
+    /** @brief Float buffer; throws if the snapshot holds samples of another size */
+    const float* buffer(uint32_t index) const;
+    const void* samples(uint32_t index) const;
+
+private:
+    SnapshotInfo _info;
+    const char* _data = nullptr;
+    size_t _size = 0;
+    std::vector<char> _fallback;
+
+    void unmap();
+};
+
+bool snapshotExists(const std::string& path);
+
+} // namespace tg
+
+#endif // TG_SNAPSHOT_HPP
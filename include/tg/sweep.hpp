@@ -0,0 +1,58 @@
+#ifndef TG_SWEEP_HPP
+#define TG_SWEEP_HPP
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "tg/ThreadPool.hpp"
+#include "tg/job.hpp"
+
+namespace tg {
+
+class HeightmapCache;
+
+/** @brief One swept job option; the sweep covers every combination of the axes' values */
+struct SweepAxis {
+    std::string option;                 // job option without "--", e.g. "thermal-iterations"
+    std::vector<std::string> values;
+};
+
+struct SweepVariant {
+    JobSpec spec;
+    std::string label;                  // e.g. "roughness-0.3_thermal-iterations-50", appended to names and outputs
+};
+
+/**
+ * @brief Variants of a sweep and the stages they share. Variants with the same generator settings share one
+ * generator run, and variants that differ only in thermal iterations share one thermal run that hands out
+ * the intermediate heightmaps as it passes each requested iteration count.
+ */
+struct SweepPlan {
+    std::vector<SweepVariant> variants;
+    size_t generatorRuns = 0;
+    size_t thermalRuns = 0;
+};
+
+/** @brief Parses "option=v1,v2,..." or a numeric range "option=start:stop:step" */
+SweepAxis parseSweepAxis(const std::string& text);
+
+/**
+ * @brief Expands the base job arguments over the axes. Every variant gets the same seed unless "seed" is swept,
+ * so they differ only in the swept settings. Throws std::invalid_argument for options that cannot be swept.
+ */
+SweepPlan planSweep(const std::vector<std::string>& baseArgs, const std::vector<SweepAxis>& axes);
+
+/**
+ * @brief Runs every variant, independent branches concurrently on pool, and writes their outputs.
+ * onDone is called once per variant, from a pool thread, with an empty error on success. Every generator and
+ * thermal run gets the context; once it is cancelled the remaining variants fail with "Operation cancelled".
+ * @return the number of variants that failed
+ */
+size_t runSweep(SweepPlan& plan, ThreadPool& pool, HeightmapCache* cache = nullptr,
+                const std::function<void(const SweepVariant& variant, const std::string& error)>& onDone = {},
+                const ExecutionContext& context = {});
+
+} // namespace tg
+
+#endif // TG_SWEEP_HPP
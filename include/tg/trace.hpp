@@ -0,0 +1,91 @@
+#ifndef TG_TRACE_HPP
+#define TG_TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * Stage tracing. Zones and counters are recorded into per-thread ring buffers while tracing is
+ * started and can be written out as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+ *
+ * Built with TG_TRACING (CMake option TG_ENABLE_TRACING); otherwise the TG_TRACE_* macros compile
+ * to nothing and start()/writeChromeJson() report that tracing is unavailable.
+ *
+ * Zone, counter and thread names must be string literals or otherwise outlive the trace.
+ */
+namespace tg::trace {
+
+#ifdef TG_TRACING
+inline constexpr bool compiledIn = true;
+#else
+inline constexpr bool compiledIn = false;
+#endif
+
+/** @brief Clears previously recorded events and starts recording */
+void start();
+void stop();
+bool active();
+
+/** @brief Writes the events currently held in the ring buffers; throws std::runtime_error on failure */
+void writeChromeJson(const std::string& path);
+
+#ifdef TG_TRACING
+
+namespace detail {
+extern std::atomic<bool> recording;
+
+uint64_t now();
+void recordZone(const char* name, uint64_t start, uint64_t end, const char* argName, uint64_t argValue);
+void recordCounter(const char* name, uint64_t value);
+void recordTrackZone(const char* track, const char* name, uint64_t start, uint64_t end);
+void setThreadName(const char* name);
+} // namespace detail
+
+class Zone {
+public:
+    explicit Zone(const char* name, const char* argName = nullptr, uint64_t argValue = 0)
+        : _name(name), _argName(argName), _argValue(argValue),
+          _start(detail::recording.load(std::memory_order_relaxed) ? detail::now() : 0) { }
+
+    ~Zone() {
+        if(_start != 0) detail::recordZone(_name, _start, detail::now(), _argName, _argValue);
+    }
+
+    Zone(const Zone&) = delete;
+    Zone& operator=(const Zone&) = delete;
+
+private:
+    const char* _name;
+    const char* _argName;
+    uint64_t _argValue;
+    uint64_t _start;
+};
+
+inline void counter(const char* name, uint64_t value) {
+    if(detail::recording.load(std::memory_order_relaxed)) detail::recordCounter(name, value);
+}
+
+#endif
+
+} // namespace tg::trace
+
+#ifdef TG_TRACING
+#define TG_TRACE_CONCAT_INNER(a, b) a##b
+#define TG_TRACE_CONCAT(a, b) TG_TRACE_CONCAT_INNER(a, b)
+#define TG_TRACE_SCOPE(name) ::tg::trace::Zone TG_TRACE_CONCAT(tgTraceZone, __LINE__)(name)
+#define TG_TRACE_SCOPE_VALUE(name, argName, value) ::tg::trace::Zone TG_TRACE_CONCAT(tgTraceZone, __LINE__)(name, argName, static_cast<uint64_t>(value))
+#define TG_TRACE_COUNTER(name, value) ::tg::trace::counter(name, static_cast<uint64_t>(value))
+#define TG_TRACE_THREAD_NAME(name) ::tg::trace::detail::setThreadName(name)
+// A zone measured elsewhere, e.g. on the GPU, shown on its own track; start and end are steady_clock nanoseconds
+#define TG_TRACE_TRACK_ZONE(track, name, start, end) \
+    do { if(::tg::trace::active()) ::tg::trace::detail::recordTrackZone(track, name, start, end); } while(0)
+#else
+#define TG_TRACE_SCOPE(name) ((void)0)
+#define TG_TRACE_SCOPE_VALUE(name, argName, value) ((void)0)
+#define TG_TRACE_COUNTER(name, value) ((void)0)
+#define TG_TRACE_THREAD_NAME(name) ((void)0)
+#define TG_TRACE_TRACK_ZONE(track, name, start, end) ((void)0)
+#endif
+
+#endif // TG_TRACE_HPP
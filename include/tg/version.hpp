@@ -0,0 +1,11 @@
+#ifndef TG_VERSION_HPP
+#define TG_VERSION_HPP
+
+namespace tg {
+
+// Reported in the About dialog and in benchmark results
+inline constexpr const char* libraryVersion = "1.0.0";
+
+} // namespace tg
+
+#endif // TG_VERSION_HPP
@@ -0,0 +1,491 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/utsname.h>
+
+#include "tg/Scheduler.hpp"
+#include "tg/generator.hpp"
+#include "tg/numa.hpp"
+#include "tg/version.hpp"
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief One timed workload at a fixed size, set up outside the timed region
+ */
+struct Workload {
+    double pixelsPerRun = 0.0;      // samples produced or processed by one run
+    std::function<uint64_t()> run;  // timed; returns the bytes produced
+    std::function<void()> reset;    // untimed; restores inputs consumed by run, may be empty
+};
+
+struct BenchCase {
+    std::string name;
+    bool endToEnd;
+    bool parallel;  // runs on the shared scheduler, so it is measured at every thread count and NUMA placement
+    std::function<Workload(size_t size, const fs::path& directory)> prepare;
+};
+
+struct BenchResult {
+    const BenchCase* benchCase;
+    size_t size;
+    unsigned threads;
+    tg::NumaPlacement numa;
+    std::vector<double> seconds;
+    double pixelsPerRun;
+    uint64_t bytesPerRun;
+    uint64_t peakRssBytes;
+    bool peakRssPerCase;
+};
+
+// Input for filters, meshing and exporters; fixed seed so every run sees the same terrain
+static tg::Heightmap benchHeightmap(size_t size) {
+    return tg::generatePerlinNoiseHeightmap(size, size, 8, 1);
+}
+
+static uint64_t fileBytes(const fs::path& path) {
+    std::error_code ec;
+    uint64_t bytes = fs::file_size(path, ec);
+    return ec ? 0 : bytes;
+}
+
+static uint64_t directoryBytes(const fs::path& directory) {
+    uint64_t bytes = 0;
+    for(const auto& entry : fs::directory_iterator(directory)) {
+        if(entry.is_regular_file()) bytes += entry.file_size();
+    }
+    return bytes;
+}
+
+static std::vector<BenchCase> benchCases() {
+    std::vector<BenchCase> cases;
+
+    auto generator = [&cases](const std::string& name, bool parallel, std::function<tg::Heightmap(size_t)> generate) {
+        cases.push_back({"generate/" + name, false, parallel, [generate](size_t size, const fs::path&) {
+            Workload workload;
+            workload.pixelsPerRun = static_cast<double>(size) * size;
+            workload.run = [generate, size]() {
+                tg::Heightmap heightmap = generate(size);
+                return static_cast<uint64_t>(heightmap.data.size() * sizeof(uint16_t));
+            };
+            return workload;
+        }});
+    };
+
+    generator("flat", false, [](size_t size) { return tg::generateFlatHeightmap(size, size); });
+    generator("random", false, [](size_t size) { return tg::generateRandomHeightmap(size, size, 1); });
+    generator("perlin", true, [](size_t size) { return tg::generatePerlinNoiseHeightmap(size, size, 8, 1); });
+    generator("simplex", true, [](size_t size) { return tg::generateSimplexNoiseHeightmap(size, size, 8, 1); });
+    generator("diamond-square", true, [](size_t size) { return tg::generateDiamondSquareHeightmap(size, size, 0.5f, 1); });
+    generator("faulting", true, [](size_t size) { return tg::generateFaultingHeightmap(size, size, 10, 1); });
+
+    constexpr int thermalIterations = 10;
+    cases.push_back({"filter/thermal", false, true, [](size_t size, const fs::path&) {
+        auto source = std::make_shared<tg::Heightmap>(benchHeightmap(size));
+        auto working = std::make_shared<tg::Heightmap>(*source);
+
+        Workload workload;
+        workload.pixelsPerRun = static_cast<double>(size) * size * thermalIterations;
+        workload.run = [working]() {
+            tg::applyThermalWeathering(*working, 0.01f, 0.25f, thermalIterations);
+            return static_cast<uint64_t>(working->data.size() * sizeof(uint16_t));
+        };
+        workload.reset = [source, working]() { *working = *source; };
+        return workload;
+    }});
+
+    cases.push_back({"mesh/convert", false, true, [](size_t size, const fs::path&) {
+        auto source = std::make_shared<tg::Heightmap>(benchHeightmap(size));
+
+        Workload workload;
+        workload.pixelsPerRun = static_cast<double>(size) * size;
+        workload.run = [source]() {
+            tg::Mesh mesh = tg::convertHeightmapToMesh(*source);
+            return static_cast<uint64_t>(mesh.interleavedAttributes.size() * sizeof(tg::Attributes) + mesh.indices.size() * sizeof(uint32_t));
+        };
+        return workload;
+    }});
+
+    // A local edit, e.g. a brush stroke: only the vertex rows around a 64 x 64 sample region are rebuilt
+    cases.push_back({"mesh/update-region", false, true, [](size_t size, const fs::path&) {
+        auto source = std::make_shared<tg::Heightmap>(benchHeightmap(size));
+        size_t edge = std::min<size_t>(64, size);
+        tg::HeightmapRegion region{(size - edge) / 2, (size - edge) / 2, (size + edge) / 2, (size + edge) / 2};
+
+        Workload workload;
+        workload.pixelsPerRun = static_cast<double>(edge) * edge;
+        workload.run = [source, region]() {
+            auto [rowBegin, rowEnd] = tg::affectedMeshRows(*source, region);
+            tg::Vector<tg::Attributes> vertices = tg::convertHeightmapRowsToVertices(*source, rowBegin, rowEnd);
+            return static_cast<uint64_t>(vertices.size() * sizeof(tg::Attributes));
+        };
+        return workload;
+    }});
+
+    cases.push_back({"export/r16", false, false, [](size_t size, const fs::path& directory) {
+        auto source = std::make_shared<tg::Heightmap>(benchHeightmap(size));
+        fs::path path = directory / "bench.r16";
+
+        Workload workload;
+        workload.pixelsPerRun = static_cast<double>(size) * size;
+        workload.run = [source, path]() {
+            tg::exportHeightmapAsR16Async(*source, path.string()).get();
+            return fileBytes(path);
+        };
+        return workload;
+    }});
+
+    cases.push_back({"export/obj", false, false, [](size_t size, const fs::path& directory) {
+        auto source = std::make_shared<tg::Heightmap>(benchHeightmap(size));
+        fs::path path = directory / "bench.obj";
+
+        Workload workload;
+        workload.pixelsPerRun = static_cast<double>(size) * size;
+        workload.run = [source, path]() {
+            tg::exportHeightmapAsObjAsync(*source, path.string()).get();
+            return fileBytes(path);
+        };
+        return workload;
+    }});
+
+    cases.push_back({"export/r16-tiles", false, true, [](size_t size, const fs::path& directory) {
+        auto source = std::make_shared<tg::Heightmap>(benchHeightmap(size));
+        fs::path tileDirectory = directory / "tiles";
+
+        Workload workload;
+        workload.pixelsPerRun = static_cast<double>(size) * size;
+        workload.run = [source, tileDirectory]() {
+            fs::create_directories(tileDirectory);
+            tg::exportHeightmapAsR16Tiles(*source, (tileDirectory / "bench.r16").string(), 505);
+            return directoryBytes(tileDirectory);
+        };
+        workload.reset = [tileDirectory]() { fs::remove_all(tileDirectory); };
+        return workload;
+    }});
+
+    // What a user does in the editor: generate, weather, mesh for display, export both formats
+    cases.push_back({"pipeline/perlin-thermal-export", true, true, [](size_t size, const fs::path& directory) {
+        fs::path r16Path = directory / "pipeline.r16";
+        fs::path objPath = directory / "pipeline.obj";
+
+        Workload workload;
+        workload.pixelsPerRun = static_cast<double>(size) * size;
+        workload.run = [size, r16Path, objPath]() {
+            tg::Heightmap heightmap = tg::generatePerlinNoiseHeightmap(size, size, 8, 1);
+            tg::applyThermalWeathering(heightmap, 0.01f, 0.25f, thermalIterations);
+            tg::Mesh mesh = tg::convertHeightmapToMesh(heightmap);
+
+            std::future<void> r16 = tg::exportHeightmapAsR16Async(heightmap, r16Path.string());
+            std::future<void> obj = tg::exportHeightmapAsObjAsync(heightmap, objPath.string());
+            r16.get();
+            obj.get();
+
+            return static_cast<uint64_t>(mesh.interleavedAttributes.size() * sizeof(tg::Attributes) + mesh.indices.size() * sizeof(uint32_t))
+                 + fileBytes(r16Path) + fileBytes(objPath);
+        };
+        return workload;
+    }});
+
+    return cases;
+}
+
+// Peak resident set size. On Linux the high-water mark can be reset, giving a peak per case;
+// elsewhere only the peak over the whole process is available.
+static bool resetPeakRss() {
+#ifdef __linux__
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+    clearRefs.flush();
+    return static_cast<bool>(clearRefs);
+#else
+    return false;
+#endif
+}
+
+static uint64_t peakRssBytes() {
+#ifdef __linux__
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while(std::getline(status, line)) {
+        if(line.rfind("VmHWM:", 0) == 0) {
+            return std::stoull(line.substr(6)) * 1024;
+        }
+    }
+#endif
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+static double median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2.0;
+}
+
+static std::string cpuName() {
+#ifdef __linux__
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while(std::getline(cpuinfo, line)) {
+        if(line.rfind("model name", 0) == 0) {
+            size_t colon = line.find(':');
+            if(colon != std::string::npos) return line.substr(line.find_first_not_of(' ', colon + 1));
+        }
+    }
+#endif
+    struct utsname name;
+    return uname(&name) == 0 ? name.machine : "unknown";
+}
+
+static std::string jsonString(const std::string& text) {
+    std::string escaped = "\"";
+    for(char ch : text) {
+        if(ch == '"' || ch == '\\') escaped += '\\';
+        if(static_cast<unsigned char>(ch) >= 0x20) escaped += ch;
+    }
+    return escaped + "\"";
+}
+
+static void writeResultsJson(const std::string& path, const std::vector<BenchResult>& results, int repeat) {
+    std::ostringstream json;
+    json << std::setprecision(9);
+
+    char timestamp[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    struct utsname name;
+    std::string os = uname(&name) == 0 ? std::string(name.sysname) + " " + name.release : "unknown";
+
+    json << "{\n";
+    json << "  \"schema\": 1,\n";
+    json << "  \"version\": " << jsonString(tg::libraryVersion) << ",\n";
+    json << "  \"timestamp\": " << jsonString(timestamp) << ",\n";
+    json << "  \"host\": {\n";
+    json << "    \"cpu\": " << jsonString(cpuName()) << ",\n";
+    json << "    \"hardwareThreads\": " << std::thread::hardware_concurrency() << ",\n";
+    json << "    \"numaNodes\": " << tg::numaNodes().size() << ",\n";
+    json << "    \"os\": " << jsonString(os) << "\n";
+    json << "  },\n";
+    json << "  \"repeat\": " << repeat << ",\n";
+    json << "  \"results\": [";
+
+    for(size_t i = 0; i < results.size(); i++) {
+        const BenchResult& result = results[i];
+        double seconds = median(result.seconds);
+
+        json << (i == 0 ? "\n" : ",\n");
+        json << "    {\n";
+        json << "      \"name\": " << jsonString(result.benchCase->name) << ",\n";
+        json << "      \"kind\": " << jsonString(result.benchCase->endToEnd ? "end-to-end" : "micro") << ",\n";
+        json << "      \"width\": " << result.size << ",\n";
+        json << "      \"height\": " << result.size << ",\n";
+        json << "      \"threads\": " << result.threads << ",\n";
+        json << "      \"numa\": " << jsonString(tg::numaPlacementName(result.numa)) << ",\n";
+        json << "      \"seconds\": [";
+        for(size_t r = 0; r < result.seconds.size(); r++) json << (r == 0 ? "" : ", ") << result.seconds[r];
+        json << "],\n";
+        json << "      \"medianSeconds\": " << seconds << ",\n";
+        json << "      \"minSeconds\": " << *std::min_element(result.seconds.begin(), result.seconds.end()) << ",\n";
+        json << "      \"pixelsPerRun\": " << result.pixelsPerRun << ",\n";
+        json << "      \"bytesPerRun\": " << result.bytesPerRun << ",\n";
+        json << "      \"mpxPerSecond\": " << result.pixelsPerRun / seconds / 1e6 << ",\n";
+        json << "      \"bytesPerSecond\": " << result.bytesPerRun / seconds << ",\n";
+        json << "      \"peakRssBytes\": " << result.peakRssBytes << ",\n";
+        json << "      \"peakRssScope\": " << jsonString(result.peakRssPerCase ? "case" : "process") << "\n";
+        json << "    }";
+    }
+    json << "\n  ]\n}\n";
+
+    std::ofstream file(path);
+    if(!file) {
+        throw std::runtime_error("Failed to open file for writing: " + path);
+    }
+    file << json.str();
+}
+
+static std::vector<size_t> parseList(const std::string& text) {
+    std::vector<size_t> values;
+    std::stringstream stream(text);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+        size_t consumed = 0;
+        size_t value = std::stoul(item, &consumed);
+        if(consumed != item.size() || value == 0) throw std::invalid_argument("Invalid list value: " + item);
+        values.push_back(value);
+    }
+    return values;
+}
+
+static std::vector<size_t> defaultThreadCounts() {
+    size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> counts;
+    for(size_t count = 1; count < hardwareThreads; count *= 2) counts.push_back(count);
+    counts.push_back(hardwareThreads);
+    return counts;
+}
+
+// Local against interleaved placement where there is more than one node to place on
+static std::vector<tg::NumaPlacement> defaultNumaPlacements() {
+    if(tg::numaNodes().size() > 1) return {tg::NumaPlacement::Local, tg::NumaPlacement::Interleaved};
+    return {tg::NumaPlacement::Default};
+}
+
+static void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options]\n"
+              << "\n"
+              << "Options:\n"
+              << "  --sizes <list>      Comma-separated edge lengths (default: 512,1024,2048,4096,8192)\n"
+              << "  --threads <list>    Thread counts for parallel cases (default: 1,2,4,... up to the core count)\n"
+              << "  --numa <list>       NUMA placements for parallel cases: default, local, interleaved\n"
+              << "                      (default: local,interleaved on machines with several nodes)\n"
+              << "  --repeat <n>        Timed runs per measurement; the median is reported (default: 3)\n"
+              << "  --filter <text>     Only run cases whose name contains <text>; may be repeated\n"
+              << "  --output <path>     JSON results file (default: bench.json)\n"
+              << "  --dir <path>        Where to create the scratch directory for exporter output (default: system temp)\n"
+              << "  --list              List the benchmark cases and exit\n"
+              << "  --help              Show this help message\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<size_t> sizes = {512, 1024, 2048, 4096, 8192};
+    std::vector<size_t> threadCounts = defaultThreadCounts();
+    std::vector<tg::NumaPlacement> placements = defaultNumaPlacements();
+    int repeat = 3;
+    std::vector<std::string> filters;
+    std::string outputPath = "bench.json";
+    fs::path scratchParent = fs::temp_directory_path();
+
+    std::vector<BenchCase> cases = benchCases();
+
+    try {
+        for(int i=1; i<argc; ++i) {
+            std::string arg = argv[i];
+            if(arg == "--sizes" && i + 1 < argc) {
+                sizes = parseList(argv[++i]);
+            } else if(arg == "--threads" && i + 1 < argc) {
+                threadCounts = parseList(argv[++i]);
+            } else if(arg == "--numa" && i + 1 < argc) {
+                placements.clear();
+                std::stringstream list(argv[++i]);
+                std::string name;
+                while(std::getline(list, name, ',')) placements.push_back(tg::parseNumaPlacement(name));
+            } else if(arg == "--repeat" && i + 1 < argc) {
+                repeat = std::max(1, std::stoi(argv[++i]));
+            } else if(arg == "--filter" && i + 1 < argc) {
+                filters.push_back(argv[++i]);
+            } else if(arg == "--output" && i + 1 < argc) {
+                outputPath = argv[++i];
+            } else if(arg == "--dir" && i + 1 < argc) {
+                scratchParent = argv[++i];
+            } else if(arg == "--list") {
+                for(const BenchCase& benchCase : cases) {
+                    std::cout << benchCase.name << (benchCase.parallel ? " (parallel)" : "") << "\n";
+                }
+                return EXIT_SUCCESS;
+            } else if(arg == "--help") {
+                printUsage(argv[0]);
+                return EXIT_SUCCESS;
+            } else {
+                throw std::invalid_argument("Unknown argument: " + arg);
+            }
+        }
+    } catch(const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\nSee " << argv[0] << " --help" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto selected = [&filters](const BenchCase& benchCase) {
+        if(filters.empty()) return true;
+        return std::any_of(filters.begin(), filters.end(), [&](const std::string& filter) {
+            return benchCase.name.find(filter) != std::string::npos;
+        });
+    };
+
+    std::vector<BenchResult> results;
+    fs::path scratch = scratchParent / "terrainGen-bench";
+
+    try {
+        fs::create_directories(scratch);
+
+        std::cout << std::left << std::setw(34) << "case" << std::right << std::setw(7) << "size" << std::setw(9) << "threads" << std::setw(13) << "numa"
+                  << std::setw(12) << "median ms" << std::setw(11) << "Mpx/s" << std::setw(11) << "MB/s" << std::setw(12) << "peak RSS MB" << "\n";
+
+        for(const BenchCase& benchCase : cases) {
+            if(!selected(benchCase)) continue;
+
+            for(size_t size : sizes) {
+                std::vector<std::pair<tg::NumaPlacement, size_t>> configurations = {{tg::NumaPlacement::Default, 1}};
+                if(benchCase.parallel) {
+                    configurations.clear();
+                    for(tg::NumaPlacement numa : placements) {
+                        for(size_t threads : threadCounts) configurations.emplace_back(numa, threads);
+                    }
+                }
+
+                for(auto [numa, threads] : configurations) {
+                    tg::SchedulerOptions scheduler;
+                    scheduler.threads = static_cast<unsigned>(threads);
+                    scheduler.numa = numa;
+                    tg::configureScheduler(scheduler);
+
+                    bool perCase = resetPeakRss();
+                    Workload workload = benchCase.prepare(size, scratch);
+
+                    BenchResult result{&benchCase, size, static_cast<unsigned>(threads), numa, {}, workload.pixelsPerRun, 0, 0, perCase};
+                    for(int r = 0; r < repeat; r++) {
+                        if(r > 0 && workload.reset) workload.reset();
+
+                        auto start = std::chrono::steady_clock::now();
+                        result.bytesPerRun = workload.run();
+                        result.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+                    }
+                    if(workload.reset) workload.reset();
+                    result.peakRssBytes = peakRssBytes();
+
+                    double seconds = median(result.seconds);
+                    std::cout << std::left << std::setw(34) << benchCase.name << std::right << std::setw(7) << size << std::setw(9) << threads
+                              << std::setw(13) << tg::numaPlacementName(numa)
+                              << std::fixed << std::setprecision(2)
+                              << std::setw(12) << seconds * 1e3
+                              << std::setw(11) << result.pixelsPerRun / seconds / 1e6
+                              << std::setw(11) << result.bytesPerRun / seconds / 1e6
+                              << std::setw(12) << result.peakRssBytes / 1e6 << std::endl;
+                    std::cout.unsetf(std::ios::fixed);
+
+                    results.push_back(std::move(result));
+                }
+            }
+        }
+
+        tg::configureScheduler({});
+        fs::remove_all(scratch);
+
+        writeResultsJson(outputPath, results, repeat);
+    } catch(const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Results written to " << outputPath << std::endl;
+    return EXIT_SUCCESS;
+}
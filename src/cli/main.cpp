@@ -1,62 +1,470 @@
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <future>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
-#include "tg/generator.hpp"
+#include "tg/ExecutionContext.hpp"
+#include "tg/Server.hpp"
+#include "tg/Scheduler.hpp"
+#include "tg/ThreadPool.hpp"
+#include "tg/cache.hpp"
+#include "tg/job.hpp"
+#include "tg/memory.hpp"
+#include "tg/sweep.hpp"
+#include "tg/trace.hpp"
 
-int main(int argc, char* argv[]) {
-    std::string mode = "perlin";
-    size_t size = 512;
-    std::string path = "heightmap.r16";
-
-    for(int i=1; i<argc; ++i) {
-        std::string arg = argv[i];
-        if(arg == "--mode" && i + 1 < argc) {
-            mode = argv[++i];
-        } else if(arg == "--size" && i + 1 < argc) {
-            size = std::stoul(argv[++i]);
-        } else if(arg == "--path" && i + 1 < argc) {
-            path = argv[++i];
-        } else if(arg == "--help") {
-            std::cout << "Usage: " << argv[0] << " [options]\n"
-                      << "Options:\n"
-                      << "  --mode <mode>    Set the generation mode (default: perlin)\n"
-                      << "  --size <size>    Set the size of the heightmap (default: 512)\n"
-                      << "  --path <path>    Set the output path for the heightmap (default: heightmap)\n"
-                      << "  --help          Show this help message\n"
-                      << std::endl
-                      << "Available modes: flat, random, perlin\n"
-                      << "Note: The heightmap file type will depend on the specified file extension.\n"
-                      << "Available extensions: .r16\n";
-            return EXIT_SUCCESS;
+struct CliOptions {
+    std::string batchPath;
+    std::string tracePath;
+    std::string socketPath;
+    std::string outputRoot;
+    unsigned socketMode = 0600;
+    std::string cacheDirectory;
+    uint64_t cacheSize = uint64_t(4) << 30;
+    unsigned numJobs = 0;        // batch or server jobs running at once; 0 = one per core
+    size_t queueLimit = 64;      // server jobs waiting for a worker
+    uint64_t memoryLimit = 0;    // bytes; 0 = no limit
+    std::vector<tg::SweepAxis> sweeps;
+    bool estimateOnly = false;
+    bool memoryReport = false;
+    bool progress = false;
+};
+
+static void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [job options] --output <path> [--output <path> ...]\n"
+              << "       " << program << " --batch <file> [--jobs <n>]\n"
+              << "       " << program << " [job options] --sweep <option>=<values> [--sweep ...] [--jobs <n>]\n"
+              << "       " << program << " --serve <socket> [--jobs <n>] [--queue-limit <n>] [--output-root <dir>]\n"
+              << "\n"
+              << "Options:\n"
+              << "  --batch <file>               Run every job in <file>; one job per line, same options as below\n"
+              << "  --jobs <n>                   Batch, sweep and server mode: number of jobs to run at once (default: one per core)\n"
+              << "  --sweep <option>=<values>    Run the job once per value (v1,v2,... or start:stop:step); repeat to sweep\n"
+              << "                               several options. Variants share generator and thermal runs where possible\n"
+              << "  --serve <socket>             Serve generation requests on a Unix domain socket until SIGINT/SIGTERM\n"
+              << "  --queue-limit <n>            Server mode: jobs that may wait for a worker before requests are rejected (default: 64)\n"
+              << "  --output-root <dir>          Server mode: directory that request paths are relative to (default: working directory)\n"
+              << "  --socket-mode <octal>        Server mode: permissions of the socket file (default: 600)\n"
+              << "  --threads <n>                Threads shared by the parallel algorithms of all jobs (default: one per core)\n"
+              << "  --pin-threads                Pin each of those threads to its own CPU (Linux)\n"
+              << "  --numa <placement>           Placement of large buffers on multi-socket machines: default, local (each\n"
+              << "                               band of rows on the node of the threads working on it) or interleaved\n"
+              << "  --cache <dir>                Reuse generated and filtered heightmaps stored in <dir>\n"
+              << "  --cache-size <MiB>           Cache size limit; least recently used entries are removed (default: 4096)\n"
+              << "  --trace <path>               Record stage timings and write them as Chrome trace JSON\n"
+              << "  --estimate                   Print the estimated peak memory of each job and exit\n"
+              << "  --memory-limit <MiB>         Reject jobs estimated above the limit; batch jobs only start while\n"
+              << "                               the estimates of all running jobs fit\n"
+              << "  --memory-report              Print tracked memory per stage after running\n"
+              << "  --progress                   Print the progress of each job's stages to stderr\n"
+              << "  --help                       Show this help message\n"
+              << "\n"
+              << tg::jobUsage()
+              << "\n"
+              << "The output format depends on the file extension: .r16 (Unreal Engine 5) or .obj (Blender).\n";
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double mebibytes(uint64_t bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+static std::string describeJob(const tg::JobSpec& spec) {
+    return spec.name + " (" + tg::generationMethodName(spec.method) + ", " + std::to_string(spec.width) + "x"
+         + std::to_string(spec.height) + ", seed " + std::to_string(*spec.seed) + ")";
+}
+
+static void printEstimate(const tg::JobSpec& spec, const tg::MemoryEstimate& estimate) {
+    std::cout << spec.name << ": estimated peak " << std::fixed << std::setprecision(1) << mebibytes(estimate.peakBytes) << " MiB";
+    if(estimate.peakStage != nullptr) std::cout << " in " << estimate.peakStage;
+    std::cout << "\n";
+    for(const auto& [stage, bytes] : estimate.stages) {
+        std::cout << "  " << std::left << std::setw(32) << stage << std::right << std::setw(10) << mebibytes(bytes) << " MiB\n";
+    }
+    if(estimate.writerBufferBytes > 0) {
+        std::cout << "  " << std::left << std::setw(32) << "file writer buffers" << std::right << std::setw(10) << mebibytes(estimate.writerBufferBytes) << " MiB\n";
+    }
+    std::cout.unsetf(std::ios::fixed);
+    std::cout << std::setprecision(6) << std::flush;
+}
+
+static void printMemoryReport() {
+    if(!tg::memory::compiledIn) {
+        std::cerr << "Memory tracking is not available in this build (configure with TG_ENABLE_MEMORY_TRACKING=ON)" << std::endl;
+        return;
+    }
+
+    std::cout << "Tracked memory, peak " << std::fixed << std::setprecision(1) << mebibytes(tg::memory::peakBytes()) << " MiB\n";
+    for(const tg::memory::StageUsage& stage : tg::memory::stageUsage()) {
+        if(stage.allocations == 0) continue;
+        std::cout << "  " << std::left << std::setw(32) << stage.name << std::right << std::setw(10) << mebibytes(stage.peakBytes)
+                  << " MiB peak, " << mebibytes(stage.currentBytes) << " MiB alive, " << stage.allocations << " allocations\n";
+    }
+    std::cout.unsetf(std::ios::fixed);
+    std::cout << std::setprecision(6) << std::flush;
+}
+
+static void checkMemoryLimit(const tg::JobSpec& spec, const tg::MemoryEstimate& estimate, uint64_t limit) {
+    if(limit > 0 && estimate.peakBytes > limit) {
+        throw std::runtime_error("Job " + spec.name + " needs an estimated " + std::to_string(estimate.peakBytes >> 20)
+                               + " MiB, over the " + std::to_string(limit >> 20) + " MiB limit");
+    }
+}
+
+// Cancelled by the first SIGINT/SIGTERM while jobs run; a second one kills the process as usual
+static tg::CancellationToken interrupted;
+
+static void cancelJobs(int signal) {
+    interrupted.cancel();
+    std::signal(signal, SIG_DFL);
+}
+
+static std::mutex progressMutex;
+
+/** @brief Context of one job: cancelled on interrupt, printing its stages to stderr in 10% steps if asked to */
+static tg::ExecutionContext jobContext(const CliOptions& options, const std::string& name) {
+    tg::ExecutionContext context;
+    context.cancel = interrupted;
+    if(options.progress) {
+        auto last = std::make_shared<std::pair<std::string, int>>("", -1);
+        context.onProgress = [name, last](const char* stage, float fraction) {
+            int step = static_cast<int>(fraction * 10.0f);
+            if(last->first == stage && last->second == step) return;
+            *last = {stage, step};
+            std::lock_guard<std::mutex> lock(progressMutex);
+            std::cerr << name << ": " << stage << " " << step * 10 << "%" << std::endl;
+        };
+    }
+    return context;
+}
+
+/**
+ * @brief Blocks jobs from starting until their estimated memory fits next to the jobs already running
+ */
+class MemoryBudget {
+public:
+    explicit MemoryBudget(uint64_t bytes) : _capacity(bytes), _available(bytes) { }
+
+    /** @brief Waits until bytes are free; more than the whole budget would never fit, so that throws instead */
+    void acquire(uint64_t bytes) {
+        if(bytes > _capacity) {
+            throw std::invalid_argument("Reservation of " + std::to_string(bytes >> 20) + " MiB exceeds the "
+                                      + std::to_string(_capacity >> 20) + " MiB memory budget");
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _released.wait(lock, [&]() { return bytes <= _available; });
+        _available -= bytes;
+    }
+
+    void release(uint64_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _available += bytes;
+        }
+        _released.notify_all();
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _released;
+    const uint64_t _capacity;
+    uint64_t _available;
+};
+
+static int runBatch(std::vector<tg::JobSpec>& jobs, const CliOptions& options, tg::HeightmapCache* cache) {
+    tg::ThreadPool pool(options.numJobs);
+    std::mutex outputMutex;
+    auto batchStart = std::chrono::steady_clock::now();
+
+    // The file writer's buffers are shared by all jobs, so they are taken off the budget once
+    std::vector<tg::MemoryEstimate> estimates;
+    uint64_t sharedBytes = 0;
+    for(const tg::JobSpec& spec : jobs) {
+        estimates.push_back(tg::estimateJobMemory(spec));
+        checkMemoryLimit(spec, estimates.back(), options.memoryLimit);
+        sharedBytes = std::max(sharedBytes, estimates.back().writerBufferBytes);
+    }
+    // A job whose own buffers are smaller than the shared ones still has to fit next to the largest of them
+    if(options.memoryLimit > 0) {
+        for(size_t i = 0; i < jobs.size(); i++) {
+            uint64_t bytes = estimates[i].peakBytes - estimates[i].writerBufferBytes + sharedBytes;
+            if(bytes > options.memoryLimit) {
+                throw std::runtime_error("Job " + jobs[i].name + " needs an estimated " + std::to_string(bytes >> 20)
+                                       + " MiB next to the batch's shared file buffers, over the "
+                                       + std::to_string(options.memoryLimit >> 20) + " MiB limit");
+            }
+        }
+    }
+    MemoryBudget budget(options.memoryLimit > 0 ? options.memoryLimit - sharedBytes : UINT64_MAX);
+
+    std::vector<std::future<bool>> results;
+    for(size_t i = 0; i < jobs.size(); i++) {
+        tg::JobSpec& spec = jobs[i];
+        uint64_t reserved = options.memoryLimit > 0 ? estimates[i].peakBytes - estimates[i].writerBufferBytes : 0;
+
+        results.push_back(pool.submit([&spec, &options, &outputMutex, &budget, reserved, cache]() {
+            budget.acquire(reserved);
+            auto start = std::chrono::steady_clock::now();
+            try {
+                tg::runJob(spec, nullptr, cache, jobContext(options, spec.name));
+            } catch(const std::exception& e) {
+                budget.release(reserved);
+                std::lock_guard<std::mutex> lock(outputMutex);
+                std::cerr << "Error in job " << spec.name << ": " << e.what() << std::endl;
+                return false;
+            }
+            budget.release(reserved);
+            std::lock_guard<std::mutex> lock(outputMutex);
+            std::cout << "Done " << describeJob(spec) << " in " << secondsSince(start) << "s" << std::endl;
+            return true;
+        }));
+    }
+
+    size_t failed = 0;
+    for(auto& result : results) {
+        if(!result.get()) failed++;
+    }
+
+    std::cout << jobs.size() - failed << "/" << jobs.size() << " jobs completed in " << secondsSince(batchStart) << "s"
+              << std::endl;
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static tg::Server* activeServer = nullptr;
+
+static void stopServer(int) {
+    if(activeServer != nullptr) activeServer->stop();
+}
+
+static int runServer(const CliOptions& options, const std::vector<std::string>& jobArgs, tg::HeightmapCache* cache) {
+    if(!jobArgs.empty()) {
+        throw std::invalid_argument("Job options cannot be combined with --serve: " + jobArgs.front());
+    }
+
+    tg::ServerOptions serverOptions;
+    serverOptions.socketPath = options.socketPath;
+    serverOptions.socketMode = options.socketMode;
+    serverOptions.outputRoot = options.outputRoot;
+    serverOptions.workers = options.numJobs;
+    serverOptions.maxQueued = options.queueLimit;
+    serverOptions.memoryLimit = options.memoryLimit;
+    serverOptions.cache = cache;
+
+    tg::Server server(serverOptions);
+    activeServer = &server;
+#ifndef _WIN32
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    std::signal(SIGINT, stopServer);
+    std::signal(SIGTERM, stopServer);
+
+    server.run();
+
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    activeServer = nullptr;
+    std::cout << "Server stopped" << std::endl;
+    return EXIT_SUCCESS;
+}
+
+static int runSweepJobs(const CliOptions& options, std::vector<std::string> jobArgs, tg::HeightmapCache* cache) {
+    if(!options.batchPath.empty()) {
+        throw std::invalid_argument("--sweep cannot be combined with --batch");
+    }
+    if(tg::parseJobArguments(jobArgs).outputs.empty()) {
+        jobArgs.push_back("--output");
+        jobArgs.push_back("heightmap.r16");
+    }
+
+    tg::SweepPlan plan = tg::planSweep(jobArgs, options.sweeps);
+    for(const tg::SweepVariant& variant : plan.variants) {
+        tg::MemoryEstimate estimate = tg::estimateJobMemory(variant.spec);
+        if(options.estimateOnly) {
+            printEstimate(variant.spec, estimate);
         } else {
-            throw std::invalid_argument("Unknown argument: " + arg);
+            checkMemoryLimit(variant.spec, estimate, options.memoryLimit);
         }
     }
 
-    tg::Heightmap heightmap;
+    std::cout << plan.variants.size() << " variants sharing " << plan.generatorRuns << " generator runs and "
+              << plan.thermalRuns << " thermal runs" << std::endl;
+    if(options.estimateOnly) return EXIT_SUCCESS;
 
-    if(mode == "flat") {
-        heightmap = tg::generateFlatHeightmap(size, size);
-    } else if(mode == "random") {
-        heightmap = tg::generateRandomHeightmap(size, size);
-    } else if(mode == "perlin") {
-        try {
-            heightmap = tg::generatePerlinNoiseHeightmap(size, size);
-        } catch(const std::runtime_error& e) {
-            std::cerr << "Error: " << e.what() << std::endl;
-            return EXIT_FAILURE;
+    tg::ThreadPool pool(options.numJobs);
+    std::mutex outputMutex;
+    auto start = std::chrono::steady_clock::now();
+
+    // Variants share runs, so only cancellation applies; each variant is reported as it is done
+    tg::ExecutionContext context;
+    context.cancel = interrupted;
+    size_t failed = tg::runSweep(plan, pool, cache, [&](const tg::SweepVariant& variant, const std::string& error) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        if(error.empty()) {
+            std::cout << "Done " << describeJob(variant.spec) << std::endl;
+        } else {
+            std::cerr << "Error in job " << variant.spec.name << ": " << error << std::endl;
+        }
+    }, context);
+
+    std::cout << plan.variants.size() - failed << "/" << plan.variants.size() << " variants completed in "
+              << secondsSince(start) << "s" << std::endl;
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int runJobs(const CliOptions& options, const std::vector<std::string>& jobArgs, tg::HeightmapCache* cache) {
+    if(!options.sweeps.empty()) {
+        return runSweepJobs(options, jobArgs, cache);
+    }
+
+    std::vector<tg::JobSpec> jobs;
+
+    if(!options.batchPath.empty()) {
+        if(!jobArgs.empty()) {
+            throw std::invalid_argument("Job options cannot be combined with --batch: " + jobArgs.front());
+        }
+
+        jobs = tg::loadJobFile(options.batchPath);
+        if(jobs.empty()) {
+            throw std::invalid_argument("No jobs in " + options.batchPath);
         }
     } else {
-        throw std::invalid_argument("Unknown mode: " + mode);
+        jobs.push_back(tg::parseJobArguments(jobArgs));
+        if(jobs.front().outputs.empty()) {
+            jobs.front().outputs.push_back("heightmap.r16");
+        }
     }
 
-    try {
-        tg::exportHeightmapAsR16(heightmap, path);
-    } catch(const std::runtime_error& e) {
-        std::cerr << "Error exporting heightmap: " << e.what() << std::endl;
-        return EXIT_FAILURE;
+    if(options.estimateOnly) {
+        for(const tg::JobSpec& spec : jobs) printEstimate(spec, tg::estimateJobMemory(spec));
+        return EXIT_SUCCESS;
     }
 
+    if(!options.batchPath.empty()) {
+        return runBatch(jobs, options, cache);
+    }
+
+    tg::JobSpec& spec = jobs.front();
+    checkMemoryLimit(spec, tg::estimateJobMemory(spec), options.memoryLimit);
+
+    auto start = std::chrono::steady_clock::now();
+    tg::runJob(spec, nullptr, cache, jobContext(options, spec.name));
+    std::cout << "Done " << describeJob(spec) << " in " << secondsSince(start) << "s" << std::endl;
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+int main(int argc, char* argv[]) {
+    CliOptions options;
+    std::vector<std::string> jobArgs;
+    int status = EXIT_SUCCESS;
+
+    try {
+        for(int i=1; i<argc; ++i) {
+            std::string arg = argv[i];
+            if(arg == "--batch" && i + 1 < argc) {
+                options.batchPath = argv[++i];
+            } else if(arg == "--sweep" && i + 1 < argc) {
+                options.sweeps.push_back(tg::parseSweepAxis(argv[++i]));
+            } else if(arg == "--serve" && i + 1 < argc) {
+                options.socketPath = argv[++i];
+            } else if(arg == "--queue-limit" && i + 1 < argc) {
+                options.queueLimit = static_cast<size_t>(std::stoul(argv[++i]));
+            } else if(arg == "--output-root" && i + 1 < argc) {
+                options.outputRoot = argv[++i];
+            } else if(arg == "--socket-mode" && i + 1 < argc) {
+                options.socketMode = static_cast<unsigned>(std::stoul(argv[++i], nullptr, 8));
+                if(options.socketMode > 0777) throw std::invalid_argument("Socket mode must be within 000-777");
+            } else if(arg == "--jobs" && i + 1 < argc) {
+                options.numJobs = static_cast<unsigned>(std::stoul(argv[++i]));
+            } else if(arg == "--threads" && i + 1 < argc) {
+                tg::setThreadCount(static_cast<unsigned>(std::stoul(argv[++i])));
+            } else if(arg == "--pin-threads") {
+                tg::SchedulerOptions scheduler = tg::schedulerOptions();
+                scheduler.pinThreads = true;
+                tg::configureScheduler(scheduler);
+            } else if(arg == "--numa" && i + 1 < argc) {
+                tg::SchedulerOptions scheduler = tg::schedulerOptions();
+                scheduler.numa = tg::parseNumaPlacement(argv[++i]);
+                tg::configureScheduler(scheduler);
+            } else if(arg == "--cache" && i + 1 < argc) {
+                options.cacheDirectory = argv[++i];
+            } else if(arg == "--cache-size" && i + 1 < argc) {
+                options.cacheSize = static_cast<uint64_t>(std::stoull(argv[++i])) << 20;
+            } else if(arg == "--trace" && i + 1 < argc) {
+                options.tracePath = argv[++i];
+            } else if(arg == "--estimate") {
+                options.estimateOnly = true;
+            } else if(arg == "--memory-limit" && i + 1 < argc) {
+                options.memoryLimit = static_cast<uint64_t>(std::stoull(argv[++i])) << 20;
+            } else if(arg == "--memory-report") {
+                options.memoryReport = true;
+            } else if(arg == "--progress") {
+                options.progress = true;
+            } else if(arg == "--help") {
+                printUsage(argv[0]);
+                return EXIT_SUCCESS;
+            } else {
+                jobArgs.push_back(arg);
+            }
+        }
+
+        if(!options.tracePath.empty()) {
+            tg::trace::start();
+            TG_TRACE_THREAD_NAME("main");
+        }
+
+        std::unique_ptr<tg::HeightmapCache> cache;
+        if(!options.cacheDirectory.empty()) {
+            cache = std::make_unique<tg::HeightmapCache>(options.cacheDirectory, options.cacheSize);
+        }
+
+        if(options.socketPath.empty()) {
+            std::signal(SIGINT, cancelJobs);
+            std::signal(SIGTERM, cancelJobs);
+            status = runJobs(options, jobArgs, cache.get());
+            std::signal(SIGINT, SIG_DFL);
+            std::signal(SIGTERM, SIG_DFL);
+        } else {
+            status = runServer(options, jobArgs, cache.get());
+        }
+
+        if(cache && !options.estimateOnly) {
+            std::cout << "Cache: " << cache->hits() << " hits, " << cache->misses() << " misses, " << std::fixed << std::setprecision(1)
+                      << mebibytes(cache->sizeBytes()) << " of " << mebibytes(cache->maxBytes()) << " MiB used" << std::endl;
+            std::cout.unsetf(std::ios::fixed);
+            std::cout << std::setprecision(6);
+        }
+    } catch(const std::invalid_argument& e) {
+        std::cerr << "Error: " << e.what() << "\nSee " << argv[0] << " --help" << std::endl;
+        status = EXIT_FAILURE;
+    } catch(const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        status = EXIT_FAILURE;
+    }
+
+    if(options.memoryReport) printMemoryReport();
+
+    // Failed runs are traced too; that is often when the trace is wanted
+    if(tg::trace::active()) {
+        tg::trace::stop();
+        try {
+            tg::trace::writeChromeJson(options.tracePath);
+            std::cout << "Trace written to " << options.tracePath << std::endl;
+        } catch(const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            status = EXIT_FAILURE;
+        }
+    }
+
+    return status;
+}
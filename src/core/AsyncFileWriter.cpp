@@ -0,0 +1,660 @@
+#include "tg/AsyncFileWriter.hpp"
+#include "tg/trace.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <malloc.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define TG_HAS_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+// Ops travel through the kernel rings, which ThreadSanitizer cannot see
+#if defined(__SANITIZE_THREAD__)
+extern "C" void __tsan_acquire(void* addr);
+extern "C" void __tsan_release(void* addr);
+#define TG_TSAN_ACQUIRE(addr) __tsan_acquire(addr)
+#define TG_TSAN_RELEASE(addr) __tsan_release(addr)
+#else
+#define TG_TSAN_ACQUIRE(addr) ((void)0)
+#define TG_TSAN_RELEASE(addr) ((void)0)
+#endif
+
+namespace tg {
+
+struct AsyncFileWriter::FileState {
+    int fd = -1;
+    std::string path;
+    bool directIO = false;
+
+    uint64_t offset = 0;       // next write offset, always a multiple of the alignment with directIO
+    uint64_t logicalSize = 0;  // real file size once the padded tail has been written
+
+    std::mutex mutex;
+    unsigned pending = 0;
+    bool closing = false;
+    bool finished = false;
+    int error = 0;
+    std::promise<void> done;
+};
+
+struct AsyncFileWriter::WriteOp {
+    std::shared_ptr<FileState> state;
+    int buffer = -1;
+    uint64_t offset = 0;
+    size_t length = 0;
+    size_t written = 0;
+#ifdef TG_HAS_IO_URING
+    iovec iov{};
+#endif
+};
+
+class AsyncFileWriter::Backend {
+public:
+    virtual ~Backend() = default;
+    virtual void submit(WriteOp* op) = 0;
+    virtual const char* name() const = 0;
+};
+
+static void* allocateAligned(size_t alignment, size_t size) {
+#ifdef _WIN32
+    void* ptr = _aligned_malloc(size, alignment);
+#else
+    void* ptr = nullptr;
+    if(posix_memalign(&ptr, alignment, size) != 0) ptr = nullptr;
+#endif
+    if(!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+static void freeAligned(void* ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+static int64_t positionalWrite(int fd, const void* data, size_t size, uint64_t offset) {
+#ifdef _WIN32
+    static std::mutex seekMutex;
+    std::lock_guard<std::mutex> lock(seekMutex);
+    if(_lseeki64(fd, static_cast<__int64>(offset), SEEK_SET) < 0) return -errno;
+    int result = _write(fd, data, static_cast<unsigned>(size));
+    return result < 0 ? -errno : result;
+#else
+    ssize_t result = pwrite(fd, data, size, static_cast<off_t>(offset));
+    return result < 0 ? -errno : result;
+#endif
+}
+
+/**
+ * @brief Portable backend: a few threads issuing blocking positional writes
+ */
+class ThreadPoolBackend : public AsyncFileWriter::Backend {
+public:
+    using Callback = std::function<void(AsyncFileWriter::WriteOp*, int64_t)>;
+    using DataFn = std::function<const char*(AsyncFileWriter::WriteOp*)>;
+
+    ThreadPoolBackend(unsigned numThreads, Callback onComplete, DataFn data)
+        : _onComplete(std::move(onComplete)), _data(std::move(data)) {
+        for(unsigned i = 0; i < std::max(1u, numThreads); i++) {
+            _threads.emplace_back([this]() { worker(); });
+        }
+    }
+
+    ~ThreadPoolBackend() override {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _cv.notify_all();
+        for(auto& t : _threads) t.join();
+    }
+
+    void submit(AsyncFileWriter::WriteOp* op) override {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queue.push_back(op);
+        }
+        _cv.notify_one();
+    }
+
+    const char* name() const override { return "threadpool"; }
+
+private:
+    Callback _onComplete;
+    DataFn _data;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<AsyncFileWriter::WriteOp*> _queue;
+    bool _stopping = false;
+    std::vector<std::thread> _threads;
+
+    void worker() {
+        TG_TRACE_THREAD_NAME("file writer");
+
+        while(true) {
+            AsyncFileWriter::WriteOp* op;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+                if(_queue.empty()) return;
+                op = _queue.front();
+                _queue.pop_front();
+            }
+
+            int64_t result;
+            {
+                TG_TRACE_SCOPE_VALUE("pwrite", "bytes", op->length - op->written);
+                result = positionalWrite(op->state->fd, _data(op) + op->written, op->length - op->written, op->offset + op->written);
+            }
+            _onComplete(op, result);
+        }
+    }
+};
+
+#ifdef TG_HAS_IO_URING
+
+/**
+ * @brief io_uring backend driven through the raw syscalls, so there is no liburing dependency.
+ * Submissions are serialized by a mutex; a single reaper thread waits on the completion queue.
+ */
+class IoUringBackend : public AsyncFileWriter::Backend {
+public:
+    using Callback = ThreadPoolBackend::Callback;
+    using DataFn = ThreadPoolBackend::DataFn;
+
+    IoUringBackend(unsigned queueDepth, const std::vector<void*>& buffers, size_t bufferSize, bool registerBuffers, Callback onComplete, DataFn data)
+        : _onComplete(std::move(onComplete)), _data(std::move(data)) {
+        io_uring_params params{};
+        // One extra entry for the shutdown NOP
+        _ringFd = static_cast<int>(syscall(__NR_io_uring_setup, queueDepth + 1, &params));
+        if(_ringFd < 0) {
+            throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+        }
+
+        _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if(singleMap) _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+
+        _sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+        _cqRing = singleMap ? _sqRing : mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING);
+        _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        _sqes = static_cast<io_uring_sqe*>(mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES));
+
+        if(_sqRing == MAP_FAILED || _cqRing == MAP_FAILED || _sqes == MAP_FAILED) {
+            int error = errno;
+            unmapRings();
+            close(_ringFd);
+            throw std::system_error(error, std::generic_category(), "io_uring mmap");
+        }
+
+        char* sq = static_cast<char*>(_sqRing);
+        _sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        _sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        _sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        char* cq = static_cast<char*>(_cqRing);
+        _cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        _cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        _cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        _cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        if(registerBuffers) {
+            std::vector<iovec> iovecs;
+            for(void* buffer : buffers) iovecs.push_back({buffer, bufferSize});
+            // Commonly fails under a low RLIMIT_MEMLOCK; plain writes still work
+            _fixedBuffers = syscall(__NR_io_uring_register, _ringFd, IORING_REGISTER_BUFFERS, iovecs.data(), static_cast<unsigned>(iovecs.size())) == 0;
+        }
+
+        _reaper = std::thread([this]() { reap(); });
+    }
+
+    ~IoUringBackend() override {
+        int error;
+        {
+            std::lock_guard<std::mutex> lock(_submitMutex);
+            io_uring_sqe* sqe = nextSqe();
+            sqe->opcode = IORING_OP_NOP;
+            sqe->user_data = 0;
+            error = tryPushSqe();
+        }
+        if(error != 0) {
+            // The reaper never sees the NOP and keeps waiting on the ring; leave both to process exit instead of throwing here
+            fprintf(stderr, "Failed to stop io_uring reaper: %s\n", std::strerror(error));
+            _reaper.detach();
+            return;
+        }
+        _reaper.join();
+
+        unmapRings();
+        close(_ringFd);
+    }
+
+    void submit(AsyncFileWriter::WriteOp* op) override {
+        std::lock_guard<std::mutex> lock(_submitMutex);
+
+        io_uring_sqe* sqe = nextSqe();
+        sqe->fd = op->state->fd;
+        sqe->off = op->offset + op->written;
+        sqe->user_data = reinterpret_cast<uint64_t>(op);
+
+        char* data = const_cast<char*>(_data(op)) + op->written;
+        size_t remaining = op->length - op->written;
+        if(_fixedBuffers) {
+            sqe->opcode = IORING_OP_WRITE_FIXED;
+            sqe->addr = reinterpret_cast<uint64_t>(data);
+            sqe->len = static_cast<uint32_t>(remaining);
+            sqe->buf_index = static_cast<uint16_t>(op->buffer);
+        } else {
+            op->iov = {data, remaining};
+            sqe->opcode = IORING_OP_WRITEV;
+            sqe->addr = reinterpret_cast<uint64_t>(&op->iov);
+            sqe->len = 1;
+        }
+
+        TG_TSAN_RELEASE(op);
+        pushSqe();
+    }
+
+    const char* name() const override { return _fixedBuffers ? "io_uring (registered buffers)" : "io_uring"; }
+
+private:
+    Callback _onComplete;
+    DataFn _data;
+
+    int _ringFd = -1;
+    void* _sqRing = MAP_FAILED;
+    void* _cqRing = MAP_FAILED;
+    size_t _sqRingSize = 0;
+    size_t _cqRingSize = 0;
+    io_uring_sqe* _sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t _sqesSize = 0;
+
+    unsigned* _sqTail;
+    unsigned _sqMask;
+    unsigned* _sqArray;
+    unsigned* _cqHead;
+    unsigned* _cqTail;
+    unsigned _cqMask;
+    io_uring_cqe* _cqes;
+
+    bool _fixedBuffers = false;
+    std::mutex _submitMutex;
+    std::thread _reaper;
+
+    void unmapRings() {
+        if(_sqes != MAP_FAILED) munmap(_sqes, _sqesSize);
+        if(_cqRing != MAP_FAILED && _cqRing != _sqRing) munmap(_cqRing, _cqRingSize);
+        if(_sqRing != MAP_FAILED) munmap(_sqRing, _sqRingSize);
+    }
+
+    // The kernel consumes every entry inside io_uring_enter, so the ring never fills up
+    io_uring_sqe* nextSqe() {
+        unsigned index = *_sqTail & _sqMask;
+        io_uring_sqe* sqe = &_sqes[index];
+        memset(sqe, 0, sizeof(io_uring_sqe));
+        _sqArray[index] = index;
+        return sqe;
+    }
+
+    /** @return 0 once the kernel has taken the entry, otherwise the errno io_uring_enter failed with */
+    int tryPushSqe() noexcept {
+        __atomic_store_n(_sqTail, *_sqTail + 1, __ATOMIC_RELEASE);
+        while(syscall(__NR_io_uring_enter, _ringFd, 1, 0, 0, nullptr, 0) < 0) {
+            if(errno != EINTR && errno != EAGAIN && errno != EBUSY) return errno;
+        }
+        return 0;
+    }
+
+    void pushSqe() {
+        int error = tryPushSqe();
+        if(error != 0) {
+            throw std::system_error(error, std::generic_category(), "io_uring_enter");
+        }
+    }
+
+    void reap() {
+        TG_TRACE_THREAD_NAME("io_uring reaper");
+
+        while(true) {
+            if(syscall(__NR_io_uring_enter, _ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) {
+                // Nothing sensible to do without a completion queue; surface it through the waiting writes
+                std::this_thread::yield();
+            }
+
+            unsigned head = *_cqHead;
+            unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+            bool stop = false;
+
+            while(head != tail) {
+                io_uring_cqe cqe = _cqes[head & _cqMask];
+                head++;
+                __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+
+                if(cqe.user_data == 0) {
+                    stop = true;
+                    continue;
+                }
+                auto* op = reinterpret_cast<AsyncFileWriter::WriteOp*>(cqe.user_data);
+                TG_TSAN_ACQUIRE(op);
+                _onComplete(op, cqe.res);
+            }
+
+            if(stop) return;
+        }
+    }
+};
+
+#endif // TG_HAS_IO_URING
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+AsyncFileWriter::AsyncFileWriter() : AsyncFileWriter(Options()) { }
+
+AsyncFileWriter::AsyncFileWriter(const Options& options) : _options(options) {
+#ifdef _WIN32
+    _alignment = 4096;
+#else
+    _alignment = std::max<size_t>(4096, static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+#endif
+    _options.queueDepth = std::max(1u, _options.queueDepth);
+    _options.bufferSize = std::max(_alignment, (_options.bufferSize + _alignment - 1) / _alignment * _alignment);
+
+    for(unsigned i = 0; i < _options.queueDepth; i++) {
+        _buffers.push_back(allocateAligned(_alignment, _options.bufferSize));
+        _freeBuffers.push_back(static_cast<int>(i));
+    }
+
+    auto onComplete = [this](WriteOp* op, int64_t result) { this->onComplete(op, result); };
+    auto data = [this](WriteOp* op) { return static_cast<const char*>(bufferData(op->buffer)); };
+
+#ifdef TG_HAS_IO_URING
+    if(!_options.forceFallback) {
+        try {
+            _backend = std::make_unique<IoUringBackend>(_options.queueDepth, _buffers, _options.bufferSize, _options.registerBuffers, onComplete, data);
+        } catch(const std::system_error&) {
+            // Kernel too old, or io_uring blocked by seccomp; use the portable path
+            _backend.reset();
+        }
+    }
+#endif
+
+    if(!_backend) {
+        _backend = std::make_unique<ThreadPoolBackend>(_options.fallbackThreads, onComplete, data);
+    }
+}
+
+AsyncFileWriter::~AsyncFileWriter() {
+    // Drain: every buffer returns to the free list once its write completes
+    {
+        std::unique_lock<std::mutex> lock(_bufferMutex);
+        _bufferAvailable.wait(lock, [this]() { return _freeBuffers.size() == _buffers.size(); });
+    }
+
+    _backend.reset();
+
+    for(void* buffer : _buffers) freeAligned(buffer);
+}
+
+static AsyncFileWriter::Options& sharedOptionsStorage() {
+    static AsyncFileWriter::Options options;
+    return options;
+}
+
+void AsyncFileWriter::configureShared(const Options& options) {
+    sharedOptionsStorage() = options;
+}
+
+const AsyncFileWriter::Options& AsyncFileWriter::sharedOptions() {
+    return sharedOptionsStorage();
+}
+
+AsyncFileWriter& AsyncFileWriter::shared() {
+    static AsyncFileWriter writer(sharedOptionsStorage());
+    return writer;
+}
+
+const char* AsyncFileWriter::backendName() const {
+    return _backend->name();
+}
+
+std::unique_ptr<AsyncFileWriter::File> AsyncFileWriter::open(const std::string& path) {
+    auto state = std::make_shared<FileState>();
+    state->path = path;
+
+#ifdef _WIN32
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_BINARY;
+    state->fd = ::_open(path.c_str(), flags, _S_IREAD | _S_IWRITE);
+#else
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    if(_options.directIO) {
+        state->fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+        state->directIO = state->fd >= 0;
+    }
+#endif
+    // tmpfs and some network filesystems reject O_DIRECT
+    if(state->fd < 0) {
+        state->fd = ::open(path.c_str(), flags, 0644);
+    }
+#if defined(__APPLE__)
+    if(_options.directIO && state->fd >= 0) {
+        fcntl(state->fd, F_NOCACHE, 1);
+    }
+#endif
+#endif
+
+    if(state->fd < 0) {
+        throw std::runtime_error("Failed to open file for writing: " + path);
+    }
+
+    return std::unique_ptr<File>(new File(*this, std::move(state)));
+}
+
+int AsyncFileWriter::acquireBuffer() {
+    std::unique_lock<std::mutex> lock(_bufferMutex);
+    if(_freeBuffers.empty()) {
+        TG_TRACE_SCOPE("wait for write buffer");
+        _bufferAvailable.wait(lock, [this]() { return !_freeBuffers.empty(); });
+    }
+    int index = _freeBuffers.back();
+    _freeBuffers.pop_back();
+    TG_TRACE_COUNTER("writes in flight", _buffers.size() - _freeBuffers.size());
+    return index;
+}
+
+void AsyncFileWriter::releaseBuffer(int index) {
+    {
+        std::lock_guard<std::mutex> lock(_bufferMutex);
+        _freeBuffers.push_back(index);
+        TG_TRACE_COUNTER("writes in flight", _buffers.size() - _freeBuffers.size());
+    }
+    _bufferAvailable.notify_all();
+}
+
+void AsyncFileWriter::submit(WriteOp* op) {
+    {
+        std::lock_guard<std::mutex> lock(op->state->mutex);
+        op->state->pending++;
+    }
+    _backend->submit(op);
+}
+
+void AsyncFileWriter::onComplete(WriteOp* op, int64_t result) {
+    std::shared_ptr<FileState> state = op->state;
+
+    if(result > 0 && op->written + static_cast<size_t>(result) < op->length) {
+        // Short write; send the remainder
+        op->written += static_cast<size_t>(result);
+        try {
+            _backend->submit(op);
+            return;
+        } catch(const std::system_error& e) {
+            // This runs on the backend's completion thread, where an exception would end the process; fail the file instead
+            result = -e.code().value();
+        }
+    }
+
+    bool finish = false;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if(result < 0 && state->error == 0) state->error = static_cast<int>(-result);
+        if(result == 0 && state->error == 0) state->error = EIO;
+        state->pending--;
+        finish = state->closing && state->pending == 0 && !state->finished;
+        if(finish) state->finished = true;
+    }
+
+    releaseBuffer(op->buffer);
+    delete op;
+
+    if(finish) finishFile(state);
+}
+
+void AsyncFileWriter::finishFile(const std::shared_ptr<FileState>& state) {
+    int error = state->error;
+
+#ifndef _WIN32
+    // A direct I/O tail is written as a whole block; cut the file back to its real length
+    if(error == 0 && state->directIO && state->offset != state->logicalSize) {
+        if(ftruncate(state->fd, static_cast<off_t>(state->logicalSize)) != 0) error = errno;
+    }
+    if(::close(state->fd) != 0 && error == 0) error = errno;
+#else
+    if(::_close(state->fd) != 0 && error == 0) error = errno;
+#endif
+    state->fd = -1;
+
+    if(error != 0) {
+        state->done.set_exception(std::make_exception_ptr(std::runtime_error("Failed to write " + state->path + ": " + std::strerror(error))));
+    } else {
+        state->done.set_value();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+AsyncFileWriter::File::File(AsyncFileWriter& writer, std::shared_ptr<FileState> state) : _writer(writer), _state(std::move(state)) { }
+
+AsyncFileWriter::File::~File() {
+    if(!_closed) {
+        try {
+            close();
+        } catch(const std::exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+        }
+    }
+}
+
+const std::string& AsyncFileWriter::File::path() const {
+    return _state->path;
+}
+
+void AsyncFileWriter::File::append(const void* data, size_t size) {
+    if(_closed) {
+        throw std::logic_error("Append to closed file: " + _state->path);
+    }
+
+    const char* bytes = static_cast<const char*>(data);
+    size_t bufferSize = _writer._options.bufferSize;
+
+    while(size > 0) {
+        if(_currentBuffer < 0) {
+            _currentBuffer = _writer.acquireBuffer();
+            _currentFill = 0;
+        }
+
+        size_t count = std::min(size, bufferSize - _currentFill);
+        memcpy(static_cast<char*>(_writer.bufferData(_currentBuffer)) + _currentFill, bytes, count);
+        _currentFill += count;
+        bytes += count;
+        size -= count;
+
+        if(_currentFill == bufferSize) submitCurrentBuffer();
+    }
+}
+
+void AsyncFileWriter::File::submitCurrentBuffer() {
+    size_t length = _currentFill;
+    _state->logicalSize = _state->offset + _currentFill;
+
+    if(_state->directIO) {
+        // O_DIRECT needs block-aligned lengths; only the final tail is ever padded
+        size_t alignment = _writer._alignment;
+        size_t padded = (length + alignment - 1) / alignment * alignment;
+        memset(static_cast<char*>(_writer.bufferData(_currentBuffer)) + length, 0, padded - length);
+        length = padded;
+    }
+
+    auto* op = new WriteOp;
+    op->state = _state;
+    op->buffer = _currentBuffer;
+    op->offset = _state->offset;
+    op->length = length;
+    _state->offset += length;
+
+    _currentBuffer = -1;
+    _currentFill = 0;
+
+    _writer.submit(op);
+}
+
+std::future<void> AsyncFileWriter::File::closeAsync() {
+    if(_closed) {
+        throw std::logic_error("File already closed: " + _state->path);
+    }
+    _closed = true;
+
+    if(_currentBuffer >= 0) {
+        if(_currentFill > 0) {
+            submitCurrentBuffer();
+        } else {
+            _writer.releaseBuffer(_currentBuffer);
+            _currentBuffer = -1;
+        }
+    }
+
+    std::future<void> future = _state->done.get_future();
+
+    bool finish = false;
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        _state->closing = true;
+        finish = _state->pending == 0 && !_state->finished;
+        if(finish) _state->finished = true;
+    }
+    if(finish) _writer.finishFile(_state);
+
+    return future;
+}
+
+void AsyncFileWriter::File::close() {
+    closeAsync().get();
+}
+
+} // namespace tg
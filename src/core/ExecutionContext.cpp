@@ -0,0 +1,23 @@
+#include "tg/ExecutionContext.hpp"
+
+namespace tg {
+
+ProgressReporter::ProgressReporter(const ExecutionContext& context, const char* stage, size_t total)
+    : _context(context), _stage(stage), _total(total) {
+    advance(0);
+}
+
+void ProgressReporter::advance(size_t units) {
+    if(!_context.onProgress) return;
+
+    size_t done = _done.fetch_add(units, std::memory_order_relaxed) + units;
+    int perMille = _total == 0 ? 1000 : static_cast<int>(std::min(done, _total) * 1000 / _total);
+    if(perMille <= _reported.load(std::memory_order_relaxed)) return;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(perMille <= _reported.load(std::memory_order_relaxed)) return;
+    _reported.store(perMille, std::memory_order_relaxed);
+    _context.onProgress(_stage, perMille / 1000.0f);
+}
+
+} // namespace tg
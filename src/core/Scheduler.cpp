@@ -0,0 +1,227 @@
+#include "tg/Scheduler.hpp"
+#include "tg/trace.hpp"
+
+#include <cstdio>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace tg {
+
+static thread_local Scheduler* currentScheduler = nullptr;
+static thread_local int currentWorker = -1;
+
+static std::mutex sharedMutex;
+static std::atomic<Scheduler*> sharedScheduler{nullptr};
+static SchedulerOptions sharedOptions;
+
+Scheduler::Scheduler(const SchedulerOptions& options) : _options(options) {
+    unsigned threads = _options.threads > 0 ? _options.threads : std::max(1u, std::thread::hardware_concurrency());
+
+    // The thread waiting on the work takes part in it, so one thread fewer is started
+    unsigned numWorkers = threads - 1;
+    for(unsigned i = 0; i < numWorkers; i++) {
+        _queues.push_back(std::make_unique<WorkerQueue>());
+    }
+
+    // Node by node, so consecutive workers share a node and every node gets its share of them
+    const std::vector<NumaNode>& nodes = numaNodes();
+    std::vector<std::pair<int, int>> cpus; // (cpu, node index)
+    for(size_t node = 0; node < nodes.size(); node++) {
+        for(int cpu : nodes[node].cpus) cpus.emplace_back(cpu, static_cast<int>(node));
+    }
+
+    bool numaLocal = _options.numa == NumaPlacement::Local && nodes.size() > 1 && numWorkers > 0;
+    _workerNodes.assign(numWorkers, 0);
+    if(numaLocal) {
+        _nodeWorkersBefore.assign(nodes.size() + 1, 0);
+        for(unsigned i = 0; i < numWorkers; i++) {
+            _workerNodes[i] = cpus[(i + 1) % cpus.size()].second;
+            _nodeWorkersBefore[_workerNodes[i] + 1]++;
+        }
+        for(size_t node = 0; node < nodes.size(); node++) {
+            _nodeQueues.push_back(std::make_unique<WorkerQueue>());
+            _nodeWorkersBefore[node + 1] += _nodeWorkersBefore[node];
+        }
+    }
+
+    for(unsigned i = 0; i < numWorkers; i++) {
+        _workers.emplace_back([this, i]() { worker(static_cast<int>(i)); });
+    }
+
+#ifdef __linux__
+    if(_options.pinThreads || numaLocal) {
+        for(size_t i = 0; i < _workers.size() && !cpus.empty(); i++) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[(i + 1) % cpus.size()].first, &set);
+            if(pthread_setaffinity_np(_workers[i].native_handle(), sizeof(set), &set) != 0) {
+                fprintf(stderr, "Failed to pin scheduler worker %zu\n", i);
+            }
+        }
+    }
+#endif
+}
+
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+        _stopping = true;
+    }
+    _wake.notify_all();
+
+    for(auto& thread : _workers) thread.join();
+}
+
+Scheduler& Scheduler::shared() {
+    Scheduler* scheduler = sharedScheduler.load(std::memory_order_acquire);
+    if(scheduler) return *scheduler;
+
+    std::lock_guard<std::mutex> lock(sharedMutex);
+    scheduler = sharedScheduler.load(std::memory_order_relaxed);
+    if(!scheduler) {
+        // Never destroyed: workers may still be parked when static destructors run
+        scheduler = new Scheduler(sharedOptions);
+        sharedScheduler.store(scheduler, std::memory_order_release);
+    }
+    return *scheduler;
+}
+
+void configureScheduler(const SchedulerOptions& options) {
+    std::lock_guard<std::mutex> lock(sharedMutex);
+    sharedOptions = options;
+    delete sharedScheduler.exchange(nullptr, std::memory_order_acq_rel);
+}
+
+SchedulerOptions schedulerOptions() {
+    std::lock_guard<std::mutex> lock(sharedMutex);
+    return sharedOptions;
+}
+
+std::pair<size_t, size_t> Scheduler::nodeBand(size_t node, size_t begin, size_t end) const {
+    if(_nodeQueues.empty()) return {begin, end};
+
+    size_t count = end - begin;
+    size_t total = _nodeWorkersBefore.back();
+    return {begin + count * _nodeWorkersBefore[node] / total, begin + count * _nodeWorkersBefore[node + 1] / total};
+}
+
+void Scheduler::spawn(std::function<void()> task, int node) {
+    WorkerQueue& queue = node >= 0 && static_cast<size_t>(node) < _nodeQueues.size() ? *_nodeQueues[node]
+                       : currentScheduler == this ? *_queues[currentWorker] : _injected;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    _queued.fetch_add(1, std::memory_order_release);
+
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+    }
+    _wake.notify_one();
+}
+
+bool Scheduler::tryTake(WorkerQueue& queue, bool newest, std::function<void()>& task) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if(queue.tasks.empty()) return false;
+    if(newest) {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+    } else {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+    }
+    return true;
+}
+
+bool Scheduler::tryRunTask(int self) {
+    if(_queued.load(std::memory_order_acquire) == 0) return false;
+
+    std::function<void()> task;
+    int node = self >= 0 ? _workerNodes[self] : -1;
+
+    // Own tasks newest first, as they are the most likely to still be in cache; everything else oldest first.
+    // Work meant for this node comes before shared work, work meant for other nodes only when nothing else is left.
+    bool found = (self >= 0 && tryTake(*_queues[self], true, task))
+              || (node >= 0 && !_nodeQueues.empty() && tryTake(*_nodeQueues[node], false, task))
+              || tryTake(_injected, false, task);
+
+    for(int pass = 0; pass < 2 && !found; pass++) {
+        for(size_t i = 0; !found && i < _queues.size(); i++) {
+            size_t victim = (static_cast<size_t>(self + 1) + i) % _queues.size();
+            if(static_cast<int>(victim) == self || (_workerNodes[victim] == node) != (pass == 0)) continue;
+            found = tryTake(*_queues[victim], false, task);
+        }
+    }
+
+    for(size_t i = 0; !found && i < _nodeQueues.size(); i++) {
+        if(static_cast<int>(i) != node) found = tryTake(*_nodeQueues[i], false, task);
+    }
+
+    if(!found) return false;
+    _queued.fetch_sub(1, std::memory_order_relaxed);
+    task();
+    return true;
+}
+
+void Scheduler::helpUntil(const std::function<bool()>& done) {
+    int self = currentScheduler == this ? currentWorker : -1;
+
+    while(!done()) {
+        if(tryRunTask(self)) continue;
+
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _wake.wait(lock, [&]() { return _queued.load(std::memory_order_acquire) > 0 || done(); });
+    }
+}
+
+void Scheduler::notifyProgress() {
+    {
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+    }
+    _wake.notify_all();
+}
+
+void Scheduler::worker(int index) {
+    TG_TRACE_THREAD_NAME("scheduler worker");
+    currentScheduler = this;
+    currentWorker = index;
+
+    while(true) {
+        if(tryRunTask(index)) continue;
+
+        std::unique_lock<std::mutex> lock(_sleepMutex);
+        _wake.wait(lock, [this]() { return _stopping.load() || _queued.load(std::memory_order_acquire) > 0; });
+        if(_stopping.load() && _queued.load(std::memory_order_acquire) == 0) return;
+    }
+}
+
+TaskGroup::~TaskGroup() {
+    if(_pending.load(std::memory_order_acquire) > 0) {
+        _scheduler.helpUntil([this]() { return _pending.load(std::memory_order_acquire) == 0; });
+    }
+}
+
+void TaskGroup::wait() {
+    _scheduler.helpUntil([this]() { return _pending.load(std::memory_order_acquire) == 0; });
+
+    std::lock_guard<std::mutex> lock(_errorMutex);
+    if(_error) {
+        std::exception_ptr error = _error;
+        _error = nullptr;
+        std::rethrow_exception(error);
+    }
+    _token.throwIfCancelled();
+}
+
+void TaskGroup::recordError(std::exception_ptr error) {
+    {
+        std::lock_guard<std::mutex> lock(_errorMutex);
+        if(!_error) _error = error;
+    }
+    _failed.store(true, std::memory_order_relaxed);
+}
+
+} // namespace tg
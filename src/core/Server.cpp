@@ -0,0 +1,617 @@
+#include "tg/Server.hpp"
+#include "tg/cache.hpp"
+#include "tg/job.hpp"
+#include "tg/memory.hpp"
+#include "tg/trace.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace tg {
+
+static constexpr size_t MAX_REQUEST_BYTES = 1 << 20;
+static constexpr size_t LATENCY_SAMPLES = 4096;
+static constexpr size_t MAX_QUEUED_LINES = 256;   // per connection
+static constexpr size_t MAX_QUEUED_PROGRESS = 64; // progress lines are dropped while more lines than this are unsent
+static constexpr int WRITE_TIMEOUT_MS = 30000;    // a client that reads nothing for this long is disconnected
+
+#ifndef _WIN32
+
+namespace {
+
+// Lines waiting for a connection's writer thread, so workers and readers never block on a slow client
+struct Outbox {
+    int fd;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::string> lines;
+    bool closed = false; // no more lines will be queued; the writer exits once the rest are sent
+    bool failed = false; // the client went away or stopped reading; queued and later lines are dropped
+
+    explicit Outbox(int fd) : fd(fd) { }
+    ~Outbox() { close(fd); }
+};
+
+} // namespace
+
+// Writes one line; false once the client has gone away or has not read anything for WRITE_TIMEOUT_MS
+static bool sendLine(int fd, const std::string& message) {
+#ifdef MSG_NOSIGNAL
+    constexpr int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else
+    constexpr int flags = MSG_DONTWAIT;
+#endif
+    size_t sent = 0;
+    while(sent < message.size()) {
+        ssize_t result = ::send(fd, message.data() + sent, message.size() - sent, flags);
+        if(result > 0) {
+            sent += static_cast<size_t>(result);
+            continue;
+        }
+        if(result < 0 && errno == EINTR) continue;
+        if(result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            pollfd writable{fd, POLLOUT, 0};
+            int ready = poll(&writable, 1, WRITE_TIMEOUT_MS);
+            if(ready > 0 || (ready < 0 && errno == EINTR)) continue;
+        }
+        return false;
+    }
+    return true;
+}
+
+static void writeLines(Outbox& outbox) {
+    TG_TRACE_THREAD_NAME("server writer");
+
+    std::unique_lock<std::mutex> lock(outbox.mutex);
+    while(true) {
+        outbox.changed.wait(lock, [&]() { return !outbox.lines.empty() || outbox.closed; });
+        if(outbox.lines.empty()) return;
+
+        std::string line = std::move(outbox.lines.front());
+        outbox.lines.pop_front();
+        outbox.changed.notify_all();
+
+        lock.unlock();
+        bool sent = sendLine(outbox.fd, line);
+        lock.lock();
+
+        if(!sent && !outbox.failed) {
+            // Also ends the connection's reader, so a client that stops reading cannot keep queueing requests
+            outbox.failed = true;
+            outbox.lines.clear();
+            shutdown(outbox.fd, SHUT_RDWR);
+            outbox.changed.notify_all();
+        }
+    }
+}
+
+struct Server::Connection {
+    int fd;
+    std::shared_ptr<Outbox> outbox;
+
+    explicit Connection(std::shared_ptr<Outbox> outbox) : fd(outbox->fd), outbox(std::move(outbox)) { }
+
+    ~Connection() {
+        {
+            std::lock_guard<std::mutex> lock(outbox->mutex);
+            outbox->closed = true;
+        }
+        outbox->changed.notify_all();
+    }
+
+    // One response per line; a client that went away just stops receiving
+    void send(const std::string& line) {
+        {
+            std::lock_guard<std::mutex> lock(outbox->mutex);
+            if(outbox->failed) return;
+            outbox->lines.push_back(line + "\n");
+        }
+        outbox->changed.notify_all();
+    }
+
+    // Progress is only worth sending while the client keeps up; called from scheduler workers, so it never waits
+    void sendProgress(const std::string& line) {
+        {
+            std::lock_guard<std::mutex> lock(outbox->mutex);
+            if(outbox->failed || outbox->lines.size() >= MAX_QUEUED_PROGRESS) return;
+            outbox->lines.push_back(line + "\n");
+        }
+        outbox->changed.notify_all();
+    }
+
+    // The reader stops taking requests while the client leaves this many responses unread
+    void waitForRoom() {
+        std::unique_lock<std::mutex> lock(outbox->mutex);
+        outbox->changed.wait(lock, [this]() { return outbox->lines.size() < MAX_QUEUED_LINES || outbox->failed; });
+    }
+};
+
+static std::string idJson(const JsonValue* id) {
+    if(id == nullptr || id->isNull()) return "null";
+    if(id->type() == JsonValue::Type::Number) return id->asString();
+    if(id->type() == JsonValue::Type::String) return jsonQuote(id->asString());
+    throw std::invalid_argument("Request id must be a string or number");
+}
+
+static std::string errorResponse(const std::string& id, const std::string& message) {
+    return "{\"id\":" + id + ",\"status\":\"error\",\"error\":" + jsonQuote(message) + "}";
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+Server::Server(const ServerOptions& options)
+    : _options(options), _pool(options.workers) {
+    if(_options.socketPath.empty()) {
+        throw std::invalid_argument("Server needs a socket path");
+    }
+    if(_options.socketPath.size() >= sizeof(sockaddr_un::sun_path)) {
+        throw std::invalid_argument("Socket path is too long: " + _options.socketPath);
+    }
+}
+
+Server::~Server() {
+    if(_listenFd >= 0) close(_listenFd);
+
+    std::lock_guard<std::mutex> lock(_shmMutex);
+    for(const std::string& name : _sharedMemory) shm_unlink(name.c_str());
+}
+
+void Server::openSocket() {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, _options.socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    // A socket file left by a crashed server is removed; one with a live server behind it is not
+    struct stat info;
+    if(lstat(_options.socketPath.c_str(), &info) == 0) {
+        if(!S_ISSOCK(info.st_mode)) {
+            throw std::runtime_error("Socket path exists and is not a socket: " + _options.socketPath);
+        }
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool live = probe >= 0 && connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+        if(probe >= 0) close(probe);
+        if(live) {
+            throw std::runtime_error("Another server is already listening on " + _options.socketPath);
+        }
+        unlink(_options.socketPath.c_str());
+    }
+
+    _listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(_listenFd < 0) {
+        throw std::system_error(errno, std::generic_category(), "socket");
+    }
+    fcntl(_listenFd, F_SETFD, FD_CLOEXEC);
+
+    if(bind(_listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        throw std::system_error(errno, std::generic_category(), "bind " + _options.socketPath);
+    }
+    // Before listen(), so nobody can connect while the file still has the umask's permissions
+    if(chmod(_options.socketPath.c_str(), static_cast<mode_t>(_options.socketMode)) < 0) {
+        throw std::system_error(errno, std::generic_category(), "chmod " + _options.socketPath);
+    }
+    if(listen(_listenFd, 64) < 0) {
+        throw std::system_error(errno, std::generic_category(), "listen");
+    }
+}
+
+void Server::run() {
+    openSocket();
+    _startTime = std::chrono::steady_clock::now();
+
+    fprintf(stdout, "Listening on %s with %u workers\n", _options.socketPath.c_str(), _pool.size());
+    fflush(stdout);
+
+    // Poll with a timeout so stop() from a signal handler is noticed without any wakeup mechanism
+    while(!_stopping.load()) {
+        pollfd listener{_listenFd, POLLIN, 0};
+        int ready = poll(&listener, 1, 200);
+        if(ready < 0 && errno != EINTR) {
+            throw std::system_error(errno, std::generic_category(), "poll");
+        }
+        if(ready <= 0) continue;
+
+        int fd = accept(_listenFd, nullptr, nullptr);
+        if(fd < 0) continue;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+        int enable = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+
+        auto outbox = std::make_shared<Outbox>(fd);
+        auto connection = std::make_shared<Connection>(outbox);
+        {
+            std::lock_guard<std::mutex> lock(_connectionsMutex);
+            std::erase_if(_connections, [](const std::weak_ptr<Connection>& weak) { return weak.expired(); });
+            _connections.push_back(connection);
+        }
+        {
+            std::lock_guard<std::mutex> lock(_activityMutex);
+            _readers++;
+            _writers++;
+        }
+        std::thread(&Server::serveConnection, this, std::move(connection)).detach();
+        std::thread([this, outbox]() {
+            writeLines(*outbox);
+            {
+                // Notified under the lock: once it is released run() may return and the server be destroyed
+                std::lock_guard<std::mutex> lock(_activityMutex);
+                _writers--;
+                _activityDone.notify_all();
+            }
+        }).detach();
+    }
+
+    close(_listenFd);
+    _listenFd = -1;
+    unlink(_options.socketPath.c_str());
+
+    // Stop reading new requests but keep connections writable so accepted jobs still get their responses
+    {
+        std::lock_guard<std::mutex> lock(_connectionsMutex);
+        for(auto& weak : _connections) {
+            if(auto connection = weak.lock()) shutdown(connection->fd, SHUT_RD);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(_activityMutex);
+    _activityDone.wait(lock, [this]() { return _queued == 0 && _running == 0 && _readers == 0 && _writers == 0; });
+}
+
+void Server::serveConnection(std::shared_ptr<Connection> connection) {
+    TG_TRACE_THREAD_NAME("server connection");
+
+    std::string pending;
+    char buffer[64 * 1024];
+
+    while(true) {
+        connection->waitForRoom();
+        ssize_t received = recv(connection->fd, buffer, sizeof(buffer), 0);
+        if(received < 0 && errno == EINTR) continue;
+        if(received <= 0) break;
+
+        pending.append(buffer, static_cast<size_t>(received));
+
+        size_t lineStart = 0;
+        size_t newline;
+        while((newline = pending.find('\n', lineStart)) != std::string::npos) {
+            std::string line = pending.substr(lineStart, newline - lineStart);
+            lineStart = newline + 1;
+            if(!line.empty() && line.back() == '\r') line.pop_back();
+            if(!line.empty()) handleRequest(connection, line);
+        }
+        pending.erase(0, lineStart);
+
+        if(pending.size() > MAX_REQUEST_BYTES) {
+            connection->send(errorResponse("null", "Request exceeds " + std::to_string(MAX_REQUEST_BYTES) + " bytes"));
+            break;
+        }
+    }
+
+    // Jobs still holding the connection keep it open until their responses are sent
+    connection.reset();
+
+    {
+        std::lock_guard<std::mutex> lock(_activityMutex);
+        _readers--;
+        _activityDone.notify_all();
+    }
+}
+
+void Server::handleRequest(const std::shared_ptr<Connection>& connection, const std::string& line) {
+    std::string id = "null";
+    try {
+        JsonValue request = JsonValue::parse(line);
+        if(request.type() != JsonValue::Type::Object) {
+            throw std::invalid_argument("Request must be a JSON object");
+        }
+        id = idJson(request.find("id"));
+
+        const JsonValue* op = request.find("op");
+        std::string operation = op ? op->asString() : "generate";
+
+        if(operation == "generate") {
+            submitJob(connection, request, id);
+        } else if(operation == "cancel") {
+            cancelJob(connection, request);
+            connection->send("{\"id\":" + id + ",\"status\":\"ok\"}");
+        } else if(operation == "stats") {
+            connection->send("{\"id\":" + id + ",\"status\":\"ok\"," + statsJson() + "}");
+        } else if(operation == "release") {
+            const JsonValue* name = request.find("shm");
+            if(name == nullptr) throw std::invalid_argument("release needs \"shm\"");
+            releaseSharedMemory(name->asString());
+            connection->send("{\"id\":" + id + ",\"status\":\"ok\"}");
+        } else if(operation == "ping") {
+            connection->send("{\"id\":" + id + ",\"status\":\"ok\"}");
+        } else if(operation == "shutdown") {
+            connection->send("{\"id\":" + id + ",\"status\":\"ok\"}");
+            stop();
+        } else {
+            throw std::invalid_argument("Unknown op: " + operation);
+        }
+    } catch(const std::exception& e) {
+        connection->send(errorResponse(id, e.what()));
+    }
+}
+
+void Server::submitJob(const std::shared_ptr<Connection>& connection, const JsonValue& request, const std::string& id) {
+    const JsonValue* job = request.find("job");
+    if(job == nullptr) throw std::invalid_argument("generate needs \"job\"");
+
+    JobSpec spec = parseJobObject(*job);
+    for(std::string& output : spec.outputs) output = resolvePath(output);
+    if(!spec.thermalCheckpoint.path.empty()) spec.thermalCheckpoint.path = resolvePath(spec.thermalCheckpoint.path);
+
+    const JsonValue* result = request.find("result");
+    bool sharedMemory = result != nullptr && result->asString() == "shm";
+    if(result != nullptr && !sharedMemory && result->asString() != "file") {
+        throw std::invalid_argument("result must be \"file\" or \"shm\"");
+    }
+    if(!sharedMemory && spec.outputs.empty()) {
+        throw std::invalid_argument("File results need at least one output");
+    }
+
+    ExecutionContext context;
+    if(const JsonValue* threads = request.find("threads")) {
+        if(threads->asNumber() < 1) throw std::invalid_argument("threads must be at least 1");
+        context.threads = static_cast<unsigned>(threads->asNumber());
+    }
+    if(const JsonValue* progress = request.find("progress"); progress != nullptr && progress->asBool()) {
+        // Whole percent steps are plenty for a client and keep the socket quiet during long thermal runs
+        auto last = std::make_shared<std::pair<std::string, int>>("", -1);
+        context.onProgress = [connection, id, last](const char* stage, float fraction) {
+            int percent = static_cast<int>(fraction * 100.0f);
+            if(last->first == stage && last->second == percent) return;
+            *last = {stage, percent};
+            std::ostringstream out;
+            out << "{\"id\":" << id << ",\"status\":\"progress\",\"stage\":" << jsonQuote(stage) << ",\"fraction\":" << percent / 100.0 << "}";
+            connection->sendProgress(out.str());
+        };
+    }
+
+    if(_options.memoryLimit > 0) {
+        MemoryEstimate estimate = estimateJobMemory(spec);
+        if(estimate.peakBytes > _options.memoryLimit) {
+            _rejected++;
+            throw std::runtime_error("Job needs an estimated " + std::to_string(estimate.peakBytes >> 20) + " MiB, over the "
+                                   + std::to_string(_options.memoryLimit >> 20) + " MiB limit");
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_activityMutex);
+        if(_queued >= _options.maxQueued) {
+            _rejected++;
+            throw std::runtime_error("Server busy: " + std::to_string(_queued) + " jobs queued");
+        }
+        _queued++;
+    }
+
+    std::pair<const Connection*, std::string> jobKey(connection.get(), id);
+    if(id != "null") {
+        std::lock_guard<std::mutex> lock(_jobsMutex);
+        if(!_jobs.emplace(jobKey, context.cancel).second) {
+            {
+                std::lock_guard<std::mutex> activityLock(_activityMutex);
+                _queued--;
+            }
+            _rejected++;
+            throw std::invalid_argument("A job with id " + id + " is already queued or running");
+        }
+    }
+
+    auto enqueued = std::chrono::steady_clock::now();
+
+    _pool.submit([this, connection, spec, sharedMemory, id, jobKey, context, enqueued]() {
+        {
+            std::lock_guard<std::mutex> lock(_activityMutex);
+            _queued--;
+            _running++;
+        }
+        recordLatency("queue", secondsSince(enqueued));
+
+        std::string response;
+        try {
+            // A request without a seed gets a random one, reported back in the response
+            JobSpec job = spec;
+            JobTimings timings;
+            Heightmap heightmap = generateJobHeightmap(job, &timings, _options.cache, context);
+            context.cancel.throwIfCancelled();
+            writeJobOutputs(job, heightmap, &timings);
+
+            recordLatency("generate", timings.generateSeconds);
+            if(job.thermal) recordLatency("filter", timings.filterSeconds);
+            if(!job.outputs.empty()) recordLatency("export", timings.exportSeconds);
+
+            std::ostringstream out;
+            out << "{\"id\":" << id << ",\"status\":\"ok\",\"seed\":" << *job.seed
+                << ",\"width\":" << heightmap.width << ",\"height\":" << heightmap.height << ",\"outputs\":[";
+            for(size_t i = 0; i < job.outputs.size(); i++) {
+                out << (i == 0 ? "" : ",") << jsonQuote(job.outputs[i]);
+            }
+            out << "]";
+
+            if(sharedMemory) {
+                size_t bytes = heightmap.data.size() * sizeof(uint16_t);
+                out << ",\"shm\":{\"name\":" << jsonQuote(exportSharedMemory(heightmap.data.data(), bytes))
+                    << ",\"bytes\":" << bytes << ",\"format\":\"r16\"}";
+            }
+
+            double total = secondsSince(enqueued);
+            recordLatency("total", total);
+            out << ",\"seconds\":" << total << "}";
+            response = out.str();
+            _completed++;
+        } catch(const OperationCancelled& e) {
+            response = errorResponse(id, e.what());
+            _cancelled++;
+        } catch(const std::exception& e) {
+            response = errorResponse(id, e.what());
+            _failed++;
+        }
+
+        if(id != "null") {
+            std::lock_guard<std::mutex> lock(_jobsMutex);
+            _jobs.erase(jobKey);
+        }
+        connection->send(response);
+
+        {
+            std::lock_guard<std::mutex> lock(_activityMutex);
+            _running--;
+            _activityDone.notify_all();
+        }
+    });
+}
+
+void Server::cancelJob(const std::shared_ptr<Connection>& connection, const JsonValue& request) {
+    std::string target = idJson(request.find("target"));
+    if(target == "null") throw std::invalid_argument("cancel needs \"target\"");
+
+    // The job stops at its next check and answers its own request with an error
+    std::lock_guard<std::mutex> lock(_jobsMutex);
+    auto job = _jobs.find({connection.get(), target});
+    if(job == _jobs.end()) throw std::invalid_argument("No queued or running job with id " + target);
+    job->second.cancel();
+}
+
+std::string Server::resolvePath(const std::string& path) const {
+    std::filesystem::path relative(path);
+    if(relative.empty() || relative.has_root_path()) {
+        throw std::invalid_argument("Paths must be relative to the server's output root: " + path);
+    }
+    for(const std::filesystem::path& part : relative) {
+        if(part == "..") throw std::invalid_argument("Paths cannot leave the server's output root: " + path);
+    }
+    return _options.outputRoot.empty() ? path : (std::filesystem::path(_options.outputRoot) / relative).string();
+}
+
+std::string Server::exportSharedMemory(const void* data, size_t size) {
+    std::string name;
+    {
+        std::lock_guard<std::mutex> lock(_shmMutex);
+        name = "/terrainGen-" + std::to_string(getpid()) + "-" + std::to_string(_nextSharedMemory++);
+    }
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "shm_open " + name);
+    }
+
+    void* mapped = MAP_FAILED;
+    if(ftruncate(fd, static_cast<off_t>(size)) == 0 && size > 0) {
+        mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    int error = errno;
+    close(fd);
+
+    if(size > 0 && mapped == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::system_error(error, std::generic_category(), "Failed to map shared memory " + name);
+    }
+    if(size > 0) {
+        memcpy(mapped, data, size);
+        munmap(mapped, size);
+    }
+
+    std::lock_guard<std::mutex> lock(_shmMutex);
+    _sharedMemory.insert(name);
+    return name;
+}
+
+void Server::releaseSharedMemory(const std::string& name) {
+    std::lock_guard<std::mutex> lock(_shmMutex);
+    if(_sharedMemory.erase(name) == 0) {
+        throw std::invalid_argument("Unknown shared memory result: " + name);
+    }
+    shm_unlink(name.c_str());
+}
+
+void Server::recordLatency(const char* stage, double seconds) {
+    std::lock_guard<std::mutex> lock(_statsMutex);
+    StageSamples& samples = _stages[stage];
+    if(samples.seconds.size() < LATENCY_SAMPLES) {
+        samples.seconds.push_back(seconds);
+    } else {
+        samples.seconds[samples.next] = seconds;
+    }
+    samples.next = (samples.next + 1) % LATENCY_SAMPLES;
+    samples.count++;
+}
+
+std::string Server::statsJson() {
+    std::ostringstream out;
+    {
+        std::lock_guard<std::mutex> lock(_activityMutex);
+        out << "\"queueDepth\":" << _queued << ",\"running\":" << _running;
+    }
+    out << ",\"workers\":" << _pool.size() << ",\"maxQueued\":" << _options.maxQueued
+        << ",\"completed\":" << _completed << ",\"failed\":" << _failed << ",\"rejected\":" << _rejected
+        << ",\"cancelled\":" << _cancelled
+        << ",\"uptimeSeconds\":" << secondsSince(_startTime);
+
+    if(_options.cache != nullptr) {
+        out << ",\"cache\":{\"hits\":" << _options.cache->hits() << ",\"misses\":" << _options.cache->misses()
+            << ",\"bytes\":" << _options.cache->sizeBytes() << ",\"maxBytes\":" << _options.cache->maxBytes() << "}";
+    }
+
+    if(memory::compiledIn) {
+        out << ",\"memory\":{\"currentBytes\":" << memory::currentBytes() << ",\"peakBytes\":" << memory::peakBytes() << "}";
+    }
+
+    // Percentiles over the most recent LATENCY_SAMPLES runs of each stage, in milliseconds
+    out << ",\"stages\":{";
+    std::lock_guard<std::mutex> lock(_statsMutex);
+    bool first = true;
+    for(const auto& [name, samples] : _stages) {
+        std::vector<double> sorted = samples.seconds;
+        std::sort(sorted.begin(), sorted.end());
+        auto percentile = [&sorted](double p) {
+            size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+            return sorted[index] * 1e3;
+        };
+
+        out << (first ? "" : ",") << jsonQuote(name) << ":{\"count\":" << samples.count
+            << ",\"p50Ms\":" << percentile(0.50) << ",\"p90Ms\":" << percentile(0.90)
+            << ",\"p99Ms\":" << percentile(0.99) << ",\"maxMs\":" << sorted.back() * 1e3 << "}";
+        first = false;
+    }
+    out << "}";
+    return out.str();
+}
+
+#else
+
+struct Server::Connection { };
+
+Server::Server(const ServerOptions& options) : _options(options), _pool(1) {
+    throw std::runtime_error("The generation server needs Unix domain sockets and is not available on this platform");
+}
+
+Server::~Server() = default;
+
+void Server::run() { }
+
+#endif
+
+} // namespace tg
@@ -0,0 +1,53 @@
+#include "tg/ThreadPool.hpp"
+#include "tg/trace.hpp"
+
+namespace tg {
+
+ThreadPool::ThreadPool(unsigned numThreads) {
+    if(numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    for(unsigned i = 0; i < numThreads; i++) {
+        _threads.emplace_back([this]() { worker(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _cv.notify_all();
+
+    for(auto& thread : _threads) thread.join();
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.push_back(std::move(task));
+    }
+    _cv.notify_one();
+}
+
+void ThreadPool::worker() {
+    TG_TRACE_THREAD_NAME("pool worker");
+
+    while(true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+            if(_queue.empty()) return;
+            task = std::move(_queue.front());
+            _queue.pop_front();
+        }
+        task();
+    }
+}
+
+} // namespace tg
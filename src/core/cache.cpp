@@ -0,0 +1,235 @@
+#include "tg/cache.hpp"
+#include "tg/snapshot.hpp"
+#include "tg/trace.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/locking.h>
+#include <sys/stat.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace tg {
+
+namespace fs = std::filesystem;
+
+static constexpr const char* CACHE_EXTENSION = ".tgc";
+static constexpr const char* LOCK_FILE = "lock";
+
+static uint64_t hashText(uint64_t hash, const std::string& text) {
+    // FNV-1a; the separator keeps ("ab", "c") and ("a", "bc") apart
+    for(unsigned char ch : text) {
+        hash ^= ch;
+        hash *= 1099511628211ull;
+    }
+    hash ^= 0xff;
+    hash *= 1099511628211ull;
+    return hash;
+}
+
+CacheKey makeCacheKey(const std::string& stage, const std::string& parameters, const CacheKey* input) {
+    uint64_t hash = 14695981039346656037ull;
+    hash = hashText(hash, std::to_string(algorithmVersion));
+    hash = hashText(hash, stage);
+    hash = hashText(hash, parameters);
+    if(input != nullptr) {
+        hash = hashText(hash, input->stage);
+        hash = hashText(hash, std::to_string(input->hash));
+    }
+    return {stage, hash};
+}
+
+namespace {
+
+// Held while the directory is scanned and trimmed, so processes sharing it do not evict on top of each other. Loads and
+// stores need no lock: entries appear by rename, and a reader keeps its mapping of an entry removed under it.
+class DirectoryLock {
+public:
+    explicit DirectoryLock(const fs::path& directory) {
+        std::string path = (directory / LOCK_FILE).string();
+#ifdef _WIN32
+        _fd = _open(path.c_str(), _O_RDWR | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+        _locked = _fd >= 0 && _locking(_fd, _LK_LOCK, 1) == 0;
+#else
+        _fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        while(_fd >= 0 && !_locked) {
+            _locked = flock(_fd, LOCK_EX) == 0;
+            if(!_locked && errno != EINTR) break;
+        }
+#endif
+    }
+
+    ~DirectoryLock() {
+        if(_fd < 0) return;
+#ifdef _WIN32
+        if(_locked) _locking(_fd, _LK_UNLCK, 1);
+        _close(_fd);
+#else
+        close(_fd); // releases the flock
+#endif
+    }
+
+    DirectoryLock(const DirectoryLock&) = delete;
+    DirectoryLock& operator=(const DirectoryLock&) = delete;
+
+    bool locked() const { return _locked; }
+
+private:
+    int _fd = -1;
+    bool _locked = false;
+};
+
+struct CacheFile {
+    fs::file_time_type lastUse; // load() touches the entries it returns
+    uint64_t bytes;
+    fs::path path;
+};
+
+// Entries of every process sharing the directory, least recently used first
+std::vector<CacheFile> listEntries(const fs::path& directory) {
+    std::vector<CacheFile> files;
+    std::error_code error;
+    for(fs::directory_iterator file(directory, error), end; !error && file != end; file.increment(error)) {
+        std::error_code fileError;
+        if(!file->is_regular_file(fileError) || file->path().extension() != CACHE_EXTENSION) continue;
+
+        uint64_t bytes = file->file_size(fileError);
+        fs::file_time_type lastUse = file->last_write_time(fileError);
+        if(fileError) continue; // removed since the iterator listed it
+        files.push_back({lastUse, bytes, file->path()});
+    }
+    std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) { return a.lastUse < b.lastUse; });
+    return files;
+}
+
+} // namespace
+
+HeightmapCache::HeightmapCache(const std::string& directory, uint64_t maxBytes)
+    : _directory(directory), _maxBytes(maxBytes) {
+    fs::create_directories(_directory);
+    std::lock_guard<std::mutex> lock(_mutex);
+    evict();
+}
+
+std::string HeightmapCache::fileName(const CacheKey& key) {
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(key.hash));
+    return key.stage + "-" + hash + CACHE_EXTENSION;
+}
+
+std::optional<Heightmap> HeightmapCache::load(const CacheKey& key) {
+    std::string name = fileName(key);
+    fs::path path = fs::path(_directory) / name;
+
+    // The directory is the index, so entries stored by other processes since this one started are found too
+    std::error_code error;
+    if(!fs::exists(path, error)) {
+        _misses++;
+        return std::nullopt;
+    }
+
+    TG_TRACE_SCOPE("cache load");
+    TG_MEMORY_STAGE("HeightmapCache::load");
+
+    try {
+        MappedSnapshot snapshot(path.string());
+        const SnapshotInfo& info = snapshot.info();
+        if(info.kind != key.stage || info.parameterHash != key.hash || info.bufferCount != 1 || info.sampleBytes != sizeof(uint16_t)) {
+            throw std::runtime_error("Cache entry does not match its key: " + path.string());
+        }
+
+        Heightmap heightmap;
+        heightmap.width = info.width;
+        heightmap.height = info.height;
+        heightmap.data.resize(info.width * info.height);
+        memcpy(heightmap.data.data(), snapshot.samples(0), heightmap.data.size() * sizeof(uint16_t));
+
+        fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+        _hits++;
+        return heightmap;
+    } catch(const std::exception& e) {
+        // Evicted by another process in the meantime, or damaged; either way recompute and store it again
+        if(fs::exists(path, error)) {
+            fprintf(stderr, "Ignoring cache entry %s: %s\n", name.c_str(), e.what());
+            fs::remove(path, error);
+        }
+        _misses++;
+        return std::nullopt;
+    }
+}
+
+void HeightmapCache::store(const CacheKey& key, const Heightmap& heightmap) {
+    std::string name = fileName(key);
+    uint64_t bytes = 4096 + (heightmap.data.size() * sizeof(uint16_t) + 4095) / 4096 * 4096;
+    if(bytes > _maxBytes) return;
+
+    fs::path path = fs::path(_directory) / name;
+    std::error_code error;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(fs::exists(path, error) || !_writing.insert(name).second) return;
+    }
+
+    TG_TRACE_SCOPE("cache store");
+
+    SnapshotInfo info{key.stage, key.hash, heightmap.width, heightmap.height, 0, 1, sizeof(uint16_t)};
+    bool stored = true;
+    try {
+        writeSnapshot(path.string(), info, {heightmap.data.data()});
+    } catch(const std::exception& e) {
+        // A full or read-only disk only costs the speedup
+        fprintf(stderr, "Failed to store cache entry %s: %s\n", name.c_str(), e.what());
+        stored = false;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _writing.erase(name);
+    if(stored) evict();
+}
+
+void HeightmapCache::evict() {
+    TG_TRACE_SCOPE("cache evict");
+
+    // Without the lock another process may be trimming the same files; it will get the directory under the limit
+    DirectoryLock directoryLock(_directory);
+    if(!directoryLock.locked()) return;
+
+    std::vector<CacheFile> files = listEntries(_directory);
+    uint64_t totalBytes = 0;
+    for(const CacheFile& file : files) totalBytes += file.bytes;
+
+    for(const CacheFile& file : files) {
+        if(totalBytes <= _maxBytes) break;
+        std::error_code error;
+        fs::remove(file.path, error);
+        totalBytes -= file.bytes;
+    }
+}
+
+void HeightmapCache::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    DirectoryLock directoryLock(_directory);
+    for(const CacheFile& file : listEntries(_directory)) {
+        std::error_code error;
+        fs::remove(file.path, error);
+    }
+}
+
+uint64_t HeightmapCache::sizeBytes() const {
+    uint64_t totalBytes = 0;
+    for(const CacheFile& file : listEntries(_directory)) totalBytes += file.bytes;
+    return totalBytes;
+}
+
+} // namespace tg
@@ -1,99 +1,224 @@
 #include "tg/generator.hpp"
-
-#include <barrier>
+#include "tg/AsyncFileWriter.hpp"
+#include "tg/noise.hpp"
+#include "tg/Scheduler.hpp"
+#include "tg/json.hpp"
+#include "tg/numa.hpp"
+#include "tg/snapshot.hpp"
+#include "tg/trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
-#include <thread>
+#include <limits>
+#include <mutex>
+#include <sstream>
 #include <random>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <glm/glm.hpp>
 #include <glm/gtc/constants.hpp>
 
 namespace tg {
 
-Heightmap generateFlatHeightmap(size_t width, size_t height, uint16_t value) {
+uint32_t generateRandomSeed() {
+    std::random_device rd;
+    return rd();
+}
+
+void setThreadCount(unsigned count) {
+    SchedulerOptions options = schedulerOptions();
+    if(options.threads == count) return;
+    options.threads = count;
+    configureScheduler(options);
+}
+
+unsigned threadCount() {
+    return Scheduler::shared().concurrency();
+}
+
+/** @brief Smallest and largest value of a float array; both start at 0 like the serial loops they replace */
+static std::pair<float, float> parallelMinMax(const float* values, size_t count, const ExecutionContext& context) {
+    std::mutex mutex;
+    float minValue = 0.0f;
+    float maxValue = 0.0f;
+    parallelFor(0, count, [&](size_t begin, size_t end) {
+        float localMin = 0.0f;
+        float localMax = 0.0f;
+        for(size_t i = begin; i < end; i++) {
+            if(values[i] > localMax) localMax = values[i];
+            if(values[i] < localMin) localMin = values[i];
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        minValue = std::min(minValue, localMin);
+        maxValue = std::max(maxValue, localMax);
+    }, context.grain(count, 1 << 14), context.cancel);
+    return {minValue, maxValue};
+}
+
+Heightmap generateFlatHeightmap(size_t width, size_t height, uint16_t value, const ExecutionContext& context) {
+    TG_TRACE_SCOPE_VALUE("generateFlatHeightmap", "pixels", width * height);
+    TG_MEMORY_STAGE("generateFlatHeightmap");
+    context.cancel.throwIfCancelled();
+    ProgressReporter progress(context, "flat", 1);
+
     Heightmap heights;
     heights.width = width;
     heights.height = height;
 
     heights.data.assign(width * height, value);
 
+    progress.advance();
     return heights;
 }
 
-Heightmap generateRandomHeightmap(size_t width, size_t height) {
+Heightmap generateRandomHeightmap(size_t width, size_t height, uint32_t seed, const ExecutionContext& context) {
+    TG_TRACE_SCOPE_VALUE("generateRandomHeightmap", "pixels", width * height);
+    TG_MEMORY_STAGE("generateRandomHeightmap");
+    ProgressReporter progress(context, "random", height);
+
     Heightmap heights;
     heights.width = width;
     heights.height = height;
+    heights.data.reserve(width * height);
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    std::mt19937 gen(seed);
     std::uniform_int_distribution<uint16_t> dis(0, 65535);
-    for(size_t i = 0; i < width * height; i++) {
-        heights.data.push_back(dis(gen));
+    for(size_t y = 0; y < height; y++) {
+        context.cancel.throwIfCancelled();
+        for(size_t x = 0; x < width; x++) {
+            heights.data.push_back(dis(gen));
+        }
+        progress.advance();
     }
 
     return heights;
 }
 
-Heightmap generatePerlinNoiseHeightmap(size_t width, size_t height, size_t gridResolution) {
+std::vector<float> perlinGradients(size_t gridResolution, uint32_t seed) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> dis(0.0f, glm::two_pi<float>());
+
+    size_t corners = gridResolution + 1;
+    std::vector<float> gradients(corners * corners * 2);
+    for(size_t i = 0; i < corners * corners; i++) {
+        float angle = dis(gen);
+        gradients[i * 2] = std::cos(angle);
+        gradients[i * 2 + 1] = std::sin(angle);
+    }
+    return gradients;
+}
+
+Heightmap generatePerlinNoiseHeightmap(size_t width, size_t height, size_t gridResolution, uint32_t seed, const ExecutionContext& context) {
+    TG_TRACE_SCOPE_VALUE("generatePerlinNoiseHeightmap", "pixels", width * height);
+    TG_MEMORY_STAGE("generatePerlinNoiseHeightmap");
+    context.cancel.throwIfCancelled();
+    ProgressReporter progress(context, "perlin", height);
+
     Heightmap heights;
     heights.width = width;
     heights.height = height;
+    resizePlaced(heights.data, height, width);
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
-
-    std::vector<std::vector<glm::vec2>> vectorGrid(gridResolution + 1, std::vector<glm::vec2>(gridResolution + 1, glm::vec2()));
-    for(size_t y = 0; y < gridResolution + 1; y++) {
-        for(size_t x = 0; x < gridResolution + 1; x++) {
-            std::uniform_real_distribution<float> dis(0.0f, glm::two_pi<float>());
-            float angle = dis(gen);
-            vectorGrid[x][y] = glm::vec2(std::cos(angle), std::sin(angle));
-        }
-    }
+    std::vector<float> gradients = perlinGradients(gridResolution, seed);
+    size_t corners = gridResolution + 1;
+    auto gradient = [&](size_t x, size_t y) {
+        return glm::vec2(gradients[(y * corners + x) * 2], gradients[(y * corners + x) * 2 + 1]);
+    };
 
     float cellWidth = static_cast<float>(width) / gridResolution;
     float cellHeight = static_cast<float>(height) / gridResolution;
 
-    for(size_t y = 0; y < height; y++) {
-        for(size_t x = 0; x < width; x++) {
-            size_t cellX = floor(x / cellWidth);
-            size_t cellY = floor(y / cellHeight);
-            float localX = (x / cellWidth) - cellX;
-            float localY = (y / cellHeight) - cellY;
-
-            float dotTL = glm::dot(vectorGrid[cellX][cellY], glm::vec2(localX, localY));
-            float dotTR = glm::dot(vectorGrid[cellX+1][cellY], glm::vec2(localX-1, localY));
-            float dotBL = glm::dot(vectorGrid[cellX][cellY+1], glm::vec2(localX, localY-1));
-            float dotBR = glm::dot(vectorGrid[cellX+1][cellY+1], glm::vec2(localX-1, localY-1));
+    parallelFor(0, height, [&](size_t rowBegin, size_t rowEnd) {
+        for(size_t y = rowBegin; y < rowEnd; y++) {
+            context.cancel.throwIfCancelled();
+            for(size_t x = 0; x < width; x++) {
+                size_t cellX = floor(x / cellWidth);
+                size_t cellY = floor(y / cellHeight);
+                float localX = (x / cellWidth) - cellX;
+                float localY = (y / cellHeight) - cellY;
+
+                float dotTL = glm::dot(gradient(cellX, cellY), glm::vec2(localX, localY));
+                float dotTR = glm::dot(gradient(cellX+1, cellY), glm::vec2(localX-1, localY));
+                float dotBL = glm::dot(gradient(cellX, cellY+1), glm::vec2(localX, localY-1));
+                float dotBR = glm::dot(gradient(cellX+1, cellY+1), glm::vec2(localX-1, localY-1));
         
-            float u = 6*pow(localX, 5) - 15*pow(localX, 4) + 10*pow(localX, 3);
-            float v = 6*pow(localY, 5) - 15*pow(localY, 4) + 10*pow(localY, 3);
+                float u = 6*pow(localX, 5) - 15*pow(localX, 4) + 10*pow(localX, 3);
+                float v = 6*pow(localY, 5) - 15*pow(localY, 4) + 10*pow(localY, 3);
         
-            float nx0 = glm::mix(dotTL, dotTR, u);
-            float nx1 = glm::mix(dotBL, dotBR, u);
-            float nxy = glm::mix(nx0, nx1, v);
+                float nx0 = glm::mix(dotTL, dotTR, u);
+                float nx1 = glm::mix(dotBL, dotBR, u);
+                float nxy = glm::mix(nx0, nx1, v);
 
-            heights.data.push_back(static_cast<uint16_t>((nxy + 1.0f) / 2.0f * UINT16_MAX));
+                heights.data[y * width + x] = static_cast<uint16_t>((nxy + 1.0f) / 2.0f * UINT16_MAX);
+            }
+            progress.advance();
         }
-    }
+    }, context.grain(height), context.cancel);
 
     return heights;
 }
 
-Heightmap generateDiamondSquareHeightmap(size_t width, size_t height, float roughness) {
+Heightmap generateSimplexNoiseHeightmap(size_t width, size_t height, size_t gridResolution, uint32_t seed, const ExecutionContext& context) {
+    TG_TRACE_SCOPE_VALUE("generateSimplexNoiseHeightmap", "pixels", width * height);
+    TG_MEMORY_STAGE("generateSimplexNoiseHeightmap");
+    context.cancel.throwIfCancelled();
+    ProgressReporter progress(context, "simplex", height);
+
     Heightmap heights;
     heights.width = width;
     heights.height = height;
+    resizePlaced(heights.data, height, width);
+
+    SimplexNoise noise(seed);
+    float stepX = static_cast<float>(gridResolution) / width;
+    float stepY = static_cast<float>(gridResolution) / height;
+
+    parallelFor(0, height, [&](size_t rowBegin, size_t rowEnd) {
+        // Each band evaluates whole rows in one batch, then quantizes them
+        std::vector<float> row(width);
+        for(size_t y = rowBegin; y < rowEnd; y++) {
+            context.cancel.throwIfCancelled();
+            noise.evaluateRow(0.0f, stepX, y * stepY, row.data(), width);
+
+            uint16_t* out = heights.data.data() + y * width;
+            for(size_t x = 0; x < width; x++) {
+                out[x] = static_cast<uint16_t>(std::clamp((row[x] + 1.0f) / 2.0f, 0.0f, 1.0f) * UINT16_MAX);
+            }
+            progress.advance();
+        }
+    }, context.grain(height), context.cancel);
+
+    return heights;
+}
+
+Heightmap generateDiamondSquareHeightmap(size_t width, size_t height, float roughness, uint32_t seed, const ExecutionContext& context) {
+    TG_TRACE_SCOPE_VALUE("generateDiamondSquareHeightmap", "pixels", width * height);
+    TG_MEMORY_STAGE("generateDiamondSquareHeightmap");
+
+    Heightmap heights;
+    heights.width = width;
+    heights.height = height;
+    resizePlaced(heights.data, height, width);
 
     // Diamond-Square requires a gridsize of 2^n + 1
     size_t dim = width > height ? width : height;
     dim = std::bit_ceil(dim) + 1;
-    std::vector<std::vector<float>> diamondSquareGrid(dim, std::vector<float>(dim, 0));
+    Vector<Vector<float>> diamondSquareGrid(dim, Vector<float>(dim, 0));
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    std::mt19937 gen(seed);
 
     std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
 
@@ -115,51 +240,92 @@ Heightmap generateDiamondSquareHeightmap(size_t width, size_t height, float roug
     size_t stepSize = dim - 1;
     float scale = 1.0f * roughness;
 
-    while(stepSize > 1) {
+    // Progress counts computed grid points: points^2 diamond and 2 * points^2 square points per step, then the output
+    size_t totalPoints = width * height;
+    for(size_t points = 1; points < dim - 1; points *= 2) totalPoints += 3 * points * points;
+    ProgressReporter progress(context, "diamond-square", totalPoints);
 
-        // Diamond step
-        for(size_t x = 0; x < dim - 1; x += stepSize) {
-            for(size_t y = 0; y < dim - 1; y += stepSize) {
-                float average = (diamondSquareGrid[y][x] +
-                                 diamondSquareGrid[y+stepSize][x] +
-                                 diamondSquareGrid[y][x+stepSize] +
-                                 diamondSquareGrid[y+stepSize][x+stepSize]) / 4.0f;
-
-                // Random values from dis(gen) can cause wandering, so we need to normalize at the end
-                diamondSquareGrid[y + stepSize / 2][x + stepSize / 2] = average + dis(gen) * scale;
-
-                // Remember max and min values to normalize later
-                if(diamondSquareGrid[y + stepSize / 2][x + stepSize / 2] > maxValue) maxValue = diamondSquareGrid[y + stepSize / 2][x + stepSize / 2];
-                if(diamondSquareGrid[y + stepSize / 2][x + stepSize / 2] < minValue) minValue = diamondSquareGrid[y + stepSize / 2][x + stepSize / 2];
-            }
-        }
+    // The random offsets are drawn serially, a block of columns at a time and in the order the serial loops
+    // drew them, so the points of a step can be computed in parallel and a seed still gives the same terrain
+    Vector<float> offsets(std::max<size_t>(1 << 16, dim));
+    std::mutex rangeMutex;
 
-        // Square step
-        for(size_t x = 0; x < dim - 1; x += stepSize / 2) {
-            for(size_t y = (x + stepSize / 2) % stepSize; y < dim - 1; y += stepSize) {
-                float total = 0.0f;
-                size_t count = 0;
+    auto mergeRange = [&](float localMin, float localMax) {
+        std::lock_guard<std::mutex> lock(rangeMutex);
+        minValue = std::min(minValue, localMin);
+        maxValue = std::max(maxValue, localMax);
+    };
 
-                if(static_cast<int>(x) - static_cast<int>(stepSize / 2) >= 0) {
-                    total += diamondSquareGrid[y][x - stepSize / 2]; count++;
-                }
-                if(static_cast<int>(x) + static_cast<int>(stepSize / 2) < dim) {
-                    total += diamondSquareGrid[y][x + stepSize / 2]; count++;
-                }
-                if(static_cast<int>(y) - static_cast<int>(stepSize / 2) >= 0) {
-                    total += diamondSquareGrid[y - stepSize / 2][x]; count++;
-                }
-                if(static_cast<int>(y) + static_cast<int>(stepSize / 2) < dim) {
-                    total += diamondSquareGrid[y + stepSize / 2][x]; count++;
+    // Calls point(column, row, offset) for every point of a step; each column holds points points
+    auto forEachPoint = [&](size_t columns, size_t points, const auto& point) {
+        size_t blockColumns = std::max<size_t>(1, offsets.size() / points);
+        for(size_t firstColumn = 0; firstColumn < columns; firstColumn += blockColumns) {
+            context.cancel.throwIfCancelled();
+            size_t lastColumn = std::min(columns, firstColumn + blockColumns);
+            for(size_t i = 0; i < (lastColumn - firstColumn) * points; i++) {
+                offsets[i] = dis(gen);
+            }
+
+            // Split by rows so neighbouring points of a row are not written from different threads
+            size_t rowGrain = context.grain(points, std::max<size_t>(1, 4096 / (lastColumn - firstColumn)));
+            parallelFor(0, points, [&](size_t rowBegin, size_t rowEnd) {
+                float localMin = std::numeric_limits<float>::max();
+                float localMax = std::numeric_limits<float>::lowest();
+                for(size_t row = rowBegin; row < rowEnd; row++) {
+                    for(size_t column = firstColumn; column < lastColumn; column++) {
+                        float value = point(column, row, offsets[(column - firstColumn) * points + row]);
+                        if(value > localMax) localMax = value;
+                        if(value < localMin) localMin = value;
+                    }
                 }
+                mergeRange(localMin, localMax);
+                progress.advance((rowEnd - rowBegin) * (lastColumn - firstColumn));
+            }, rowGrain, context.cancel);
+        }
+    };
 
-                float average = total / count;
-                diamondSquareGrid[y][x] = average + dis(gen) * scale;
+    while(stepSize > 1) {
+        size_t half = stepSize / 2;
+        size_t points = (dim - 1) / stepSize;
 
-                if(diamondSquareGrid[y][x] > maxValue) maxValue = diamondSquareGrid[y][x];
-                if(diamondSquareGrid[y][x] < minValue) minValue = diamondSquareGrid[y][x];
+        // Diamond step
+        forEachPoint(points, points, [&](size_t column, size_t row, float offset) {
+            size_t x = column * stepSize;
+            size_t y = row * stepSize;
+            float average = (diamondSquareGrid[y][x] +
+                             diamondSquareGrid[y+stepSize][x] +
+                             diamondSquareGrid[y][x+stepSize] +
+                             diamondSquareGrid[y+stepSize][x+stepSize]) / 4.0f;
+
+            // Random values from dis(gen) can cause wandering, so we need to normalize at the end
+            diamondSquareGrid[y + half][x + half] = average + offset * scale;
+            return diamondSquareGrid[y + half][x + half];
+        });
+
+        // Square step; its points only read diamond centers and corners, never each other
+        forEachPoint(2 * points, points, [&](size_t column, size_t row, float offset) {
+            size_t x = column * half;
+            size_t y = (x + half) % stepSize + row * stepSize;
+            float total = 0.0f;
+            size_t count = 0;
+
+            if(x >= half) {
+                total += diamondSquareGrid[y][x - half]; count++;
             }
-        }
+            if(x + half < dim) {
+                total += diamondSquareGrid[y][x + half]; count++;
+            }
+            if(y >= half) {
+                total += diamondSquareGrid[y - half][x]; count++;
+            }
+            if(y + half < dim) {
+                total += diamondSquareGrid[y + half][x]; count++;
+            }
+
+            float average = total / count;
+            diamondSquareGrid[y][x] = average + offset * scale;
+            return diamondSquareGrid[y][x];
+        });
 
         stepSize /= 2;
         scale *= roughness;
@@ -168,302 +334,777 @@ Heightmap generateDiamondSquareHeightmap(size_t width, size_t height, float roug
     // Clip our larger grid to the size requested
     float range = maxValue - minValue;
 
-    for(size_t y=0; y < height; y++) {
-        for(size_t x=0; x < width; x++) {
-            heights.data.push_back((diamondSquareGrid[y][x] - minValue) / range * UINT16_MAX);
+    parallelFor(0, height, [&](size_t rowBegin, size_t rowEnd) {
+        for(size_t y = rowBegin; y < rowEnd; y++) {
+            for(size_t x = 0; x < width; x++) {
+                heights.data[y * width + x] = (diamondSquareGrid[y][x] - minValue) / range * UINT16_MAX;
+            }
         }
-    }
+        progress.advance((rowEnd - rowBegin) * width);
+    }, context.grain(height), context.cancel);
 
     return heights;
 }
 
-Heightmap generateFaultingHeightmap(size_t width, size_t height, int iterations) {
+Heightmap generateFaultingHeightmap(size_t width, size_t height, int iterations, uint32_t seed, const ExecutionContext& context) {
+    TG_TRACE_SCOPE_VALUE("generateFaultingHeightmap", "pixels", width * height);
+    TG_MEMORY_STAGE("generateFaultingHeightmap");
+    context.cancel.throwIfCancelled();
+    ProgressReporter progress(context, "faulting", height);
+
     Heightmap heights;
     heights.width = width;
     heights.height = height;
+    resizePlaced(heights.data, height, width);
 
-    std::vector<std::vector<float>> unnormalizedHeights(height, std::vector<float>(width, 0.0f));
+    Vector<float> unnormalizedHeights;
+    resizePlaced(unnormalizedHeights, height, width);
 
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    std::mt19937 gen(seed);
 
     std::uniform_int_distribution<size_t> widthDistribution(0, width);
     std::uniform_int_distribution<size_t> heightDistribution(0, height);
 
     std::uniform_real_distribution<float> angleDistribution(0.0f, glm::two_pi<float>());
 
+    // Faults are drawn serially so a seed gives the same terrain however the rows are split up
+    struct Fault {
+        glm::vec3 point;
+        glm::vec3 normal;
+    };
+    Vector<Fault> faults;
+    faults.reserve(iterations > 0 ? iterations : 0);
+
     for(int i=0; i < iterations; i++) {
+        if(i % 65536 == 0) context.cancel.throwIfCancelled();
         glm::vec3 point(widthDistribution(gen), heightDistribution(gen), 0.0f);
         float angle = angleDistribution(gen);
         glm::vec3 normal(cos(angle), sin(angle), 0);
+        faults.push_back({point, normal});
+    }
 
-        float displacement = 1.0f;
-
-        for(int y=0; y<height; y++) {
-            for(int x=0; x<width; x++){
-                if(glm::dot(glm::vec3(x, y, 0.0f)-point, normal) >= 0.0f){
-                    unnormalizedHeights[y][x] += displacement;
-                } else {
-                    unnormalizedHeights[y][x] -= displacement;
+    float displacement = 1.0f;
+
+    // Every row applies the faults in the same order as before, so the sums are exactly the same
+    parallelFor(0, height, [&](size_t rowBegin, size_t rowEnd) {
+        for(size_t y = rowBegin; y < rowEnd; y++) {
+            context.cancel.throwIfCancelled();
+            for(const Fault& fault : faults) {
+                for(size_t x = 0; x < width; x++) {
+                    if(glm::dot(glm::vec3(x, y, 0.0f)-fault.point, fault.normal) >= 0.0f){
+                        unnormalizedHeights[y * width + x] += displacement;
+                    } else {
+                        unnormalizedHeights[y * width + x] -= displacement;
+                    }
                 }
             }
+            progress.advance();
         }
-    }
+    }, context.grain(height), context.cancel);
 
-    float maxHeight = 0.0f;
-    float minHeight = 0.0f;
     // Definitely better perfomance to check min and max once per height separately here
-    for(int y=0; y<height; y++) {
-        for(int x=0; x<width; x++) {
-            if(unnormalizedHeights[y][x] > maxHeight) maxHeight = unnormalizedHeights[y][x];
-            if(unnormalizedHeights[y][x] < minHeight) minHeight = unnormalizedHeights[y][x];
-        }
-    }
+    auto [minHeight, maxHeight] = parallelMinMax(unnormalizedHeights.data(), unnormalizedHeights.size(), context);
 
     // Populate heights with normalized height values [0 - UINT16_MAX]
-    for(int y=0; y<height; y++) {
-        for(int x=0; x<width; x++) {
-            heights.data.push_back((unnormalizedHeights[y][x] - minHeight) / (maxHeight-minHeight) * UINT16_MAX);
+    parallelFor(0, height, [&](size_t rowBegin, size_t rowEnd) {
+        for(size_t y = rowBegin; y < rowEnd; y++) {
+            for(size_t x = 0; x < width; x++) {
+                heights.data[y * width + x] = (unnormalizedHeights[y * width + x] - minHeight) / (maxHeight-minHeight) * UINT16_MAX;
+            }
         }
-    }
+    }, context.grain(height), context.cancel);
 
     return heights;
 }
 
-void applyThermalWeathering(Heightmap& heightmap, float threshold, float c, int iterations) {
-    // Convert heightmap uint16_t to floats
-    std::vector<std::vector<float>> heights;
-    for(int y=0; y < heightmap.height; y++) {
-        heights.push_back(std::vector<float>());
-        for(int x=0; x < heightmap.width; x++) {
-            heights.back().push_back(static_cast<float>(heightmap.data[y*heightmap.height+x]) / UINT16_MAX);
+/** @brief FNV-1a over the raw parameter bits and a hash of the input samples, so a checkpoint only resumes the run it came from */
+static uint64_t hashThermalParameters(float threshold, float c, const Heightmap& input) {
+    uint64_t hash = (14695981039346656037ull ^ algorithmVersion) * 1099511628211ull;
+    for(float value : {threshold, c}) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        for(int i = 0; i < 4; i++) {
+            hash ^= (bits >> (8 * i)) & 0xff;
+            hash *= 1099511628211ull;
         }
     }
-    
-    int numThreads = std::thread::hardware_concurrency();
-    std::barrier sync(numThreads);
-
-    std::vector<std::vector<std::vector<float>>> deltas;
-    deltas.reserve(numThreads);
-    for(int i=0; i < numThreads; i++) {
-        deltas.push_back(std::vector<std::vector<float>>(heightmap.height, std::vector<float>(heightmap.width, 0.0f)));
+
+    // The samples go in four at a time; byte by byte would take a noticeable part of a run on large maps
+    const uint16_t* samples = input.data.data();
+    size_t count = input.width * input.height;
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        uint64_t word;
+        memcpy(&word, samples + i, sizeof(word));
+        hash ^= word;
+        hash *= 1099511628211ull;
     }
-   
-    auto worker = [&](int threadId) {
-        int chunk = (heightmap.height) / numThreads;
-        int rowStart = threadId * chunk;
-        int rowEnd = (threadId == numThreads - 1) ? heightmap.height : rowStart + chunk;
-
-        for(int i=0; i < iterations; i++) {
-            deltas[threadId] = std::vector<std::vector<float>>(heightmap.height, std::vector<float>(heightmap.width, 0.0f));
-            for(int y=rowStart; y < rowEnd; y++) {
-                for(int x=0; x < heightmap.width; x++) {
-                    float height = heights[y][x];
-
-                    for(int dx = -1; dx < 2; dx++) {
-                        for(int dy = -1; dy < 2; dy++) {
-                            if(dx == 0 && dy == 0) continue;
-                            int nx = x + dx;
-                            int ny = y + dy;
-                            if(0 <= nx && nx < heightmap.width && 0 <= ny && ny < heightmap.height) {
-                                float dh = height - heights[ny][nx];
-                                if(dh > threshold) {
-                                    float move = c * (dh - threshold) / 2.0;
-                                    deltas[threadId][y][x] -= move;
-                                    deltas[threadId][ny][nx] += move;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
+    for(; i < count; i++) {
+        hash ^= samples[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
 
-            sync.arrive_and_wait();
+// Normalize and store new values
+static void storeNormalizedHeights(const float* heights, Heightmap& heightmap, const ExecutionContext& context) {
+    size_t count = heightmap.width * heightmap.height;
+    auto [minHeight, maxHeight] = parallelMinMax(heights, count, context);
 
-            for(int y=rowStart; y < rowEnd; y++) {
-                for(int x=0; x < heightmap.width; x++) {
-                    // Combine deltas from neighbors
-                    float delta = deltas[threadId][y][x];
+    parallelFor(0, count, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            heightmap.data[i] = (heights[i] - minHeight) / (maxHeight - minHeight) * UINT16_MAX;
+        }
+    }, context.grain(count, 1 << 14), context.cancel);
+}
 
-                    if(y==rowStart && threadId != 0) delta += deltas[threadId - 1][y][x];
-                    if(y==rowEnd && threadId != numThreads - 1) delta += deltas[threadId + 1][y][x];
+void applyThermalWeathering(Heightmap& heightmap, float threshold, float c, int iterations, const ExecutionContext& context) {
+    applyThermalWeathering(heightmap, threshold, c, iterations, ThermalCheckpointOptions(), context);
+}
 
-                    heights[y][x] += delta;
-                }
+void applyThermalWeathering(Heightmap& heightmap, float threshold, float c, int iterations, const ThermalCheckpointOptions& checkpoint,
+                            const ExecutionContext& context) {
+    TG_TRACE_SCOPE_VALUE("applyThermalWeathering", "iterations", iterations);
+    TG_MEMORY_STAGE("applyThermalWeathering");
+
+    size_t width = heightmap.width;
+    size_t height = heightmap.height;
+    if(width == 0 || height == 0) return;
+
+    // Double-buffered float working state; every iteration reads one buffer and writes the other
+    Vector<float> current;
+    Vector<float> next;
+    resizePlaced(current, height, width);
+    resizePlaced(next, height, width);
+
+    // Only checkpoints carry the hash; hashing the input costs a pass over it
+    uint64_t parameterHash = checkpoint.path.empty() ? 0 : hashThermalParameters(threshold, c, heightmap);
+    int startIteration = 0;
+
+    if(checkpoint.resume && !checkpoint.path.empty() && snapshotExists(checkpoint.path)) {
+        MappedSnapshot snapshot(checkpoint.path);
+        const SnapshotInfo& info = snapshot.info();
+        if(info.kind != "thermal" || info.width != width || info.height != height || info.parameterHash != parameterHash || info.bufferCount != 1) {
+            throw std::runtime_error("Checkpoint does not match this thermal weathering run: " + checkpoint.path);
+        }
+        if(info.step > static_cast<uint64_t>(iterations)) {
+            throw std::runtime_error("Checkpoint is already past iteration " + std::to_string(iterations) + ": " + checkpoint.path);
+        }
+
+        memcpy(current.data(), snapshot.buffer(0), width * height * sizeof(float));
+        startIteration = static_cast<int>(info.step);
+    } else {
+        parallelFor(0, width * height, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                current[i] = static_cast<float>(heightmap.data[i]) / UINT16_MAX;
             }
+        }, context.grain(width * height, 1 << 14), context.cancel);
+    }
 
-            sync.arrive_and_wait();
+    float* readBuffer = current.data();
+    float* writeBuffer = next.data();
+    int iteration = startIteration;
+
+    // Checkpoints: the state is copied into staging, then a background thread writes it out.
+    // A checkpoint that comes due while the previous one is still being written is skipped, never waited on.
+    bool checkpointing = !checkpoint.path.empty() && (checkpoint.everyIterations > 0 || checkpoint.everySeconds > 0.0);
+    Vector<float> staging;
+    if(checkpointing) resizePlaced(staging, height, width);
+    std::future<void> pendingWrite;
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+
+    auto reportWrite = [&]() {
+        try {
+            pendingWrite.get();
+        } catch(const std::exception& e) {
+            fprintf(stderr, "Thermal checkpoint failed: %s\n", e.what());
         }
     };
 
-    std::vector<std::thread> threads;
-    for(int t = 0; t < numThreads; t++)
-        threads.emplace_back(worker, t);
-    for(auto& t : threads)
-        t.join();
+    // Intermediate results are taken from the float state, so the run continues exactly as if it had not stopped
+    std::vector<int> emitIterations = checkpoint.emitIterations;
+    std::sort(emitIterations.begin(), emitIterations.end());
+    auto nextEmit = std::upper_bound(emitIterations.begin(), emitIterations.end(), startIteration);
+
+    auto emit = [&]() {
+        TG_TRACE_SCOPE_VALUE("thermal emit", "iteration", iteration);
+        Heightmap intermediate;
+        intermediate.width = width;
+        intermediate.height = height;
+        intermediate.data.resize(width * height);
+        storeNormalizedHeights(readBuffer, intermediate, context);
+        checkpoint.onEmit(iteration, intermediate);
+    };
 
-/*
-    for(int i=0; i < iterations; i++) {
-        std::vector<std::vector<float>> delta(heightmap.height, std::vector<float>(heightmap.width, 0.0f));
+    auto checkpointDue = [&]() {
+        if(!checkpointing || iteration == iterations) return false;
 
-        for(int y=0; y < heightmap.height; y++) {
-            for(int x=0; x < heightmap.width; x++) {
-                float height = heights[y][x];
+        auto now = std::chrono::steady_clock::now();
+        bool due = (checkpoint.everyIterations > 0 && iteration % checkpoint.everyIterations == 0)
+                || (checkpoint.everySeconds > 0.0 && std::chrono::duration<double>(now - lastCheckpoint).count() >= checkpoint.everySeconds);
+        if(!due) return false;
 
-                for(int dx = -1; dx < 2; dx++) {
+        if(pendingWrite.valid()) {
+            if(pendingWrite.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+            reportWrite();
+        }
+        return true;
+    };
+
+    auto writeCheckpoint = [&]() {
+        parallelFor(0, width * height, [&](size_t begin, size_t end) {
+            memcpy(staging.data() + begin, readBuffer + begin, (end - begin) * sizeof(float));
+        }, context.grain(width * height, 1 << 16));
+
+        lastCheckpoint = std::chrono::steady_clock::now();
+        SnapshotInfo info{"thermal", parameterHash, width, height, static_cast<uint64_t>(iteration), 1};
+        try {
+            pendingWrite = std::async(std::launch::async, [&checkpoint, &staging, info]() {
+                writeSnapshot(checkpoint.path, info, {staging.data()});
+            });
+        } catch(const std::exception& e) {
+            fprintf(stderr, "Thermal checkpoint failed: %s\n", e.what());
+        }
+    };
+
+    // Every iteration only reads the previous one, so its rows are split across the scheduler
+    size_t rowGrain = context.grain(height, std::max<size_t>(1, 16384 / width));
+    ProgressReporter progress(context, "thermal", iterations > 0 ? iterations : 0);
+    progress.advance(startIteration);
+
+    for(int i = startIteration; i < iterations; i++) {
+        context.cancel.throwIfCancelled();
+        const float* heights = readBuffer;
+        float* result = writeBuffer;
+
+        parallelFor(0, height, [&](size_t rowStart, size_t rowEnd) {
+            TG_TRACE_SCOPE_VALUE("thermal band", "rows", rowEnd - rowStart);
+            for(size_t y = rowStart; y < rowEnd; y++) {
+                for(size_t x = 0; x < width; x++) {
+                    float h = heights[y * width + x];
+                    float delta = 0.0f;
+
+                    // Material leaves towards lower neighbours and arrives from higher ones
                     for(int dy = -1; dy < 2; dy++) {
-                        if(dx == 0 && dy == 0) continue;
-                        int nx = x + dx;
-                        int ny = y + dy;
-                        if(0 <= nx && nx < heightmap.width && 0 <= ny && ny < heightmap.height) {
-                            float dh = height - heights[ny][nx];
-                            if(dh > threshold) {
-                                float move = c * (dh - threshold) / 2.0;
-                                delta[y][x] -= move;
-                                delta[ny][nx] += move;
+                        for(int dx = -1; dx < 2; dx++) {
+                            if(dx == 0 && dy == 0) continue;
+                            size_t nx = x + dx;
+                            size_t ny = y + dy;
+                            if(nx < width && ny < height) {
+                                float dh = h - heights[ny * width + nx];
+                                if(dh > threshold) {
+                                    delta -= c * (dh - threshold) / 2.0f;
+                                } else if(-dh > threshold) {
+                                    delta += c * (-dh - threshold) / 2.0f;
+                                }
                             }
                         }
                     }
+
+                    result[y * width + x] = h + delta;
                 }
             }
+        }, rowGrain, context.cancel);
+
+        std::swap(readBuffer, writeBuffer);
+        iteration++;
+        TG_TRACE_COUNTER("thermal iteration", iteration);
+
+        while(nextEmit != emitIterations.end() && *nextEmit < iteration) ++nextEmit;
+        if(nextEmit != emitIterations.end() && *nextEmit == iteration && iteration < iterations && checkpoint.onEmit) {
+            emit();
         }
 
-        for(int y=0; y < heightmap.height; y++) {
-            for(int x=0; x < heightmap.width; x++) {
-                heights[y][x] += delta[y][x];
+        if(checkpointDue()) writeCheckpoint();
+        progress.advance();
+    }
+
+    if(pendingWrite.valid()) reportWrite();
+
+    // Renormalizing touches every sample, even where no material moved
+    storeNormalizedHeights(readBuffer, heightmap, context);
+    markDirty(heightmap, {0, 0, width, height});
+}
+
+/**
+ * @brief Mesh vertex at sample (x, y); the normal is taken from the neighbouring samples, one-sided on the border,
+ * and flat along an axis with a single sample
+ */
+static Attributes meshVertex(const Heightmap& heightmap, size_t x, size_t y) {
+    size_t width = heightmap.width;
+    size_t height = heightmap.height;
+    const uint16_t* data = heightmap.data.data();
+    auto z = [&](size_t index) { return data[index] / static_cast<float>(UINT16_MAX); };
+
+    size_t i = y*width + x;
+
+    // Calculate dx and dy, minding heightmap boundary conditions
+    glm::vec3 RL = (width == 1) ? glm::vec3(1, 0, 0)
+             : (x == 0) ? glm::vec3(1, 0, data[i+1] - data[i])
+             : (x == width - 1) ? glm::vec3(1, 0, data[i] - data[i-1])
+             : glm::vec3(2.0f / width, 0.0f, z(i+1) - z(i-1));
+    glm::vec3 UD = (height == 1) ? glm::vec3(0, -1, 0)
+             : (y == 0) ? glm::vec3(0, -1, data[i+width] - data[i])
+             : (y == height - 1) ? glm::vec3(0, -1, data[i] - data[i-width])
+             : glm::vec3(0.0f, 2.0f / height, z(i+width) - z(i-width));
+
+    glm::vec3 normal = glm::normalize(glm::cross(RL, UD));
+
+    /* Yes, the position x, y = u, v; it's redundant data, perhaps will remove later */
+    float u = static_cast<float>(x) / width;
+    float v = static_cast<float>(y) / height;
+    return {u, v, z(i), normal.x, normal.y, normal.z, u, v};
+}
+
+Mesh convertHeightmapToMesh(const Heightmap& heightmap, const ExecutionContext& context) {
+    TG_TRACE_SCOPE_VALUE("convertHeightmapToMesh", "pixels", heightmap.width * heightmap.height);
+    TG_MEMORY_STAGE("convertHeightmapToMesh");
+
+    Mesh mesh;
+
+    size_t width = heightmap.width;
+    size_t height = heightmap.height;
+
+    // Sized up front so rows can be filled in parallel; growing by push_back would also briefly hold two copies
+    if(width > 1 && height > 1) resizePlaced(mesh.indices, height - 1, 6 * (width - 1));
+    resizePlaced(mesh.interleavedAttributes, height, width);
+
+    size_t rowGrain = context.grain(height, std::max<size_t>(1, 4096 / std::max<size_t>(width, 1)));
+
+    // Vertices and indices each count one unit per row
+    ProgressReporter progress(context, "mesh", 2 * height);
+
+    // Generate Indices
+    if(!mesh.indices.empty()) {
+        parallelFor(0, height - 1, [&](size_t rowBegin, size_t rowEnd) {
+            for(size_t y = rowBegin; y < rowEnd; y++) {
+                uint32_t* quad = mesh.indices.data() + 6 * y * (width - 1);
+                for(size_t x = 0; x < width - 1; x++, quad += 6) {
+                    uint32_t topLeft = y*width + x;
+                    uint32_t topRight = topLeft + 1;
+                    uint32_t bottomLeft = (y+1)*width + x;
+                    uint32_t bottomRight = bottomLeft + 1;
+
+                    quad[0] = topLeft;
+                    quad[1] = bottomLeft;
+                    quad[2] = topRight;
+
+                    quad[3] = topRight;
+                    quad[4] = bottomLeft;
+                    quad[5] = bottomRight;
+                }
+            }
+            progress.advance(rowEnd - rowBegin);
+        }, rowGrain, context.cancel);
+    }
+    progress.advance(mesh.indices.empty() ? height : 1);
+
+    // Generate Vertices, normals included
+    parallelFor(0, height, [&](size_t rowBegin, size_t rowEnd) {
+        for(size_t y = rowBegin; y < rowEnd; y++) {
+            Attributes* row = mesh.interleavedAttributes.data() + y * width;
+            for(size_t x = 0; x < width; x++) {
+                row[x] = meshVertex(heightmap, x, y);
             }
         }
+        progress.advance(rowEnd - rowBegin);
+    }, rowGrain, context.cancel);
+
+    return mesh;
+}
+
+void markDirty(Heightmap& heightmap, const HeightmapRegion& region) {
+    HeightmapRegion clipped{region.x0, region.y0, std::min(region.x1, heightmap.width), std::min(region.y1, heightmap.height)};
+    if(clipped.empty()) return;
+
+    HeightmapRegion& dirty = heightmap.dirty;
+    if(dirty.empty()) {
+        dirty = clipped;
+    } else {
+        dirty = {std::min(dirty.x0, clipped.x0), std::min(dirty.y0, clipped.y0), std::max(dirty.x1, clipped.x1), std::max(dirty.y1, clipped.y1)};
     }
-*/
-
-    // Normalize and store new values
-    float maxHeight = 0.0f;
-    float minHeight = 0.0f;
-    for(int y=0; y < heightmap.height; y++){
-        for(int x=0; x < heightmap.width; x++) {
-            if(heights[y][x] > maxHeight) maxHeight = heights[y][x];
-            if(heights[y][x] < minHeight) minHeight = heights[y][x];
+}
+
+HeightmapRegion takeDirtyRegion(Heightmap& heightmap) {
+    return std::exchange(heightmap.dirty, HeightmapRegion{});
+}
+
+std::pair<size_t, size_t> affectedMeshRows(const Heightmap& heightmap, const HeightmapRegion& region) {
+    if(region.empty()) return {0, 0};
+    return {region.y0 > 0 ? region.y0 - 1 : 0, std::min(region.y1 + 1, heightmap.height)};
+}
+
+Vector<Attributes> convertHeightmapRowsToVertices(const Heightmap& heightmap, size_t rowBegin, size_t rowEnd, const ExecutionContext& context) {
+    TG_TRACE_SCOPE_VALUE("convertHeightmapRowsToVertices", "rows", rowEnd - rowBegin);
+
+    size_t width = heightmap.width;
+    rowEnd = std::min(rowEnd, heightmap.height);
+    if(rowBegin >= rowEnd) return {};
+
+    Vector<Attributes> vertices(width * (rowEnd - rowBegin));
+    parallelFor(rowBegin, rowEnd, [&](size_t bandBegin, size_t bandEnd) {
+        for(size_t y = bandBegin; y < bandEnd; y++) {
+            Attributes* row = vertices.data() + (y - rowBegin) * width;
+            for(size_t x = 0; x < width; x++) {
+                row[x] = meshVertex(heightmap, x, y);
+            }
         }
+    }, context.grain(rowEnd - rowBegin, std::max<size_t>(1, 4096 / std::max<size_t>(width, 1))), context.cancel);
+
+    return vertices;
+}
+
+std::future<void> exportHeightmapAsR16Async(const Heightmap& heightmap, const std::string& filepath) {
+    TG_TRACE_SCOPE_VALUE("exportHeightmapAsR16", "bytes", heightmap.data.size() * sizeof(uint16_t));
+
+    auto file = AsyncFileWriter::shared().open(filepath);
+    file->append(heightmap.data.data(), heightmap.data.size() * sizeof(uint16_t));
+    return file->closeAsync();
+}
+
+void exportHeightmapAsR16(Heightmap& heightmap, const std::string& filepath) {
+    exportHeightmapAsR16Async(heightmap, filepath).get();
+
+    fprintf(stdout, "Heightmap exported as R16 to %s\n", filepath.c_str());
+}
+
+/**
+ * @brief Formats into a fixed scratch buffer and hands full chunks to the writer
+ */
+class ObjFormatter {
+public:
+    explicit ObjFormatter(AsyncFileWriter::File& file) : _file(file) { }
+    ~ObjFormatter() { flush(); }
+
+    void vertex(float x, float y, float z) {
+        reserve(3 * 16 + 4);
+        put("v ", 2);
+        number(x); put(" ", 1);
+        number(y); put(" ", 1);
+        number(z); put("\n", 1);
+    }
+
+    void face(uint32_t a, uint32_t b, uint32_t c) {
+        reserve(3 * 11 + 4);
+        put("f ", 2);
+        number(a); put(" ", 1);
+        number(b); put(" ", 1);
+        number(c); put("\n", 1);
     }
 
-    for(int y=0; y < heightmap.height; y++){
-        for(int x=0; x < heightmap.width; x++) {
-            heightmap.data[y * heightmap.height + x] = (heights[y][x] - minHeight) / (maxHeight-minHeight) * UINT16_MAX;
+    void flush() {
+        if(_fill > 0) _file.append(_buffer, _fill);
+        _fill = 0;
+    }
+
+private:
+    AsyncFileWriter::File& _file;
+    char _buffer[1 << 16];
+    size_t _fill = 0;
+
+    void reserve(size_t size) { if(_fill + size > sizeof(_buffer)) flush(); }
+    void put(const char* text, size_t size) { memcpy(_buffer + _fill, text, size); _fill += size; }
+
+    // Same 6 significant digits as the default ostream formatting
+    void number(float value) { _fill = std::to_chars(_buffer + _fill, _buffer + sizeof(_buffer), value, std::chars_format::general, 6).ptr - _buffer; }
+    void number(uint32_t value) { _fill = std::to_chars(_buffer + _fill, _buffer + sizeof(_buffer), value).ptr - _buffer; }
+};
+
+std::future<void> exportHeightmapAsObjAsync(const Heightmap& heightmap, const std::string& filepath) {
+    TG_TRACE_SCOPE_VALUE("exportHeightmapAsObj", "pixels", heightmap.width * heightmap.height);
+    TG_MEMORY_STAGE("exportHeightmapAsObj");
+
+    auto file = AsyncFileWriter::shared().open(filepath);
+
+    Mesh mesh = convertHeightmapToMesh(heightmap);
+
+    {
+        ObjFormatter obj(*file);
+
+        // Convert mesh to Z-up instead of Y-down
+        for(const auto& attributes : mesh.interleavedAttributes) {
+            obj.vertex(attributes.x, attributes.z, attributes.y);
+        }
+
+        for(size_t i = 0; i < mesh.indices.size(); i+=3) {
+            obj.face(mesh.indices[i] + 1, mesh.indices[i+1] + 1, mesh.indices[i+2] + 1);
         }
     }
-}
 
-Mesh convertHeightmapToMesh(const Heightmap& heightmap) {
-    Mesh mesh;
+    return file->closeAsync();
+}
 
-    size_t width = heightmap.width;
-    size_t height = heightmap.height;
+void exportHeightmapAsObj(Heightmap& heightmap, const std::string& filepath) {
+    exportHeightmapAsObjAsync(heightmap, filepath).get();
 
-    std::vector<float> positions;
-    std::vector<float> normals;
-    std::vector<float> uvs;
+    fprintf(stdout, "Heightmap exported as OBJ to %s\n", filepath.c_str());
+}
 
-    // Generate Vertices
-    for(size_t y=0; y < height; y++) {
-        for(size_t x=0; x < width; x++) {
-            positions.push_back(static_cast<float>(x) / width);
-            positions.push_back(static_cast<float>(y) / height);
-            positions.push_back(heightmap.data[y*height + x] / static_cast<float>(UINT16_MAX));
+namespace {
 
-            /* Yes, the position x, y = u, v; it's redundant data, perhaps will remove later */
-            uvs.push_back(static_cast<float>(x) / width);
-            uvs.push_back(static_cast<float>(y) / height);
+// PNG chunk checksums: CRC-32 with the reflected polynomial 0xEDB88320
+const std::array<uint32_t, 256>& crcTable() {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> entries{};
+        for(uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for(int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entries[n] = c;
         }
+        return entries;
+    }();
+    return table;
+}
+
+uint32_t updateCrc(uint32_t crc, const uint8_t* data, size_t size) {
+    const std::array<uint32_t, 256>& table = crcTable();
+    for(size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+void putBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+    out.insert(out.end(), {uint8_t(value >> 24), uint8_t(value >> 16), uint8_t(value >> 8), uint8_t(value)});
+}
+
+void appendPngChunk(std::vector<uint8_t>& out, const char type[4], const std::vector<uint8_t>& data) {
+    putBigEndian(out, static_cast<uint32_t>(data.size()));
+    size_t typeStart = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    putBigEndian(out, updateCrc(0xFFFFFFFFu, out.data() + typeStart, out.size() - typeStart) ^ 0xFFFFFFFFu);
+}
+
+} // namespace
+
+/**
+ * @note The image data is a zlib stream of stored (uncompressed) deflate blocks: previews are small and this needs no
+ * compression library. Any PNG reader accepts it; recompress with an optimizer if size matters.
+ */
+std::future<void> exportImageAsPngAsync(const uint8_t* rgba, uint32_t width, uint32_t height, const std::string& filepath) {
+    TG_TRACE_SCOPE_VALUE("exportImageAsPng", "pixels", size_t(width) * height);
+
+    // Scanlines, each behind filter type 0 (none)
+    size_t rowBytes = size_t(width) * 4;
+    std::vector<uint8_t> scanlines((rowBytes + 1) * height);
+    for(uint32_t y = 0; y < height; y++) {
+        scanlines[y * (rowBytes + 1)] = 0;
+        memcpy(&scanlines[y * (rowBytes + 1) + 1], rgba + y * rowBytes, rowBytes);
     }
 
-    // Generate Indices
-    for(size_t y=0; y < height - 1; y++) {
-        for(size_t x=0; x < width - 1; x++) {
-            uint32_t topLeft = y*height + x;
-            uint32_t topRight = topLeft + 1;
-            uint32_t bottomLeft = (y+1)*height + x;
-            uint32_t bottomRight = bottomLeft + 1;
-
-            mesh.indices.push_back(topLeft);
-            mesh.indices.push_back(bottomLeft);
-            mesh.indices.push_back(topRight);
-
-            mesh.indices.push_back(topRight);
-            mesh.indices.push_back(bottomLeft);
-            mesh.indices.push_back(bottomRight);
+    constexpr size_t STORED_BLOCK_BYTES = 65535;
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    zlib.reserve(scanlines.size() + scanlines.size() / STORED_BLOCK_BYTES * 5 + 16);
+    size_t offset = 0;
+    do {
+        size_t length = std::min(STORED_BLOCK_BYTES, scanlines.size() - offset);
+        bool last = offset + length == scanlines.size();
+        zlib.insert(zlib.end(), {uint8_t(last ? 1 : 0), uint8_t(length), uint8_t(length >> 8), uint8_t(~length), uint8_t(~length >> 8)});
+        zlib.insert(zlib.end(), scanlines.begin() + offset, scanlines.begin() + offset + length);
+        offset += length;
+    } while(offset < scanlines.size());
+
+    // Adler-32 of the uncompressed data closes the zlib stream
+    uint32_t a = 1, b = 0;
+    for(uint8_t byte : scanlines) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    putBigEndian(zlib, (b << 16) | a);
+
+    std::vector<uint8_t> header;
+    putBigEndian(header, width);
+    putBigEndian(header, height);
+    header.insert(header.end(), {8, 6, 0, 0, 0}); // 8 bits per channel, RGBA, deflate, adaptive filtering, no interlace
+
+    std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    appendPngChunk(png, "IHDR", header);
+    appendPngChunk(png, "IDAT", zlib);
+    appendPngChunk(png, "IEND", {});
+
+    auto file = AsyncFileWriter::shared().open(filepath);
+    file->append(png.data(), png.size());
+    return file->closeAsync();
+}
+
+TileGrid computeTileGrid(size_t width, size_t height, size_t tileSize, const std::string& filepath) {
+    if(tileSize < 2) {
+        throw std::invalid_argument("Tile size must be at least 2");
+    }
+    if(width == 0 || height == 0) {
+        throw std::invalid_argument("Cannot tile an empty heightmap");
+    }
+
+    TileGrid grid;
+    grid.sourceWidth = width;
+    grid.sourceHeight = height;
+    grid.tileSize = tileSize;
+
+    // Neighbouring tiles share their edge samples, so each new tile only advances by tileSize - 1
+    size_t step = tileSize - 1;
+    grid.tilesX = width <= tileSize ? 1 : (width - 1 + step - 1) / step;
+    grid.tilesY = height <= tileSize ? 1 : (height - 1 + step - 1) / step;
+
+    // Unreal picks up tiled heightmaps named <name>_x<X>_y<Y>.<ext>
+    std::filesystem::path path(filepath);
+    std::string stem = path.stem().string();
+    std::string extension = path.has_extension() ? path.extension().string() : std::string(".r16");
+
+    for(size_t ty = 0; ty < grid.tilesY; ty++) {
+        for(size_t tx = 0; tx < grid.tilesX; tx++) {
+            grid.tiles.push_back({tx, ty, tx * step, ty * step,
+                                  stem + "_x" + std::to_string(tx) + "_y" + std::to_string(ty) + extension});
         }
     }
 
-    // Compute Normals
-    for(size_t y=0; y < height; y++) {
-        for(size_t x=0; x < width; x++) {
-            // Calculate dx and dy, minding heightmap boundary conditions
-            glm::vec3 RL = (x == 0) ? glm::vec3(1, 0, heightmap.data[y*height+x+1] - heightmap.data[y*height+x])
-                     : (x == width) ? glm::vec3(1, 0, heightmap.data[y*height+x] - heightmap.data[y*height+x-1])
-                     : glm::vec3(2.0f / width, 0.0f, positions[3*y*width+3*(x+1)+2] - positions[3*y*width+3*(x-1)+2]);
-            glm::vec3 UD = (y == 0) ? glm::vec3(0, -1, heightmap.data[(y+1)*height+x] - heightmap.data[y*height+x])
-                     : (y == height) ? glm::vec3(0, -1, heightmap.data[y*height+x] - heightmap.data[(y-1)*height+x])
-                     : glm::vec3(0.0f, 2.0f / height, positions[3*(y+1)*width+3*x+2] - positions[3*(y-1)*width+3*x+2]);
-
-            glm::vec3 normal = glm::normalize(glm::cross(RL, UD));
-
-            normals.push_back(normal.x);
-            normals.push_back(normal.y);
-            normals.push_back(normal.z);
+    return grid;
+}
+
+static void writeTileManifest(const TileGrid& grid, const std::filesystem::path& manifestPath) {
+    std::ostringstream file;
+    file << "{\n"
+         << "  \"format\": \"r16\",\n"
+         << "  \"sourceWidth\": " << grid.sourceWidth << ",\n"
+         << "  \"sourceHeight\": " << grid.sourceHeight << ",\n"
+         << "  \"tileSize\": " << grid.tileSize << ",\n"
+         << "  \"overlap\": 1,\n"
+         << "  \"tilesX\": " << grid.tilesX << ",\n"
+         << "  \"tilesY\": " << grid.tilesY << ",\n"
+         << "  \"tiles\": [\n";
+
+    for(size_t i = 0; i < grid.tiles.size(); i++) {
+        const HeightmapTile& tile = grid.tiles[i];
+        file << "    { \"x\": " << tile.tileX << ", \"y\": " << tile.tileY
+             << ", \"offsetX\": " << tile.offsetX << ", \"offsetY\": " << tile.offsetY
+             << ", \"file\": " << jsonQuote(tile.filename) << " }"
+             << (i + 1 < grid.tiles.size() ? ",\n" : "\n");
+    }
+
+    file << "  ]\n}\n";
+
+    std::string manifest = file.str();
+    auto output = AsyncFileWriter::shared().open(manifestPath.string());
+    output->append(manifest.data(), manifest.size());
+    output->close();
+}
+
+/**
+ * @brief Writes every tile of the grid straight out of the source samples, one scheduler task per tile
+ * @note Tiles reaching past the source edge repeat the last row/column so all tiles keep the same size
+ */
+static void writeR16Tiles(const uint16_t* source, const TileGrid& grid, const std::filesystem::path& directory) {
+    TG_TRACE_SCOPE_VALUE("writeR16Tiles", "tiles", grid.tiles.size());
+
+    std::vector<std::future<void>> pendingTiles(grid.tiles.size());
+    std::exception_ptr firstError;
+
+    {
+        TaskGroup group;
+        for(size_t i = 0; i < grid.tiles.size(); i++) {
+            group.run([&, i]() {
+                const HeightmapTile& tile = grid.tiles[i];
+                TG_TRACE_SCOPE_VALUE("R16 tile", "bytes", grid.tileSize * grid.tileSize * sizeof(uint16_t));
+
+                auto file = AsyncFileWriter::shared().open((directory / tile.filename).string());
+
+                size_t validWidth = std::min(grid.tileSize, grid.sourceWidth - tile.offsetX);
+                std::vector<uint16_t> padding;
+
+                for(size_t y = 0; y < grid.tileSize; y++) {
+                    size_t sourceY = std::min(tile.offsetY + y, grid.sourceHeight - 1);
+                    const uint16_t* row = source + sourceY * grid.sourceWidth + tile.offsetX;
+
+                    file->append(row, validWidth * sizeof(uint16_t));
+
+                    if(validWidth < grid.tileSize) {
+                        padding.assign(grid.tileSize - validWidth, row[validWidth - 1]);
+                        file->append(padding.data(), padding.size() * sizeof(uint16_t));
+                    }
+                }
+
+                // Writes keep landing while this thread moves on to the next tile
+                pendingTiles[i] = file->closeAsync();
+            });
+        }
+
+        // The first failure skips the tiles that have not started; the ones already written are still waited for
+        try {
+            group.wait();
+        } catch(...) {
+            firstError = std::current_exception();
         }
     }
 
-    // Combine into interleaved array
-    for(size_t i = 0; i < width*height; i++) {
-        float x = positions[3*i];
-        float y = positions[3*i + 1];
-        float z = positions[3*i + 2];
-        float n_x = normals[3*i];
-        float n_y = normals[3*i + 1];
-        float n_z = normals[3*i + 2];
-        float u = uvs[2*i];
-        float v = uvs[2*i + 1];
-
-        mesh.interleavedAttributes.push_back({x, y, z, n_x, n_y, n_z, u, v});
+    for(auto& pending : pendingTiles) {
+        if(!pending.valid()) continue;
+        try {
+            pending.get();
+        } catch(...) {
+            if(!firstError) firstError = std::current_exception();
+        }
     }
 
-    return mesh;
+    if(firstError) std::rethrow_exception(firstError);
 }
 
-void exportHeightmapAsR16(Heightmap& heightmap, const std::string& filepath) {
-    std::ofstream file(filepath, std::ios::binary);
-    if(!file) {
-        throw std::runtime_error("Failed to open file for writing: " + filepath);
+TileGrid exportHeightmapAsR16Tiles(const Heightmap& heightmap, const std::string& filepath, size_t tileSize) {
+    if(heightmap.data.size() != heightmap.width * heightmap.height) {
+        throw std::invalid_argument("Heightmap data does not match its dimensions");
     }
 
-    file.write(reinterpret_cast<const char*>(heightmap.data.data()), heightmap.data.size() * sizeof(uint16_t));
-    file.close();
+    TileGrid grid = computeTileGrid(heightmap.width, heightmap.height, tileSize, filepath);
 
-    fprintf(stdout, "Heightmap exported as R16 to %s\n", filepath.c_str());
+    std::filesystem::path path(filepath);
+    writeR16Tiles(heightmap.data.data(), grid, path.parent_path());
+    std::filesystem::path manifestPath = path.parent_path() / (path.stem().string() + "_tiles.json");
+    writeTileManifest(grid, manifestPath);
+
+    fprintf(stdout, "Heightmap exported as %zu x %zu R16 tiles, manifest %s\n", grid.tilesX, grid.tilesY, manifestPath.string().c_str());
+
+    return grid;
 }
 
-void exportHeightmapAsObj(Heightmap& heightmap, const std::string& filepath) {
-    std::ofstream file(filepath, std::ios::binary);
-    if(!file) {
-        throw std::runtime_error("Failed to open file for writing: " + filepath);
+TileGrid exportR16FileAsR16Tiles(const std::string& sourcePath, size_t width, size_t height, const std::string& filepath, size_t tileSize) {
+#ifdef _WIN32
+    throw std::runtime_error("Tiling from a mapped .r16 file is not supported on this platform");
+#else
+    TileGrid grid = computeTileGrid(width, height, tileSize, filepath);
+
+    int fd = open(sourcePath.c_str(), O_RDONLY);
+    if(fd < 0) {
+        throw std::runtime_error("Failed to open file for reading: " + sourcePath);
     }
 
-    Mesh mesh = convertHeightmapToMesh(heightmap);
+    struct stat info;
+    size_t expectedSize = width * height * sizeof(uint16_t);
+    if(fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < expectedSize) {
+        close(fd);
+        throw std::runtime_error("R16 file is smaller than " + std::to_string(width) + "x" + std::to_string(height) + ": " + sourcePath);
+    }
 
-    // Convert mesh to Z-up instead of Y-down
-    for(const auto& attributes : mesh.interleavedAttributes) {
-        file << "v " << attributes.x << " " << attributes.z << " " << attributes.y << "\n";
+    void* mapped = mmap(nullptr, expectedSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED) {
+        throw std::runtime_error("Failed to map file: " + sourcePath);
     }
 
-    for(int i = 0; i < mesh.indices.size(); i+=3) {
-        file << "f " << mesh.indices[i] + 1 << " "
-                     << mesh.indices[i+1] + 1 << " "
-                     << mesh.indices[i+2] + 1 << "\n";
+    // Tiles are read row by row, front to back
+    madvise(mapped, expectedSize, MADV_SEQUENTIAL);
+
+    std::filesystem::path path(filepath);
+    std::filesystem::path manifestPath = path.parent_path() / (path.stem().string() + "_tiles.json");
+    try {
+        writeR16Tiles(static_cast<const uint16_t*>(mapped), grid, path.parent_path());
+        writeTileManifest(grid, manifestPath);
+    } catch(...) {
+        munmap(mapped, expectedSize);
+        throw;
     }
+    munmap(mapped, expectedSize);
 
-    file.close();
+    fprintf(stdout, "%s exported as %zu x %zu R16 tiles, manifest %s\n", sourcePath.c_str(), grid.tilesX, grid.tilesY, manifestPath.string().c_str());
 
-    fprintf(stdout, "Heightmap exported as OBJ to %s\n", filepath.c_str());
+    return grid;
+#endif
 }
 
-} // namespace tg
\ No newline at end of file
+} // namespace tg
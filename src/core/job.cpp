@@ -0,0 +1,453 @@
+#include "tg/job.hpp"
+#include "tg/AsyncFileWriter.hpp"
+#include "tg/cache.hpp"
+#include "tg/trace.hpp"
+
+#include <bit>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <stdexcept>
+
+namespace tg {
+
+const char* generationMethodName(GenerationMethod method) {
+    switch(method) {
+        case GenerationMethod::Flat: return "flat";
+        case GenerationMethod::Random: return "random";
+        case GenerationMethod::Perlin: return "perlin";
+        case GenerationMethod::DiamondSquare: return "diamond-square";
+        case GenerationMethod::Faulting: return "faulting";
+        case GenerationMethod::Simplex: return "simplex";
+    }
+    return "unknown";
+}
+
+static GenerationMethod parseGenerationMethod(const std::string& name) {
+    for(GenerationMethod method : {GenerationMethod::Flat, GenerationMethod::Random, GenerationMethod::Perlin,
+                                   GenerationMethod::DiamondSquare, GenerationMethod::Faulting, GenerationMethod::Simplex}) {
+        if(name == generationMethodName(method)) return method;
+    }
+    throw std::invalid_argument("Unknown mode: " + name);
+}
+
+static const std::string& nextValue(const std::vector<std::string>& args, size_t& i) {
+    if(i + 1 >= args.size()) {
+        throw std::invalid_argument("Missing value for " + args[i]);
+    }
+    return args[++i];
+}
+
+template<typename T>
+static T parseNumber(const std::vector<std::string>& args, size_t& i) {
+    const std::string& flag = args[i];
+    const std::string& value = nextValue(args, i);
+    try {
+        size_t consumed = 0;
+        T result;
+        if constexpr(std::is_floating_point_v<T>) {
+            result = static_cast<T>(std::stod(value, &consumed));
+        } else if constexpr(std::is_signed_v<T>) {
+            result = static_cast<T>(std::stoll(value, &consumed));
+        } else {
+            if(!value.empty() && value[0] == '-') throw std::invalid_argument(value);
+            result = static_cast<T>(std::stoull(value, &consumed));
+        }
+        if(consumed != value.size()) throw std::invalid_argument(value);
+        return result;
+    } catch(const std::logic_error&) {
+        throw std::invalid_argument("Invalid value for " + flag + ": " + value);
+    }
+}
+
+JobSpec parseJobArguments(const std::vector<std::string>& args) {
+    JobSpec spec;
+
+    for(size_t i = 0; i < args.size(); i++) {
+        const std::string& arg = args[i];
+
+        if(arg == "--name") {
+            spec.name = nextValue(args, i);
+        } else if(arg == "--mode") {
+            spec.method = parseGenerationMethod(nextValue(args, i));
+        } else if(arg == "--size") {
+            spec.width = spec.height = parseNumber<size_t>(args, i);
+        } else if(arg == "--width") {
+            spec.width = parseNumber<size_t>(args, i);
+        } else if(arg == "--height") {
+            spec.height = parseNumber<size_t>(args, i);
+        } else if(arg == "--seed") {
+            spec.seed = parseNumber<uint32_t>(args, i);
+        } else if(arg == "--value") {
+            spec.flatValue = parseNumber<uint16_t>(args, i);
+        } else if(arg == "--grid") {
+            spec.perlinGridSize = parseNumber<size_t>(args, i);
+        } else if(arg == "--roughness") {
+            spec.diamondSquareRoughness = parseNumber<float>(args, i);
+        } else if(arg == "--faults") {
+            spec.faultingIterations = parseNumber<int>(args, i);
+        } else if(arg == "--thermal") {
+            spec.thermal = true;
+        } else if(arg == "--thermal-iterations") {
+            spec.thermal = true;
+            spec.thermalIterations = parseNumber<int>(args, i);
+        } else if(arg == "--talus") {
+            spec.thermalThreshold = parseNumber<float>(args, i);
+        } else if(arg == "--thermal-constant") {
+            spec.thermalConstant = parseNumber<float>(args, i);
+        } else if(arg == "--checkpoint") {
+            spec.thermalCheckpoint.path = nextValue(args, i);
+        } else if(arg == "--checkpoint-every") {
+            spec.thermalCheckpoint.everyIterations = parseNumber<int>(args, i);
+        } else if(arg == "--checkpoint-seconds") {
+            spec.thermalCheckpoint.everySeconds = parseNumber<double>(args, i);
+        } else if(arg == "--resume") {
+            spec.thermalCheckpoint.resume = true;
+        } else if(arg == "--output" || arg == "--path") {
+            spec.outputs.push_back(nextValue(args, i));
+        } else if(arg == "--tile-size") {
+            spec.tileSize = parseNumber<size_t>(args, i);
+        } else {
+            throw std::invalid_argument("Unknown argument: " + arg);
+        }
+    }
+
+    if(spec.width == 0 || spec.height == 0) {
+        throw std::invalid_argument("Heightmap size must be positive");
+    }
+    if((spec.method == GenerationMethod::Perlin || spec.method == GenerationMethod::Simplex) && spec.perlinGridSize == 0) {
+        throw std::invalid_argument("Noise grid size must be positive");
+    }
+    if(spec.thermalConstant < 0.0f || spec.thermalConstant > 1.0f) {
+        throw std::invalid_argument("Thermal constant must be within [0, 1]");
+    }
+    if(spec.tileSize == 1) {
+        throw std::invalid_argument("Tile size must be at least 2");
+    }
+
+    for(const std::string& output : spec.outputs) {
+        std::string extension = std::filesystem::path(output).extension().string();
+        if(extension != ".r16" && extension != ".obj") {
+            throw std::invalid_argument("Unsupported output extension: " + output);
+        }
+    }
+
+    if(spec.name.empty()) {
+        spec.name = spec.outputs.empty() ? generationMethodName(spec.method) : std::filesystem::path(spec.outputs.front()).stem().string();
+    }
+
+    return spec;
+}
+
+JobSpec parseJobObject(const JsonValue& job) {
+    std::vector<std::string> args;
+
+    for(const auto& [key, value] : job.asObject()) {
+        std::string flag = "--" + key;
+        switch(value.type()) {
+            case JsonValue::Type::Bool:
+                if(value.asBool()) args.push_back(flag);
+                break;
+            case JsonValue::Type::Array:
+                for(const JsonValue& item : value.asArray()) {
+                    args.push_back(flag);
+                    args.push_back(item.asString());
+                }
+                break;
+            case JsonValue::Type::Null:
+                break;
+            case JsonValue::Type::Object:
+                throw std::invalid_argument("Unexpected object for " + key);
+            default:
+                args.push_back(flag);
+                args.push_back(value.asString());
+        }
+    }
+
+    return parseJobArguments(args);
+}
+
+std::vector<std::string> splitArguments(const std::string& line) {
+    std::vector<std::string> args;
+    std::string current;
+    bool inQuotes = false;
+    bool hasToken = false;
+
+    for(char ch : line) {
+        if(ch == '"') {
+            inQuotes = !inQuotes;
+            hasToken = true;
+        } else if(!inQuotes && ch == '#') {
+            break;
+        } else if(!inQuotes && (ch == ' ' || ch == '\t' || ch == '\r')) {
+            if(hasToken) args.push_back(current);
+            current.clear();
+            hasToken = false;
+        } else {
+            current += ch;
+            hasToken = true;
+        }
+    }
+    if(inQuotes) {
+        throw std::invalid_argument("Unterminated quote: " + line);
+    }
+    if(hasToken) args.push_back(current);
+
+    return args;
+}
+
+std::vector<JobSpec> loadJobFile(const std::string& path) {
+    std::ifstream file(path);
+    if(!file) {
+        throw std::runtime_error("Failed to open job file: " + path);
+    }
+
+    std::vector<JobSpec> jobs;
+    std::string line;
+    size_t lineNumber = 0;
+    while(std::getline(file, line)) {
+        lineNumber++;
+        std::vector<std::string> args = splitArguments(line);
+        if(args.empty()) continue;
+
+        try {
+            jobs.push_back(parseJobArguments(args));
+        } catch(const std::invalid_argument& e) {
+            throw std::invalid_argument(path + ":" + std::to_string(lineNumber) + ": " + e.what());
+        }
+    }
+
+    return jobs;
+}
+
+std::string jobUsage() {
+    return
+        "Job options:\n"
+        "  --name <name>                Label used in progress output (default: first output's name)\n"
+        "  --mode <mode>                flat, random, perlin, simplex, diamond-square, faulting (default: perlin)\n"
+        "  --size <n>                   Width and height of the heightmap (default: 512)\n"
+        "  --width <n>, --height <n>    Set width and height separately\n"
+        "  --seed <n>                   Random seed (default: random, printed when done)\n"
+        "  --value <n>                  Flat: height value 0-65535 (default: 32768)\n"
+        "  --grid <n>                   Perlin, Simplex: grid resolution (default: 4)\n"
+        "  --roughness <f>              Diamond-Square: roughness (default: 0.5)\n"
+        "  --faults <n>                 Faulting: number of faults (default: 10)\n"
+        "  --thermal                    Apply thermal weathering\n"
+        "  --thermal-iterations <n>     Thermal: iterations, implies --thermal (default: 10)\n"
+        "  --talus <f>                  Thermal: talus slope threshold (default: 0.01)\n"
+        "  --thermal-constant <f>       Thermal: scaling constant in [0, 1] (default: 0.25)\n"
+        "  --checkpoint <path>          Thermal: snapshot file for checkpoints\n"
+        "  --checkpoint-every <n>       Thermal: checkpoint every n iterations\n"
+        "  --checkpoint-seconds <f>     Thermal: checkpoint every f seconds\n"
+        "  --resume                     Thermal: continue from the checkpoint if present\n"
+        "  --output <path>              Output file, .r16 or .obj; may be repeated\n"
+        "  --tile-size <n>              Write .r16 outputs as n x n tiles with a manifest (e.g. 1009, 2017)\n";
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Floats are keyed by their exact bits, so 0.1 and 0.1000001 never share an entry
+static std::string exactFloat(float value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%a", value);
+    return text;
+}
+
+CacheKey generatorCacheKey(const JobSpec& spec) {
+    std::string parameters = std::to_string(spec.width) + "x" + std::to_string(spec.height);
+    switch(spec.method) {
+        case GenerationMethod::Flat:
+            parameters += " value " + std::to_string(spec.flatValue);
+            break;
+        case GenerationMethod::Random:
+            parameters += " seed " + std::to_string(*spec.seed);
+            break;
+        case GenerationMethod::Perlin:
+        case GenerationMethod::Simplex:
+            parameters += " seed " + std::to_string(*spec.seed) + " grid " + std::to_string(spec.perlinGridSize);
+            break;
+        case GenerationMethod::DiamondSquare:
+            parameters += " seed " + std::to_string(*spec.seed) + " roughness " + exactFloat(spec.diamondSquareRoughness);
+            break;
+        case GenerationMethod::Faulting:
+            parameters += " seed " + std::to_string(*spec.seed) + " faults " + std::to_string(spec.faultingIterations);
+            break;
+    }
+    return makeCacheKey(generationMethodName(spec.method), parameters);
+}
+
+CacheKey thermalCacheKey(const JobSpec& spec, const CacheKey& input) {
+    return makeCacheKey("thermal", "talus " + exactFloat(spec.thermalThreshold) + " constant " + exactFloat(spec.thermalConstant)
+                                 + " iterations " + std::to_string(spec.thermalIterations), &input);
+}
+
+static Heightmap runGenerator(const JobSpec& spec, uint32_t seed, const ExecutionContext& context) {
+    switch(spec.method) {
+        case GenerationMethod::Flat:
+            return generateFlatHeightmap(spec.width, spec.height, spec.flatValue, context);
+        case GenerationMethod::Random:
+            return generateRandomHeightmap(spec.width, spec.height, seed, context);
+        case GenerationMethod::Perlin:
+            return generatePerlinNoiseHeightmap(spec.width, spec.height, spec.perlinGridSize, seed, context);
+        case GenerationMethod::Simplex:
+            return generateSimplexNoiseHeightmap(spec.width, spec.height, spec.perlinGridSize, seed, context);
+        case GenerationMethod::DiamondSquare:
+            return generateDiamondSquareHeightmap(spec.width, spec.height, spec.diamondSquareRoughness, seed, context);
+        case GenerationMethod::Faulting:
+            return generateFaultingHeightmap(spec.width, spec.height, spec.faultingIterations, seed, context);
+    }
+    throw std::invalid_argument("Unknown generation method");
+}
+
+Heightmap generateJobHeightmap(JobSpec& spec, JobTimings* timings, HeightmapCache* cache, const ExecutionContext& context) {
+    context.cancel.throwIfCancelled();
+    if(!spec.seed) spec.seed = generateRandomSeed();
+    uint32_t seed = *spec.seed;
+
+    auto start = std::chrono::steady_clock::now();
+
+    // The last cached stage wins: a hit on the filtered result skips the generator as well
+    std::optional<CacheKey> generatorKey;
+    std::optional<CacheKey> thermalKey;
+    if(cache) {
+        generatorKey = generatorCacheKey(spec);
+        if(spec.thermal) {
+            thermalKey = thermalCacheKey(spec, *generatorKey);
+            if(std::optional<Heightmap> cached = cache->load(*thermalKey)) {
+                if(timings) *timings = {secondsSince(start), 0.0, 0.0};
+                return std::move(*cached);
+            }
+        }
+    }
+
+    context.cancel.throwIfCancelled();
+    std::optional<Heightmap> cachedInput = generatorKey ? cache->load(*generatorKey) : std::nullopt;
+    Heightmap heightmap;
+    if(cachedInput) {
+        heightmap = std::move(*cachedInput);
+    } else {
+        heightmap = runGenerator(spec, seed, context);
+        if(generatorKey) cache->store(*generatorKey, heightmap);
+    }
+
+    if(timings) timings->generateSeconds = secondsSince(start);
+    start = std::chrono::steady_clock::now();
+
+    if(spec.thermal) {
+        applyThermalWeathering(heightmap, spec.thermalThreshold, spec.thermalConstant, spec.thermalIterations, spec.thermalCheckpoint, context);
+        if(thermalKey) cache->store(*thermalKey, heightmap);
+    }
+
+    if(timings) timings->filterSeconds = secondsSince(start);
+
+    return heightmap;
+}
+
+void writeJobOutputs(const JobSpec& spec, const Heightmap& heightmap, JobTimings* timings) {
+    auto start = std::chrono::steady_clock::now();
+
+    // Start every output before waiting on any, so R16 and OBJ writes overlap
+    std::vector<std::future<void>> pending;
+    for(const std::string& output : spec.outputs) {
+        std::string extension = std::filesystem::path(output).extension().string();
+        if(extension == ".obj") {
+            pending.push_back(exportHeightmapAsObjAsync(heightmap, output));
+        } else if(spec.tileSize > 0) {
+            exportHeightmapAsR16Tiles(heightmap, output, spec.tileSize);
+        } else {
+            pending.push_back(exportHeightmapAsR16Async(heightmap, output));
+        }
+    }
+
+    {
+        TG_TRACE_SCOPE("wait for outputs");
+        for(auto& future : pending) future.get();
+    }
+
+    if(timings) timings->exportSeconds = secondsSince(start);
+}
+
+void runJob(JobSpec& spec, JobTimings* timings, HeightmapCache* cache, const ExecutionContext& context) {
+    TG_TRACE_SCOPE_VALUE("runJob", "pixels", spec.width * spec.height);
+
+    Heightmap heightmap = generateJobHeightmap(spec, timings, cache, context);
+    context.cancel.throwIfCancelled();
+    writeJobOutputs(spec, heightmap, timings);
+}
+
+MemoryEstimate estimateJobMemory(const JobSpec& spec) {
+    const uint64_t width = spec.width;
+    const uint64_t height = spec.height;
+    const uint64_t pixels = width * height;
+    const uint64_t heightmapBytes = pixels * sizeof(uint16_t);
+    const uint64_t rowBytes = sizeof(Vector<float>);
+
+    MemoryEstimate estimate;
+    auto stage = [&estimate](const char* name, uint64_t bytes) {
+        estimate.stages.emplace_back(name, bytes);
+        if(bytes > estimate.peakBytes) {
+            estimate.peakBytes = bytes;
+            estimate.peakStage = name;
+        }
+    };
+
+    switch(spec.method) {
+        case GenerationMethod::Flat:
+            stage("generateFlatHeightmap", heightmapBytes);
+            break;
+        case GenerationMethod::Random:
+            stage("generateRandomHeightmap", heightmapBytes);
+            break;
+        case GenerationMethod::Perlin: {
+            uint64_t gridPoints = spec.perlinGridSize + 1;
+            stage("generatePerlinNoiseHeightmap", heightmapBytes + gridPoints * gridPoints * 2 * sizeof(float));
+            break;
+        }
+        case GenerationMethod::Simplex:
+            // One row of float samples per band being worked on
+            stage("generateSimplexNoiseHeightmap", heightmapBytes + threadCount() * width * sizeof(float));
+            break;
+        case GenerationMethod::DiamondSquare: {
+            // Works on a square 2^n + 1 grid covering the requested size
+            uint64_t dim = std::bit_ceil(std::max(width, height)) + 1;
+            // plus a block of random offsets drawn ahead of each step
+            uint64_t offsets = std::max<uint64_t>(1 << 16, dim);
+            stage("generateDiamondSquareHeightmap", heightmapBytes + dim * dim * sizeof(float) + dim * rowBytes + offsets * sizeof(float));
+            break;
+        }
+        case GenerationMethod::Faulting:
+            stage("generateFaultingHeightmap", heightmapBytes + pixels * sizeof(float)
+                                               + std::max(spec.faultingIterations, 0) * 6 * sizeof(float));
+            break;
+    }
+
+    if(spec.thermal) {
+        // Two float buffers, plus a staging copy when checkpointing
+        bool checkpointing = !spec.thermalCheckpoint.path.empty()
+                          && (spec.thermalCheckpoint.everyIterations > 0 || spec.thermalCheckpoint.everySeconds > 0.0);
+        stage("applyThermalWeathering", heightmapBytes + pixels * sizeof(float) * (checkpointing ? 3 : 2));
+    }
+
+    bool hasObj = false;
+    for(const std::string& output : spec.outputs) {
+        if(std::filesystem::path(output).extension() == ".obj") hasObj = true;
+    }
+    if(hasObj) {
+        // The mesh peaks while it is built: the heightmap, the interleaved vertices and the indices
+        uint64_t quads = width > 1 && height > 1 ? (width - 1) * (height - 1) : 0;
+        stage("convertHeightmapToMesh", heightmapBytes + pixels * sizeof(Attributes) + quads * 6 * sizeof(uint32_t));
+    }
+
+    if(!spec.outputs.empty()) {
+        const AsyncFileWriter::Options& writer = AsyncFileWriter::sharedOptions();
+        estimate.writerBufferBytes = static_cast<uint64_t>(writer.queueDepth) * writer.bufferSize;
+        estimate.peakBytes += estimate.writerBufferBytes;
+    }
+
+    return estimate;
+}
+
+} // namespace tg
@@ -0,0 +1,242 @@
+#include "tg/json.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace tg {
+
+class JsonParser {
+public:
+    explicit JsonParser(const std::string& text) : _text(text) { }
+
+    JsonValue document() {
+        JsonValue value = parseValue(0);
+        skipWhitespace();
+        if(_pos != _text.size()) fail("trailing characters");
+        return value;
+    }
+
+private:
+    static constexpr int MAX_DEPTH = 64;
+
+    const std::string& _text;
+    size_t _pos = 0;
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::invalid_argument("Invalid JSON at offset " + std::to_string(_pos) + ": " + message);
+    }
+
+    void skipWhitespace() {
+        while(_pos < _text.size() && (_text[_pos] == ' ' || _text[_pos] == '\t' || _text[_pos] == '\n' || _text[_pos] == '\r')) _pos++;
+    }
+
+    bool consume(const char* literal) {
+        size_t length = std::char_traits<char>::length(literal);
+        if(_text.compare(_pos, length, literal) != 0) return false;
+        _pos += length;
+        return true;
+    }
+
+    void expect(char ch) {
+        skipWhitespace();
+        if(_pos >= _text.size() || _text[_pos] != ch) fail(std::string("expected '") + ch + "'");
+        _pos++;
+    }
+
+    JsonValue parseValue(int depth) {
+        if(depth > MAX_DEPTH) fail("nested too deeply");
+        skipWhitespace();
+        if(_pos >= _text.size()) fail("unexpected end");
+
+        JsonValue value;
+        char ch = _text[_pos];
+        if(ch == '{') {
+            value._type = JsonValue::Type::Object;
+            _pos++;
+            skipWhitespace();
+            if(_pos < _text.size() && _text[_pos] == '}') { _pos++; return value; }
+            while(true) {
+                skipWhitespace();
+                if(_pos >= _text.size() || _text[_pos] != '"') fail("expected a key");
+                std::string key = parseString();
+                expect(':');
+                value._object.emplace_back(std::move(key), parseValue(depth + 1));
+                skipWhitespace();
+                if(_pos < _text.size() && _text[_pos] == ',') { _pos++; continue; }
+                expect('}');
+                return value;
+            }
+        } else if(ch == '[') {
+            value._type = JsonValue::Type::Array;
+            _pos++;
+            skipWhitespace();
+            if(_pos < _text.size() && _text[_pos] == ']') { _pos++; return value; }
+            while(true) {
+                value._array.push_back(parseValue(depth + 1));
+                skipWhitespace();
+                if(_pos < _text.size() && _text[_pos] == ',') { _pos++; continue; }
+                expect(']');
+                return value;
+            }
+        } else if(ch == '"') {
+            value._type = JsonValue::Type::String;
+            value._text = parseString();
+        } else if(consume("true")) {
+            value._type = JsonValue::Type::Bool;
+            value._bool = true;
+        } else if(consume("false")) {
+            value._type = JsonValue::Type::Bool;
+        } else if(consume("null")) {
+            value._type = JsonValue::Type::Null;
+        } else if(ch == '-' || (ch >= '0' && ch <= '9')) {
+            size_t start = _pos;
+            if(_text[_pos] == '-') _pos++;
+            while(_pos < _text.size() && ((_text[_pos] >= '0' && _text[_pos] <= '9') || _text[_pos] == '.' || _text[_pos] == 'e'
+                                          || _text[_pos] == 'E' || _text[_pos] == '+' || _text[_pos] == '-')) _pos++;
+            value._type = JsonValue::Type::Number;
+            value._text = _text.substr(start, _pos - start);
+
+            char* end = nullptr;
+            strtod(value._text.c_str(), &end);
+            if(end != value._text.c_str() + value._text.size()) fail("malformed number");
+        } else {
+            fail(std::string("unexpected '") + ch + "'");
+        }
+        return value;
+    }
+
+    std::string parseString() {
+        _pos++; // opening quote
+        std::string result;
+        while(true) {
+            if(_pos >= _text.size()) fail("unterminated string");
+            char ch = _text[_pos++];
+            if(ch == '"') return result;
+            if(static_cast<unsigned char>(ch) < 0x20) fail("control character in string");
+            if(ch != '\\') {
+                result += ch;
+                continue;
+            }
+
+            if(_pos >= _text.size()) fail("unterminated string");
+            char escape = _text[_pos++];
+            switch(escape) {
+                case '"': result += '"'; break;
+                case '\\': result += '\\'; break;
+                case '/': result += '/'; break;
+                case 'b': result += '\b'; break;
+                case 'f': result += '\f'; break;
+                case 'n': result += '\n'; break;
+                case 'r': result += '\r'; break;
+                case 't': result += '\t'; break;
+                case 'u': appendUtf8(result, parseCodePoint()); break;
+                default: fail("invalid escape");
+            }
+        }
+    }
+
+    unsigned parseHex4() {
+        if(_pos + 4 > _text.size()) fail("truncated \\u escape");
+        unsigned value = 0;
+        for(int i = 0; i < 4; i++) {
+            char ch = _text[_pos++];
+            value <<= 4;
+            if(ch >= '0' && ch <= '9') value |= ch - '0';
+            else if(ch >= 'a' && ch <= 'f') value |= ch - 'a' + 10;
+            else if(ch >= 'A' && ch <= 'F') value |= ch - 'A' + 10;
+            else fail("invalid \\u escape");
+        }
+        return value;
+    }
+
+    unsigned parseCodePoint() {
+        unsigned codePoint = parseHex4();
+        if(codePoint >= 0xD800 && codePoint <= 0xDBFF) {
+            if(!consume("\\u")) fail("unpaired surrogate");
+            unsigned low = parseHex4();
+            if(low < 0xDC00 || low > 0xDFFF) fail("unpaired surrogate");
+            codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+        }
+        return codePoint;
+    }
+
+    static void appendUtf8(std::string& out, unsigned codePoint) {
+        if(codePoint < 0x80) {
+            out += static_cast<char>(codePoint);
+        } else if(codePoint < 0x800) {
+            out += static_cast<char>(0xC0 | (codePoint >> 6));
+            out += static_cast<char>(0x80 | (codePoint & 0x3F));
+        } else if(codePoint < 0x10000) {
+            out += static_cast<char>(0xE0 | (codePoint >> 12));
+            out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (codePoint & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (codePoint >> 18));
+            out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (codePoint & 0x3F));
+        }
+    }
+};
+
+JsonValue JsonValue::parse(const std::string& text) {
+    return JsonParser(text).document();
+}
+
+bool JsonValue::asBool() const {
+    if(_type != Type::Bool) throw std::invalid_argument("JSON value is not a boolean");
+    return _bool;
+}
+
+double JsonValue::asNumber() const {
+    if(_type != Type::Number) throw std::invalid_argument("JSON value is not a number");
+    return strtod(_text.c_str(), nullptr);
+}
+
+const std::string& JsonValue::asString() const {
+    if(_type != Type::String && _type != Type::Number) throw std::invalid_argument("JSON value is not a string");
+    return _text;
+}
+
+const std::vector<JsonValue>& JsonValue::asArray() const {
+    if(_type != Type::Array) throw std::invalid_argument("JSON value is not an array");
+    return _array;
+}
+
+const std::vector<std::pair<std::string, JsonValue>>& JsonValue::asObject() const {
+    if(_type != Type::Object) throw std::invalid_argument("JSON value is not an object");
+    return _object;
+}
+
+const JsonValue* JsonValue::find(const std::string& key) const {
+    if(_type != Type::Object) return nullptr;
+    for(const auto& [name, value] : _object) {
+        if(name == key) return &value;
+    }
+    return nullptr;
+}
+
+std::string jsonQuote(const std::string& text) {
+    std::string quoted = "\"";
+    for(char ch : text) {
+        switch(ch) {
+            case '"': quoted += "\\\""; break;
+            case '\\': quoted += "\\\\"; break;
+            case '\n': quoted += "\\n"; break;
+            case '\r': quoted += "\\r"; break;
+            case '\t': quoted += "\\t"; break;
+            default:
+                if(static_cast<unsigned char>(ch) < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+                    quoted += escaped;
+                } else {
+                    quoted += ch;
+                }
+        }
+    }
+    return quoted + "\"";
+}
+
+} // namespace tg
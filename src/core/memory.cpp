@@ -0,0 +1,163 @@
+#include "tg/memory.hpp"
+
+#ifdef TG_MEMORY_TRACKING
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#endif
+
+namespace tg::memory {
+
+#ifdef TG_MEMORY_TRACKING
+
+namespace {
+
+constexpr uint32_t MAX_STAGES = 64;
+
+// Every allocation is prefixed with the stage it is charged to, so frees go back to the right stage
+constexpr size_t HEADER_SIZE = alignof(std::max_align_t);
+
+struct Counter {
+    std::atomic<uint64_t> current{0};
+    std::atomic<uint64_t> peak{0};
+    std::atomic<uint64_t> allocations{0};
+
+    void add(uint64_t bytes) {
+        uint64_t now = current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        uint64_t previousPeak = peak.load(std::memory_order_relaxed);
+        while(now > previousPeak && !peak.compare_exchange_weak(previousPeak, now, std::memory_order_relaxed)) { }
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void remove(uint64_t bytes) {
+        current.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    void resetPeak() {
+        peak.store(current.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+};
+
+struct Stages {
+    std::mutex mutex;
+    const char* names[MAX_STAGES] = {"other"};
+    std::atomic<uint32_t> count{1};
+    Counter counters[MAX_STAGES];
+    Counter total;
+};
+
+// Never destroyed: tracked containers with static storage may be freed after static destructors run
+Stages& stages() {
+    static Stages* instance = new Stages();
+    return *instance;
+}
+
+thread_local uint32_t currentStage = 0;
+
+} // namespace
+
+namespace detail {
+
+uint32_t registerStage(const char* name) {
+    Stages& s = stages();
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    uint32_t count = s.count.load(std::memory_order_relaxed);
+    for(uint32_t i = 0; i < count; i++) {
+        if(strcmp(s.names[i], name) == 0) return i;
+    }
+    if(count == MAX_STAGES) return 0;
+
+    s.names[count] = name;
+    s.count.store(count + 1, std::memory_order_release);
+    return count;
+}
+
+uint32_t enterStage(uint32_t stage) {
+    uint32_t previous = currentStage;
+    currentStage = stage;
+    return previous;
+}
+
+void leaveStage(uint32_t previous) {
+    currentStage = previous;
+}
+
+void* allocate(size_t bytes) {
+    char* block = static_cast<char*>(malloc(bytes + HEADER_SIZE));
+    if(block == nullptr) throw std::bad_alloc();
+
+    uint32_t stage = currentStage;
+    memcpy(block, &stage, sizeof(stage));
+
+    Stages& s = stages();
+    s.counters[stage].add(bytes);
+    s.total.add(bytes);
+
+    return block + HEADER_SIZE;
+}
+
+void deallocate(void* ptr, size_t bytes) noexcept {
+    if(ptr == nullptr) return;
+    char* block = static_cast<char*>(ptr) - HEADER_SIZE;
+
+    uint32_t stage;
+    memcpy(&stage, block, sizeof(stage));
+
+    Stages& s = stages();
+    s.counters[stage].remove(bytes);
+    s.total.remove(bytes);
+
+    free(block);
+}
+
+} // namespace detail
+
+std::vector<StageUsage> stageUsage() {
+    Stages& s = stages();
+    uint32_t count = s.count.load(std::memory_order_acquire);
+
+    std::vector<StageUsage> usage;
+    for(uint32_t i = 0; i < count; i++) {
+        const Counter& counter = s.counters[i];
+        usage.push_back({s.names[i], counter.current.load(std::memory_order_relaxed), counter.peak.load(std::memory_order_relaxed),
+                         counter.allocations.load(std::memory_order_relaxed)});
+    }
+    return usage;
+}
+
+uint64_t currentBytes() {
+    return stages().total.current.load(std::memory_order_relaxed);
+}
+
+uint64_t peakBytes() {
+    return stages().total.peak.load(std::memory_order_relaxed);
+}
+
+void resetPeaks() {
+    Stages& s = stages();
+    uint32_t count = s.count.load(std::memory_order_acquire);
+    for(uint32_t i = 0; i < count; i++) s.counters[i].resetPeak();
+    s.total.resetPeak();
+}
+
+#else
+
+std::vector<StageUsage> stageUsage() {
+    return {};
+}
+
+uint64_t currentBytes() {
+    return 0;
+}
+
+uint64_t peakBytes() {
+    return 0;
+}
+
+void resetPeaks() { }
+
+#endif
+
+} // namespace tg::memory
@@ -0,0 +1,95 @@
+#include "tg/noise.hpp"
+
+#include <cmath>
+#include <random>
+
+namespace tg {
+
+namespace {
+
+constexpr float F2 = 0.366025403784f;   // (sqrt(3) - 1) / 2, skews (x, y) onto the simplex lattice
+constexpr float G2 = 0.211324865405f;   // (3 - sqrt(3)) / 6, unskews it again
+
+// A compare and a subtract instead of std::floor, which keeps the loops vectorizable
+inline int32_t fastFloor(float v) {
+    int32_t i = static_cast<int32_t>(v);
+    return i - (v < static_cast<float>(i) ? 1 : 0);
+}
+
+inline uint32_t hashCorner(int32_t i, int32_t j, uint32_t key) {
+    uint32_t h = key ^ (static_cast<uint32_t>(i) * 0x9E3779B1u);
+    h = (h ^ (h >> 15)) * 0x85EBCA77u;
+    h ^= static_cast<uint32_t>(j) * 0xC2B2AE3Du;
+    h = (h ^ (h >> 13)) * 0x27D4EB2Fu;
+    return h ^ (h >> 16);
+}
+
+// Dot product of (x, y) with one of the 8 gradients (+-1, +-2), (+-2, +-1); selects and signs are done with arithmetic,
+// since float conditionals keep the compiler from vectorizing the loops
+inline float gradientDot(uint32_t hash, float x, float y) {
+    float swap = static_cast<float>((hash >> 2) & 1);
+    float u = x + swap * (y - x);
+    float v = y + swap * (x - y);
+    float signU = 1.0f - 2.0f * static_cast<float>(hash & 1);
+    float signV = 2.0f - 4.0f * static_cast<float>((hash >> 1) & 1);
+    return signU * u + signV * v;
+}
+
+// Contribution of the corner at offset (x, y) from the sample; zero beyond a radius of sqrt(0.5)
+inline float corner(float x, float y, uint32_t hash) {
+    float t = 0.5f - x * x - y * y;
+    t = 0.5f * (t + std::fabs(t));     // max(t, 0) without a float compare, which would stop the loops vectorizing
+    t *= t;
+    return t * t * gradientDot(hash, x, y);
+}
+
+inline float simplex(float x, float y, uint32_t key) {
+    float s = (x + y) * F2;
+    int32_t i = fastFloor(x + s);
+    int32_t j = fastFloor(y + s);
+    float t = static_cast<float>(i + j) * G2;
+    float x0 = x - (static_cast<float>(i) - t);
+    float y0 = y - (static_cast<float>(j) - t);
+
+    // The middle corner: one step along x in the lower triangle of the cell, along y in the upper one
+    int32_t i1 = x0 > y0 ? 1 : 0;
+    int32_t j1 = 1 - i1;
+
+    float x1 = x0 - static_cast<float>(i1) + G2;
+    float y1 = y0 - static_cast<float>(j1) + G2;
+    float x2 = x0 - 1.0f + 2.0f * G2;
+    float y2 = y0 - 1.0f + 2.0f * G2;
+
+    float n = corner(x0, y0, hashCorner(i, j, key))
+            + corner(x1, y1, hashCorner(i + i1, j + j1, key))
+            + corner(x2, y2, hashCorner(i + 1, j + 1, key));
+    return 40.0f * n; // scales the sum to about [-1, 1]
+}
+
+} // namespace
+
+SimplexNoise::SimplexNoise(uint32_t seed) {
+    std::mt19937 gen(seed);
+    _key = gen();
+}
+
+void SimplexNoise::evaluate(const float* x, const float* y, float* out, size_t count) const {
+    const uint32_t key = _key;
+    for(size_t i = 0; i < count; i++) {
+        out[i] = simplex(x[i], y[i], key);
+    }
+}
+
+void SimplexNoise::evaluateRow(float x0, float step, float y, float* out, size_t count) const {
+    const uint32_t key = _key;
+    // A 32-bit column index: SSE2 has no vector conversion from 64-bit integers to float
+    for(size_t i = 0; i < count; i++) {
+        out[i] = simplex(x0 + static_cast<float>(static_cast<int32_t>(i)) * step, y, key);
+    }
+}
+
+float SimplexNoise::evaluate(float x, float y) const {
+    return simplex(x, y, _key);
+}
+
+} // namespace tg
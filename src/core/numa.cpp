@@ -0,0 +1,170 @@
+#include "tg/numa.hpp"
+#include "tg/Scheduler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace tg {
+
+#ifdef __linux__
+// From <linux/mempolicy.h>; called through syscall() so libnuma is not needed
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+// "0-3,8,10-11"
+static std::vector<int> parseCpuList(const std::string& text) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while(pos < text.size()) {
+        size_t end = text.find(',', pos);
+        if(end == std::string::npos) end = text.size();
+        std::string range = text.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        try {
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for(int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+        } catch(const std::exception&) { }
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+static std::vector<NumaNode> discoverNodes() {
+    namespace fs = std::filesystem;
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &allowed);
+    }
+
+    std::vector<NumaNode> nodes;
+    std::error_code error;
+    for(const fs::directory_entry& entry : fs::directory_iterator("/sys/devices/system/node", error)) {
+        std::string name = entry.path().filename().string();
+        if(name.rfind("node", 0) != 0 || name.size() == 4 || name.find_first_not_of("0123456789", 4) != std::string::npos) continue;
+
+        std::ifstream file(entry.path() / "cpulist");
+        std::string list;
+        std::getline(file, list);
+
+        NumaNode node{std::stoi(name.substr(4)), {}};
+        for(int cpu : parseCpuList(list)) {
+            if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) node.cpus.push_back(cpu);
+        }
+        if(!node.cpus.empty()) nodes.push_back(std::move(node));
+    }
+
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+    if(nodes.empty()) {
+        NumaNode node{0, {}};
+        for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if(CPU_ISSET(cpu, &allowed)) node.cpus.push_back(cpu);
+        }
+        nodes.push_back(std::move(node));
+    }
+    return nodes;
+}
+
+static void bindPages(uintptr_t begin, uintptr_t end, int mode, const std::vector<int>& nodeIds) {
+    if(end <= begin) return;
+
+    unsigned long mask[16] = {};
+    constexpr size_t maskBits = sizeof(mask) * 8;
+    for(int id : nodeIds) {
+        if(id >= 0 && static_cast<size_t>(id) < maskBits) mask[id / (sizeof(unsigned long) * 8)] |= 1ul << (id % (sizeof(unsigned long) * 8));
+    }
+
+    if(syscall(SYS_mbind, begin, end - begin, mode, mask, maskBits, MPOL_MF_MOVE) != 0) {
+        // Containers often forbid it; the buffers then simply stay where they are first written
+        static std::atomic<bool> warned{false};
+        if(!warned.exchange(true)) fprintf(stderr, "NUMA placement unavailable: %s\n", strerror(errno));
+    }
+}
+#endif
+
+const std::vector<NumaNode>& numaNodes() {
+#ifdef __linux__
+    static const std::vector<NumaNode> nodes = discoverNodes();
+#else
+    static const std::vector<NumaNode> nodes = []() {
+        NumaNode node{0, {}};
+        for(unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++) node.cpus.push_back(static_cast<int>(cpu));
+        return std::vector<NumaNode>{node};
+    }();
+#endif
+    return nodes;
+}
+
+NumaPlacement parseNumaPlacement(const std::string& name) {
+    if(name == "default") return NumaPlacement::Default;
+    if(name == "local") return NumaPlacement::Local;
+    if(name == "interleaved") return NumaPlacement::Interleaved;
+    throw std::invalid_argument("Unknown NUMA placement: " + name + " (expected default, local or interleaved)");
+}
+
+const char* numaPlacementName(NumaPlacement placement) {
+    switch(placement) {
+        case NumaPlacement::Default: return "default";
+        case NumaPlacement::Local: return "local";
+        case NumaPlacement::Interleaved: return "interleaved";
+    }
+    return "default";
+}
+
+void placeRows(void* data, size_t bytes, size_t rows) {
+#ifdef __linux__
+    const std::vector<NumaNode>& nodes = numaNodes();
+    Scheduler& scheduler = Scheduler::shared();
+    NumaPlacement placement = scheduler.options().numa;
+    if(data == nullptr || bytes == 0 || rows == 0 || nodes.size() < 2 || placement == NumaPlacement::Default) return;
+
+    static const uintptr_t pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    auto pageUp = [](uintptr_t address) { return (address + pageSize - 1) / pageSize * pageSize; };
+
+    // mbind works on whole pages: a page shared by two bands goes with the earlier one, a partial first page stays as is
+    uintptr_t base = reinterpret_cast<uintptr_t>(data);
+    if(placement == NumaPlacement::Interleaved) {
+        std::vector<int> ids;
+        for(const NumaNode& node : nodes) ids.push_back(node.id);
+        bindPages(pageUp(base), pageUp(base + bytes), MPOL_INTERLEAVE, ids);
+        return;
+    }
+
+    if(scheduler.nodeCount() < 2) return;
+    size_t rowBytes = bytes / rows;
+    for(size_t node = 0; node < scheduler.nodeCount(); node++) {
+        auto [rowBegin, rowEnd] = scheduler.nodeBand(node, 0, rows);
+        uintptr_t end = rowEnd == rows ? base + bytes : base + rowEnd * rowBytes;
+        bindPages(pageUp(base + rowBegin * rowBytes), pageUp(end), MPOL_PREFERRED, {nodes[node].id});
+    }
+#else
+    (void)data;
+    (void)bytes;
+    (void)rows;
+#endif
+}
+
+} // namespace tg
@@ -0,0 +1,226 @@
+#include "tg/snapshot.hpp"
+#include "tg/AsyncFileWriter.hpp"
+#include "tg/trace.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace tg {
+
+static constexpr char SNAPSHOT_MAGIC[8] = {'T', 'G', 'S', 'N', 'A', 'P', '0', '1'};
+static constexpr size_t SNAPSHOT_ALIGNMENT = 4096;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t bufferCount;
+    uint64_t width;
+    uint64_t height;
+    uint64_t step;
+    uint64_t parameterHash;
+    char kind[16];
+    uint32_t sampleBytes; // 0 in files written before the field existed, which hold floats
+};
+
+static bool checkedMultiply(size_t a, size_t b, size_t& result) {
+    if(a != 0 && b > std::numeric_limits<size_t>::max() / a) return false;
+    result = a * b;
+    return true;
+}
+
+/** @brief Bytes of the buffers a header describes, past the header block; false if a corrupt header makes it overflow */
+static bool payloadSize(const SnapshotInfo& info, size_t& bytes) {
+    size_t samples, bufferBytes;
+    if(!checkedMultiply(info.width, info.height, samples) || !checkedMultiply(samples, info.sampleBytes, bufferBytes)) return false;
+    if(bufferBytes > std::numeric_limits<size_t>::max() - (SNAPSHOT_ALIGNMENT - 1)) return false;
+    size_t aligned = (bufferBytes + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+    return checkedMultiply(aligned, info.bufferCount, bytes) && bytes <= std::numeric_limits<size_t>::max() - SNAPSHOT_ALIGNMENT;
+}
+
+static size_t alignedBufferSize(size_t width, size_t height, size_t sampleBytes) {
+    size_t size = width * height * sampleBytes;
+    return (size + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+// Unique to this process and thread, so concurrent writers of one path, e.g. two processes sharing a heightmap cache,
+// never write into the same temporary file before the rename
+static std::string temporaryPathFor(const std::string& path) {
+#ifdef _WIN32
+    int pid = _getpid();
+#else
+    int pid = getpid();
+#endif
+    size_t thread = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    return path + "." + std::to_string(pid) + "." + std::to_string(thread) + ".tmp";
+}
+
+/**
+ * @brief Flushes a written file, or with directory set the directory entry of one renamed into it, to the device.
+ * Directories cannot be synced on Windows, where renames are only as durable as the file system makes them.
+ */
+static void syncToDevice(const std::string& path, bool directory) {
+#ifdef _WIN32
+    if(directory) return;
+    int fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+    bool synced = fd >= 0 && _commit(fd) == 0;
+    if(fd >= 0) _close(fd);
+#else
+    int fd = open(path.c_str(), directory ? O_RDONLY | O_DIRECTORY : O_RDONLY);
+    bool synced = fd >= 0 && fsync(fd) == 0;
+    if(fd >= 0) close(fd);
+#endif
+    if(!synced) {
+        throw std::runtime_error("Failed to sync snapshot to disk: " + path);
+    }
+}
+
+void writeSnapshot(const std::string& path, const SnapshotInfo& info, const std::vector<const void*>& buffers) {
+    TG_TRACE_SCOPE_VALUE("writeSnapshot", "bytes", info.width * info.height * info.sampleBytes * info.bufferCount);
+
+    if(buffers.size() != info.bufferCount) {
+        throw std::invalid_argument("Snapshot buffer count does not match its header");
+    }
+    if(info.sampleBytes == 0) {
+        throw std::invalid_argument("Snapshot sample size must not be zero");
+    }
+
+    std::vector<char> header(SNAPSHOT_ALIGNMENT, 0);
+    SnapshotHeader fields{};
+    memcpy(fields.magic, SNAPSHOT_MAGIC, sizeof(fields.magic));
+    fields.version = 1;
+    fields.bufferCount = info.bufferCount;
+    fields.width = info.width;
+    fields.height = info.height;
+    fields.step = info.step;
+    fields.parameterHash = info.parameterHash;
+    strncpy(fields.kind, info.kind.c_str(), sizeof(fields.kind) - 1);
+    fields.sampleBytes = info.sampleBytes;
+    memcpy(header.data(), &fields, sizeof(fields));
+
+    std::string temporaryPath = temporaryPathFor(path);
+    try {
+        auto file = AsyncFileWriter::shared().open(temporaryPath);
+        file->append(header.data(), header.size());
+
+        size_t bufferBytes = info.width * info.height * info.sampleBytes;
+        std::vector<char> padding(alignedBufferSize(info.width, info.height, info.sampleBytes) - bufferBytes, 0);
+        for(const void* buffer : buffers) {
+            file->append(buffer, bufferBytes);
+            if(!padding.empty()) file->append(padding.data(), padding.size());
+        }
+
+        file->close();
+
+        // The data must be on the device before the rename can replace the previous snapshot, and the rename after it
+        syncToDevice(temporaryPath, false);
+        std::filesystem::rename(temporaryPath, path);
+        std::filesystem::path directory = std::filesystem::path(path).parent_path();
+        syncToDevice(directory.empty() ? "." : directory.string(), true);
+    } catch(...) {
+        std::error_code error;
+        std::filesystem::remove(temporaryPath, error);
+        throw;
+    }
+}
+
+bool snapshotExists(const std::string& path) {
+    std::error_code error;
+    return std::filesystem::is_regular_file(path, error);
+}
+
+MappedSnapshot::MappedSnapshot(const std::string& path) {
+#ifdef _WIN32
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if(!file) {
+        throw std::runtime_error("Failed to open snapshot: " + path);
+    }
+    _fallback.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(_fallback.data(), _fallback.size());
+    _data = _fallback.data();
+    _size = _fallback.size();
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        throw std::runtime_error("Failed to open snapshot: " + path);
+    }
+
+    struct stat fileInfo;
+    if(fstat(fd, &fileInfo) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to stat snapshot: " + path);
+    }
+    _size = static_cast<size_t>(fileInfo.st_size);
+
+    void* mapped = _size > 0 ? mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(mapped == MAP_FAILED) {
+        throw std::runtime_error("Failed to map snapshot: " + path);
+    }
+    _data = static_cast<const char*>(mapped);
+#endif
+
+    SnapshotHeader fields{};
+    if(_size >= SNAPSHOT_ALIGNMENT) memcpy(&fields, _data, sizeof(fields));
+    if(memcmp(fields.magic, SNAPSHOT_MAGIC, sizeof(fields.magic)) != 0) {
+        unmap();
+        throw std::runtime_error("Not a snapshot file: " + path);
+    }
+
+    _info.kind = std::string(fields.kind, strnlen(fields.kind, sizeof(fields.kind)));
+    _info.parameterHash = fields.parameterHash;
+    _info.width = fields.width;
+    _info.height = fields.height;
+    _info.step = fields.step;
+    _info.bufferCount = fields.bufferCount;
+    _info.sampleBytes = fields.sampleBytes != 0 ? fields.sampleBytes : sizeof(float);
+
+    size_t payload;
+    if(!payloadSize(_info, payload) || _size < SNAPSHOT_ALIGNMENT + payload) {
+        unmap();
+        throw std::runtime_error("Snapshot is truncated or corrupt: " + path);
+    }
+}
+
+MappedSnapshot::~MappedSnapshot() {
+    unmap();
+}
+
+void MappedSnapshot::unmap() {
+#ifndef _WIN32
+    if(_data) munmap(const_cast<char*>(_data), _size);
+#endif
+    _data = nullptr;
+}
+
+const float* MappedSnapshot::buffer(uint32_t index) const {
+    if(_info.sampleBytes != sizeof(float)) {
+        throw std::runtime_error("Snapshot does not hold float samples");
+    }
+    return static_cast<const float*>(samples(index));
+}
+
+const void* MappedSnapshot::samples(uint32_t index) const {
+    if(index >= _info.bufferCount) {
+        throw std::out_of_range("Snapshot buffer index out of range");
+    }
+    return _data + SNAPSHOT_ALIGNMENT + index * alignedBufferSize(_info.width, _info.height, _info.sampleBytes);
+}
+
+} // namespace tg
@@ -0,0 +1,361 @@
+#include "tg/sweep.hpp"
+#include "tg/cache.hpp"
+#include "tg/trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <stdexcept>
+
+namespace tg {
+
+static constexpr size_t MAX_SWEEP_VARIANTS = 10000;
+
+static size_t decimalPlaces(const std::string& number) {
+    size_t point = number.find('.');
+    if(point == std::string::npos) return 0;
+    size_t end = number.find_first_of("eE", point);
+    return (end == std::string::npos ? number.size() : end) - point - 1;
+}
+
+static std::vector<std::string> splitList(const std::string& text, char separator) {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while(true) {
+        size_t end = text.find(separator, start);
+        parts.push_back(text.substr(start, end - start));
+        if(end == std::string::npos) return parts;
+        start = end + 1;
+    }
+}
+
+SweepAxis parseSweepAxis(const std::string& text) {
+    size_t equals = text.find('=');
+    if(equals == std::string::npos || equals == 0 || equals + 1 == text.size()) {
+        throw std::invalid_argument("Sweep must look like option=v1,v2,... or option=start:stop:step: " + text);
+    }
+
+    SweepAxis axis;
+    axis.option = text.substr(0, equals);
+    if(axis.option.rfind("--", 0) == 0) axis.option.erase(0, 2);
+    std::string values = text.substr(equals + 1);
+
+    std::vector<std::string> range = splitList(values, ':');
+    if(range.size() == 1) {
+        axis.values = splitList(values, ',');
+        for(const std::string& value : axis.values) {
+            if(value.empty()) throw std::invalid_argument("Empty value in sweep: " + text);
+        }
+        return axis;
+    }
+    if(range.size() != 3) {
+        throw std::invalid_argument("Sweep range must be start:stop:step: " + text);
+    }
+
+    double start, stop, step;
+    try {
+        start = std::stod(range[0]);
+        stop = std::stod(range[1]);
+        step = std::stod(range[2]);
+    } catch(const std::exception&) {
+        throw std::invalid_argument("Sweep range must be numeric: " + text);
+    }
+    if(!(step > 0.0) || stop < start) {
+        throw std::invalid_argument("Sweep range needs start <= stop and a positive step: " + text);
+    }
+
+    // Print with the precision the range was written in, so 0.3:0.7:0.1 gives 0.3, not 0.30000000000000004
+    int precision = static_cast<int>(std::max(decimalPlaces(range[0]), decimalPlaces(range[2])));
+    for(size_t i = 0; start + i * step <= stop + step * 1e-6; i++) {
+        if(i >= MAX_SWEEP_VARIANTS) throw std::invalid_argument("Sweep range has too many values: " + text);
+        char value[64];
+        snprintf(value, sizeof(value), "%.*f", precision, start + i * step);
+        axis.values.push_back(value);
+    }
+    return axis;
+}
+
+static std::string labelPart(const SweepAxis& axis, const std::string& value) {
+    std::string part = axis.option + "-" + value;
+    for(char& ch : part) {
+        if(!isalnum(static_cast<unsigned char>(ch)) && ch != '.' && ch != '-') ch = '_';
+    }
+    return part;
+}
+
+/** @brief Variants grouped by shared stages; indices into SweepPlan::variants */
+struct ThermalChain {
+    std::map<int, std::vector<size_t>> byIterations; // variants with the same iteration count get the same result
+};
+
+struct GeneratorNode {
+    size_t representative;
+    std::vector<size_t> unfiltered;
+    std::vector<ThermalChain> chains;
+};
+
+static std::vector<GeneratorNode> buildGraph(const std::vector<SweepVariant>& variants) {
+    std::vector<GeneratorNode> nodes;
+    std::map<uint64_t, size_t> nodeByKey;
+    std::vector<std::vector<std::pair<float, float>>> chainParameters;
+
+    for(size_t i = 0; i < variants.size(); i++) {
+        const JobSpec& spec = variants[i].spec;
+        auto [found, inserted] = nodeByKey.emplace(generatorCacheKey(spec).hash, nodes.size());
+        if(inserted) {
+            nodes.push_back({i, {}, {}});
+            chainParameters.emplace_back();
+        }
+        size_t nodeIndex = found->second;
+        GeneratorNode& node = nodes[nodeIndex];
+
+        if(!spec.thermal) {
+            node.unfiltered.push_back(i);
+            continue;
+        }
+
+        std::pair<float, float> parameters{spec.thermalThreshold, spec.thermalConstant};
+        auto& known = chainParameters[nodeIndex];
+        auto chain = std::find(known.begin(), known.end(), parameters);
+        if(chain == known.end()) {
+            known.push_back(parameters);
+            node.chains.emplace_back();
+            chain = known.end() - 1;
+        }
+        node.chains[chain - known.begin()].byIterations[spec.thermalIterations].push_back(i);
+    }
+    return nodes;
+}
+
+SweepPlan planSweep(const std::vector<std::string>& baseArgs, const std::vector<SweepAxis>& axes) {
+    if(axes.empty()) {
+        throw std::invalid_argument("A sweep needs at least one axis");
+    }
+
+    static const std::set<std::string> fixedOptions = {"name", "output", "path", "checkpoint", "checkpoint-every",
+                                                       "checkpoint-seconds", "resume", "thermal"};
+    size_t count = 1;
+    for(const SweepAxis& axis : axes) {
+        if(fixedOptions.count(axis.option) != 0) {
+            throw std::invalid_argument("--" + axis.option + " cannot be swept");
+        }
+        count *= axis.values.size();
+        if(count > MAX_SWEEP_VARIANTS) {
+            throw std::invalid_argument("Sweep has more than " + std::to_string(MAX_SWEEP_VARIANTS) + " variants");
+        }
+    }
+
+    JobSpec base = parseJobArguments(baseArgs);
+    if(!base.thermalCheckpoint.path.empty()) {
+        throw std::invalid_argument("--checkpoint cannot be used in a sweep; every variant would share one file");
+    }
+    uint32_t seed = base.seed ? *base.seed : generateRandomSeed();
+
+    SweepPlan plan;
+    std::vector<size_t> index(axes.size(), 0);
+    for(size_t n = 0; n < count; n++) {
+        std::vector<std::string> args = baseArgs;
+        std::string label;
+        for(size_t a = 0; a < axes.size(); a++) {
+            const std::string& value = axes[a].values[index[a]];
+            args.push_back("--" + axes[a].option);
+            args.push_back(value);
+            label += (a == 0 ? "" : "_") + labelPart(axes[a], value);
+        }
+
+        SweepVariant variant{parseJobArguments(args), label};
+        JobSpec& spec = variant.spec;
+        if(!spec.seed) spec.seed = seed;
+        spec.name = base.name + "_" + label;
+        for(std::string& output : spec.outputs) {
+            std::filesystem::path path(output);
+            output = (path.parent_path() / (path.stem().string() + "_" + label + path.extension().string())).string();
+        }
+        plan.variants.push_back(std::move(variant));
+
+        // Odometer over the axes, last axis fastest
+        for(size_t a = axes.size(); a-- > 0;) {
+            if(++index[a] < axes[a].values.size()) break;
+            index[a] = 0;
+        }
+    }
+
+    for(const GeneratorNode& node : buildGraph(plan.variants)) {
+        plan.generatorRuns++;
+        plan.thermalRuns += node.chains.size();
+    }
+    return plan;
+}
+
+/**
+ * @brief Walks the sweep graph. Every stage is a pool task that queues the stages depending on it when it
+ * finishes, so no task ever waits on another and a fixed-size pool cannot deadlock.
+ */
+class SweepRun {
+public:
+    SweepRun(SweepPlan& plan, ThreadPool& pool, HeightmapCache* cache,
+             const std::function<void(const SweepVariant&, const std::string&)>& onDone, const ExecutionContext& context)
+        : _plan(plan), _pool(pool), _cache(cache), _onDone(onDone), _context(context) { }
+
+    size_t run() {
+        for(GeneratorNode& node : buildGraph(_plan.variants)) {
+            spawn([this, node = std::move(node)]() { runGenerator(node); });
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _idle.wait(lock, [this]() { return _pending == 0; });
+        return _failed.load();
+    }
+
+private:
+    SweepPlan& _plan;
+    ThreadPool& _pool;
+    HeightmapCache* _cache;
+    const std::function<void(const SweepVariant&, const std::string&)>& _onDone;
+    const ExecutionContext& _context;
+
+    std::mutex _mutex;
+    std::condition_variable _idle;
+    size_t _pending = 0;
+    std::atomic<size_t> _failed{0};
+
+    void spawn(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _pending++;
+        }
+        _pool.submit([this, task = std::move(task)]() {
+            // Stages report their own failures per variant; this only keeps the count of pending tasks right
+            try {
+                task();
+            } catch(const std::exception& e) {
+                fprintf(stderr, "Sweep task failed: %s\n", e.what());
+            }
+            // Notified under the lock: once run() sees no pending tasks this object is gone
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(--_pending == 0) _idle.notify_all();
+        });
+    }
+
+    void finish(size_t variant, const std::string& error) {
+        if(!error.empty()) _failed++;
+        if(_onDone) _onDone(_plan.variants[variant], error);
+    }
+
+    void fail(const std::vector<size_t>& variants, const std::string& error) {
+        for(size_t variant : variants) finish(variant, error);
+    }
+
+    // Writes the outputs of variants sharing one result, after storing it in the cache if it was computed here
+    void exportResult(std::vector<size_t> variants, std::shared_ptr<const Heightmap> heightmap, std::optional<CacheKey> storeKey) {
+        spawn([this, variants = std::move(variants), heightmap = std::move(heightmap), storeKey = std::move(storeKey)]() {
+            if(_cache && storeKey) _cache->store(*storeKey, *heightmap);
+            for(size_t variant : variants) {
+                try {
+                    writeJobOutputs(_plan.variants[variant].spec, *heightmap);
+                    finish(variant, "");
+                } catch(const std::exception& e) {
+                    finish(variant, e.what());
+                }
+            }
+        });
+    }
+
+    void runGenerator(const GeneratorNode& node) {
+        JobSpec spec = _plan.variants[node.representative].spec;
+        spec.thermal = false;
+
+        std::shared_ptr<const Heightmap> heightmap;
+        try {
+            TG_TRACE_SCOPE("sweep generator");
+            heightmap = std::make_shared<const Heightmap>(generateJobHeightmap(spec, nullptr, _cache, _context));
+        } catch(const std::exception& e) {
+            fail(node.unfiltered, e.what());
+            for(const ThermalChain& chain : node.chains) {
+                for(const auto& [iterations, variants] : chain.byIterations) fail(variants, e.what());
+            }
+            return;
+        }
+
+        if(!node.unfiltered.empty()) exportResult(node.unfiltered, heightmap, std::nullopt);
+
+        CacheKey inputKey = generatorCacheKey(spec);
+        for(const ThermalChain& chain : node.chains) {
+            spawn([this, chain, heightmap, inputKey]() { runChain(chain, heightmap, inputKey); });
+        }
+    }
+
+    void runChain(ThermalChain chain, std::shared_ptr<const Heightmap> input, const CacheKey& inputKey) {
+        auto thermalKey = [&](const std::vector<size_t>& variants) {
+            return thermalCacheKey(_plan.variants[variants.front()].spec, inputKey);
+        };
+
+        // Counts that are already cached need no thermal run; the run only goes as far as the last one that is not
+        if(_cache) {
+            for(auto group = chain.byIterations.begin(); group != chain.byIterations.end();) {
+                CacheKey key = thermalKey(group->second);
+                if(std::optional<Heightmap> cached = _cache->load(key)) {
+                    exportResult(group->second, std::make_shared<const Heightmap>(std::move(*cached)), std::nullopt);
+                    group = chain.byIterations.erase(group);
+                } else {
+                    ++group;
+                }
+            }
+        }
+        if(chain.byIterations.empty()) return;
+
+        const JobSpec& spec = _plan.variants[chain.byIterations.rbegin()->second.front()].spec;
+        int lastIterations = chain.byIterations.rbegin()->first;
+
+        std::set<int> emitted;
+        try {
+            TG_TRACE_SCOPE_VALUE("sweep thermal chain", "results", chain.byIterations.size());
+
+            // Intermediate results are emitted between iterations, so zero iterations needs its own (trivial) run
+            if(chain.byIterations.begin()->first <= 0 && lastIterations > 0) {
+                const std::vector<size_t>& variants = chain.byIterations.begin()->second;
+                Heightmap unweathered = *input;
+                applyThermalWeathering(unweathered, spec.thermalThreshold, spec.thermalConstant, chain.byIterations.begin()->first, _context);
+                exportResult(variants, std::make_shared<const Heightmap>(std::move(unweathered)), thermalKey(variants));
+                emitted.insert(chain.byIterations.begin()->first);
+            }
+
+            ThermalCheckpointOptions options;
+            for(const auto& [iterations, variants] : chain.byIterations) {
+                if(iterations > 0 && iterations < lastIterations) options.emitIterations.push_back(iterations);
+            }
+            options.onEmit = [&](int iteration, const Heightmap& intermediate) {
+                const std::vector<size_t>& variants = chain.byIterations.at(iteration);
+                exportResult(variants, std::make_shared<const Heightmap>(intermediate), thermalKey(variants));
+                emitted.insert(iteration);
+            };
+
+            Heightmap heightmap = *input;
+            applyThermalWeathering(heightmap, spec.thermalThreshold, spec.thermalConstant, lastIterations, options, _context);
+
+            const std::vector<size_t>& variants = chain.byIterations.rbegin()->second;
+            exportResult(variants, std::make_shared<const Heightmap>(std::move(heightmap)), thermalKey(variants));
+        } catch(const std::exception& e) {
+            for(const auto& [iterations, variants] : chain.byIterations) {
+                if(emitted.count(iterations) == 0) fail(variants, e.what());
+            }
+        }
+    }
+};
+
+size_t runSweep(SweepPlan& plan, ThreadPool& pool, HeightmapCache* cache,
+                const std::function<void(const SweepVariant& variant, const std::string& error)>& onDone,
+                const ExecutionContext& context) {
+    TG_TRACE_SCOPE_VALUE("runSweep", "variants", plan.variants.size());
+    return SweepRun(plan, pool, cache, onDone, context).run();
+}
+
+} // namespace tg
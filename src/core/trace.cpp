@@ -0,0 +1,278 @@
+#include "tg/trace.hpp"
+
+#include <stdexcept>
+
+#ifdef TG_TRACING
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#endif
+
+namespace tg::trace {
+
+#ifdef TG_TRACING
+
+namespace {
+
+constexpr size_t EVENTS_PER_THREAD = 1 << 16;
+
+enum class EventType : uint8_t { Zone, Counter };
+
+struct Event {
+    const char* name;
+    const char* argName;
+    uint64_t start;
+    uint64_t end;
+    uint64_t value;
+    uint32_t threadId;
+    EventType type;
+};
+
+/**
+ * @brief Fixed-size ring of events; once full, the oldest events are overwritten.
+ * Only its owning thread writes to it, so the lock is uncontended except while a trace is written out.
+ */
+struct ThreadBuffer {
+    std::mutex mutex;
+    std::vector<Event> events = std::vector<Event>(EVENTS_PER_THREAD);
+    size_t next = 0;
+    size_t count = 0;
+
+    void push(const Event& event) {
+        std::lock_guard<std::mutex> lock(mutex);
+        events[next] = event;
+        next = (next + 1) % events.size();
+        count = std::min(count + 1, events.size());
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        next = 0;
+        count = 0;
+    }
+};
+
+/**
+ * @brief Owns every ring buffer. Buffers of exited threads keep their events and are handed to new
+ * threads, so short-lived workers (one set per thermal weathering call) don't grow memory without bound.
+ */
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::vector<ThreadBuffer*> freeBuffers;
+    std::map<uint32_t, std::string> threadNames;
+    std::map<std::string, uint32_t> tracks;     // named tracks get a thread id of their own
+    uint32_t nextThreadId = 1;
+    uint64_t origin = 0;
+};
+
+// Never destroyed: threads may still record while static destructors run at exit
+Registry& registry() {
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+struct ThreadState {
+    ThreadBuffer* buffer = nullptr;
+    uint32_t threadId = 0;
+
+    ~ThreadState() {
+        if(buffer == nullptr) return;
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.freeBuffers.push_back(buffer);
+    }
+
+    void attach() {
+        if(buffer != nullptr) return;
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        if(reg.freeBuffers.empty()) {
+            reg.buffers.push_back(std::make_unique<ThreadBuffer>());
+            buffer = reg.buffers.back().get();
+        } else {
+            buffer = reg.freeBuffers.back();
+            reg.freeBuffers.pop_back();
+        }
+        threadId = reg.nextThreadId++;
+    }
+};
+
+thread_local ThreadState threadState;
+
+void push(const Event& event) {
+    threadState.attach();
+    Event stamped = event;
+    stamped.threadId = threadState.threadId;
+    threadState.buffer->push(stamped);
+}
+
+void writeEscaped(std::string& out, const char* text) {
+    for(const char* ch = text; *ch != '\0'; ch++) {
+        if(*ch == '"' || *ch == '\\') out += '\\';
+        if(static_cast<unsigned char>(*ch) >= 0x20) out += *ch;
+    }
+}
+
+void writeMicroseconds(std::string& out, uint64_t nanoseconds) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.3f", nanoseconds / 1000.0);
+    out += text;
+}
+
+} // namespace
+
+namespace detail {
+
+std::atomic<bool> recording{false};
+
+uint64_t now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void recordZone(const char* name, uint64_t start, uint64_t end, const char* argName, uint64_t argValue) {
+    push({name, argName, start, end, argValue, 0, EventType::Zone});
+}
+
+void recordCounter(const char* name, uint64_t value) {
+    uint64_t time = now();
+    push({name, nullptr, time, time, value, 0, EventType::Counter});
+}
+
+void recordTrackZone(const char* track, const char* name, uint64_t start, uint64_t end) {
+    uint32_t trackId;
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        auto [it, inserted] = reg.tracks.try_emplace(track, 0);
+        if(inserted) {
+            it->second = reg.nextThreadId++;
+            reg.threadNames[it->second] = track;
+        }
+        trackId = it->second;
+    }
+
+    // Stored in the calling thread's buffer, but stamped with the track's id
+    threadState.attach();
+    threadState.buffer->push({name, nullptr, start, end, 0, trackId, EventType::Zone});
+}
+
+void setThreadName(const char* name) {
+    threadState.attach();
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.threadNames[threadState.threadId] = name;
+}
+
+} // namespace detail
+
+void start() {
+    Registry& reg = registry();
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for(auto& buffer : reg.buffers) buffer->clear();
+        reg.origin = detail::now();
+    }
+    detail::recording.store(true, std::memory_order_relaxed);
+}
+
+void stop() {
+    detail::recording.store(false, std::memory_order_relaxed);
+}
+
+bool active() {
+    return detail::recording.load(std::memory_order_relaxed);
+}
+
+void writeChromeJson(const std::string& path) {
+    Registry& reg = registry();
+    std::vector<Event> events;
+    std::map<uint32_t, std::string> threadNames;
+    uint64_t origin;
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for(auto& buffer : reg.buffers) {
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+            size_t first = (buffer->next + buffer->events.size() - buffer->count) % buffer->events.size();
+            for(size_t i = 0; i < buffer->count; i++) {
+                events.push_back(buffer->events[(first + i) % buffer->events.size()]);
+            }
+        }
+        threadNames = reg.threadNames;
+        origin = reg.origin;
+    }
+
+    std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.start < b.start; });
+
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    auto separator = [&]() {
+        if(!first) json += ",\n";
+        first = false;
+    };
+
+    for(const auto& [threadId, name] : threadNames) {
+        separator();
+        json += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + std::to_string(threadId) + ",\"args\":{\"name\":\"";
+        writeEscaped(json, name.c_str());
+        json += "\"}}";
+    }
+
+    for(const Event& event : events) {
+        if(event.start < origin) continue; // recorded before the trace was started
+        separator();
+
+        json += "{\"name\":\"";
+        writeEscaped(json, event.name);
+        json += "\",\"cat\":\"tg\",\"pid\":1,\"tid\":" + std::to_string(event.threadId) + ",\"ts\":";
+        writeMicroseconds(json, event.start - origin);
+
+        if(event.type == EventType::Zone) {
+            json += ",\"ph\":\"X\",\"dur\":";
+            writeMicroseconds(json, event.end - event.start);
+            if(event.argName != nullptr) {
+                json += ",\"args\":{\"";
+                writeEscaped(json, event.argName);
+                json += "\":" + std::to_string(event.value) + "}";
+            }
+        } else {
+            json += ",\"ph\":\"C\",\"args\":{\"value\":" + std::to_string(event.value) + "}";
+        }
+        json += "}";
+    }
+    json += "\n]}\n";
+
+    std::ofstream file(path, std::ios::binary);
+    if(!file) {
+        throw std::runtime_error("Failed to open file for writing: " + path);
+    }
+    file.write(json.data(), json.size());
+    if(!file) {
+        throw std::runtime_error("Failed to write trace: " + path);
+    }
+}
+
+#else
+
+void start() {
+    throw std::runtime_error("Tracing is not available in this build (configure with TG_ENABLE_TRACING=ON)");
+}
+
+void stop() { }
+
+bool active() {
+    return false;
+}
+
+void writeChromeJson(const std::string& /*path*/) {
+    throw std::runtime_error("Tracing is not available in this build (configure with TG_ENABLE_TRACING=ON)");
+}
+
+#endif
+
+} // namespace tg::trace
@@ -1,5 +1,8 @@
 #include "tg/App.hpp"
 
+#include <stdexcept>
+#include <string>
+
 namespace tg {
 
 App::App(int argc, char* argv[]) : argc(argc), argv(argv) { }
@@ -7,6 +10,38 @@ App::App(int argc, char* argv[]) : argc(argc), argv(argv) { }
 App::~App() { }
 
 void App::run() {
+    // --thumbnails and --check-compute run without a window and exit; the rest of the arguments are ignored by the editor.
+    // --validate runs any mode under the validation layer and fails on its errors; --frames quits the editor after n frames
+    std::string thumbnailJobs;
+    std::string thumbnailDirectory = "thumbnails";
+    uint32_t thumbnailSize = 256;
+    bool checkCompute = false;
+    uint64_t maxFrames = 0;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--check-compute") {
+            checkCompute = true;
+        } else if(arg == "--validate") {
+            _renderer.enableValidation();
+        } else if(arg == "--frames" && i + 1 < argc) {
+            maxFrames = std::stoull(argv[++i]);
+        } else if(arg == "--thumbnails" && i + 1 < argc) {
+            thumbnailJobs = argv[++i];
+        } else if(arg == "--thumbnail-dir" && i + 1 < argc) {
+            thumbnailDirectory = argv[++i];
+        } else if(arg == "--thumbnail-size" && i + 1 < argc) {
+            thumbnailSize = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+    }
+    if(checkCompute) {
+        runComputeCheck();
+        return;
+    }
+    if(!thumbnailJobs.empty()) {
+        runHeadless(thumbnailJobs, thumbnailDirectory, thumbnailSize);
+        return;
+    }
+
     // Initialize SDL and create a window
     SDL_Init(SDL_INIT_VIDEO);
 
@@ -22,8 +57,16 @@ void App::run() {
     _renderer.init(_window, argv[0]);
 
     // Main application loop
-    while (_renderer.isRunning()) {
+    uint64_t frames = 0;
+    while (_renderer.isRunning() && (maxFrames == 0 || frames++ < maxFrames)) {
         SDL_Event e;
+
+        // Idle: block until there is input instead of redrawing an unchanged window; input resumes full rate at once
+        int32_t timeout = _renderer.idleWaitMilliseconds();
+        if(timeout > 0 && SDL_WaitEventTimeout(&e, timeout)) {
+            _renderer.handleEvent(e);
+        }
+
         while(SDL_PollEvent(&e) != false) {
             _renderer.handleEvent(e);
         }
@@ -36,6 +79,33 @@ void App::run() {
     _renderer.cleanup();
 
     SDL_DestroyWindow(_window);
+    checkValidation();
+}
+
+void App::runHeadless(const std::string& jobFile, const std::string& directory, uint32_t size) {
+    std::vector<JobSpec> jobs = loadJobFile(jobFile);
+    if(jobs.empty()) throw std::invalid_argument("No jobs in " + jobFile);
+
+    _renderer.initHeadless(size, size);
+    size_t failed = _renderer.renderThumbnails(std::move(jobs), directory);
+    _renderer.cleanup();
+    checkValidation();
+
+    if(failed > 0) throw std::runtime_error(std::to_string(failed) + " thumbnails failed");
+}
+
+void App::runComputeCheck() {
+    _renderer.initHeadless(64, 64);
+    size_t failed = _renderer.checkComputeParity();
+    _renderer.cleanup();
+    checkValidation();
+
+    if(failed > 0) throw std::runtime_error(std::to_string(failed) + " compute parity checks failed");
+}
+
+void App::checkValidation() const {
+    uint32_t errors = _renderer.validationErrors();
+    if(errors > 0) throw std::runtime_error(std::to_string(errors) + " validation errors");
 }
 
 } // namespace tg
@@ -0,0 +1,427 @@
+#include "tg/ComputeTerrain.hpp"
+#include "tg/generator.hpp"
+#include "tg/trace.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <compute_spv.h>
+
+namespace tg {
+
+namespace {
+
+constexpr uint32_t GROUP_SIZE = 16;     // numthreads of every pass in shaders/compute.slang
+constexpr uint32_t BINDING_COUNT = 5;
+constexpr uint32_t RANGE_START = 0x80000000; // orderedBits(0.0f); the range starts at 0 like parallelMinMax()
+
+// Push constants of every pass, see shaders/compute.slang
+struct ComputeParams {
+    uint32_t size[2];
+    uint32_t gridResolution;
+    float threshold;
+    float c;
+};
+
+const char* const ENTRY_POINTS[] = {"perlin", "thermalLoad", "thermalStep", "heightRange", "storeHeights"};
+
+void memoryBarrier(VkCommandBuffer commandBuffer, VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess,
+                   VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess) {
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = srcStage;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstStageMask = dstStage;
+    barrier.dstAccessMask = dstAccess;
+
+    VkDependencyInfo dependencyInfo{};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.memoryBarrierCount = 1;
+    dependencyInfo.pMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+}
+
+void transitionImage(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+                     VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess) {
+    VkImageMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = srcStage;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstStageMask = dstStage;
+    barrier.dstAccessMask = dstAccess;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+    VkDependencyInfo dependencyInfo{};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.imageMemoryBarrierCount = 1;
+    dependencyInfo.pImageMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+}
+
+// Every pass reads what the one before it wrote
+void computeBarrier(VkCommandBuffer commandBuffer) {
+    memoryBarrier(commandBuffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                  VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+}
+
+} // namespace
+
+void ComputeTerrain::init(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamily, VkPipelineCache pipelineCache) {
+    TG_TRACE_SCOPE("create compute pipelines");
+
+    _device = device;
+    _allocator = allocator;
+    _queue = queue;
+
+    VkCommandPoolCreateInfo commandPoolCreateInfo{};
+    commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    commandPoolCreateInfo.queueFamilyIndex = queueFamily;
+    commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    if(vkCreateCommandPool(_device, &commandPoolCreateInfo, nullptr, &_commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute command pool!");
+    }
+
+    VkCommandBufferAllocateInfo commandBufferAllocateInfo{};
+    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocateInfo.commandPool = _commandPool;
+    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandBufferAllocateInfo.commandBufferCount = 1;
+
+    if(vkAllocateCommandBuffers(_device, &commandBufferAllocateInfo, &_commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate compute command buffer!");
+    }
+
+    VkFenceCreateInfo fenceCreateInfo{};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    if(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute fence!");
+    }
+
+    VkDescriptorSetLayoutBinding bindings[BINDING_COUNT]{};
+    for(uint32_t i = 0; i < BINDING_COUNT; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = BINDING_COUNT;
+    layoutInfo.pBindings = bindings;
+
+    if(vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr, &_descriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute descriptor set layout!");
+    }
+
+    VkDescriptorPoolSize poolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * BINDING_COUNT};
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = 2;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+
+    if(vkCreateDescriptorPool(_device, &poolInfo, nullptr, &_descriptorPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute descriptor pool!");
+    }
+
+    VkDescriptorSetLayout setLayouts[2] = {_descriptorSetLayout, _descriptorSetLayout};
+    VkDescriptorSetAllocateInfo setAllocateInfo{};
+    setAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    setAllocateInfo.descriptorPool = _descriptorPool;
+    setAllocateInfo.descriptorSetCount = 2;
+    setAllocateInfo.pSetLayouts = setLayouts;
+
+    if(vkAllocateDescriptorSets(_device, &setAllocateInfo, _descriptorSets) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate compute descriptor sets!");
+    }
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(ComputeParams);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &_descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if(vkCreatePipelineLayout(_device, &pipelineLayoutInfo, nullptr, &_pipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute pipeline layout!");
+    }
+
+    VkShaderModuleCreateInfo moduleInfo{};
+    moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    moduleInfo.codeSize = sizeof(compute_spv);
+    moduleInfo.pCode = compute_spv;
+
+    VkShaderModule shaderModule;
+    if(vkCreateShaderModule(_device, &moduleInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute shader module!");
+    }
+
+    VkComputePipelineCreateInfo pipelineInfos[PassCount]{};
+    for(uint32_t i = 0; i < PassCount; i++) {
+        pipelineInfos[i].sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfos[i].stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfos[i].stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfos[i].stage.module = shaderModule;
+        pipelineInfos[i].stage.pName = ENTRY_POINTS[i];
+        pipelineInfos[i].layout = _pipelineLayout;
+    }
+
+    VkResult result = vkCreateComputePipelines(_device, pipelineCache, PassCount, pipelineInfos, nullptr, _pipelines);
+    vkDestroyShaderModule(_device, shaderModule, nullptr);
+    if(result != VK_SUCCESS) throw std::runtime_error("Failed to create compute pipelines!");
+
+    // Every binding points at a real buffer from the start, even those a run does not use
+    ensureBuffer(_packed, 16, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0);
+    ensureBuffer(_heights[0], 16, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 0);
+    ensureBuffer(_heights[1], 16, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 0);
+    ensureBuffer(_range, 2 * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0);
+    ensureBuffer(_gradients, 16, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+    ensureBuffer(_readback, 16, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+    updateDescriptorSets();
+}
+
+void ComputeTerrain::destroy() {
+    if(_device == VK_NULL_HANDLE) return;
+
+    wait();
+    destroyBuffer(_packed);
+    destroyBuffer(_heights[0]);
+    destroyBuffer(_heights[1]);
+    destroyBuffer(_range);
+    destroyBuffer(_gradients);
+    destroyBuffer(_readback);
+
+    for(VkPipeline pipeline : _pipelines) vkDestroyPipeline(_device, pipeline, nullptr);
+    vkDestroyPipelineLayout(_device, _pipelineLayout, nullptr);
+    vkDestroyDescriptorPool(_device, _descriptorPool, nullptr);
+    vkDestroyDescriptorSetLayout(_device, _descriptorSetLayout, nullptr);
+    vkDestroyFence(_device, _fence, nullptr);
+    vkDestroyCommandPool(_device, _commandPool, nullptr);
+
+    _device = VK_NULL_HANDLE;
+}
+
+void ComputeTerrain::ensureBuffer(Buffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags) {
+    if(buffer.buffer != VK_NULL_HANDLE && buffer.size >= size) return;
+    destroyBuffer(buffer);
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo allocInfo{};
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+    allocInfo.flags = flags;
+
+    VmaAllocationInfo allocationInfo{};
+    if(vmaCreateBuffer(_allocator, &bufferInfo, &allocInfo, &buffer.buffer, &buffer.allocation, &allocationInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute buffer!");
+    }
+    buffer.size = size;
+    buffer.mapped = allocationInfo.pMappedData;
+}
+
+void ComputeTerrain::destroyBuffer(Buffer& buffer) {
+    if(buffer.buffer == VK_NULL_HANDLE) return;
+    vmaDestroyBuffer(_allocator, buffer.buffer, buffer.allocation);
+    buffer = Buffer();
+}
+
+void ComputeTerrain::updateDescriptorSets() {
+    VkWriteDescriptorSet writes[2 * BINDING_COUNT]{};
+    VkDescriptorBufferInfo bufferInfos[2 * BINDING_COUNT]{};
+
+    for(uint32_t set = 0; set < 2; set++) {
+        const Buffer* buffers[BINDING_COUNT] = {&_packed, &_heights[set], &_heights[1 - set], &_range, &_gradients};
+        for(uint32_t binding = 0; binding < BINDING_COUNT; binding++) {
+            uint32_t i = set * BINDING_COUNT + binding;
+            bufferInfos[i].buffer = buffers[binding]->buffer;
+            bufferInfos[i].offset = 0;
+            bufferInfos[i].range = VK_WHOLE_SIZE;
+
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = _descriptorSets[set];
+            writes[i].dstBinding = binding;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].pBufferInfo = &bufferInfos[i];
+        }
+    }
+
+    vkUpdateDescriptorSets(_device, 2 * BINDING_COUNT, writes, 0, nullptr);
+}
+
+void ComputeTerrain::dispatch(Pass pass, uint32_t set) {
+    vkCmdBindPipeline(_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipelines[pass]);
+    vkCmdBindDescriptorSets(_commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipelineLayout, 0, 1, &_descriptorSets[set], 0, nullptr);
+    vkCmdDispatch(_commandBuffer, (_width + GROUP_SIZE - 1) / GROUP_SIZE, (_height + GROUP_SIZE - 1) / GROUP_SIZE, 1);
+}
+
+void ComputeTerrain::submit(const ComputeRequest& request, VkImage image, VkSemaphore waitSemaphore, uint64_t waitValue) {
+    TG_TRACE_SCOPE_VALUE("submit compute terrain", "pixels", uint64_t(request.width) * request.height);
+
+    if(request.width < 2 || request.height < 2) throw std::invalid_argument("Compute terrain needs at least 2x2 samples");
+    if(request.perlin && request.perlinGridSize == 0) throw std::invalid_argument("Perlin grid size must be positive");
+
+    // The buffers and the command buffer are reused, so the previous run has to be done with them
+    wait();
+
+    _width = request.width;
+    _height = request.height;
+    VkDeviceSize count = VkDeviceSize(_width) * _height;
+    VkDeviceSize packedBytes = (count + 1) / 2 * sizeof(uint32_t);
+
+    ensureBuffer(_packed, packedBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, 0);
+    ensureBuffer(_readback, packedBytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+    if(request.thermal) {
+        ensureBuffer(_heights[0], count * sizeof(float), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 0);
+        ensureBuffer(_heights[1], count * sizeof(float), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 0);
+    }
+    if(request.perlin) {
+        std::vector<float> gradients = perlinGradients(request.perlinGridSize, request.seed);
+        ensureBuffer(_gradients, gradients.size() * sizeof(float), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+        memcpy(_gradients.mapped, gradients.data(), gradients.size() * sizeof(float));
+        vmaFlushAllocation(_allocator, _gradients.allocation, 0, VK_WHOLE_SIZE);
+    }
+    updateDescriptorSets();
+
+    if(vkResetCommandBuffer(_commandBuffer, 0) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to reset compute command buffer!");
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(_commandBuffer, &beginInfo);
+
+        ComputeParams params{};
+        params.size[0] = _width;
+        params.size[1] = _height;
+        params.gridResolution = request.perlinGridSize;
+        params.threshold = request.thermalThreshold;
+        params.c = request.thermalConstant;
+        vkCmdPushConstants(_commandBuffer, _pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+
+        VkBufferImageCopy imageCopy{};
+        imageCopy.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        imageCopy.imageExtent = {_width, _height, 1};
+
+        VkImageLayout imageLayout;
+        if(request.perlin) {
+            dispatch(Perlin, 0);
+            imageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        } else {
+            // Frames submitted earlier may still be drawing from the texture; the copy waits for their vertex shaders
+            transitionImage(_commandBuffer, image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                            VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT, 0, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+            vkCmdCopyImageToBuffer(_commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, _packed.buffer, 1, &imageCopy);
+            memoryBarrier(_commandBuffer, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                          VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+            imageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        }
+
+        if(request.thermal) {
+            int iterations = std::max(request.thermalIterations, 0);
+            vkCmdFillBuffer(_commandBuffer, _range.buffer, 0, VK_WHOLE_SIZE, RANGE_START);
+
+            computeBarrier(_commandBuffer);
+            dispatch(ThermalLoad, 0);
+
+            // Set 0 reads the first float buffer and writes the second, set 1 the other way round
+            for(int i = 0; i < iterations; i++) {
+                computeBarrier(_commandBuffer);
+                dispatch(ThermalStep, i % 2);
+            }
+            uint32_t resultSet = iterations % 2;
+
+            memoryBarrier(_commandBuffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_CLEAR_BIT,
+                          VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                          VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+            dispatch(HeightRange, resultSet);
+            computeBarrier(_commandBuffer);
+            dispatch(StoreHeights, resultSet);
+        }
+
+        memoryBarrier(_commandBuffer, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                      VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+        transitionImage(_commandBuffer, image, imageLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_COPY_BIT, 0,
+                        VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+
+        vkCmdCopyBufferToImage(_commandBuffer, _packed.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageCopy);
+
+        VkBufferCopy readbackCopy{0, 0, packedBytes};
+        vkCmdCopyBuffer(_commandBuffer, _packed.buffer, _readback.buffer, 1, &readbackCopy);
+
+        transitionImage(_commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                        VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+        memoryBarrier(_commandBuffer, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+
+    vkEndCommandBuffer(_commandBuffer);
+
+    VkSemaphoreSubmitInfo waitSemaphoreInfo{};
+    waitSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+    waitSemaphoreInfo.semaphore = waitSemaphore;
+    waitSemaphoreInfo.value = waitValue;
+    waitSemaphoreInfo.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+
+    VkCommandBufferSubmitInfo commandBufferInfo{};
+    commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+    commandBufferInfo.commandBuffer = _commandBuffer;
+
+    VkSubmitInfo2 submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+    submitInfo.waitSemaphoreInfoCount = waitSemaphore != VK_NULL_HANDLE ? 1 : 0;
+    submitInfo.pWaitSemaphoreInfos = &waitSemaphoreInfo;
+    submitInfo.commandBufferInfoCount = 1;
+    submitInfo.pCommandBufferInfos = &commandBufferInfo;
+
+    if(vkResetFences(_device, 1, &_fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to reset compute fence!");
+    }
+    if(vkQueueSubmit2(_queue, 1, &submitInfo, _fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit compute command buffer!");
+    }
+    _submitted = true;
+}
+
+bool ComputeTerrain::finished() const {
+    return !_submitted || vkGetFenceStatus(_device, _fence) == VK_SUCCESS;
+}
+
+void ComputeTerrain::wait() {
+    if(!_submitted) return;
+    TG_TRACE_SCOPE("wait for compute terrain");
+    if(vkWaitForFences(_device, 1, &_fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to wait for compute fence!");
+    }
+}
+
+void ComputeTerrain::readResult(uint16_t* data) const {
+    TG_TRACE_SCOPE_VALUE("read compute terrain", "pixels", uint64_t(_width) * _height);
+
+    // The packed pairs are little-endian, so the buffer already is the row-major uint16 array
+    vmaInvalidateAllocation(_allocator, _readback.allocation, 0, VK_WHOLE_SIZE);
+    memcpy(data, _readback.mapped, size_t(_width) * _height * sizeof(uint16_t));
+}
+
+} // namespace tg
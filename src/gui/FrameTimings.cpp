@@ -0,0 +1,55 @@
+#include "tg/FrameTimings.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace tg {
+
+void FrameTimings::record(FrameStage stage, float milliseconds) {
+    History& entry = _histories[static_cast<size_t>(stage)];
+    entry.samples[entry.next] = milliseconds;
+    entry.next = (entry.next + 1) % HISTORY;
+    entry.count = std::min(entry.count + 1, HISTORY);
+}
+
+size_t FrameTimings::offset(FrameStage stage) const {
+    const History& entry = history(stage);
+    return entry.count < HISTORY ? 0 : entry.next;
+}
+
+float FrameTimings::percentile(FrameStage stage, float fraction) const {
+    const History& entry = history(stage);
+    if(entry.count == 0) return 0.0f;
+
+    // Nearest rank over a copy; a few hundred samples, once per overlay redraw
+    std::array<float, HISTORY> sorted;
+    std::copy_n(entry.samples.begin(), entry.count, sorted.begin());
+    size_t rank = static_cast<size_t>(std::ceil(std::clamp(fraction, 0.0f, 1.0f) * entry.count));
+    size_t index = std::min(rank == 0 ? 0 : rank - 1, entry.count - 1);
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.begin() + entry.count);
+    return sorted[index];
+}
+
+float FrameTimings::latest(FrameStage stage) const {
+    const History& entry = history(stage);
+    if(entry.count == 0) return 0.0f;
+    return entry.samples[(entry.next + HISTORY - 1) % HISTORY];
+}
+
+const char* FrameTimings::name(FrameStage stage) {
+    switch(stage) {
+        case FrameStage::Frame: return "Frame";
+        case FrameStage::Update: return "Update";
+        case FrameStage::FenceWait: return "Fence wait";
+        case FrameStage::Record: return "Record";
+        case FrameStage::Submit: return "Submit";
+        case FrameStage::Present: return "Present";
+        case FrameStage::GpuTerrain: return "GPU terrain pass";
+        case FrameStage::GpuGui: return "GPU GUI pass";
+        case FrameStage::GpuTotal: return "GPU total";
+        case FrameStage::Count: break;
+    }
+    return "";
+}
+
+} // namespace tg
@@ -0,0 +1,141 @@
+#include "tg/PipelineCache.hpp"
+#include "tg/trace.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace tg {
+
+namespace {
+
+constexpr char FILE_MAGIC[4] = {'T', 'G', 'P', 'C'};
+constexpr uint32_t FILE_VERSION = 1;
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+    uint64_t dataHash;
+};
+
+uint64_t hashBytes(const std::vector<char>& data) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for(char ch : data) {
+        hash ^= static_cast<unsigned char>(ch);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+FileHeader headerFor(const VkPhysicalDeviceProperties& properties) {
+    FileHeader header{};
+    memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    header.driverVersion = properties.driverVersion;
+    memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    return header;
+}
+
+/** @return the cache data of a file written on this device and driver, or nothing */
+std::vector<char> readCacheFile(const std::string& path, const VkPhysicalDeviceProperties& properties) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if(!file) return {};
+    std::streamoff fileSize = file.tellg();
+    file.seekg(0);
+
+    FileHeader header;
+    if(!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return {};
+
+    FileHeader expected = headerFor(properties);
+    if(memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version ||
+       header.vendorID != expected.vendorID || header.deviceID != expected.deviceID || header.driverVersion != expected.driverVersion ||
+       memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+        return {};
+    }
+
+    // A damaged or truncated size must not turn into a huge allocation
+    if(fileSize < 0 || header.dataSize > static_cast<uint64_t>(fileSize) - sizeof(header)) return {};
+
+    std::vector<char> data(header.dataSize);
+    if(!file.read(data.data(), static_cast<std::streamsize>(data.size())) || hashBytes(data) != header.dataHash) return {};
+    return data;
+}
+
+} // namespace
+
+void PipelineCache::init(VkDevice device, const VkPhysicalDeviceProperties& properties, const std::string& path) {
+    TG_TRACE_SCOPE("load pipeline cache");
+
+    _device = device;
+    _properties = properties;
+    _path = path;
+
+    std::vector<char> data;
+    if(!_path.empty()) data = readCacheFile(_path, _properties);
+
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheInfo.initialDataSize = data.size();
+    cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+    if(vkCreatePipelineCache(_device, &cacheInfo, nullptr, &_cache) != VK_SUCCESS) {
+        // The driver still gets to reject data that passed the header check; start empty then
+        cacheInfo.initialDataSize = 0;
+        cacheInfo.pInitialData = nullptr;
+        data.clear();
+        if(vkCreatePipelineCache(_device, &cacheInfo, nullptr, &_cache) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create pipeline cache!");
+        }
+    }
+    _loaded = !data.empty();
+}
+
+void PipelineCache::save() {
+    if(_cache == VK_NULL_HANDLE || _path.empty()) return;
+    TG_TRACE_SCOPE("save pipeline cache");
+
+    size_t size = 0;
+    std::vector<char> data;
+    if(vkGetPipelineCacheData(_device, _cache, &size, nullptr) != VK_SUCCESS) return;
+    data.resize(size);
+    if(vkGetPipelineCacheData(_device, _cache, &size, data.data()) != VK_SUCCESS) return;
+    data.resize(size);
+
+    FileHeader header = headerFor(_properties);
+    header.dataSize = data.size();
+    header.dataHash = hashBytes(data);
+
+    std::string temporaryPath = _path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if(!file) {
+            fprintf(stderr, "Failed to write pipeline cache: %s\n", temporaryPath.c_str());
+            return;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, _path, error);
+    if(error) fprintf(stderr, "Failed to write pipeline cache: %s\n", error.message().c_str());
+}
+
+void PipelineCache::destroy() {
+    if(_cache == VK_NULL_HANDLE) return;
+    vkDestroyPipelineCache(_device, _cache, nullptr);
+    _cache = VK_NULL_HANDLE;
+}
+
+} // namespace tg
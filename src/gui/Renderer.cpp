@@ -1,7 +1,15 @@
 #include "tg/Renderer.hpp"
-
+#include "tg/job.hpp"
+#include "tg/trace.hpp"
+#include "tg/version.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
-#include <fstream>
+#include <set>
 #include <string>
 
 #include <glm/gtc/matrix_transform.hpp>
@@ -13,22 +21,119 @@
 #include <SDL3/SDL_vulkan.h>
 #include <VkBootstrap.h>
 
+// Generated from the compiled shaders by embed_spirv.cmake
+#include <default_spv.h>
+#include <displaced_spv.h>
+
 namespace tg {
 
+// Enough for a 64 << 31 sample map; TerrainQuadtree levels beyond this never occur
+static constexpr uint32_t MAX_LOD_LEVELS = 32;
+
+// Start of the frame, end of the viewport pass, end of the GUI pass
+static constexpr uint32_t TIMESTAMP_COUNT = 3;
+
+static float millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static uint64_t steadyNanoseconds() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Per-user directory for the caches, with a trailing separator; empty if SDL cannot provide one
+static std::string preferencesPath() {
+    std::string prefPath;
+    if(char* path = SDL_GetPrefPath("terrainGen", "Terrain-Generator")) {
+        prefPath = path;
+        SDL_free(path);
+    }
+    return prefPath;
+}
+
 void Renderer::init(SDL_Window* window, char* argv0) {
+    _initStart = std::chrono::steady_clock::now();
     _window = window;
     executablePath = argv0;
 
+    std::string prefPath = preferencesPath();
+
     initVulkan();
+
+    VkPhysicalDeviceProperties physicalDeviceProperties;
+    vkGetPhysicalDeviceProperties(_physicalDevice, &physicalDeviceProperties);
+    _pipelineCache.init(_device, physicalDeviceProperties, prefPath.empty() ? std::string() : prefPath + "pipeline_cache.bin");
+
+    // Pipelines are first needed by the first frame, so the driver compiles them while the swapchain, ImGui and
+    // the default geometry are set up. The worker only creates objects of its own and reads the pipeline cache.
+    std::future<float> pipelines = std::async(std::launch::async, [this]() {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        createGraphicsPipeline();
+        initCompute();
+        return millisecondsSince(start);
+    });
+
     createSwapchain();
     initGUI();
     createViewportResources();
     initDefaultGeometry();
 
     NFD_Init();
+
+    // Regenerating with the same seed and settings, e.g. to try other filters, reads the earlier stages back
+    if(!prefPath.empty()) {
+        try {
+            _heightmapCache = std::make_unique<HeightmapCache>(prefPath + "cache", HEIGHTMAP_CACHE_BYTES);
+        } catch(const std::exception& e) {
+            fprintf(stderr, "Heightmap cache disabled: %s\n", e.what());
+        }
+    }
+    seed = generateRandomSeed();
+
+    _pipelineMilliseconds = pipelines.get();
+
+    // Ring buffers are bounded, so the editor always records and File > Save Trace dumps the recent past
+    if(trace::compiledIn) {
+        trace::start();
+        TG_TRACE_THREAD_NAME("main");
+    }
+}
+
+void Renderer::initHeadless(uint32_t width, uint32_t height) {
+    _initStart = std::chrono::steady_clock::now();
+    _headless = true;
+    _mainViewportExtent = {width, height};
+    _mainViewportWidth = width;
+
+    std::string prefPath = preferencesPath();
+
+    initVulkan();
+    if(width == 0 || height == 0 || width > _maxViewportSize || height > _maxViewportSize) {
+        throw std::runtime_error("Thumbnail size is outside the device's image size limit!");
+    }
+
+    VkPhysicalDeviceProperties physicalDeviceProperties;
+    vkGetPhysicalDeviceProperties(_physicalDevice, &physicalDeviceProperties);
+    _pipelineCache.init(_device, physicalDeviceProperties, prefPath.empty() ? std::string() : prefPath + "pipeline_cache.bin");
+
+    std::chrono::steady_clock::time_point pipelineStart = std::chrono::steady_clock::now();
+    createGraphicsPipeline();
+    initCompute();
+    _pipelineMilliseconds = millisecondsSince(pipelineStart);
+
+    createViewportResources();
+    initDefaultGeometry();
+
+    for(int i=0; i < NUM_FRAME_OVERLAP; i++) {
+        _frames[i].thumbnailReadback = createBuffer(VkDeviceSize(width) * height * 4, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                    VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+        vmaMapMemory(_allocator, _frames[i].thumbnailReadback.allocation, &_frames[i].thumbnailReadbackData);
+    }
 }
 
 void Renderer::handleEvent(const SDL_Event& event) {
+    _framesSinceEvent = 0;
+
     // Forward event to ImGui
     ImGui_ImplSDL3_ProcessEvent(&event);
 
@@ -36,12 +141,34 @@ void Renderer::handleEvent(const SDL_Event& event) {
         case SDL_EVENT_QUIT:
             _isRunning = false;
             break;
+        case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+            _swapchainOutdated = true;
+            break;
         default:
             break;
     }   
 }
 
+/**
+ * @note A minimized window waits too; its swapchain is recreated on the next wake-up that finds it has an area again.
+ * Generation jobs finish on their own thread, so while one runs the loop wakes often enough to show progress and swap it in.
+ */
+int32_t Renderer::idleWaitMilliseconds() const {
+    if(_framesSinceEvent < IDLE_AFTER_FRAMES) return 0;
+    if(_generation || _computeRun.pending) return JOB_WAIT_MILLISECONDS;
+    return IDLE_WAIT_MILLISECONDS;
+}
+
 void Renderer::update() {
+    TG_TRACE_SCOPE("update");
+    std::chrono::steady_clock::time_point updateStart = std::chrono::steady_clock::now();
+
+    if(_framesSinceEvent < IDLE_AFTER_FRAMES) _framesSinceEvent++;
+
+    // Before the GUI is laid out, so it already uses the new size
+    if(_swapchainOutdated) recreateSwapchain();
+    ensureViewportImages(getCurrentFrame());
+
     ImGui_ImplVulkan_NewFrame();
     ImGui_ImplSDL3_NewFrame();
     ImGui::NewFrame();
@@ -76,6 +203,39 @@ void Renderer::update() {
                     NFD_FreePathU8(savePath);
                 }
             }
+            if(ImGui::BeginMenu("Export as .r16 tiles")) {
+                // Common UE5 landscape sizes; tiles share their edge rows
+                for(size_t tileSize : {505, 1009, 2017, 4033}) {
+                    std::string label = std::to_string(tileSize) + " x " + std::to_string(tileSize);
+                    if(ImGui::MenuItem(label.c_str())) {
+                        nfdu8char_t *savePath = nullptr;
+
+                        nfdsavedialogu8args_t args = {0};
+                        args.defaultName = "heightmap.r16";
+
+                        nfdresult_t result = NFD_SaveDialogU8_With(&savePath, &args);
+
+                        if(result == NFD_OKAY){
+                            exportHeightmapAsR16Tiles(_currentHeightmap, savePath, tileSize);
+                            NFD_FreePathU8(savePath);
+                        }
+                    }
+                }
+                ImGui::EndMenu();
+            }
+            if(trace::compiledIn && ImGui::MenuItem("Save Trace...")) {
+                nfdu8char_t *savePath = nullptr;
+
+                nfdsavedialogu8args_t args = {0};
+                args.defaultName = "trace.json";
+
+                nfdresult_t result = NFD_SaveDialogU8_With(&savePath, &args);
+
+                if(result == NFD_OKAY){
+                    trace::writeChromeJson(savePath);
+                    NFD_FreePathU8(savePath);
+                }
+            }
             if(ImGui::MenuItem("Quit")) {
                 _isRunning = false;
             }
@@ -88,6 +248,15 @@ void Renderer::update() {
                 pitch = glm::radians(30.0f);
                 panOffset = glm::vec2(0.0f, 0.0f);
             }
+            ImGui::Separator();
+            if(ImGui::MenuItem("Mesh", nullptr, _renderMode == RenderMode::Mesh)) {
+                _renderMode = RenderMode::Mesh;
+            }
+            if(ImGui::MenuItem("GPU Displacement", nullptr, _renderMode == RenderMode::Displaced, fitsHeightmapTexture(_currentHeightmap.width, _currentHeightmap.height))) {
+                _renderMode = RenderMode::Displaced;
+            }
+            ImGui::Separator();
+            ImGui::MenuItem("Frame Timings", nullptr, &_showFrameTimings);
         ImGui::EndMenu();
         }
         if(ImGui::BeginMenu("Help")) {
@@ -115,6 +284,21 @@ void Renderer::update() {
         ImGui::Separator();
 
         ImGui::InputInt("Size", &selectedSize);
+        ImGui::InputScalar("Seed", ImGuiDataType_U32, &seed);
+        ImGui::SameLine();
+        if(ImGui::Button("New Seed")) {
+            seed = generateRandomSeed();
+        }
+
+        ImGui::BeginDisabled(!_computeAvailable);
+        int backend = static_cast<int>(selectedBackend);
+        if(ImGui::Combo("Backend", &backend, backendNames, 2)) {
+            selectedBackend = static_cast<Backend>(backend);
+        }
+        ImGui::EndDisabled();
+        if(selectedBackend == Backend::Compute && selectedMethod != 0) {
+            ImGui::TextWrapped("Only Perlin noise runs on the GPU; this method and its weathering use the CPU.");
+        }
 
         if(ImGui::CollapsingHeader("Generation Method")){
             ImGui::PushStyleColor(ImGuiCol_Header,        ImVec4(0.55f, 0.55f, 0.60f, 1.0f));
@@ -132,7 +316,7 @@ void Renderer::update() {
             ImGui::PushStyleColor(ImGuiCol_PopupBg, ImVec4(0.70f, 0.70f, 0.75f, 1.0f));
 
             if(ImGui::BeginCombo("Method", methodNames[selectedMethod])) {
-                for(int i=0; i < 3; i++) {
+                for(int i=0; i < 4; i++) {
                     bool isSelected = (selectedMethod == i);
                     if(ImGui::Selectable(methodNames[i], isSelected)) {
                         selectedMethod = i;
@@ -162,11 +346,18 @@ void Renderer::update() {
                     ImGui::InputInt("Iterations##Faulting", &faultingIterations);
                 }
                 ImGui::Unindent();
+            } else if(selectedMethod == 3) {
+                ImGui::Indent();
+                if(ImGui::CollapsingHeader("Simplex Noise Parameters")) {
+                    ImGui::InputInt("Grid Size##Simplex", &perlinGridSize);
+                }
+                ImGui::Unindent();
             }
 
             ImGui::PopStyleColor(10);
         }
 
+        bool shouldApplyThermal = false;
         if(ImGui::CollapsingHeader("Post Processing Filters")) {
 
             ImGui::PushStyleColor(ImGuiCol_Header,        ImVec4(0.55f, 0.55f, 0.60f, 1.0f));
@@ -192,6 +383,7 @@ void Renderer::update() {
                     ImGui::InputFloat("Scaling constant", &thermalConstant);
                     thermalConstant = glm::clamp(thermalConstant, 0.0f, 1.0f);
                 }
+                shouldApplyThermal = ImGui::Button("Apply to Current Terrain");
             ImGui::Unindent();
 
             ImGui::PopStyleColor(10);
@@ -200,6 +392,22 @@ void Renderer::update() {
         ImGui::Spacing();
 
         bool shouldGenerate = ImGui::Button("Generate");
+        if(_generation) {
+            ImGui::SameLine();
+            if(ImGui::Button("Cancel")) {
+                cancelGeneration();
+            } else {
+                ImGui::SameLine();
+                ImGui::ProgressBar(_generation->progress.load(), ImVec2(-1.0f, 0.0f), _generation->stage.load());
+            }
+        } else if(_computeRun.pending) {
+            // A compute run cannot be stopped halfway; a newer request replaces it once it is done
+            ImGui::SameLine();
+            ImGui::TextUnformatted("Running on the GPU...");
+        }
+        if(!_generationError.empty()) {
+            ImGui::TextWrapped("Generation failed: %s", _generationError.c_str());
+        }
         
     ImGui::End();
 
@@ -211,16 +419,20 @@ void Renderer::update() {
     bool viewportHovered;
     ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0, 0));
     ImGui::Begin("Main Viewport", nullptr, panelFlags);
-        ImGui::Image(getCurrentFrame()._GUIdescriptorSet, ImVec2(_mainViewportExtent.width / ImGui::GetIO().DisplayFramebufferScale.x, _mainViewportExtent.height / ImGui::GetIO().DisplayFramebufferScale.y));
+        VkExtent2D capacity = getCurrentFrame().viewportCapacity;
+        ImGui::Image(getCurrentFrame()._GUIdescriptorSet, ImVec2(_mainViewportExtent.width / ImGui::GetIO().DisplayFramebufferScale.x, _mainViewportExtent.height / ImGui::GetIO().DisplayFramebufferScale.y),
+                     ImVec2(0.0f, 0.0f), ImVec2(static_cast<float>(_mainViewportExtent.width) / capacity.width, static_cast<float>(_mainViewportExtent.height) / capacity.height));
 
         viewportHovered = ImGui::IsWindowHovered();
     ImGui::End();
     ImGui::PopStyleVar();
 
+    if(_showFrameTimings) drawFrameTimings();
+
     if(ImGui::BeginPopupModal("About##Popup")) {
         ImGui::Text("Terrain-Generator");
         ImGui::Separator();
-        ImGui::TextWrapped("Version 1.0.0\n(c) 2025 Benjamin Wei\n");
+        ImGui::TextWrapped("Version %s\n(c) 2025 Benjamin Wei\n", libraryVersion);
         ImGui::Spacing();
         ImGui::TextWrapped("This application uses third-party libraries:");
         ImGui::BulletText("Dear ImGui (MIT)");
@@ -313,35 +525,46 @@ void Renderer::update() {
         ImGui::EndPopup();
     }
 
-    // Handle Terrain Generation
+    // Handle Terrain Generation; the job runs in the background, or on the GPU, on a snapshot of the settings
     if(shouldGenerate) {
-        if(selectedMethod == 0) {
-            _currentHeightmap = generatePerlinNoiseHeightmap(selectedSize, selectedSize, perlinGridSize);
-        } else if(selectedMethod == 1) {
-            _currentHeightmap = generateDiamondSquareHeightmap(selectedSize, selectedSize, diamondSquareRoughness);
-        } else if(selectedMethod == 2) {
-            _currentHeightmap = generateFaultingHeightmap(selectedSize, selectedSize, faultingIterations);
+        JobSpec spec;
+        constexpr GenerationMethod methods[4] = { GenerationMethod::Perlin, GenerationMethod::DiamondSquare, GenerationMethod::Faulting,
+                                                  GenerationMethod::Simplex };
+        spec.method = methods[selectedMethod];
+        spec.width = selectedSize;
+        spec.height = selectedSize;
+        spec.seed = seed;
+        spec.perlinGridSize = perlinGridSize;
+        spec.diamondSquareRoughness = diamondSquareRoughness;
+        spec.faultingIterations = faultingIterations;
+        spec.thermal = shouldThermalWeather;
+        spec.thermalThreshold = thermalThreshold;
+        spec.thermalConstant = thermalConstant;
+        spec.thermalIterations = thermalIterations;
+
+        if(usesCompute(spec)) {
+            startComputeGeneration(std::move(spec));
+        } else {
+            startGeneration(std::move(spec));
         }
-
-        if(shouldThermalWeather) {
-            applyThermalWeathering(_currentHeightmap, thermalThreshold, thermalConstant, thermalIterations);
+    }
+    if(shouldApplyThermal) {
+        if(selectedBackend == Backend::Compute && _computeAvailable && _heightmapTexture.image != VK_NULL_HANDLE) {
+            startComputeThermalEdit();
+        } else {
+            startThermalEdit();
         }
+    }
 
-        Mesh mesh = convertHeightmapToMesh(_currentHeightmap);
-
-        vkDeviceWaitIdle(_device);
-        vmaDestroyBuffer(_allocator, _vertexBuffer.buffer, _vertexBuffer.allocation);
-        vmaDestroyBuffer(_allocator, _indexBuffer.buffer, _indexBuffer.allocation);
+    pollCompute();
+    pollGeneration();
 
-        // Upload index and vertex buffers 
-        _vertexBuffer = uploadToNewDeviceLocalBuffer(mesh.interleavedAttributes.size() * sizeof(Attributes), mesh.interleavedAttributes.data(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-        _indexBuffer = uploadToNewDeviceLocalBuffer(mesh.indices.size() * sizeof(uint32_t), mesh.indices.data(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    // Editing tools change _currentHeightmap in place and mark what they touched; only that part goes to the GPU
+    updateTerrainRegion(takeDirtyRegion(_currentHeightmap), {});
 
-        // Reset view parameters, in case user gets lost or something
-        distance = 4.0f;
-        yaw = glm::radians(45.0f);
-        pitch = glm::radians(30.0f);
-        panOffset = glm::vec2(0.0f, 0.0f);
+    // The displaced mode never needs the mesh, so it is only built once the mesh mode asks for it
+    if(_renderMode == RenderMode::Mesh && !_meshMatchesHeightmap) {
+        uploadMesh(convertHeightmapToMesh(_currentHeightmap));
     }
 
     // Handle Mouse IO
@@ -370,6 +593,13 @@ void Renderer::update() {
         distance = glm::max(distance, 0.1f);
     }
 
+    updateCamera();
+
+    _frameTimings.record(FrameStage::Update, millisecondsSince(updateStart));
+}
+
+/** @brief Computes the orbit camera's matrices and writes them into the current frame's uniform buffer */
+void Renderer::updateCamera() {
     glm::vec3 forward;
     forward.x = cos(pitch) * sin(yaw);
     forward.y = sin(pitch);
@@ -387,26 +617,59 @@ void Renderer::update() {
     glm::mat4 MVP = P_matrix * V_matrix * M_matrix;
     memcpy(getCurrentFrame().uboData, &MVP, sizeof(glm::mat4));
 
+    MVP_matrix = MVP;
+    cameraModelPosition = glm::vec3(glm::inverse(M_matrix) * glm::vec4(cameraPos, 1.0f));
+
     memcpy(static_cast<char*>(getCurrentFrame().uboData) + sizeof(glm::mat4), &normal_matrix, sizeof(glm::mat4));
 }
 
 // @todo: Move some of these functions to a separate helper function header + implementation file
 void Renderer::render() {
-    if(vkWaitForFences(_device, 1, &getCurrentFrame().renderFence, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to wait for fence!");
+    TG_TRACE_SCOPE("render");
+
+    std::chrono::steady_clock::time_point renderStart = std::chrono::steady_clock::now();
+    if(_lastRenderStart != std::chrono::steady_clock::time_point()) {
+        _frameTimings.record(FrameStage::Frame, std::chrono::duration<float, std::milli>(renderStart - _lastRenderStart).count());
+    }
+    _lastRenderStart = renderStart;
+
+    // Minimized: nothing to present to until the window has an area again
+    if(_swapchainOutdated) {
+        ImGui::EndFrame();
+        return;
+    }
+
+    {
+        TG_TRACE_SCOPE("wait for frame fence");
+        if(vkWaitForFences(_device, 1, &getCurrentFrame().renderFence, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to wait for fence!");
+        }
+    }
+    _frameTimings.record(FrameStage::FenceWait, millisecondsSince(renderStart));
+    readFrameTimestamps(getCurrentFrame());
+
+    destroyRetiredResources(false);
+
+    // Nothing the terrain pass draws changed: the GUI samples the image of the last pass instead of drawing it again
+    bool drawTerrain = needsTerrainPass(getCurrentFrame());
+    if(drawTerrain) {
+        bindHeightmapTexture(getCurrentFrame());
+        if(_renderMode == RenderMode::Displaced) selectPatches(getCurrentFrame());
+        setGUITexture(getCurrentFrame(), getCurrentFrame().viewportColor.view);
+    } else {
+        setGUITexture(getCurrentFrame(), _frames[_viewportFrame].viewportColor.view);
     }
 
     uint32_t imageIndex;
     VkResult acquireImageResult = vkAcquireNextImageKHR(_device, _swapchain, UINT64_MAX, getCurrentFrame().imageAcquireToRenderSemaphore, VK_NULL_HANDLE, &imageIndex);
     if(acquireImageResult == VK_ERROR_OUT_OF_DATE_KHR) {
-        // Perhaps in the future I will improve the responsiveness of window resizing by redesigning the swapchain recreation logic
-        vkDeviceWaitIdle(_device);
-        destroySwapchain();
-        createSwapchain();
-        destroyViewportResources();
-        createViewportResources();
+        // Nothing was acquired and the fence is still signalled; the next update() replaces the swapchain
+        _swapchainOutdated = true;
+        ImGui::EndFrame();
         return;
-    } else if(acquireImageResult != VK_SUCCESS && acquireImageResult != VK_SUBOPTIMAL_KHR) {
+    } else if(acquireImageResult == VK_SUBOPTIMAL_KHR) {
+        _swapchainOutdated = true;
+    } else if(acquireImageResult != VK_SUCCESS) {
         throw std::runtime_error("Failed to acquire swapchain image!");
     }
 
@@ -414,6 +677,7 @@ void Renderer::render() {
         throw std::runtime_error("Failed to reset fence!");
     }
 
+    std::chrono::steady_clock::time_point recordStart = std::chrono::steady_clock::now();
     VkCommandBuffer buf = getCurrentFrame()._mainCommandBuffer;
     if(vkResetCommandBuffer(buf, 0) != VK_SUCCESS) {
         throw std::runtime_error("Failed to reset command buffer!");
@@ -426,15 +690,31 @@ void Renderer::render() {
         throw std::runtime_error("Failed to begin command buffer!");
     }
 
+        if(_timestampPeriod > 0.0f) {
+            vkCmdResetQueryPool(buf, getCurrentFrame().timestampPool, 0, TIMESTAMP_COUNT);
+            vkCmdWriteTimestamp2(buf, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, getCurrentFrame().timestampPool, 0);
+        }
+
         // Record main commands
-        recordMainCommands(buf, imageIndex);
+        recordMainCommands(buf, imageIndex, drawTerrain);
+
+        if(_timestampPeriod > 0.0f) {
+            vkCmdWriteTimestamp2(buf, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, getCurrentFrame().timestampPool, 2);
+        }
 
     vkEndCommandBuffer(buf);
+    _frameTimings.record(FrameStage::Record, millisecondsSince(recordStart));
 
-    VkSemaphoreSubmitInfo waitSemaphoreInfo{};
-    waitSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
-    waitSemaphoreInfo.semaphore = getCurrentFrame().imageAcquireToRenderSemaphore;
-    waitSemaphoreInfo.stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+    VkSemaphoreSubmitInfo waitSemaphoreInfos[2]{};
+    waitSemaphoreInfos[0].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+    waitSemaphoreInfos[0].semaphore = getCurrentFrame().imageAcquireToRenderSemaphore;
+    waitSemaphoreInfos[0].stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+
+    // Vertex input and the heightmap reads wait for the uploads queued so far; values already reached cost nothing
+    waitSemaphoreInfos[1].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+    waitSemaphoreInfos[1].semaphore = _uploader.semaphore();
+    waitSemaphoreInfos[1].value = _uploader.lastSubmitted();
+    waitSemaphoreInfos[1].stageMask = VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT;
 
     VkSemaphoreSubmitInfo signalSemaphoreInfo{};
     signalSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
@@ -447,16 +727,31 @@ void Renderer::render() {
 
     VkSubmitInfo2 submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
-    submitInfo.waitSemaphoreInfoCount = 1;
+    submitInfo.waitSemaphoreInfoCount = _uploader.lastSubmitted() > 0 ? 2 : 1;
     submitInfo.signalSemaphoreInfoCount = 1;
     submitInfo.commandBufferInfoCount = 1;
 
-    submitInfo.pWaitSemaphoreInfos = &waitSemaphoreInfo;
+    submitInfo.pWaitSemaphoreInfos = waitSemaphoreInfos;
     submitInfo.pSignalSemaphoreInfos = &signalSemaphoreInfo;
     submitInfo.pCommandBufferInfos = &commandBufferInfo;
 
-    if(vkQueueSubmit2(_graphicsQueue, 1, &submitInfo, getCurrentFrame().renderFence) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to submit main command buffer!");
+    std::chrono::steady_clock::time_point submitStart = std::chrono::steady_clock::now();
+    {
+        TG_TRACE_SCOPE("submit");
+        if(vkQueueSubmit2(_graphicsQueue, 1, &submitInfo, getCurrentFrame().renderFence) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to submit main command buffer!");
+        }
+    }
+    _frameTimings.record(FrameStage::Submit, millisecondsSince(submitStart));
+    getCurrentFrame().timestampsWritten = _timestampPeriod > 0.0f;
+    getCurrentFrame().submitTime = steadyNanoseconds();
+
+    if(drawTerrain) {
+        _viewportStale = false;
+        _viewportFrame = _frameCount % NUM_FRAME_OVERLAP;
+        _viewportMVP = MVP_matrix;
+        _viewportExtentDrawn = _mainViewportExtent;
+        _viewportMode = _renderMode;
     }
 
     // Submit Queue Present
@@ -469,69 +764,400 @@ void Renderer::render() {
     presentInfo.pImageIndices = &imageIndex;
 
     // @todo: Does vkbootstrap initialize the presentQueue to be exclusive or concurrent? Potential issue. Will test later.
-    VkResult presentResult = vkQueuePresentKHR(_presentQueue, &presentInfo);
+    std::chrono::steady_clock::time_point presentStart = std::chrono::steady_clock::now();
+    VkResult presentResult;
+    {
+        TG_TRACE_SCOPE("present");
+        presentResult = vkQueuePresentKHR(_presentQueue, &presentInfo);
+    }
+    _frameTimings.record(FrameStage::Present, millisecondsSince(presentStart));
 
     if(presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR) {
-        vkDeviceWaitIdle(_device);
-        destroySwapchain();
-        createSwapchain();
-        destroyViewportResources();
-        createViewportResources();
+        _swapchainOutdated = true;
     } else if(presentResult != VK_SUCCESS) {
         throw std::runtime_error("Failed to present swapchain image!");
     }
 
+    if(_timeToFirstFrame == 0.0f) {
+        _timeToFirstFrame = millisecondsSince(_initStart);
+        fprintf(stderr, "Time to first frame: %.1f ms (pipelines %.1f ms, pipeline cache %s)\n", _timeToFirstFrame,
+                _pipelineMilliseconds, _pipelineCache.loaded() ? "hit" : "miss");
+    }
+
+    _frameCount++;
+}
+
+/**
+ * @note The next job generates while the current one is drawn, and each image is read back NUM_FRAME_OVERLAP frames after
+ * it was submitted, once its fence is signalled anyway, and written by the file writer in the background. The GPU waits
+ * for the terrain uploads on the uploader's timeline, so the loop itself only blocks on generation.
+ */
+size_t Renderer::renderThumbnails(std::vector<JobSpec> jobs, const std::string& directory) {
+    TG_TRACE_SCOPE_VALUE("render thumbnails", "jobs", jobs.size());
+    std::filesystem::create_directories(directory);
+
+    auto generate = [this](JobSpec spec) {
+        bool buildQuadtree = fitsHeightmapTexture(spec.width, spec.height);
+        return std::async(std::launch::async, [spec = std::move(spec), buildQuadtree]() mutable {
+            TG_TRACE_SCOPE_VALUE("generate terrain", "pixels", spec.width * spec.height);
+
+            GeneratedTerrain terrain;
+            terrain.heightmap = generateJobHeightmap(spec);
+            if(buildQuadtree) terrain.quadtree = TerrainQuadtree(terrain.heightmap, PATCH_QUADS);
+            else terrain.mesh = convertHeightmapToMesh(terrain.heightmap);
+            return terrain;
+        });
+    };
+
+    std::vector<std::future<void>> writes;
+    std::set<std::string> usedNames;
+    size_t failed = 0;
+
+    std::future<GeneratedTerrain> next;
+    if(!jobs.empty()) next = generate(jobs.front());
+    for(size_t i = 0; i < jobs.size(); i++) {
+        std::future<GeneratedTerrain> current = std::move(next);
+        if(i + 1 < jobs.size()) next = generate(jobs[i + 1]);
+
+        // Jobs without --name or an output share their generator's name
+        std::string name = jobs[i].name;
+        if(!usedNames.insert(name).second) name += "_" + std::to_string(i);
+
+        try {
+            GeneratedTerrain terrain = current.get();
+            _renderMode = terrain.quadtree.levelCount() > 0 ? RenderMode::Displaced : RenderMode::Mesh;
+            swapInTerrain(terrain);
+            renderThumbnail((std::filesystem::path(directory) / (name + ".png")).string(), writes);
+        } catch(const std::exception& e) {
+            fprintf(stderr, "Thumbnail %s failed: %s\n", name.c_str(), e.what());
+            failed++;
+        }
+    }
+
+    // The last NUM_FRAME_OVERLAP images are still on the GPU
+    for(DataPerFrame& frame : _frames) {
+        if(vkWaitForFences(_device, 1, &frame.renderFence, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to wait for fence!");
+        }
+        if(!frame.thumbnailPath.empty()) writes.push_back(writeThumbnail(frame));
+    }
+
+    for(std::future<void>& write : writes) {
+        try {
+            write.get();
+        } catch(const std::exception& e) {
+            fprintf(stderr, "Failed to write thumbnail: %s\n", e.what());
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/** @brief Headless counterpart of render(): draws the current terrain and queues the copy of the image to the frame's readback buffer */
+void Renderer::renderThumbnail(const std::string& path, std::vector<std::future<void>>& writes) {
+    TG_TRACE_SCOPE("render thumbnail");
+    DataPerFrame& frame = getCurrentFrame();
+
+    if(vkWaitForFences(_device, 1, &frame.renderFence, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to wait for fence!");
+    }
+    readFrameTimestamps(frame);
+    if(!frame.thumbnailPath.empty()) writes.push_back(writeThumbnail(frame));
+
+    destroyRetiredResources(false);
+    ensureViewportImages(frame);
+    updateCamera();
+    bindHeightmapTexture(frame);
+    if(_renderMode == RenderMode::Displaced) selectPatches(frame);
+
+    if(vkResetFences(_device, 1, &frame.renderFence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to reset fence!");
+    }
+
+    VkCommandBuffer buf = frame._mainCommandBuffer;
+    if(vkResetCommandBuffer(buf, 0) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to reset command buffer!");
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if(vkBeginCommandBuffer(buf, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin command buffer!");
+    }
+
+        if(_timestampPeriod > 0.0f) {
+            vkCmdResetQueryPool(buf, frame.timestampPool, 0, TIMESTAMP_COUNT);
+            vkCmdWriteTimestamp2(buf, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, frame.timestampPool, 0);
+        }
+
+        recordViewportCommands(buf);
+
+        VkImageMemoryBarrier viewportBarrierFromColorAttachmentToTransferSource{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .pNext = nullptr,
+            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = frame.viewportColor.image,
+            .subresourceRange = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1
+        }};
+
+        vkCmdPipelineBarrier(
+            buf,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0,
+            0, nullptr,
+            0, nullptr,
+            1, &viewportBarrierFromColorAttachmentToTransferSource);
+
+        // The viewport fills the top-left corner of the image; the readback buffer holds exactly that, tightly packed
+        VkBufferImageCopy region{};
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.imageExtent = {_mainViewportExtent.width, _mainViewportExtent.height, 1};
+        vkCmdCopyImageToBuffer(buf, frame.viewportColor.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, frame.thumbnailReadback.buffer, 1, &region);
+
+        VkBufferMemoryBarrier readbackBarrier{};
+        readbackBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        readbackBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        readbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        readbackBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        readbackBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        readbackBarrier.buffer = frame.thumbnailReadback.buffer;
+        readbackBarrier.offset = 0;
+        readbackBarrier.size = VK_WHOLE_SIZE;
+
+        vkCmdPipelineBarrier(
+            buf,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+            0,
+            0, nullptr,
+            1, &readbackBarrier,
+            0, nullptr);
+
+        if(_timestampPeriod > 0.0f) {
+            vkCmdWriteTimestamp2(buf, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frame.timestampPool, 2);
+        }
+
+    vkEndCommandBuffer(buf);
+
+    // Vertex input and the heightmap reads wait for the terrain's uploads
+    VkSemaphoreSubmitInfo waitSemaphoreInfo{};
+    waitSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+    waitSemaphoreInfo.semaphore = _uploader.semaphore();
+    waitSemaphoreInfo.value = _uploader.lastSubmitted();
+    waitSemaphoreInfo.stageMask = VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT;
+
+    VkCommandBufferSubmitInfo commandBufferInfo{};
+    commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+    commandBufferInfo.commandBuffer = buf;
+
+    VkSubmitInfo2 submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+    submitInfo.waitSemaphoreInfoCount = _uploader.lastSubmitted() > 0 ? 1 : 0;
+    submitInfo.pWaitSemaphoreInfos = &waitSemaphoreInfo;
+    submitInfo.commandBufferInfoCount = 1;
+    submitInfo.pCommandBufferInfos = &commandBufferInfo;
+
+    if(vkQueueSubmit2(_graphicsQueue, 1, &submitInfo, frame.renderFence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit thumbnail command buffer!");
+    }
+    frame.timestampsWritten = _timestampPeriod > 0.0f;
+    frame.submitTime = steadyNanoseconds();
+    frame.thumbnailPath = path;
+
     _frameCount++;
 }
 
+/**
+ * @brief Converts the frame's read back BGRA image to RGBA and hands it to the file writer
+ * @note call after waiting for the frame's fence
+ */
+std::future<void> Renderer::writeThumbnail(DataPerFrame& frame) {
+    TG_TRACE_SCOPE("write thumbnail");
+
+    uint32_t width = _mainViewportExtent.width;
+    uint32_t height = _mainViewportExtent.height;
+    vmaInvalidateAllocation(_allocator, frame.thumbnailReadback.allocation, 0, VK_WHOLE_SIZE);
+
+    const uint8_t* bgra = static_cast<const uint8_t*>(frame.thumbnailReadbackData);
+    std::vector<uint8_t> rgba(size_t(width) * height * 4);
+    for(size_t i = 0; i < rgba.size(); i += 4) {
+        rgba[i + 0] = bgra[i + 2];
+        rgba[i + 1] = bgra[i + 1];
+        rgba[i + 2] = bgra[i + 0];
+        rgba[i + 3] = bgra[i + 3];
+    }
+
+    std::string path = std::move(frame.thumbnailPath);
+    frame.thumbnailPath.clear();
+    return exportImageAsPngAsync(rgba.data(), width, height, path);
+}
+
+size_t Renderer::checkComputeParity() {
+    TG_TRACE_SCOPE("check compute parity");
+    if(!_computeAvailable) throw std::runtime_error("The device cannot run the compute backend!");
+
+    struct ParityCase {
+        const char* name;
+        uint32_t width;
+        uint32_t height;
+        uint32_t gridSize;
+        uint32_t seed;
+        int thermalIterations;  // 0 for none
+        bool edit;              // weather a map uploaded from the host instead of generating one
+    };
+
+    // Odd and non-square sizes leave a lone sample in the last packed pair and partial workgroups on both edges
+    const ParityCase cases[] = {
+        {"perlin", 257, 257, 4, 11, 0, false},
+        {"perlin", 333, 300, 6, 3, 0, false},
+        {"perlin + thermal", 256, 256, 8, 7, 25, false},
+        {"thermal edit", 201, 160, 3, 5, 15, true},
+    };
+
+    size_t failed = 0;
+    for(const ParityCase& test : cases) {
+        Heightmap expected = generatePerlinNoiseHeightmap(test.width, test.height, test.gridSize, test.seed);
+
+        ComputeRequest request;
+        request.width = test.width;
+        request.height = test.height;
+
+        Texture texture;
+        if(test.edit) {
+            texture = uploadToNewHeightmapTexture(expected);
+        } else {
+            texture = createHeightmapTexture(test.width, test.height);
+            request.perlin = true;
+            request.perlinGridSize = test.gridSize;
+            request.seed = test.seed;
+        }
+        if(test.thermalIterations > 0) {
+            request.thermal = true;
+            request.thermalIterations = test.thermalIterations;
+            applyThermalWeathering(expected, request.thermalThreshold, request.thermalConstant, test.thermalIterations);
+        }
+
+        std::vector<uint16_t> actual(expected.data.size());
+        _compute.submit(request, texture.image, _uploader.semaphore(), _uploader.lastSubmitted());
+        _compute.wait();
+        _compute.readResult(actual.data());
+
+        vkDestroyImageView(_device, texture.view, nullptr);
+        vmaDestroyImage(_allocator, texture.image, texture.allocation);
+
+        int maxDifference = 0;
+        for(size_t i = 0; i < actual.size(); i++) {
+            maxDifference = std::max(maxDifference, std::abs(static_cast<int>(actual[i]) - static_cast<int>(expected.data[i])));
+        }
+
+        bool passed = maxDifference <= COMPUTE_PARITY_TOLERANCE;
+        fprintf(passed ? stdout : stderr, "Compute parity, %s %ux%u: largest difference %d%s\n", test.name, test.width, test.height,
+                maxDifference, passed ? "" : ", FAILED");
+        if(!passed) failed++;
+    }
+    return failed;
+}
+
 void Renderer::cleanup() {
+    // Jobs still running hold the heightmap cache; let them stop before anything goes away
+    cancelGeneration();
+    for(auto& job : _cancelledGenerations) job->result.wait();
+    _cancelledGenerations.clear();
+
     vkDeviceWaitIdle(_device);
+    destroyRetiredResources(true);
+    _compute.destroy();
+    _uploader.destroy();
 
-    NFD_Quit();
+    // Holds ImGui's pipeline as well as ours, so the next start compiles neither
+    _pipelineCache.save();
+
+    if(!_headless) NFD_Quit();
 
     // Cleanup VMA
     vmaDestroyBuffer(_allocator, _vertexBuffer.buffer, _vertexBuffer.allocation);
     vmaDestroyBuffer(_allocator, _indexBuffer.buffer, _indexBuffer.allocation);
+    vmaDestroyBuffer(_allocator, _patchVertexBuffer.buffer, _patchVertexBuffer.allocation);
+    vmaDestroyBuffer(_allocator, _patchIndexBuffer.buffer, _patchIndexBuffer.allocation);
+    vkDestroyImageView(_device, _heightmapTexture.view, nullptr);
+    vmaDestroyImage(_allocator, _heightmapTexture.image, _heightmapTexture.allocation);
+    vkDestroyImageView(_device, _computeRun.texture.view, nullptr);
+    vmaDestroyImage(_allocator, _computeRun.texture.image, _computeRun.texture.allocation);
 
     for(int i=0; i < NUM_FRAME_OVERLAP; i++) {
         vmaUnmapMemory(_allocator, _frames[i]._uboBuffer.allocation);
         vmaDestroyBuffer(_allocator, _frames[i]._uboBuffer.buffer, _frames[i]._uboBuffer.allocation);
+        if(_frames[i].patchInstanceCapacity > 0) {
+            vmaUnmapMemory(_allocator, _frames[i].patchInstanceBuffer.allocation);
+            vmaDestroyBuffer(_allocator, _frames[i].patchInstanceBuffer.buffer, _frames[i].patchInstanceBuffer.allocation);
+        }
+        vmaUnmapMemory(_allocator, _frames[i].indirectBuffer.allocation);
+        vmaDestroyBuffer(_allocator, _frames[i].indirectBuffer.buffer, _frames[i].indirectBuffer.allocation);
+        if(_frames[i].thumbnailReadback.buffer != VK_NULL_HANDLE) {
+            vmaUnmapMemory(_allocator, _frames[i].thumbnailReadback.allocation);
+            vmaDestroyBuffer(_allocator, _frames[i].thumbnailReadback.buffer, _frames[i].thumbnailReadback.allocation);
+        }
         //vkFreeDescriptorSets(_device, _descriptorPool, 1, &_frames[i]._descriptorSet);
         vkDestroyCommandPool(_device, _frames[i]._commandPool, nullptr);
         vkDestroyFence(_device, _frames[i].renderFence, nullptr);
         vkDestroySemaphore(_device, _frames[i].imageAcquireToRenderSemaphore, nullptr);
+        vkDestroyQueryPool(_device, _frames[i].timestampPool, nullptr);
     }
 
+    // The viewport images are VMA allocations, so they go before the allocator
+    destroyViewportResources();
     vmaDestroyAllocator(_allocator);
 
     for(int i=0; i < _renderToPresentSemaphores.size(); i++) {
         vkDestroySemaphore(_device, _renderToPresentSemaphores[i], nullptr);
     }
 
-    destroyViewportResources();
-
     // Cleanup ImGui
-    ImGui_ImplVulkan_Shutdown();
-    ImGui_ImplSDL3_Shutdown();
-    ImGui::DestroyContext();
+    if(!_headless) {
+        ImGui_ImplVulkan_Shutdown();
+        ImGui_ImplSDL3_Shutdown();
+        ImGui::DestroyContext();
 
-    destroySwapchain();
+        destroySwapchain();
+    }
 
     vkDestroyDescriptorPool(_device, _descriptorPool, nullptr);
     vkDestroySampler(_device, _sampler, nullptr);
     vkDestroyPipeline(_device, _graphicsPipeline, nullptr);
+    vkDestroyPipeline(_device, _displacedPipeline, nullptr);
     vkDestroyPipelineLayout(_device, _pipelineLayout, nullptr);
+    _pipelineCache.destroy();
     vkDestroyDescriptorSetLayout(_device, _descriptorSetLayout, nullptr);
 
     vkDestroyCommandPool(_device, _commandPool, nullptr);
 
-    vkDestroySurfaceKHR(_instance, _surface, nullptr);
+    if(!_headless) vkDestroySurfaceKHR(_instance, _surface, nullptr);
     vkDestroyDevice(_device, nullptr);
 
     vkb::destroy_debug_utils_messenger(_instance, _debugMessenger);
     vkDestroyInstance(_instance, nullptr);
 }
 
+/** @brief Debug messenger of enableValidation(): prints every message and counts the errors in the atomic at userData */
+static VKAPI_ATTR VkBool32 VKAPI_CALL countValidationMessages(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT type,
+                                                              const VkDebugUtilsMessengerCallbackDataEXT* callbackData, void* userData) {
+    fprintf(stderr, "[%s: %s] %s\n", vkb::to_string_message_severity(severity), vkb::to_string_message_type(type), callbackData->pMessage);
+    if(severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+        static_cast<std::atomic<uint32_t>*>(userData)->fetch_add(1);
+    }
+    return VK_FALSE;
+}
+
 void Renderer::initVulkan() {
     // Enable validation layers if in debug mode
 #ifndef NDEBUG
@@ -542,18 +1168,32 @@ void Renderer::initVulkan() {
 
     // Use VkBootstrap to create an instance and debug messenger
     vkb::InstanceBuilder instanceBuilder;
-    vkb::Result<vkb::Instance> instanceResult = instanceBuilder.set_app_name("Terrain Generator")
-        .request_validation_layers(bRequestValidationLayers)
-        .use_default_debug_messenger()
+    instanceBuilder.set_app_name("Terrain Generator")
         .require_api_version(VK_API_VERSION_1_3)
-        .build();
+        .set_headless(_headless);
+    if(_validation) {
+        // Required rather than requested, so a run without the layer fails instead of passing unchecked
+        instanceBuilder.enable_validation_layers()
+            .add_validation_feature_enable(VK_VALIDATION_FEATURE_ENABLE_SYNCHRONIZATION_VALIDATION_EXT)
+            .set_debug_callback(countValidationMessages)
+            .set_debug_callback_user_data_pointer(&_validationErrors);
+    } else {
+        instanceBuilder.request_validation_layers(bRequestValidationLayers)
+            .use_default_debug_messenger();
+    }
+
+    vkb::Result<vkb::Instance> instanceResult = instanceBuilder.build();
+    if(!instanceResult) {
+        throw std::runtime_error("Failed to create Vulkan instance: " + instanceResult.error().message());
+    }
 
     vkb::Instance vkbInstance = instanceResult.value();
     _instance = vkbInstance.instance;
     _debugMessenger = vkbInstance.debug_messenger;
 
-    // Create a surface
-    SDL_Vulkan_CreateSurface(_window, _instance, nullptr, &_surface);
+    // Create a surface; headless mode needs no presentation support, so any Vulkan 1.3 device will do, lavapipe included
+    _surface = VK_NULL_HANDLE;
+    if(!_headless) SDL_Vulkan_CreateSurface(_window, _instance, nullptr, &_surface);
 
     // Select a Physical device; create a logical device and queues
     VkPhysicalDeviceVulkan13Features physicalDeviceVulkan13Features{};
@@ -561,16 +1201,27 @@ void Renderer::initVulkan() {
     physicalDeviceVulkan13Features.dynamicRendering = VK_TRUE;
     physicalDeviceVulkan13Features.synchronization2 = VK_TRUE;
 
+    VkPhysicalDeviceVulkan12Features physicalDeviceVulkan12Features{};
+    physicalDeviceVulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    physicalDeviceVulkan12Features.timelineSemaphore = VK_TRUE;
+
     vkb::PhysicalDeviceSelector selector{ vkbInstance };
     vkb::Result<vkb::PhysicalDevice> physicalDeviceResult = selector
         .set_minimum_version(1, 3)
         .set_surface(_surface)
         .set_required_features_13(physicalDeviceVulkan13Features)
+        .set_required_features_12(physicalDeviceVulkan12Features)
         .select();
 
     vkb::PhysicalDevice vkbPhysicalDevice = physicalDeviceResult.value();
     _physicalDevice = vkbPhysicalDevice.physical_device;
 
+    // Without these the terrain patches still go out in one indirect draw instead of one per LOD level
+    VkPhysicalDeviceFeatures indirectFeatures{};
+    indirectFeatures.multiDrawIndirect = VK_TRUE;
+    indirectFeatures.drawIndirectFirstInstance = VK_TRUE;
+    _multiDrawIndirect = vkbPhysicalDevice.enable_features_if_present(indirectFeatures);
+
     vkb::DeviceBuilder deviceBuilder{ vkbPhysicalDevice };
     vkb::Device vkbDevice = deviceBuilder.build().value();
     _device = vkbDevice.device;
@@ -578,7 +1229,28 @@ void Renderer::initVulkan() {
     _graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
     _graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
-    _presentQueue = vkbDevice.get_queue(vkb::QueueType::present).value();
+    if(!_headless) _presentQueue = vkbDevice.get_queue(vkb::QueueType::present).value();
+
+    // Timestamps are optional per queue family; without them the frame timing overlay shows the CPU side only
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, queueFamilies.data());
+    uint32_t timestampBits = queueFamilies[_graphicsQueueFamily].timestampValidBits;
+    if(timestampBits > 0) {
+        _timestampPeriod = vkbPhysicalDevice.properties.limits.timestampPeriod;
+        _timestampMask = timestampBits >= 64 ? UINT64_MAX : (uint64_t(1) << timestampBits) - 1;
+    }
+
+    // Uploads go to a transfer-only queue where there is one, so copies run alongside rendering
+    vkb::Result<VkQueue> transferQueue = vkbDevice.get_dedicated_queue(vkb::QueueType::transfer);
+    if(transferQueue.has_value()) {
+        _transferQueue = transferQueue.value();
+        _transferQueueFamily = vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+    } else {
+        _transferQueue = _graphicsQueue;
+        _transferQueueFamily = _graphicsQueueFamily;
+    }
 
     // Create General Command Pool
     VkCommandPoolCreateInfo commandPoolCreateInfo{};
@@ -597,30 +1269,49 @@ void Renderer::initVulkan() {
     allocatorInfo.instance = _instance;
 
     vmaCreateAllocator(&allocatorInfo, &_allocator);
+    _maxViewportSize = vkbPhysicalDevice.properties.limits.maxImageDimension2D;
+
+    _uploader.init(_device, _allocator, _transferQueue, _transferQueueFamily);
+
+    // Sampling R16_UNORM is optional; without it, or for maps past the image size limit, only the mesh mode is offered
+    VkFormatProperties heightmapFormatProperties;
+    vkGetPhysicalDeviceFormatProperties(_physicalDevice, VK_FORMAT_R16_UNORM, &heightmapFormatProperties);
+    if(heightmapFormatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) {
+        _maxHeightmapTextureSize = vkbPhysicalDevice.properties.limits.maxImageDimension2D;
+    } else {
+        _renderMode = RenderMode::Mesh;
+    }
 
-    VkDescriptorSetLayoutBinding uboLayoutBinding{};
-    uboLayoutBinding.binding = 0;
-    uboLayoutBinding.descriptorCount = 1;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    VkDescriptorSetLayoutBinding layoutBindings[2]{};
+    layoutBindings[0].binding = 0;
+    layoutBindings[0].descriptorCount = 1;
+    layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    layoutBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    layoutBindings[1].binding = 1;
+    layoutBindings[1].descriptorCount = 1;
+    layoutBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    layoutBindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = 1;
-    layoutInfo.pBindings = &uboLayoutBinding;
+    layoutInfo.bindingCount = 2;
+    layoutInfo.pBindings = layoutBindings;
     if(vkCreateDescriptorSetLayout(_device, &layoutInfo, nullptr, &_descriptorSetLayout) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create descriptor set layout!");
     }
 
-    VkDescriptorPoolSize uboSize{};
-    uboSize.descriptorCount = static_cast<uint32_t>(NUM_FRAME_OVERLAP);
-    uboSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    VkDescriptorPoolSize poolSizes[2]{};
+    poolSizes[0].descriptorCount = static_cast<uint32_t>(NUM_FRAME_OVERLAP);
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[1].descriptorCount = static_cast<uint32_t>(NUM_FRAME_OVERLAP);
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
 
     VkDescriptorPoolCreateInfo descriptorPoolCreateInfo{};
     descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     descriptorPoolCreateInfo.maxSets = static_cast<uint32_t>(NUM_FRAME_OVERLAP);
-    descriptorPoolCreateInfo.poolSizeCount = 1;
-    descriptorPoolCreateInfo.pPoolSizes = &uboSize;
+    descriptorPoolCreateInfo.poolSizeCount = 2;
+    descriptorPoolCreateInfo.pPoolSizes = poolSizes;
 
     if(vkCreateDescriptorPool(_device, &descriptorPoolCreateInfo, nullptr, &_descriptorPool) != VK_SUCCESS) throw std::runtime_error("Failed to create descriptor pool!");
 
@@ -640,8 +1331,6 @@ void Renderer::initVulkan() {
 
     if(vkCreateSampler(_device, &samplerInfo, nullptr, &_sampler) != VK_SUCCESS) throw std::runtime_error("Failed to create sampler!");
 
-    createGraphicsPipeline();
-
     // Create command pools, command buffers, fences, semaphores for each frame
     for(int i=0; i < NUM_FRAME_OVERLAP; i++) {
         VkCommandPoolCreateInfo commandPoolCreateInfo{};
@@ -676,6 +1365,16 @@ void Renderer::initVulkan() {
             throw std::runtime_error("Failed to create semaphore!");
         }
 
+        if(_timestampPeriod > 0.0f) {
+            VkQueryPoolCreateInfo queryPoolInfo{};
+            queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolInfo.queryCount = TIMESTAMP_COUNT;
+            if(vkCreateQueryPool(_device, &queryPoolInfo, nullptr, &_frames[i].timestampPool) != VK_SUCCESS) {
+                throw std::runtime_error("Failed to create timestamp query pool!");
+            }
+        }
+
         // Create descriptor set
         VkDescriptorSetAllocateInfo descriptorAllocInfo{};
         descriptorAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
@@ -703,10 +1402,17 @@ void Renderer::initVulkan() {
         writeSet.pBufferInfo = &bufferInfo;
 
         vkUpdateDescriptorSets(_device, 1, &writeSet, 0, nullptr);
+
+        _frames[i].indirectBuffer = createBuffer(MAX_LOD_LEVELS * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+        vmaMapMemory(_allocator, _frames[i].indirectBuffer.allocation, &_frames[i].indirectData);
     }
 }
 
-void Renderer::createSwapchain() {
+/**
+ * @brief Creates the swapchain for the current window size
+ * @param oldSwapchain the swapchain being replaced, if any; it keeps presenting its queued images and is retired by the caller
+ */
+void Renderer::createSwapchain(VkSwapchainKHR oldSwapchain) {
     vkb::SwapchainBuilder swapchainBuilder{ _physicalDevice, _device, _surface };
 
     int w, h;
@@ -717,6 +1423,7 @@ void Renderer::createSwapchain() {
         .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
         .set_desired_extent(static_cast<uint32_t>(w), static_cast<uint32_t>(h))
         .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)
+        .set_old_swapchain(oldSwapchain)
         .build()
         .value();
 
@@ -749,190 +1456,124 @@ void Renderer::destroySwapchain() {
 }
 
 /**
- * @brief Creates Viewport image resources for each frame in flight
- * @note requires _swapchainExtent to be set first
+ * @brief Replaces the swapchain after a resize without waiting for the GPU: the old one is handed to the new one as
+ * oldSwapchain and destroyed once the frames that presented from it have finished
+ * @return false while the window has no area (minimized); the swapchain stays outdated and frames are skipped
+ */
+bool Renderer::recreateSwapchain() {
+    TG_TRACE_SCOPE("recreate swapchain");
+
+    int w, h;
+    SDL_GetWindowSizeInPixels(_window, &w, &h);
+    if(w <= 0 || h <= 0) return false;
+
+    _retiredSwapchains.push_back({_swapchain, std::move(_swapchainImageViews), _frameCount});
+    createSwapchain(_retiredSwapchains.back().swapchain);
+    createViewportResources();
+
+    _swapchainOutdated = false;
+    return true;
+}
+
+/**
+ * @brief Sizes the main viewport from the swapchain; the images behind it are (re)allocated per frame, see ensureViewportImages()
+ * @note requires _swapchainExtent to be set first; headless, the viewport keeps the thumbnail size from initHeadless()
  */
 void Renderer::createViewportResources() {
-    _mainViewportExtent = VkExtent2D(_swapchainExtent.width * 0.65, _swapchainExtent.height);
-    _mainViewportWidth = static_cast<float>(_swapchainExtent.width) * 0.65f; // @todo: cleanup duplicate variable
+    if(!_headless) {
+        _mainViewportExtent = VkExtent2D(_swapchainExtent.width * 0.65, _swapchainExtent.height);
+        _mainViewportWidth = static_cast<float>(_swapchainExtent.width) * 0.65f; // @todo: cleanup duplicate variable
+    }
 
     P_matrix = glm::perspective(glm::radians(45.0f), static_cast<float>(_mainViewportExtent.width) / _mainViewportExtent.height, 0.1f, 100.0f);
     P_matrix[1][1] *= -1;
+}
 
-    for(int i=0; i < NUM_FRAME_OVERLAP; i++) {
-        // Create the color attachment image for the main viewport
-        VkImageCreateInfo imageCreateInfo{};
-        imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-        imageCreateInfo.format = VK_FORMAT_B8G8R8A8_UNORM;
-        imageCreateInfo.extent.width = _swapchainExtent.width * 0.65;
-        imageCreateInfo.extent.height = _swapchainExtent.height;
-        imageCreateInfo.extent.depth = 1;
-        imageCreateInfo.mipLevels = 1;
-        imageCreateInfo.arrayLayers = 1;
-        imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-        imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-        imageCreateInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-        imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-
-        if(vkCreateImage(_device, &imageCreateInfo, nullptr, &_frames[i].mainViewportImage) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to create main viewport color attachment image!");
-        }
+/**
+ * @brief Makes sure the frame's viewport images hold _mainViewportExtent. They are reused while the viewport fits, the
+ * viewport drawing into their top-left corner, and reallocated with slack when it grows past them or shrinks far below,
+ * so dragging the window edge rarely allocates. Replaced images are retired, never waited for.
+ */
+void Renderer::ensureViewportImages(DataPerFrame& frame) {
+    VkExtent2D needed = _mainViewportExtent;
+    VkExtent2D& capacity = frame.viewportCapacity;
+    bool fits = needed.width <= capacity.width && needed.height <= capacity.height;
+    bool wasteful = needed.width * VIEWPORT_SHRINK_FACTOR < capacity.width || needed.height * VIEWPORT_SHRINK_FACTOR < capacity.height;
+    if(fits && !wasteful) return;
+
+    TG_TRACE_SCOPE("allocate viewport images");
+
+    if(frame.viewportColor.image != VK_NULL_HANDLE) {
+        _retiredTextures.push_back({frame.viewportColor, _frameCount});
+        _retiredTextures.push_back({frame.viewportDepth, _frameCount});
+        if(!_headless) _retiredGUITextures.push_back({frame._GUIdescriptorSet, _frameCount});
+    }
 
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(_device, _frames[i].mainViewportImage, &memRequirements);
+    capacity.width = std::min(std::max(needed.width + needed.width / VIEWPORT_SLACK_DIVISOR, 1u), _maxViewportSize);
+    capacity.height = std::min(std::max(needed.height + needed.height / VIEWPORT_SLACK_DIVISOR, 1u), _maxViewportSize);
 
-        VkPhysicalDeviceMemoryProperties memProperties;
-        vkGetPhysicalDeviceMemoryProperties(_physicalDevice, &memProperties);
+    // Sampled by the GUI, or copied out for a thumbnail in headless mode
+    frame.viewportColor = createViewportImage(VK_FORMAT_B8G8R8A8_UNORM, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                              VK_IMAGE_ASPECT_COLOR_BIT, capacity);
+    frame.viewportDepth = createViewportImage(VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT, capacity);
+    if(!_headless) frame._GUIdescriptorSet = ImGui_ImplVulkan_AddTexture(_sampler, frame.viewportColor.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    frame.GUITextureView = frame.viewportColor.view;
+    _viewportStale = true;
+}
 
-        uint32_t deviceLocalMemoryTypeIndex = 0;
-        for(uint32_t i=0; i < memProperties.memoryTypeCount; i++) {
-            if(memRequirements.memoryTypeBits & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) == VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
-                deviceLocalMemoryTypeIndex = i;
-                break;
-            }
-        }
+Renderer::Texture Renderer::createViewportImage(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect, VkExtent2D extent) {
+    Texture texture;
+
+    VkImageCreateInfo imageCreateInfo{};
+    imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageCreateInfo.format = format;
+    imageCreateInfo.extent = {extent.width, extent.height, 1};
+    imageCreateInfo.mipLevels = 1;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCreateInfo.usage = usage;
+    imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = deviceLocalMemoryTypeIndex;
+    VmaAllocationCreateInfo allocInfo{};
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
 
-        if(vkAllocateMemory(_device, &allocInfo, nullptr, &_frames[i].mainViewportImageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to allocate main viewport color attachment image memory!");
-        }
+    if(vmaCreateImage(_allocator, &imageCreateInfo, &allocInfo, &texture.image, &texture.allocation, nullptr) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create main viewport image!");
+    }
 
-        vkBindImageMemory(_device, _frames[i].mainViewportImage, _frames[i].mainViewportImageMemory, 0);
-
-        VkImageViewCreateInfo imageViewCreateInfo{};
-        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        imageViewCreateInfo.image = _frames[i].mainViewportImage;
-        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        imageViewCreateInfo.format = VK_FORMAT_B8G8R8A8_UNORM;
-        imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
-        imageViewCreateInfo.subresourceRange.levelCount = 1;
-        imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
-        imageViewCreateInfo.subresourceRange.layerCount = 1;
-
-        if(vkCreateImageView(_device, &imageViewCreateInfo, nullptr, &_frames[i].mainViewportImageView) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to create main viewport color attachment image view!");
-        }
+    VkImageViewCreateInfo imageViewCreateInfo{};
+    imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    imageViewCreateInfo.image = texture.image;
+    imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    imageViewCreateInfo.format = format;
+    imageViewCreateInfo.subresourceRange = {aspect, 0, 1, 0, 1};
 
-        // Create the depth attachment image for the main viewport
+    if(vkCreateImageView(_device, &imageViewCreateInfo, nullptr, &texture.view) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create main viewport image view!");
+    }
 
-        imageCreateInfo.format = VK_FORMAT_D32_SFLOAT;
-        imageCreateInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-        if(vkCreateImage(_device, &imageCreateInfo, nullptr, &_frames[i].mainViewportDepthImage) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to create main viewport depth attachment image!");
-        }
+    return texture;
+}
 
-        vkGetImageMemoryRequirements(_device, _frames[i].mainViewportDepthImage, &memRequirements);
+void Renderer::destroyViewportResources() {
+    for(int i=0; i < NUM_FRAME_OVERLAP; i++) {
+        if(_frames[i].viewportColor.image == VK_NULL_HANDLE) continue;
 
-        for(uint32_t i=0; i < memProperties.memoryTypeCount; i++) {
-            if(memRequirements.memoryTypeBits & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) == VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
-                deviceLocalMemoryTypeIndex = i;
-                break;
-            }
-        }
-
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = deviceLocalMemoryTypeIndex;
-
-        if(vkAllocateMemory(_device, &allocInfo, nullptr, &_frames[i].mainViewportDepthImageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to allocate main viewport depth attachment image memory!");
-        }
-
-        vkBindImageMemory(_device, _frames[i].mainViewportDepthImage, _frames[i].mainViewportDepthImageMemory, 0);
-
-        imageViewCreateInfo.image = _frames[i].mainViewportDepthImage;
-        imageViewCreateInfo.format = VK_FORMAT_D32_SFLOAT;
-        imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-
-        if(vkCreateImageView(_device, &imageViewCreateInfo, nullptr, &_frames[i].mainViewportDepthImageView) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to create main viewport depth attachment image view!");
-        }
-
-        // Transition Depth attachment to depth attachment optimal
-        VkFence copyFence;
-        VkFenceCreateInfo fenceInfo{};
-        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        
-        if(vkCreateFence(_device, &fenceInfo, nullptr, &copyFence) != VK_SUCCESS) throw std::runtime_error("Failed to create temp fence!");
-
-        VkCommandBuffer buf;
-        VkCommandBufferAllocateInfo commandBufferAllocateInfo{};
-        commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        commandBufferAllocateInfo.commandPool = _commandPool;
-        commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        commandBufferAllocateInfo.commandBufferCount = 1;
-
-        if(vkAllocateCommandBuffers(_device, &commandBufferAllocateInfo, &buf) != VK_SUCCESS) {
-            throw std::runtime_error("Failed to allocate command buffer!");
-        }
-
-        VkCommandBufferBeginInfo beginInfo{};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-
-        vkBeginCommandBuffer(buf, &beginInfo);
-
-            VkImageMemoryBarrier viewportBarrierFromUndefinedToDepthAttachment{
-            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-            .pNext = nullptr,
-            .srcAccessMask = 0,
-            .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-            .newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-            .image = _frames[i].mainViewportDepthImage,
-            .subresourceRange = {
-                .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
-                .baseMipLevel = 0,
-                .levelCount = 1,
-                .baseArrayLayer = 0,
-                .layerCount = 1
-            }};
-
-            vkCmdPipelineBarrier(
-                buf,
-                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-                0,
-                0, nullptr,
-                0, nullptr,
-                1, &viewportBarrierFromUndefinedToDepthAttachment
-            );
-
-        vkEndCommandBuffer(buf);
+        if(!_headless) ImGui_ImplVulkan_RemoveTexture(_frames[i]._GUIdescriptorSet);
 
-        VkSubmitInfo submitInfo{};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &buf;
+        vkDestroyImageView(_device, _frames[i].viewportColor.view, nullptr);
+        vmaDestroyImage(_allocator, _frames[i].viewportColor.image, _frames[i].viewportColor.allocation);
 
-        vkQueueSubmit(_graphicsQueue, 1, &submitInfo, copyFence);
+        vkDestroyImageView(_device, _frames[i].viewportDepth.view, nullptr);
+        vmaDestroyImage(_allocator, _frames[i].viewportDepth.image, _frames[i].viewportDepth.allocation);
 
-        vkWaitForFences(_device, 1, &copyFence, VK_TRUE, UINT64_MAX);
-
-        vkFreeCommandBuffers(_device, _commandPool, 1, &buf);
-        vkDestroyFence(_device, copyFence, nullptr);
-
-        _frames[i]._GUIdescriptorSet = ImGui_ImplVulkan_AddTexture(_sampler, _frames[i].mainViewportImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    }
-}
-
-void Renderer::destroyViewportResources() {
-    for(int i=0; i < NUM_FRAME_OVERLAP; i++) {
-        ImGui_ImplVulkan_RemoveTexture(_frames[i]._GUIdescriptorSet);
-
-        vkDestroyImageView(_device, _frames[i].mainViewportImageView, nullptr);
-        vkDestroyImage(_device, _frames[i].mainViewportImage, nullptr);
-        vkFreeMemory(_device, _frames[i].mainViewportImageMemory, nullptr);
-
-        vkDestroyImageView(_device, _frames[i].mainViewportDepthImageView, nullptr);
-        vkDestroyImage(_device, _frames[i].mainViewportDepthImage, nullptr);
-        vkFreeMemory(_device, _frames[i].mainViewportDepthImageMemory, nullptr);
+        _frames[i].viewportColor = {VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE};
+        _frames[i].viewportDepth = {VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE};
+        _frames[i].viewportCapacity = {0, 0};
     }
 }
 
@@ -969,7 +1610,7 @@ void Renderer::initGUI() {
     init_info.ImageCount = _swapchainImages.size();
     init_info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
 
-    init_info.PipelineCache = VK_NULL_HANDLE;
+    init_info.PipelineCache = _pipelineCache.handle();
     init_info.Subpass = 0;
 
     init_info.DescriptorPoolSize = IMGUI_IMPL_VULKAN_MINIMUM_IMAGE_SAMPLER_POOL_SIZE + NUM_FRAME_OVERLAP;
@@ -986,10 +1627,41 @@ void Renderer::initGUI() {
 
 void Renderer::initDefaultGeometry() {
     _currentHeightmap = generateFlatHeightmap(512, 512);
-    Mesh mesh = convertHeightmapToMesh(_currentHeightmap);
+    _vertexBuffer = {VK_NULL_HANDLE, VK_NULL_HANDLE};
+    _indexBuffer = {VK_NULL_HANDLE, VK_NULL_HANDLE};
+    _heightmapTexture = {VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE};
+    if(_renderMode == RenderMode::Mesh) {
+        uploadMesh(convertHeightmapToMesh(_currentHeightmap));
+    } else {
+        _heightmapTexture = uploadToNewHeightmapTexture(_currentHeightmap);
+        _quadtree = TerrainQuadtree(_currentHeightmap, PATCH_QUADS);
+    }
 
-    _vertexBuffer = uploadToNewDeviceLocalBuffer(mesh.interleavedAttributes.size() * sizeof(Attributes), mesh.interleavedAttributes.data(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
-    _indexBuffer = uploadToNewDeviceLocalBuffer(mesh.indices.size() * sizeof(uint32_t), mesh.indices.data(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    // One patch of PATCH_QUADS x PATCH_QUADS quads, drawn once per selected quadtree node
+    std::vector<float> patchVertices;
+    patchVertices.reserve(2 * (PATCH_QUADS + 1) * (PATCH_QUADS + 1));
+    for(uint32_t y = 0; y <= PATCH_QUADS; y++) {
+        for(uint32_t x = 0; x <= PATCH_QUADS; x++) {
+            patchVertices.push_back(static_cast<float>(x));
+            patchVertices.push_back(static_cast<float>(y));
+        }
+    }
+
+    std::vector<uint16_t> patchIndices;
+    patchIndices.reserve(6 * PATCH_QUADS * PATCH_QUADS);
+    for(uint32_t y = 0; y < PATCH_QUADS; y++) {
+        for(uint32_t x = 0; x < PATCH_QUADS; x++) {
+            uint16_t topLeft = y*(PATCH_QUADS + 1) + x;
+            uint16_t topRight = topLeft + 1;
+            uint16_t bottomLeft = (y+1)*(PATCH_QUADS + 1) + x;
+            uint16_t bottomRight = bottomLeft + 1;
+
+            patchIndices.insert(patchIndices.end(), {topLeft, bottomLeft, topRight, topRight, bottomLeft, bottomRight});
+        }
+    }
+
+    _patchVertexBuffer = uploadToNewDeviceLocalBuffer(patchVertices.size() * sizeof(float), patchVertices.data(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    _patchIndexBuffer = uploadToNewDeviceLocalBuffer(patchIndices.size() * sizeof(uint16_t), patchIndices.data(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
 
     glm::vec3 translation(-0.5f, -0.5f, -0.5f);
     
@@ -1010,120 +1682,541 @@ void Renderer::generateUserGeometry() {
 
 }
 
-void Renderer::recordMainCommands(VkCommandBuffer& commandBuffer, int imageIndex) {
-    // Render into mainViewport
-    VkImageMemoryBarrier viewportBarrierFromUndefinedToColorAttachment{
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .pNext = nullptr,
-        .srcAccessMask = 0,
-        .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .image = getCurrentFrame().mainViewportImage,
-        .subresourceRange = {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .baseMipLevel = 0,
-            .levelCount = 1,
-            .baseArrayLayer = 0,
-            .layerCount = 1
-    }};
+/**
+ * @brief A job replacing the one in flight, which stops at its next check and is dropped
+ * @note assign its result, then move it into _generation
+ */
+std::unique_ptr<Renderer::GenerationJob> Renderer::newGenerationJob() {
+    cancelGeneration();
+    _generationError.clear();
+
+    auto job = std::make_unique<GenerationJob>();
+    job->context.onProgress = [job = job.get()](const char* stage, float fraction) {
+        job->stage.store(stage);
+        job->progress.store(fraction);
+    };
+    // Leave one hardware thread to the render loop so the editor stays responsive while generating
+    job->context.threads = std::max(1u, threadCount() - 1);
+    return job;
+}
 
-    vkCmdPipelineBarrier(
-        commandBuffer,
-        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        0,
-        0, nullptr,
-        0, nullptr,
-        1, &viewportBarrierFromUndefinedToColorAttachment
-    );
+/** @brief Stops the job in flight, if any; it winds down in _cancelledGenerations */
+void Renderer::cancelGeneration() {
+    if(!_generation) return;
+    _generation->context.cancel.cancel();
+    _cancelledGenerations.push_back(std::move(_generation));
+}
 
-    VkClearValue viewportClearValue{};
-    viewportClearValue.color = { {0.0f, 0.0f, 0.0f, 1.0f} };
-    viewportClearValue.depthStencil.depth = 1.0f;
+void Renderer::startGeneration(JobSpec spec) {
+    abandonComputeRun();
+    std::unique_ptr<GenerationJob> job = newGenerationJob();
+
+    // The displaced mode draws straight from the heightmap, so the job skips meshing unless the map is too large for a texture
+    bool buildQuadtree = fitsHeightmapTexture(spec.width, spec.height);
+    bool buildMesh = _renderMode == RenderMode::Mesh || !buildQuadtree;
+
+    // The job object outlives the task: it is only dropped once its future is ready, see pollGeneration()
+    HeightmapCache* cache = _heightmapCache.get();
+    job->result = std::async(std::launch::async, [spec = std::move(spec), cache, buildMesh, buildQuadtree, job = job.get()]() mutable {
+        TG_TRACE_THREAD_NAME("generation");
+        TG_TRACE_SCOPE_VALUE("generate terrain", "pixels", spec.width * spec.height);
+
+        GeneratedTerrain terrain;
+        terrain.heightmap = generateJobHeightmap(spec, nullptr, cache, job->context);
+        if(buildMesh) terrain.mesh = convertHeightmapToMesh(terrain.heightmap, job->context);
+        if(buildQuadtree) terrain.quadtree = TerrainQuadtree(terrain.heightmap, PATCH_QUADS, job->context);
+        return terrain;
+    });
+    _generation = std::move(job);
+}
 
-    VkRenderingAttachmentInfo viewportColorAttachment{};
-    viewportColorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
-    viewportColorAttachment.imageView = getCurrentFrame().mainViewportImageView;
-    viewportColorAttachment.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
-    viewportColorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    viewportColorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    viewportColorAttachment.clearValue = { {0.0f, 0.0f, 0.0f, 1.0f}};
+/** @brief Weathers a copy of the current terrain in the background; it comes back as an edit, see swapInTerrain() */
+void Renderer::startThermalEdit() {
+    abandonComputeRun();
+    std::unique_ptr<GenerationJob> job = newGenerationJob();
+
+    bool buildVertexRows = _meshMatchesHeightmap;
+    job->result = std::async(std::launch::async, [heightmap = _currentHeightmap, threshold = thermalThreshold, c = thermalConstant,
+                                                  iterations = thermalIterations, buildVertexRows, job = job.get()]() mutable {
+        TG_TRACE_THREAD_NAME("generation");
+        TG_TRACE_SCOPE_VALUE("edit terrain", "pixels", heightmap.width * heightmap.height);
+
+        GeneratedTerrain terrain;
+        terrain.edited = true;
+        applyThermalWeathering(heightmap, threshold, c, iterations, job->context);
+        if(buildVertexRows) {
+            auto [rowBegin, rowEnd] = affectedMeshRows(heightmap, heightmap.dirty);
+            terrain.editedVertexRows = convertHeightmapRowsToVertices(heightmap, rowBegin, rowEnd, job->context);
+        }
+        terrain.heightmap = std::move(heightmap);
+        return terrain;
+    });
+    _generation = std::move(job);
+}
 
-    VkRenderingAttachmentInfo viewportDepthAttachment{};
-    viewportDepthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
-    viewportDepthAttachment.imageView = getCurrentFrame().mainViewportDepthImageView;
-    viewportDepthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
-    viewportDepthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    viewportDepthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    viewportDepthAttachment.clearValue = viewportClearValue;
+bool Renderer::usesCompute(const JobSpec& spec) const {
+    return selectedBackend == Backend::Compute && _computeAvailable && spec.method == GenerationMethod::Perlin &&
+           fitsHeightmapTexture(spec.width, spec.height);
+}
 
-    VkRenderingInfo viewportRenderingInfo{};
-    viewportRenderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
-    viewportRenderingInfo.renderArea.offset = {0, 0};
-    viewportRenderingInfo.renderArea.extent = _mainViewportExtent;
-    viewportRenderingInfo.layerCount = 1;
-    viewportRenderingInfo.colorAttachmentCount = 1;
-    viewportRenderingInfo.pColorAttachments = &viewportColorAttachment;
-    viewportRenderingInfo.pDepthAttachment = &viewportDepthAttachment;
+/**
+ * @brief Generates straight into a new heightmap texture on the GPU; the host copy and the quadtree follow once the run
+ * has finished, see pollCompute(). Bypasses the heightmap cache.
+ */
+void Renderer::startComputeGeneration(JobSpec spec) {
+    abandonComputeRun();
+    cancelGeneration();
+    _generationError.clear();
+
+    ComputeRequest request;
+    request.width = static_cast<uint32_t>(spec.width);
+    request.height = static_cast<uint32_t>(spec.height);
+    request.perlin = true;
+    request.perlinGridSize = static_cast<uint32_t>(spec.perlinGridSize);
+    request.seed = spec.seed ? *spec.seed : generateRandomSeed();
+    request.thermal = spec.thermal;
+    request.thermalThreshold = spec.thermalThreshold;
+    request.thermalConstant = spec.thermalConstant;
+    request.thermalIterations = spec.thermalIterations;
+
+    try {
+        Texture texture = createHeightmapTexture(request.width, request.height);
+        _computeRun = {true, false, texture, request.width, request.height};
+        _compute.submit(request, texture.image, _uploader.semaphore(), _uploader.lastSubmitted());
+    } catch(const std::exception& e) {
+        abandonComputeRun();
+        _generationError = e.what();
+    }
+}
 
-    vkCmdBeginRendering(commandBuffer, &viewportRenderingInfo);
+/** @brief Weathers the current terrain in place in its texture on the GPU; the host copy follows, see pollCompute() */
+void Renderer::startComputeThermalEdit() {
+    abandonComputeRun();
+    cancelGeneration();
+    _generationError.clear();
+
+    ComputeRequest request;
+    request.width = static_cast<uint32_t>(_currentHeightmap.width);
+    request.height = static_cast<uint32_t>(_currentHeightmap.height);
+    request.thermal = true;
+    request.thermalThreshold = thermalThreshold;
+    request.thermalConstant = thermalConstant;
+    request.thermalIterations = thermalIterations;
+
+    try {
+        _compute.submit(request, _heightmapTexture.image, _uploader.semaphore(), _uploader.lastSubmitted());
+        _computeRun.pending = true;
+        _computeRun.edit = true;
+        _computeRun.width = request.width;
+        _computeRun.height = request.height;
+        _viewportStale = true;
+    } catch(const std::exception& e) {
+        _generationError = e.what();
+    }
+}
 
-        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicsPipeline);
+/**
+ * @brief Makes way for a newer request. A generation that has not been swapped in is dropped and its texture retired;
+ * an edit has already changed the texture, so it is waited for and read back to keep the host copy in step.
+ */
+void Renderer::abandonComputeRun() {
+    if(_computeRun.pending && _computeRun.edit) {
+        _compute.wait();
+        pollCompute();
+    }
+    _computeRun.pending = false;
 
-        VkViewport viewport{};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = (float) _mainViewportExtent.width;
-        viewport.height = (float) _mainViewportExtent.height;
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    // Retired like a replaced texture: frames submitted after the run finish after it, so they tell when it is unused
+    if(_computeRun.texture.image != VK_NULL_HANDLE) {
+        _retiredTextures.push_back({_computeRun.texture, _frameCount});
+        _computeRun.texture = {VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE};
+    }
+}
 
-        VkRect2D scissor{};
-        scissor.offset = {0, 0};
-        scissor.extent = _mainViewportExtent;
-        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+/**
+ * @brief Once the compute run has finished, reads its heights back into the host copy. An edit only needs the quadtree
+ * bounds updated; a new terrain still needs its quadtree, and its mesh in the mesh mode, built in the background.
+ */
+void Renderer::pollCompute() {
+    if(!_computeRun.pending || !_compute.finished()) return;
+    _computeRun.pending = false;
+
+    Heightmap heightmap;
+    heightmap.width = _computeRun.width;
+    heightmap.height = _computeRun.height;
+    heightmap.data.resize(heightmap.width * heightmap.height);
+    _compute.readResult(heightmap.data.data());
+
+    if(_computeRun.edit) {
+        _computeRun.edit = false;
+        // Same check as for an edit from the CPU
+        if(heightmap.width != _currentHeightmap.width || heightmap.height != _currentHeightmap.height) return;
+
+        _currentHeightmap.data = std::move(heightmap.data);
+        _quadtree.update(_currentHeightmap, {0, 0, _currentHeightmap.width, _currentHeightmap.height});
+        _meshMatchesHeightmap = false;
+        _viewportStale = true;
+        return;
+    }
 
-        VkBuffer vertexBuffers[] = {_vertexBuffer.buffer};
-        VkDeviceSize offsets[] = {0};
-        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+    std::unique_ptr<GenerationJob> job = newGenerationJob();
+    bool buildMesh = _renderMode == RenderMode::Mesh;
+    job->result = std::async(std::launch::async, [heightmap = std::move(heightmap), buildMesh, job = job.get()]() mutable {
+        TG_TRACE_THREAD_NAME("generation");
+        TG_TRACE_SCOPE_VALUE("build computed terrain", "pixels", heightmap.width * heightmap.height);
+
+        GeneratedTerrain terrain;
+        terrain.computed = true;
+        if(buildMesh) terrain.mesh = convertHeightmapToMesh(heightmap, job->context);
+        terrain.quadtree = TerrainQuadtree(heightmap, PATCH_QUADS, job->context);
+        terrain.heightmap = std::move(heightmap);
+        return terrain;
+    });
+    _generation = std::move(job);
+}
 
-        vkCmdBindIndexBuffer(commandBuffer, _indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+void Renderer::pollGeneration() {
+    auto ready = [](const std::unique_ptr<GenerationJob>& job) {
+        return job->result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    };
 
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelineLayout, 0, 1, &getCurrentFrame()._descriptorSet, 0, nullptr);
+    // Replaced jobs are only waited for here, never joined on the frame
+    std::erase_if(_cancelledGenerations, ready);
 
-        vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>((_currentHeightmap.height - 1) * (_currentHeightmap.width - 1) * 6), 1, 0, 0, 0);
+    if(!_generation || !ready(_generation)) return;
 
-    vkCmdEndRendering(commandBuffer);
+    std::unique_ptr<GenerationJob> job = std::move(_generation);
+    try {
+        GeneratedTerrain terrain = job->result.get();
+        swapInTerrain(terrain);
+    } catch(const OperationCancelled&) {
+        // Cancelled from the panel; the previous terrain stays
+    } catch(const std::exception& e) {
+        _generationError = e.what();
+    }
+}
 
-    VkImageMemoryBarrier viewportBarrierFromColorAttachmentToShaderOptimal{
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-        .pNext = nullptr,
-        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
-        .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .image = getCurrentFrame().mainViewportImage,
-        .subresourceRange = {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .baseMipLevel = 0,
-            .levelCount = 1,
-            .baseArrayLayer = 0,
-            .layerCount = 1
-    }};
+void Renderer::swapInTerrain(GeneratedTerrain& terrain) {
+    // An edit keeps the GPU resources; a newer terrain of another size may have come in since it started, then it is stale
+    if(terrain.edited) {
+        if(terrain.heightmap.width != _currentHeightmap.width || terrain.heightmap.height != _currentHeightmap.height) return;
 
-    // Transition the viewport image to be used during the fragment shader later
-    vkCmdPipelineBarrier(
-        commandBuffer,
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT ,
-        0,
-        0, nullptr,
-        0, nullptr,
-        1, &viewportBarrierFromColorAttachmentToShaderOptimal);
+        HeightmapRegion region = takeDirtyRegion(terrain.heightmap);
+        _currentHeightmap = std::move(terrain.heightmap);
+        updateTerrainRegion(region, std::move(terrain.editedVertexRows));
+        return;
+    }
+
+    TG_TRACE_SCOPE_VALUE("upload terrain", "pixels", terrain.heightmap.width * terrain.heightmap.height);
+
+    // A computed terrain whose texture was given up for a newer request is stale as well
+    if(terrain.computed && _computeRun.texture.image == VK_NULL_HANDLE) return;
+
+    // Frames in flight keep drawing the old terrain from the old texture and buffers, so those are retired rather than destroyed
+    _retiredTextures.push_back({_heightmapTexture, _frameCount});
+    _heightmapTexture = {VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE};
+    _quadtree = std::move(terrain.quadtree);
+    if(terrain.computed) {
+        _heightmapTexture = _computeRun.texture;
+        _computeRun.texture = {VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE};
+    } else if(_quadtree.levelCount() > 0) {
+        _heightmapTexture = uploadToNewHeightmapTexture(terrain.heightmap);
+    } else {
+        _renderMode = RenderMode::Mesh;
+    }
+
+    _currentHeightmap = std::move(terrain.heightmap);
+    _currentHeightmap.dirty = {}; // everything was just uploaded
+    _viewportStale = true;
+    _meshMatchesHeightmap = false;
+    if(!terrain.mesh.interleavedAttributes.empty()) uploadMesh(terrain.mesh);
+
+    // Reset view parameters, in case user gets lost or something
+    distance = 4.0f;
+    yaw = glm::radians(45.0f);
+    pitch = glm::radians(30.0f);
+    panOffset = glm::vec2(0.0f, 0.0f);
+}
+
+/**
+ * @brief Uploads the samples of region, already changed in _currentHeightmap, into the existing heightmap texture and
+ * vertex buffer, and updates the quadtree bounds over it. The indices stay as they are.
+ * @param vertexRows the mesh rows affectedMeshRows() gives for region, or empty to build them here
+ */
+void Renderer::updateTerrainRegion(const HeightmapRegion& region, Vector<Attributes> vertexRows) {
+    if(region.empty()) return;
+    _viewportStale = true;
+    TG_TRACE_SCOPE_VALUE("update terrain region", "pixels", (region.x1 - region.x0) * (region.y1 - region.y0));
+
+    // The copies overwrite what frames in flight may still read; waiting for them is at most NUM_FRAME_OVERLAP frames, and only on an edit
+    VkFence fences[NUM_FRAME_OVERLAP];
+    for(uint32_t i = 0; i < NUM_FRAME_OVERLAP; i++) fences[i] = _frames[i].renderFence;
+    if(vkWaitForFences(_device, NUM_FRAME_OVERLAP, fences, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to wait for frames in flight!");
+    }
+
+    size_t width = _currentHeightmap.width;
+    if(_heightmapTexture.image != VK_NULL_HANDLE) {
+        _uploader.uploadImageRegion(_heightmapTexture.image, static_cast<uint32_t>(region.x0), static_cast<uint32_t>(region.y0),
+                                    static_cast<uint32_t>(region.x1 - region.x0), static_cast<uint32_t>(region.y1 - region.y0), sizeof(uint16_t),
+                                    _currentHeightmap.data.data() + region.y0 * width + region.x0, width * sizeof(uint16_t));
+        _quadtree.update(_currentHeightmap, region);
+    }
+
+    // Vertex rows are contiguous in the buffer, so the affected rows are a single copy
+    if(_meshMatchesHeightmap) {
+        auto [rowBegin, rowEnd] = affectedMeshRows(_currentHeightmap, region);
+        if(vertexRows.size() != (rowEnd - rowBegin) * width) {
+            vertexRows = convertHeightmapRowsToVertices(_currentHeightmap, rowBegin, rowEnd);
+        }
+        _uploader.upload(_vertexBuffer.buffer, VkDeviceSize(rowBegin) * width * sizeof(Attributes), vertexRows.data(), vertexRows.size() * sizeof(Attributes));
+    }
+}
+
+void Renderer::uploadMesh(const Mesh& mesh) {
+    TG_TRACE_SCOPE_VALUE("upload mesh", "bytes", mesh.interleavedAttributes.size() * sizeof(Attributes) + mesh.indices.size() * sizeof(uint32_t));
+
+    _retiredBuffers.push_back({_vertexBuffer, _frameCount});
+    _retiredBuffers.push_back({_indexBuffer, _frameCount});
+
+    _vertexBuffer = uploadToNewDeviceLocalBuffer(mesh.interleavedAttributes.size() * sizeof(Attributes), mesh.interleavedAttributes.data(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    _indexBuffer = uploadToNewDeviceLocalBuffer(mesh.indices.size() * sizeof(uint32_t), mesh.indices.data(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    _meshMatchesHeightmap = true;
+    _viewportStale = true;
+}
+
+/**
+ * @brief Points the frame's descriptor set at the current heightmap texture
+ * @note call after waiting for the frame's fence; the set must not be in use
+ */
+void Renderer::bindHeightmapTexture(DataPerFrame& frame) {
+    if(frame.boundHeightmapView == _heightmapTexture.view || _heightmapTexture.view == VK_NULL_HANDLE) return;
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageView = _heightmapTexture.view;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkWriteDescriptorSet writeSet{};
+    writeSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeSet.dstSet = frame._descriptorSet;
+    writeSet.dstBinding = 1;
+    writeSet.dstArrayElement = 0;
+    writeSet.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    writeSet.descriptorCount = 1;
+    writeSet.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(_device, 1, &writeSet, 0, nullptr);
+    frame.boundHeightmapView = _heightmapTexture.view;
+}
+
+/**
+ * @brief Picks the quadtree patches for the frame's camera and writes them and the indirect draws into the frame's buffers
+ * @note call after waiting for the frame's fence
+ */
+void Renderer::selectPatches(DataPerFrame& frame) {
+    // Level 0 is used while one of its quads covers at most LOD_PIXELS_PER_QUAD pixels; 45 degrees as in P_matrix
+    float pixelsPerUnit = _mainViewportExtent.height / (2.0f * glm::tan(glm::radians(45.0f) / 2.0f));
+    float quadSize = 1.0f / static_cast<float>(std::max(_currentHeightmap.width, _currentHeightmap.height));
+    float range0 = pixelsPerUnit * quadSize / LOD_PIXELS_PER_QUAD;
+
+    _selectedPatches.clear();
+    _quadtree.select(MVP_matrix, cameraModelPosition, range0, _selectedPatches, _patchesPerLevel);
+
+    if(_selectedPatches.size() > frame.patchInstanceCapacity) {
+        if(frame.patchInstanceCapacity > 0) {
+            vmaUnmapMemory(_allocator, frame.patchInstanceBuffer.allocation);
+            _retiredBuffers.push_back({frame.patchInstanceBuffer, _frameCount});
+        }
+        frame.patchInstanceCapacity = std::max<uint32_t>(2 * frame.patchInstanceCapacity, static_cast<uint32_t>(_selectedPatches.size()));
+        frame.patchInstanceBuffer = createBuffer(frame.patchInstanceCapacity * sizeof(PatchInstance), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+        vmaMapMemory(_allocator, frame.patchInstanceBuffer.allocation, &frame.patchInstanceData);
+    }
+    memcpy(frame.patchInstanceData, _selectedPatches.data(), _selectedPatches.size() * sizeof(PatchInstance));
+
+    // One draw per level, so a frame capture shows what each level costs; all in one draw without multi-draw support
+    VkDrawIndexedIndirectCommand* commands = static_cast<VkDrawIndexedIndirectCommand*>(frame.indirectData);
+    frame.indirectDrawCount = 0;
+    uint32_t firstInstance = 0;
+    for(uint32_t count : _patchesPerLevel) {
+        if(count == 0) continue;
+        if(!_multiDrawIndirect && frame.indirectDrawCount == 1) {
+            commands[0].instanceCount += count;
+            continue;
+        }
+        commands[frame.indirectDrawCount++] = {6 * PATCH_QUADS * PATCH_QUADS, count, 0, 0, firstInstance};
+        firstInstance += count;
+    }
+
+    frame.patchData = {
+        {cameraModelPosition.x, cameraModelPosition.y, cameraModelPosition.z},
+        range0,
+        {static_cast<uint32_t>(_currentHeightmap.width), static_cast<uint32_t>(_currentHeightmap.height)},
+        PATCH_QUADS,
+        LOD_MORPH_START
+    };
+}
+
+void Renderer::destroyRetiredResources(bool all) {
+    // Called after waiting for the current frame's fence: every frame up to NUM_FRAME_OVERLAP back has finished
+    std::erase_if(_retiredBuffers, [&](const RetiredBuffer& retired) {
+        if(!all && retired.frame + NUM_FRAME_OVERLAP > _frameCount) return false;
+        vmaDestroyBuffer(_allocator, retired.buffer.buffer, retired.buffer.allocation);
+        return true;
+    });
+    std::erase_if(_retiredTextures, [&](const RetiredTexture& retired) {
+        if(!all && retired.frame + NUM_FRAME_OVERLAP > _frameCount) return false;
+        vkDestroyImageView(_device, retired.texture.view, nullptr);
+        vmaDestroyImage(_allocator, retired.texture.image, retired.texture.allocation);
+        return true;
+    });
+    std::erase_if(_retiredGUITextures, [&](const RetiredGUITexture& retired) {
+        if(!all && retired.frame + NUM_FRAME_OVERLAP > _frameCount) return false;
+        ImGui_ImplVulkan_RemoveTexture(retired.descriptorSet);
+        return true;
+    });
+    // The frames that presented from an old swapchain have finished once their fences are signalled
+    std::erase_if(_retiredSwapchains, [&](RetiredSwapchain& retired) {
+        if(!all && retired.frame + NUM_FRAME_OVERLAP > _frameCount) return false;
+        for(VkImageView view : retired.imageViews) vkDestroyImageView(_device, view, nullptr);
+        vkDestroySwapchainKHR(_device, retired.swapchain, nullptr);
+        return true;
+    });
+}
+
+/**
+ * @brief Adds the GPU passes of the frame last submitted with these resources to the frame timings and the trace
+ * @note call after waiting for the frame's fence, before its command buffer is recorded again
+ */
+void Renderer::readFrameTimestamps(DataPerFrame& frame) {
+    if(!frame.timestampsWritten) return;
+    frame.timestampsWritten = false;
+
+    // The fence has been waited for, so the results are there without VK_QUERY_RESULT_WAIT_BIT
+    uint64_t ticks[TIMESTAMP_COUNT];
+    if(vkGetQueryPoolResults(_device, frame.timestampPool, 0, TIMESTAMP_COUNT, sizeof(ticks), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+        return;
+    }
+
+    auto nanosecondsBetween = [&](uint32_t from, uint32_t to) {
+        return static_cast<uint64_t>(static_cast<double>((ticks[to] - ticks[from]) & _timestampMask) * _timestampPeriod);
+    };
+    uint64_t terrain = nanosecondsBetween(0, 1);
+    uint64_t gui = nanosecondsBetween(1, 2);
+
+    _frameTimings.record(FrameStage::GpuTerrain, terrain / 1e6f);
+    _frameTimings.record(FrameStage::GpuGui, gui / 1e6f);
+    _frameTimings.record(FrameStage::GpuTotal, (terrain + gui) / 1e6f);
+
+    // The GPU clock is not calibrated against the CPU one: the passes start at the submit, only their lengths are measured
+    TG_TRACE_TRACK_ZONE("GPU", "terrain pass", frame.submitTime, frame.submitTime + terrain);
+    TG_TRACE_TRACK_ZONE("GPU", "GUI pass", frame.submitTime + terrain, frame.submitTime + terrain + gui);
+}
+
+void Renderer::drawFrameTimings() {
+    ImGui::SetNextWindowSize(ImVec2(460.0f, 0.0f), ImGuiCond_FirstUseEver);
+    if(!ImGui::Begin("Frame Timings", &_showFrameTimings)) {
+        ImGui::End();
+        return;
+    }
+
+    ImGui::Text("Last %zu frames, milliseconds", FrameTimings::HISTORY);
+    ImGui::Text("First frame after %.1f, pipelines %.1f (pipeline cache %s)", _timeToFirstFrame, _pipelineMilliseconds,
+                _pipelineCache.loaded() ? "hit" : "miss");
+    ImGui::Separator();
+
+    for(uint32_t i = 0; i < static_cast<uint32_t>(FrameStage::Count); i++) {
+        FrameStage stage = static_cast<FrameStage>(i);
+        if(stage == FrameStage::GpuTerrain) {
+            ImGui::Separator();
+            if(_timestampPeriod == 0.0f) {
+                ImGui::TextDisabled("The graphics queue does not support timestamps");
+                break;
+            }
+        }
+
+        ImGui::Text("%-16s %6.2f   p50 %6.2f   p95 %6.2f   p99 %6.2f", FrameTimings::name(stage), _frameTimings.latest(stage),
+                    _frameTimings.percentile(stage, 0.5f), _frameTimings.percentile(stage, 0.95f), _frameTimings.percentile(stage, 0.99f));
+
+        ImGui::PushID(static_cast<int>(i));
+        ImGui::PlotHistogram("##history", _frameTimings.samples(stage), static_cast<int>(_frameTimings.count(stage)),
+                             static_cast<int>(_frameTimings.offset(stage)), nullptr, 0.0f, FLT_MAX, ImVec2(-1.0f, 32.0f));
+        ImGui::PopID();
+    }
+
+    ImGui::End();
+}
+
+/**
+ * @brief Whether the frame has to draw the terrain, or may show the viewport image of the last terrain pass again. That
+ * image is only reused at the same capacity, so the GUI's texture coordinates, laid out from this frame's images, still fit.
+ */
+bool Renderer::needsTerrainPass(const DataPerFrame& frame) const {
+    const DataPerFrame& drawn = _frames[_viewportFrame];
+    return _viewportStale || _renderMode != _viewportMode || MVP_matrix != _viewportMVP ||
+           _mainViewportExtent.width != _viewportExtentDrawn.width || _mainViewportExtent.height != _viewportExtentDrawn.height ||
+           frame.viewportCapacity.width != drawn.viewportCapacity.width || frame.viewportCapacity.height != drawn.viewportCapacity.height;
+}
+
+/**
+ * @brief Points the frame's GUI texture at a viewport image
+ * @note call after waiting for the frame's fence; the set must not be in use
+ */
+void Renderer::setGUITexture(DataPerFrame& frame, VkImageView view) {
+    if(frame.GUITextureView == view) return;
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.sampler = _sampler;
+    imageInfo.imageView = view;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    // The layout ImGui_ImplVulkan_AddTexture allocates from: one combined image sampler at binding 0
+    VkWriteDescriptorSet writeSet{};
+    writeSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writeSet.dstSet = frame._GUIdescriptorSet;
+    writeSet.dstBinding = 0;
+    writeSet.dstArrayElement = 0;
+    writeSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writeSet.descriptorCount = 1;
+    writeSet.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(_device, 1, &writeSet, 0, nullptr);
+    frame.GUITextureView = view;
+}
+
+void Renderer::recordMainCommands(VkCommandBuffer& commandBuffer, int imageIndex, bool drawTerrain) {
+    if(drawTerrain) {
+        recordViewportCommands(commandBuffer);
+
+        VkImageMemoryBarrier viewportBarrierFromColorAttachmentToShaderOptimal{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .pNext = nullptr,
+            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = getCurrentFrame().viewportColor.image,
+            .subresourceRange = {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1
+        }};
+
+        // Transition the viewport image to be used during the fragment shader later
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT ,
+            0,
+            0, nullptr,
+            0, nullptr,
+            1, &viewportBarrierFromColorAttachmentToShaderOptimal);
+    } else if(_timestampPeriod > 0.0f) {
+        // The terrain pass took no time; keeps the GPU timings of the frame consistent
+        vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, getCurrentFrame().timestampPool, 1);
+    }
 
     // Render DearImGui onto swapchain image
 
@@ -1209,38 +2302,162 @@ void Renderer::recordMainCommands(VkCommandBuffer& commandBuffer, int imageIndex
         0, nullptr,
         0, nullptr,
         1, &barrierFromColorAttachmentToPresent);
-
 }
 
-VkShaderModule Renderer::createShaderModule(const char* filename) {
-    std::filesystem::path relativeRoot(executablePath);
-    std::ifstream file(relativeRoot.parent_path().string() + std::string("/shaders_spv/") + filename, std::ios::ate | std::ios::binary);
+/**
+ * @brief Draws the terrain into the frame's viewport images, leaving the color image in COLOR_ATTACHMENT_OPTIMAL
+ */
+void Renderer::recordViewportCommands(VkCommandBuffer commandBuffer) {
+    // Render into mainViewport
+    VkImageMemoryBarrier viewportBarrierFromUndefinedToColorAttachment{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = getCurrentFrame().viewportColor.image,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+    }};
+
+    // After the GUI passes queued before it, which may still sample this image while an idle frame shows it again
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        0,
+        0, nullptr,
+        0, nullptr,
+        1, &viewportBarrierFromUndefinedToColorAttachment
+    );
+
+    // Depth is cleared every frame, so it is moved out of UNDEFINED here too; a new image needs no separate submission
+    VkImageMemoryBarrier viewportBarrierFromUndefinedToDepthAttachment{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = getCurrentFrame().viewportDepth.image,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+    }};
+
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        0,
+        0, nullptr,
+        0, nullptr,
+        1, &viewportBarrierFromUndefinedToDepthAttachment
+    );
+
+    VkClearValue viewportClearValue{};
+    viewportClearValue.color = { {0.0f, 0.0f, 0.0f, 1.0f} };
+    viewportClearValue.depthStencil.depth = 1.0f;
+
+    VkRenderingAttachmentInfo viewportColorAttachment{};
+    viewportColorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    viewportColorAttachment.imageView = getCurrentFrame().viewportColor.view;
+    viewportColorAttachment.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+    viewportColorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    viewportColorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    viewportColorAttachment.clearValue = { {0.0f, 0.0f, 0.0f, 1.0f}};
+
+    VkRenderingAttachmentInfo viewportDepthAttachment{};
+    viewportDepthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    viewportDepthAttachment.imageView = getCurrentFrame().viewportDepth.view;
+    viewportDepthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+    viewportDepthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    viewportDepthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    viewportDepthAttachment.clearValue = viewportClearValue;
 
-    if(!file.is_open()) throw std::runtime_error("Failed to open shader file!");
+    VkRenderingInfo viewportRenderingInfo{};
+    viewportRenderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+    viewportRenderingInfo.renderArea.offset = {0, 0};
+    viewportRenderingInfo.renderArea.extent = _mainViewportExtent;
+    viewportRenderingInfo.layerCount = 1;
+    viewportRenderingInfo.colorAttachmentCount = 1;
+    viewportRenderingInfo.pColorAttachments = &viewportColorAttachment;
+    viewportRenderingInfo.pDepthAttachment = &viewportDepthAttachment;
 
-    size_t fileSize = (size_t)file.tellg();
-    std::vector<char> buffer(fileSize);
+    vkCmdBeginRendering(commandBuffer, &viewportRenderingInfo);
 
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
+        VkViewport viewport{};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = (float) _mainViewportExtent.width;
+        viewport.height = (float) _mainViewportExtent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-    file.close();
+        VkRect2D scissor{};
+        scissor.offset = {0, 0};
+        scissor.extent = _mainViewportExtent;
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipelineLayout, 0, 1, &getCurrentFrame()._descriptorSet, 0, nullptr);
+
+        VkDeviceSize offsets[] = {0, 0};
+        DataPerFrame& frame = getCurrentFrame();
+        if(_renderMode == RenderMode::Displaced) {
+            if(frame.indirectDrawCount > 0) {
+                VkBuffer vertexBuffers[] = {_patchVertexBuffer.buffer, frame.patchInstanceBuffer.buffer};
+
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _displacedPipeline);
+                vkCmdPushConstants(commandBuffer, _pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PatchData), &frame.patchData);
+                vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+                vkCmdBindIndexBuffer(commandBuffer, _patchIndexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
+
+                vkCmdDrawIndexedIndirect(commandBuffer, frame.indirectBuffer.buffer, 0, frame.indirectDrawCount, sizeof(VkDrawIndexedIndirectCommand));
+            }
+        } else {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _graphicsPipeline);
+            vkCmdBindVertexBuffers(commandBuffer, 0, 1, &_vertexBuffer.buffer, offsets);
+            vkCmdBindIndexBuffer(commandBuffer, _indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+            vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>((_currentHeightmap.height - 1) * (_currentHeightmap.width - 1) * 6), 1, 0, 0, 0);
+        }
+
+    vkCmdEndRendering(commandBuffer);
+
+    if(_timestampPeriod > 0.0f) {
+        vkCmdWriteTimestamp2(commandBuffer, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, getCurrentFrame().timestampPool, 1);
+    }
+}
+
+VkShaderModule Renderer::createShaderModule(const uint32_t* code, size_t codeSize) {
     VkShaderModule shaderModule;
     VkShaderModuleCreateInfo shaderInfo{};
     shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    shaderInfo.pCode = reinterpret_cast<const uint32_t*>(buffer.data());
-    shaderInfo.codeSize = fileSize;
+    shaderInfo.pCode = code;
+    shaderInfo.codeSize = codeSize;
 
     if(vkCreateShaderModule(_device, &shaderInfo, nullptr, &shaderModule) != VK_SUCCESS) throw std::runtime_error("Failed to create shader module!");
     return shaderModule;
 }
 
 /**
- * @note For the moment, there is only one pipeline, making management easy
+ * @note Creates the mesh pipeline and the displaced pipeline; both share one layout and differ only in shaders and vertex input
  */
 void Renderer::createGraphicsPipeline() {
-    VkShaderModule defaultShaderModule = createShaderModule("default.spv");
+    VkShaderModule defaultShaderModule = createShaderModule(default_spv, sizeof(default_spv));
+    VkShaderModule displacedShaderModule = createShaderModule(displaced_spv, sizeof(displaced_spv));
 
     VkPipelineShaderStageCreateInfo vertexStageInfo{};
     vertexStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -1342,6 +2559,14 @@ void Renderer::createGraphicsPipeline() {
     pipelineLayoutInfo.setLayoutCount = 1;
     pipelineLayoutInfo.pSetLayouts = &_descriptorSetLayout;
 
+    VkPushConstantRange patchDataRange{};
+    patchDataRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    patchDataRange.offset = 0;
+    patchDataRange.size = sizeof(PatchData);
+
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &patchDataRange;
+
     if (vkCreatePipelineLayout(_device, &pipelineLayoutInfo, nullptr, &_pipelineLayout) != VK_SUCCESS) {
         throw std::runtime_error("failed to create pipeline layout!");
     }
@@ -1372,12 +2597,54 @@ void Renderer::createGraphicsPipeline() {
     graphicsPipelineInfo.subpass = 0; 
     graphicsPipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-    if(vkCreateGraphicsPipelines(_device, VK_NULL_HANDLE, 1, &graphicsPipelineInfo, nullptr, &_graphicsPipeline) != VK_SUCCESS) throw std::runtime_error("Failed to create graphics pipeline!");
+    if(vkCreateGraphicsPipelines(_device, _pipelineCache.handle(), 1, &graphicsPipelineInfo, nullptr, &_graphicsPipeline) != VK_SUCCESS) throw std::runtime_error("Failed to create graphics pipeline!");
+
+    // Displaced pipeline: float2 patch coordinates per vertex and a PatchInstance per instance; heights come from the texture
+    stages[0].module = displacedShaderModule;
+    stages[1].module = displacedShaderModule;
+
+    VkVertexInputBindingDescription patchBindings[2]{};
+    patchBindings[0].binding = 0;
+    patchBindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    patchBindings[0].stride = 2 * sizeof(float);
+    patchBindings[1].binding = 1;
+    patchBindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+    patchBindings[1].stride = sizeof(PatchInstance);
+
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[0].offset = 0;
+
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].binding = 1;
+    attributeDescriptions[1].format = VK_FORMAT_R32G32B32A32_UINT;
+    attributeDescriptions[1].offset = 0;
+
+    vertexInputInfo.vertexBindingDescriptionCount = 2;
+    vertexInputInfo.pVertexBindingDescriptions = patchBindings;
+    vertexInputInfo.vertexAttributeDescriptionCount = 2;
+
+    if(vkCreateGraphicsPipelines(_device, _pipelineCache.handle(), 1, &graphicsPipelineInfo, nullptr, &_displacedPipeline) != VK_SUCCESS) throw std::runtime_error("Failed to create displaced graphics pipeline!");
 
     vkDestroyShaderModule(_device, defaultShaderModule, nullptr);
+    vkDestroyShaderModule(_device, displacedShaderModule, nullptr);
+}
+
+/** @note leaves _computeAvailable false when the graphics queue cannot run compute or heightmaps cannot be textures */
+void Renderer::initCompute() {
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &familyCount, families.data());
+    if(!(families[_graphicsQueueFamily].queueFlags & VK_QUEUE_COMPUTE_BIT) || _maxHeightmapTextureSize == 0) return;
+
+    // On the graphics queue, so the frames drawing from a texture are ordered after the run that writes it without semaphores
+    _compute.init(_device, _allocator, _graphicsQueue, _graphicsQueueFamily, _pipelineCache.handle());
+    _computeAvailable = true;
 }
 
-Renderer::Buffer Renderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags) {
+Renderer::Buffer Renderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VmaAllocationCreateFlags flags, bool sharedWithTransfer) {
     Buffer buf;
 
     VkBufferCreateInfo bufferInfo{};
@@ -1386,6 +2653,14 @@ Renderer::Buffer Renderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags us
     bufferInfo.usage = usage;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+    // Concurrent sharing saves the ownership transfer barriers between the transfer and graphics queues
+    uint32_t queueFamilies[] = { _graphicsQueueFamily, _transferQueueFamily };
+    if(sharedWithTransfer && _transferQueueFamily != _graphicsQueueFamily) {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = 2;
+        bufferInfo.pQueueFamilyIndices = queueFamilies;
+    }
+
     VmaAllocationCreateInfo allocInfo{};
     allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
     allocInfo.flags = flags;
@@ -1397,60 +2672,71 @@ Renderer::Buffer Renderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags us
     return buf;
 }
 
-Renderer::Buffer Renderer::uploadToNewDeviceLocalBuffer(VkDeviceSize size, void* data, VkBufferUsageFlags usage) {
-    Buffer stagingBuffer = createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
-
-    void* hostMemPtr;
-    vmaMapMemory(_allocator, stagingBuffer.allocation, &hostMemPtr);
-    memcpy(hostMemPtr, data, (size_t)size);
-    vmaUnmapMemory(_allocator, stagingBuffer.allocation);
+Renderer::Buffer Renderer::uploadToNewDeviceLocalBuffer(VkDeviceSize size, const void* data, VkBufferUsageFlags usage) {
+    Buffer deviceLocalBuffer = createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, 0, true);
 
-    Buffer deviceLocalBuffer = createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, 0);
+    // Returns once the data is in the staging ring; the next frame's submit waits for the copy on the GPU
+    _uploader.upload(deviceLocalBuffer.buffer, 0, data, size);
 
-    // Copy from host visible to device local buffer
-    VkFence copyFence;
-    VkFenceCreateInfo fenceInfo{};
-    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    
-    if(vkCreateFence(_device, &fenceInfo, nullptr, &copyFence) != VK_SUCCESS) throw std::runtime_error("Failed to create temp fence!");
-
-    VkCommandBuffer buf;
-    VkCommandBufferAllocateInfo commandBufferAllocateInfo{};
-    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    commandBufferAllocateInfo.commandPool = _commandPool;
-    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    commandBufferAllocateInfo.commandBufferCount = 1;
+    return deviceLocalBuffer;
+}
 
-    if(vkAllocateCommandBuffers(_device, &commandBufferAllocateInfo, &buf) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to allocate command buffer!");
+/** @note the contents are undefined; the compute backend copies into and out of it, hence the transfer usages */
+Renderer::Texture Renderer::createHeightmapTexture(uint32_t width, uint32_t height) {
+    Texture texture;
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = VK_FORMAT_R16_UNORM;
+    imageInfo.extent = {width, height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    // Same as the buffers: concurrent sharing instead of ownership transfers between the transfer and graphics queues
+    uint32_t queueFamilies[] = { _graphicsQueueFamily, _transferQueueFamily };
+    if(_transferQueueFamily != _graphicsQueueFamily) {
+        imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        imageInfo.queueFamilyIndexCount = 2;
+        imageInfo.pQueueFamilyIndices = queueFamilies;
     }
 
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-
-    vkBeginCommandBuffer(buf, &beginInfo);
-
-        VkBufferCopy copyRegion{};
-        copyRegion.size = size;
-        vkCmdCopyBuffer(buf, stagingBuffer.buffer, deviceLocalBuffer.buffer, 1, &copyRegion);
-
-    vkEndCommandBuffer(buf);
+    VmaAllocationCreateInfo allocInfo{};
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
 
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &buf;
+    if(vmaCreateImage(_allocator, &imageInfo, &allocInfo, &texture.image, &texture.allocation, nullptr) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create heightmap texture!");
+    }
 
-    vkQueueSubmit(_graphicsQueue, 1, &submitInfo, copyFence);
+    VkImageViewCreateInfo imageViewCreateInfo{};
+    imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    imageViewCreateInfo.image = texture.image;
+    imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    imageViewCreateInfo.format = VK_FORMAT_R16_UNORM;
+    imageViewCreateInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
 
-    vkWaitForFences(_device, 1, &copyFence, VK_TRUE, UINT64_MAX);
+    if(vkCreateImageView(_device, &imageViewCreateInfo, nullptr, &texture.view) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create heightmap texture view!");
+    }
 
-    vkFreeCommandBuffers(_device, _commandPool, 1, &buf);
-    vkDestroyFence(_device, copyFence, nullptr);
+    return texture;
+}
 
-    vmaDestroyBuffer(_allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+Renderer::Texture Renderer::uploadToNewHeightmapTexture(const Heightmap& heightmap) {
+    uint32_t width = static_cast<uint32_t>(heightmap.width);
+    uint32_t height = static_cast<uint32_t>(heightmap.height);
+    Texture texture = createHeightmapTexture(width, height);
+    _uploader.uploadImage(texture.image, width, height, sizeof(uint16_t), heightmap.data.data());
+    return texture;
+}
 
-    return deviceLocalBuffer;
+bool Renderer::fitsHeightmapTexture(size_t width, size_t height) const {
+    return width >= 2 && height >= 2 && width <= _maxHeightmapTextureSize && height <= _maxHeightmapTextureSize;
 }
 
 } // namespace tg
@@ -0,0 +1,271 @@
+#include "tg/StagingUploader.hpp"
+#include "tg/trace.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace tg {
+
+void StagingUploader::init(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamily) {
+    _device = device;
+    _allocator = allocator;
+    _queue = queue;
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = SLOT_COUNT * SLOT_BYTES;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VmaAllocationCreateInfo allocInfo{};
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo allocationInfo{};
+    if(vmaCreateBuffer(_allocator, &bufferInfo, &allocInfo, &_ring, &_ringAllocation, &allocationInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create staging ring!");
+    }
+    _ringData = static_cast<char*>(allocationInfo.pMappedData);
+
+    VkCommandPoolCreateInfo commandPoolCreateInfo{};
+    commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    commandPoolCreateInfo.queueFamilyIndex = queueFamily;
+    commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    if(vkCreateCommandPool(_device, &commandPoolCreateInfo, nullptr, &_commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create transfer command pool!");
+    }
+
+    VkCommandBuffer commandBuffers[SLOT_COUNT];
+    VkCommandBufferAllocateInfo commandBufferAllocateInfo{};
+    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocateInfo.commandPool = _commandPool;
+    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandBufferAllocateInfo.commandBufferCount = SLOT_COUNT;
+
+    if(vkAllocateCommandBuffers(_device, &commandBufferAllocateInfo, commandBuffers) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate transfer command buffers!");
+    }
+
+    _slots.resize(SLOT_COUNT);
+    for(uint32_t i = 0; i < SLOT_COUNT; i++) {
+        _slots[i].offset = i * SLOT_BYTES;
+        _slots[i].commandBuffer = commandBuffers[i];
+    }
+
+    VkSemaphoreTypeCreateInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreCreateInfo{};
+    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreCreateInfo.pNext = &timelineInfo;
+
+    if(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_timeline) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create transfer timeline semaphore!");
+    }
+}
+
+void StagingUploader::destroy() {
+    if(_device == VK_NULL_HANDLE) return;
+
+    wait(_lastSubmitted);
+    vkDestroySemaphore(_device, _timeline, nullptr);
+    vkDestroyCommandPool(_device, _commandPool, nullptr);
+    vmaDestroyBuffer(_allocator, _ring, _ringAllocation);
+
+    _slots.clear();
+    _device = VK_NULL_HANDLE;
+}
+
+void StagingUploader::wait(uint64_t value) {
+    if(value == 0) return;
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &_timeline;
+    waitInfo.pValues = &value;
+
+    if(vkWaitSemaphores(_device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to wait for transfer semaphore!");
+    }
+}
+
+uint64_t StagingUploader::submitChunk(VkDeviceSize size, const std::function<void(char* staging)>& fill,
+                                      const std::function<void(VkCommandBuffer, VkDeviceSize)>& record) {
+    Slot& slot = _slots[_nextSlot];
+    _nextSlot = (_nextSlot + 1) % SLOT_COUNT;
+
+    // Only blocks when the ring has wrapped onto a copy still in flight
+    {
+        TG_TRACE_SCOPE("wait for staging slot");
+        wait(slot.value);
+    }
+
+    fill(_ringData + slot.offset);
+    vmaFlushAllocation(_allocator, _ringAllocation, slot.offset, size);
+
+    if(vkResetCommandBuffer(slot.commandBuffer, 0) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to reset transfer command buffer!");
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(slot.commandBuffer, &beginInfo);
+
+        record(slot.commandBuffer, slot.offset);
+
+    vkEndCommandBuffer(slot.commandBuffer);
+
+    slot.value = ++_lastSubmitted;
+
+    VkSemaphoreSubmitInfo signalSemaphoreInfo{};
+    signalSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+    signalSemaphoreInfo.semaphore = _timeline;
+    signalSemaphoreInfo.value = slot.value;
+    signalSemaphoreInfo.stageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+
+    VkCommandBufferSubmitInfo commandBufferInfo{};
+    commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+    commandBufferInfo.commandBuffer = slot.commandBuffer;
+
+    VkSubmitInfo2 submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+    submitInfo.signalSemaphoreInfoCount = 1;
+    submitInfo.pSignalSemaphoreInfos = &signalSemaphoreInfo;
+    submitInfo.commandBufferInfoCount = 1;
+    submitInfo.pCommandBufferInfos = &commandBufferInfo;
+
+    if(vkQueueSubmit2(_queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit transfer command buffer!");
+    }
+
+    return slot.value;
+}
+
+uint64_t StagingUploader::upload(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+    TG_TRACE_SCOPE_VALUE("staging upload", "bytes", size);
+
+    const char* source = static_cast<const char*>(data);
+    for(VkDeviceSize done = 0; done < size;) {
+        VkDeviceSize chunk = std::min(SLOT_BYTES, size - done);
+        auto fill = [&](char* staging) { memcpy(staging, source + done, static_cast<size_t>(chunk)); };
+        submitChunk(chunk, fill, [&](VkCommandBuffer commandBuffer, VkDeviceSize ringOffset) {
+            VkBufferCopy copyRegion{};
+            copyRegion.srcOffset = ringOffset;
+            copyRegion.dstOffset = dstOffset + done;
+            copyRegion.size = chunk;
+            vkCmdCopyBuffer(commandBuffer, _ring, dst, 1, &copyRegion);
+        });
+        done += chunk;
+    }
+
+    return _lastSubmitted;
+}
+
+static void transitionImage(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+                            VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess) {
+    VkImageMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = srcStage;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstStageMask = dstStage;
+    barrier.dstAccessMask = dstAccess;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+    VkDependencyInfo dependencyInfo{};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.imageMemoryBarrierCount = 1;
+    dependencyInfo.pImageMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+}
+
+uint64_t StagingUploader::uploadImage(VkImage image, uint32_t width, uint32_t height, uint32_t texelBytes, const void* data) {
+    TG_TRACE_SCOPE_VALUE("staging image upload", "bytes", uint64_t(width) * height * texelBytes);
+
+    // Whole rows per chunk; a row wider than a slot is not supported (16 MiB holds 8M R16 samples)
+    VkDeviceSize rowBytes = VkDeviceSize(width) * texelBytes;
+    if(rowBytes > SLOT_BYTES) throw std::invalid_argument("Image rows do not fit in a staging slot");
+    uint32_t rowsPerChunk = static_cast<uint32_t>(SLOT_BYTES / rowBytes);
+
+    const char* source = static_cast<const char*>(data);
+    for(uint32_t row = 0; row < height; row += rowsPerChunk) {
+        uint32_t rows = std::min(rowsPerChunk, height - row);
+        auto fill = [&](char* staging) { memcpy(staging, source + row * rowBytes, static_cast<size_t>(rows * rowBytes)); };
+        submitChunk(rows * rowBytes, fill, [&](VkCommandBuffer commandBuffer, VkDeviceSize ringOffset) {
+            // Earlier chunks were submitted to the same queue, so these barriers also cover their copies
+            if(row == 0) {
+                transitionImage(commandBuffer, image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                VK_PIPELINE_STAGE_2_NONE, 0, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+            }
+
+            VkBufferImageCopy copyRegion{};
+            copyRegion.bufferOffset = ringOffset;
+            copyRegion.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+            copyRegion.imageOffset = {0, static_cast<int32_t>(row), 0};
+            copyRegion.imageExtent = {width, rows, 1};
+            vkCmdCopyBufferToImage(commandBuffer, _ring, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+            // The consumer's semaphore wait makes the data visible; the layout change is all that is left
+            if(row + rows == height) {
+                transitionImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_NONE, 0);
+            }
+        });
+    }
+
+    return _lastSubmitted;
+}
+
+uint64_t StagingUploader::uploadImageRegion(VkImage image, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t texelBytes,
+                                           const void* data, size_t rowPitch) {
+    TG_TRACE_SCOPE_VALUE("staging image region upload", "bytes", uint64_t(width) * height * texelBytes);
+
+    VkDeviceSize rowBytes = VkDeviceSize(width) * texelBytes;
+    if(rowBytes > SLOT_BYTES) throw std::invalid_argument("Image rows do not fit in a staging slot");
+    uint32_t rowsPerChunk = static_cast<uint32_t>(SLOT_BYTES / rowBytes);
+
+    const char* source = static_cast<const char*>(data);
+    for(uint32_t row = 0; row < height; row += rowsPerChunk) {
+        uint32_t rows = std::min(rowsPerChunk, height - row);
+
+        // The region's rows are strided in the source; packing them here keeps the copy to the region's bytes
+        auto fill = [&](char* staging) {
+            for(uint32_t i = 0; i < rows; i++) {
+                memcpy(staging + i * rowBytes, source + (row + i) * rowPitch, static_cast<size_t>(rowBytes));
+            }
+        };
+        submitChunk(rows * rowBytes, fill, [&](VkCommandBuffer commandBuffer, VkDeviceSize ringOffset) {
+            // Unlike uploadImage the layout change keeps the contents: only the region is replaced
+            if(row == 0) {
+                transitionImage(commandBuffer, image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                VK_PIPELINE_STAGE_2_NONE, 0, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+            }
+
+            VkBufferImageCopy copyRegion{};
+            copyRegion.bufferOffset = ringOffset;
+            copyRegion.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+            copyRegion.imageOffset = {static_cast<int32_t>(x), static_cast<int32_t>(y + row), 0};
+            copyRegion.imageExtent = {width, rows, 1};
+            vkCmdCopyBufferToImage(commandBuffer, _ring, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+            if(row + rows == height) {
+                transitionImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_NONE, 0);
+            }
+        });
+    }
+
+    return _lastSubmitted;
+}
+
+} // namespace tg
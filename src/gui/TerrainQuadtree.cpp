@@ -0,0 +1,212 @@
+#include "tg/TerrainQuadtree.hpp"
+#include "tg/trace.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace tg {
+
+TerrainQuadtree::TerrainQuadtree(const Heightmap& heightmap, uint32_t patchQuads, const ExecutionContext& context)
+    : _width(heightmap.width), _height(heightmap.height), _patchQuads(patchQuads) {
+    TG_TRACE_SCOPE_VALUE("build terrain quadtree", "pixels", heightmap.width * heightmap.height);
+
+    if(_width < 2 || _height < 2) throw std::invalid_argument("Heightmap must be at least 2 x 2 samples");
+    if(patchQuads == 0) throw std::invalid_argument("Patch must have at least one quad");
+
+    // Level 0: bounds over the samples of each patch, edges included, so neighbouring patches share a row
+    Level finest;
+    finest.nodesX = static_cast<uint32_t>((_width - 2) / patchQuads + 1);
+    finest.nodesY = static_cast<uint32_t>((_height - 2) / patchQuads + 1);
+    finest.bounds.assign(size_t(finest.nodesX) * finest.nodesY, {UINT16_MAX, 0});
+    _levels.push_back(std::move(finest));
+
+    parallelFor(0, _levels[0].nodesY, [&](size_t rowBegin, size_t rowEnd) {
+        for(size_t nodeY = rowBegin; nodeY < rowEnd; nodeY++) {
+            for(uint32_t nodeX = 0; nodeX < _levels[0].nodesX; nodeX++) {
+                computeFinestBounds(heightmap, nodeX, static_cast<uint32_t>(nodeY));
+            }
+        }
+    }, context.grain(_levels[0].nodesY), context.cancel);
+
+    // Coarser levels merge 2 x 2 children until one node covers the map
+    while(_levels.back().nodesX > 1 || _levels.back().nodesY > 1) {
+        const Level& children = _levels.back();
+
+        Level parents;
+        parents.nodesX = (children.nodesX + 1) / 2;
+        parents.nodesY = (children.nodesY + 1) / 2;
+        parents.bounds.assign(size_t(parents.nodesX) * parents.nodesY, {UINT16_MAX, 0});
+
+        for(uint32_t y = 0; y < children.nodesY; y++) {
+            for(uint32_t x = 0; x < children.nodesX; x++) {
+                const std::pair<uint16_t, uint16_t>& child = children.bounds[size_t(y) * children.nodesX + x];
+                std::pair<uint16_t, uint16_t>& parent = parents.bounds[size_t(y / 2) * parents.nodesX + x / 2];
+                parent.first = std::min(parent.first, child.first);
+                parent.second = std::max(parent.second, child.second);
+            }
+        }
+
+        _levels.push_back(std::move(parents));
+    }
+}
+
+void TerrainQuadtree::update(const Heightmap& heightmap, const HeightmapRegion& region) {
+    if(_levels.empty() || region.empty()) return;
+    if(heightmap.width != _width || heightmap.height != _height) throw std::invalid_argument("Heightmap size does not match the quadtree");
+
+    TG_TRACE_SCOPE_VALUE("update terrain quadtree", "pixels", (region.x1 - region.x0) * (region.y1 - region.y0));
+
+    // A sample on a patch edge belongs to the patches on both sides of it
+    auto firstNode = [&](size_t sample) { return static_cast<uint32_t>(sample == 0 ? 0 : (sample - 1) / _patchQuads); };
+    uint32_t nodeX0 = firstNode(region.x0), nodeY0 = firstNode(region.y0);
+    uint32_t nodeX1 = std::min(static_cast<uint32_t>((region.x1 - 1) / _patchQuads) + 1, _levels[0].nodesX);
+    uint32_t nodeY1 = std::min(static_cast<uint32_t>((region.y1 - 1) / _patchQuads) + 1, _levels[0].nodesY);
+
+    for(uint32_t nodeY = nodeY0; nodeY < nodeY1; nodeY++) {
+        for(uint32_t nodeX = nodeX0; nodeX < nodeX1; nodeX++) {
+            _levels[0].bounds[size_t(nodeY) * _levels[0].nodesX + nodeX] = {UINT16_MAX, 0};
+            computeFinestBounds(heightmap, nodeX, nodeY);
+        }
+    }
+
+    // Parents are merged again from all of their children, since a child's range may have shrunk
+    for(size_t level = 1; level < _levels.size(); level++) {
+        const Level& children = _levels[level - 1];
+        Level& parents = _levels[level];
+        nodeX0 /= 2, nodeY0 /= 2;
+        nodeX1 = (nodeX1 + 1) / 2, nodeY1 = (nodeY1 + 1) / 2;
+
+        for(uint32_t y = nodeY0; y < nodeY1; y++) {
+            for(uint32_t x = nodeX0; x < nodeX1; x++) {
+                std::pair<uint16_t, uint16_t>& parent = parents.bounds[size_t(y) * parents.nodesX + x];
+                parent = {UINT16_MAX, 0};
+                for(uint32_t childY = 2 * y; childY < std::min(2 * y + 2, children.nodesY); childY++) {
+                    for(uint32_t childX = 2 * x; childX < std::min(2 * x + 2, children.nodesX); childX++) {
+                        const std::pair<uint16_t, uint16_t>& child = children.bounds[size_t(childY) * children.nodesX + childX];
+                        parent.first = std::min(parent.first, child.first);
+                        parent.second = std::max(parent.second, child.second);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/** @brief Merges the samples of a level 0 node, edges included, into its bounds */
+void TerrainQuadtree::computeFinestBounds(const Heightmap& heightmap, uint32_t nodeX, uint32_t nodeY) {
+    Level& finest = _levels[0];
+    size_t x0 = size_t(nodeX) * _patchQuads;
+    size_t x1 = std::min(x0 + _patchQuads, _width - 1);
+    size_t y1 = std::min((size_t(nodeY) + 1) * _patchQuads, _height - 1);
+
+    std::pair<uint16_t, uint16_t>& bounds = finest.bounds[size_t(nodeY) * finest.nodesX + nodeX];
+    for(size_t y = size_t(nodeY) * _patchQuads; y <= y1; y++) {
+        const uint16_t* row = heightmap.data.data() + y * _width;
+        auto [lowest, highest] = std::minmax_element(row + x0, row + x1 + 1);
+        bounds.first = std::min(bounds.first, *lowest);
+        bounds.second = std::max(bounds.second, *highest);
+    }
+}
+
+struct TerrainQuadtree::SelectState {
+    glm::vec4 planes[6];    // inward-facing frustum planes in model space
+    glm::vec3 camera;
+    float range0;
+    std::vector<std::vector<PatchInstance>> perLevel;
+
+    float range(uint32_t level) const { return std::ldexp(range0, static_cast<int>(level)); }
+
+    bool inFrustum(const glm::vec3& lowest, const glm::vec3& highest) const {
+        for(const glm::vec4& plane : planes) {
+            // The corner furthest along the plane normal; if even that is behind the plane, the box is outside
+            glm::vec3 corner(plane.x >= 0.0f ? highest.x : lowest.x,
+                             plane.y >= 0.0f ? highest.y : lowest.y,
+                             plane.z >= 0.0f ? highest.z : lowest.z);
+            if(plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w < 0.0f) return false;
+        }
+        return true;
+    }
+
+    bool inRange(const glm::vec3& lowest, const glm::vec3& highest, float range) const {
+        glm::vec3 nearest = glm::clamp(camera, lowest, highest);
+        glm::vec3 offset = nearest - camera;
+        return glm::dot(offset, offset) <= range * range;
+    }
+};
+
+void TerrainQuadtree::select(const glm::mat4& modelViewProjection, const glm::vec3& cameraPosition, float range0,
+                             std::vector<PatchInstance>& instances, std::vector<uint32_t>& levelCounts) const {
+    TG_TRACE_SCOPE("select terrain patches");
+
+    levelCounts.assign(levelCount(), 0);
+    if(_levels.empty()) return;
+
+    SelectState state;
+    state.camera = cameraPosition;
+    state.range0 = range0;
+    state.perLevel.resize(levelCount());
+
+    // Gribb-Hartmann: the clip-space conditions -w <= x, y <= w and 0 <= z <= w as planes on model space
+    glm::vec4 rows[4];
+    for(int i = 0; i < 4; i++) {
+        rows[i] = glm::vec4(modelViewProjection[0][i], modelViewProjection[1][i], modelViewProjection[2][i], modelViewProjection[3][i]);
+    }
+    state.planes[0] = rows[3] + rows[0];
+    state.planes[1] = rows[3] - rows[0];
+    state.planes[2] = rows[3] + rows[1];
+    state.planes[3] = rows[3] - rows[1];
+    state.planes[4] = rows[2];
+    state.planes[5] = rows[3] - rows[2];
+
+    const Level& root = _levels.back();
+    for(uint32_t y = 0; y < root.nodesY; y++) {
+        for(uint32_t x = 0; x < root.nodesX; x++) {
+            selectNode(state, levelCount() - 1, x, y);
+        }
+    }
+
+    for(uint32_t level = 0; level < levelCount(); level++) {
+        levelCounts[level] = static_cast<uint32_t>(state.perLevel[level].size());
+        instances.insert(instances.end(), state.perLevel[level].begin(), state.perLevel[level].end());
+    }
+}
+
+/**
+ * @return false when the node is out of its level's LOD range, so its parent has to cover the area instead
+ */
+bool TerrainQuadtree::selectNode(SelectState& state, uint32_t level, uint32_t x, uint32_t y) const {
+    const Level& nodes = _levels[level];
+    const std::pair<uint16_t, uint16_t>& bounds = nodes.bounds[size_t(y) * nodes.nodesX + x];
+
+    size_t quads = size_t(_patchQuads) << level;
+    size_t x0 = x * quads, y0 = y * quads;
+    glm::vec3 lowest(static_cast<float>(x0) / _width, static_cast<float>(y0) / _height, bounds.first / static_cast<float>(UINT16_MAX));
+    glm::vec3 highest(static_cast<float>(std::min(x0 + quads, _width - 1)) / _width,
+                      static_cast<float>(std::min(y0 + quads, _height - 1)) / _height,
+                      bounds.second / static_cast<float>(UINT16_MAX));
+
+    // Culled nodes count as handled; the root level is always in range
+    if(!state.inFrustum(lowest, highest)) return true;
+    if(level + 1 < levelCount() && !state.inRange(lowest, highest, state.range(level))) return false;
+
+    PatchInstance instance{static_cast<uint32_t>(x0), static_cast<uint32_t>(y0), 1u << level, level};
+    if(level == 0 || !state.inRange(lowest, highest, state.range(level - 1))) {
+        state.perLevel[level].push_back(instance);
+        return true;
+    }
+
+    // Children out of their own range are drawn at this level's resolution: their patch, morphed all the way
+    const Level& children = _levels[level - 1];
+    for(uint32_t childY = 2 * y; childY < std::min(2 * y + 2, children.nodesY); childY++) {
+        for(uint32_t childX = 2 * x; childX < std::min(2 * x + 2, children.nodesX); childX++) {
+            if(!selectNode(state, level - 1, childX, childY)) {
+                size_t childQuads = size_t(_patchQuads) << (level - 1);
+                state.perLevel[level - 1].push_back({static_cast<uint32_t>(childX * childQuads), static_cast<uint32_t>(childY * childQuads), 1u << (level - 1), level - 1});
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace tg
@@ -0,0 +1,19 @@
+# Writes a compiled SPIR-V module into a header as a uint32_t array, so the editor does not read shaders from disk.
+# Usage: cmake -DINPUT=<file.spv> -DOUTPUT=<file.h> -DSYMBOL=<array name> -P embed_spirv.cmake
+
+file(READ ${INPUT} SPIRV_HEX HEX)
+string(LENGTH "${SPIRV_HEX}" SPIRV_HEX_LENGTH)
+math(EXPR SPIRV_WORD_REMAINDER "${SPIRV_HEX_LENGTH} % 8")
+if(SPIRV_HEX_LENGTH EQUAL 0 OR NOT SPIRV_WORD_REMAINDER EQUAL 0)
+    message(FATAL_ERROR "${INPUT} is not a SPIR-V module")
+endif()
+
+# SPIR-V words are little-endian in the file
+string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1u," SPIRV_WORDS "${SPIRV_HEX}")
+
+file(WRITE ${OUTPUT}
+    "// Generated from ${INPUT} by embed_spirv.cmake; do not edit\n"
+    "#pragma once\n"
+    "#include <cstdint>\n"
+    "static const uint32_t ${SYMBOL}[] = {${SPIRV_WORDS}};\n"
+)
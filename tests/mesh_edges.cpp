@@ -0,0 +1,38 @@
+// Meshes heightmaps with a single row or column. Their normals must stay flat along that axis; reading a neighbour
+// that does not exist tilts them, or reads past the samples.
+
+#include "tg/generator.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+int checkMesh(size_t width, size_t height) {
+    tg::Heightmap heightmap = tg::generateRandomHeightmap(width, height, 1);
+    tg::Mesh mesh = tg::convertHeightmapToMesh(heightmap);
+
+    if(mesh.interleavedAttributes.size() != width * height) {
+        fprintf(stderr, "%zux%zu: %zu vertices\n", width, height, mesh.interleavedAttributes.size());
+        return 1;
+    }
+
+    int failures = 0;
+    for(const tg::Attributes& vertex : mesh.interleavedAttributes) {
+        bool finite = std::isfinite(vertex.n_x) && std::isfinite(vertex.n_y) && std::isfinite(vertex.n_z);
+        bool flat = (width > 1 || vertex.n_x == 0.0f) && (height > 1 || vertex.n_y == 0.0f);
+        if(!finite || !flat) {
+            fprintf(stderr, "%zux%zu: normal (%g, %g, %g) at (%g, %g)\n", width, height, vertex.n_x, vertex.n_y, vertex.n_z, vertex.u, vertex.v);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+} // namespace
+
+int main() {
+    int failures = checkMesh(1, 5) + checkMesh(5, 1) + checkMesh(1, 1) + checkMesh(2, 7);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,22 @@
+# Renders the jobs in JOBS with terrainGen-gui --thumbnails and checks that OUTPUT_DIR/smoke.png is a PNG.
+# cmake -DGUI=<terrainGen-gui> -DJOBS=<job file> -DOUTPUT_DIR=<dir> [-DEXTRA_ARGS=<args>] -P thumbnail_smoke.cmake
+
+file(REMOVE_RECURSE ${OUTPUT_DIR})
+
+execute_process(
+    COMMAND ${GUI} --thumbnails ${JOBS} --thumbnail-dir ${OUTPUT_DIR} --thumbnail-size 64 ${EXTRA_ARGS}
+    RESULT_VARIABLE RESULT
+)
+if(NOT RESULT EQUAL 0)
+    message(FATAL_ERROR "terrainGen-gui --thumbnails failed: ${RESULT}")
+endif()
+
+set(THUMBNAIL ${OUTPUT_DIR}/smoke.png)
+if(NOT EXISTS ${THUMBNAIL})
+    message(FATAL_ERROR "No thumbnail written: ${THUMBNAIL}")
+endif()
+
+file(READ ${THUMBNAIL} SIGNATURE LIMIT 8 HEX)
+if(NOT SIGNATURE STREQUAL "89504e470d0a1a0a")
+    message(FATAL_ERROR "Not a PNG: ${THUMBNAIL}")
+endif()